@@ -11,6 +11,7 @@ sleep 3
 supervisorctl status all
 
 make functional-test -C ./build
+make alloc-test -C ./build
 
 #report part
 #GitLab-CI output
@@ -1,12 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <uci.h>
 
 #include "ruleng.h"
+#include "ruleng_bus.h"
 #include "utils.h"
 
 #define RULENG_DEFAULT_UBUS_PATH "/var/run/ubus/ubus.sock"
 #define RULENG_DEFAULT_RULES_PATH "ruleng-test-rules"
+#define RULENG_DEFAULT_LOG_LEVEL LOG_DEBUG
 
 static void ruleng_usage(char *n)
 {
@@ -15,18 +18,29 @@ static void ruleng_usage(char *n)
 		"Options:\n"
 		"  -s <socket> path to ubus socket [" RULENG_DEFAULT_UBUS_PATH "]\n"
 		"  -r <rules> uci rules config filename [" RULENG_DEFAULT_RULES_PATH "]\n"
+		"  -C <dir> uci config directory [" UCI_CONFDIR "]\n"
+		"  -c <cache> compiled rule cache, rebuilt when the rules change [none]\n"
+		"  -e <file> append the events received to a capture log [none]\n"
+		"  -l <target> log to '" RULENG_LOG_TARGET_SYSLOG "', '" RULENG_LOG_TARGET_CONSOLE "' or a file [" RULENG_LOG_TARGET_CONSOLE "]\n"
+		"  -L <level> syslog log level, 0-7 [%d]\n"
+		"  -M log the memory taken by loading the rules, peak included\n"
 		"  -h help\n\n"
-		, n);
+		, n, RULENG_DEFAULT_LOG_LEVEL);
 }
 
 int main(int argc, char **argv)
 {
 	char *sock = NULL;
 	char *rules = RULENG_DEFAULT_RULES_PATH;
+	char *cache = NULL;
+	char *confdir = NULL;
+	char *capture = NULL;
+	char *log_target = NULL;
+	int log_level = RULENG_DEFAULT_LOG_LEVEL;
 	int c = -1;
 
 	while((c = getopt(argc, argv,
-					  "s:r:m:h")) != -1) {
+					  "s:r:C:c:e:l:L:Mm:h")) != -1) {
 		switch (c) {
 			case 'h':
 				ruleng_usage(argv[0]);
@@ -37,6 +51,24 @@ int main(int argc, char **argv)
 			case 'r':
 				rules = optarg;
 				break;
+			case 'C':
+				confdir = optarg;
+				break;
+			case 'c':
+				cache = optarg;
+				break;
+			case 'e':
+				capture = optarg;
+				break;
+			case 'l':
+				log_target = optarg;
+				break;
+			case 'L':
+				log_level = atoi(optarg);
+				break;
+			case 'M':
+				ruleng_bus_set_mem_trace(true);
+				break;
 			default:
 				ruleng_usage(argv[0]);
 				return EXIT_FAILURE;
@@ -46,14 +78,19 @@ int main(int argc, char **argv)
 	int rc = EXIT_FAILURE;
 	struct ruleng_ctx *ctx = NULL;
 
-	if (ruleng_init(sock, rules, &ctx) != RULENG_OK)
+	if (ruleng_log_init(log_target, log_level) != RULENG_LOG_OK)
 		goto exit;
 
+	if (ruleng_init(sock, rules, confdir, cache, capture, &ctx) != RULENG_OK)
+		goto cleanup_log;
+
 	ruleng_uloop_run(ctx);
 	ruleng_free(ctx);
 
 	rc = EXIT_SUCCESS;
 
+cleanup_log:
+	ruleng_log_free();
 exit:
 	return rc;
 }
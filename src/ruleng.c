@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <uci.h>
 
 #include "ruleng.h"
 #include "ruleng_bus.h"
@@ -9,6 +10,9 @@
 enum ruleng_rc ruleng_init(
   const char *sock,
   char *rules,
+  const char *confdir,
+  const char *cache,
+  const char *capture,
   struct ruleng_ctx **ctx
 ) {
 	enum ruleng_rc rc = RULENG_OK;
@@ -28,18 +32,31 @@ enum ruleng_rc ruleng_init(
 		goto cleanup_ctx;
 	}
 
+	if (confdir && uci_set_confdir(com_ctx->uci_ctx, confdir) != UCI_OK) {
+		RULENG_ERR("%s: invalid uci config directory", confdir);
+		rc = RULENG_ERR_RULES_INIT;
+		goto cleanup_com_ctx;
+	}
+
 	struct ruleng_bus_ctx *bus_ctx = NULL;
 
-	if (ruleng_bus_init(&bus_ctx, com_ctx, rules, sock) != RULENG_BUS_OK) {
+	if (ruleng_bus_init(&bus_ctx, com_ctx, rules, sock, cache) != RULENG_BUS_OK) {
 		rc = RULENG_ERR_BUS_INIT;
 		goto cleanup_com_ctx;
 	}
 
+	if (capture && ruleng_capture_open(&bus_ctx->capture, capture) != RULENG_CAPTURE_OK) {
+		rc = RULENG_ERR_BUS_INIT;
+		goto cleanup_bus_ctx;
+	}
+
 	_ctx->bus_ctx = bus_ctx;
 	_ctx->com_ctx = com_ctx;
 
 	goto exit;
 
+cleanup_bus_ctx:
+	ruleng_bus_free(bus_ctx);
 cleanup_com_ctx:
 	ruleng_rules_ctx_free(com_ctx);
 cleanup_ctx:
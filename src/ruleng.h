@@ -17,6 +17,9 @@ struct ruleng_ctx {
 enum ruleng_rc ruleng_init(
   const char *sock,
   char *rules,
+  const char *confdir,
+  const char *cache,
+  const char *capture,
   struct ruleng_ctx **ctx
 );
 
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ruleng_arena.h"
+
+#define ARENA_ALIGN(x) (((x) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+struct ruleng_arena_block {
+	struct ruleng_arena_block *next;
+	size_t size;
+	size_t used;
+	_Alignas(max_align_t) char data[];
+};
+
+/* block allocations come from, older ones of the same event follow it */
+static struct ruleng_arena_block *arena;
+/* latest allocation, the one which can be grown in place */
+static void *arena_last;
+static size_t arena_used;
+static uint32_t arena_allocs;
+static struct ruleng_arena_stats arena_stats;
+
+static struct ruleng_arena_block *ruleng_arena_block_new(size_t size)
+{
+	struct ruleng_arena_block *b = malloc(sizeof(*b) + size);
+
+	if (b == NULL)
+		return NULL;
+
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+
+	return b;
+}
+
+void *ruleng_arena_alloc(size_t size)
+{
+	struct ruleng_arena_block *b = arena;
+	void *p = NULL;
+
+	size = ARENA_ALIGN(size);
+
+	if (b == NULL || b->size - b->used < size) {
+		size_t len = b ? b->size : RULENG_ARENA_BLOCK_SIZE;
+
+		b = ruleng_arena_block_new(size > len ? size : len);
+
+		if (b == NULL)
+			return NULL;
+
+		++arena_allocs;
+		b->next = arena;
+		arena = b;
+	}
+
+	p = b->data + b->used;
+	b->used += size;
+	arena_used += size;
+	arena_last = p;
+	memset(p, 0, size);
+
+	return p;
+}
+
+void *ruleng_arena_realloc(void *p, size_t old, size_t size)
+{
+	void *n = NULL;
+
+	if (p && p == arena_last) {
+		size_t start = (char *) p - arena->data;
+
+		if (arena->size - start >= ARENA_ALIGN(size)) {
+			arena_used += ARENA_ALIGN(size) - ARENA_ALIGN(old);
+			arena->used = start + ARENA_ALIGN(size);
+
+			if (size > old)
+				memset((char *) p + old, 0, size - old);
+
+			return p;
+		}
+	}
+
+	n = ruleng_arena_alloc(size);
+
+	if (n && p)
+		memcpy(n, p, old < size ? old : size);
+
+	return n;
+}
+
+char *ruleng_arena_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = ruleng_arena_alloc(len);
+
+	if (p)
+		memcpy(p, s, len);
+
+	return p;
+}
+
+void *ruleng_arena_promote(const void *p, size_t size)
+{
+	void *n = p ? malloc(size) : calloc(1, size);
+
+	if (n == NULL)
+		return NULL;
+
+	if (p)
+		memcpy(n, p, size);
+
+	++arena_allocs;
+	++arena_stats.promoted;
+
+	return n;
+}
+
+static bool ruleng_arena_blob_grow(struct blob_buf *buf, int minlen)
+{
+	int delta = ((minlen / 256) + 1) * 256;
+	void *p = ruleng_arena_realloc(buf->buf, buf->buflen, buf->buflen + delta);
+
+	if (p == NULL)
+		return false;
+
+	buf->buf = p;
+	buf->buflen += delta;
+
+	return true;
+}
+
+int ruleng_arena_blob_buf_init(struct blob_buf *buf, int id)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->grow = ruleng_arena_blob_grow;
+
+	return blob_buf_init(buf, id);
+}
+
+static void ruleng_arena_release(void)
+{
+	struct ruleng_arena_block *b = arena, *next = NULL;
+
+	for (; b; b = next) {
+		next = b->next;
+		free(b);
+	}
+
+	arena = NULL;
+}
+
+void ruleng_arena_reset(void)
+{
+	++arena_stats.events;
+	arena_stats.allocs += arena_allocs;
+	arena_stats.last_allocs = arena_allocs;
+
+	if (arena_allocs > arena_stats.max_allocs)
+		arena_stats.max_allocs = arena_allocs;
+
+	if (arena_used > arena_stats.peak)
+		arena_stats.peak = arena_used;
+
+	// the event spilled over into more blocks, keep one big enough for it
+	if (arena && arena->next) {
+		size_t size = 0;
+		struct ruleng_arena_block *b = NULL;
+
+		for (b = arena; b; b = b->next)
+			size += b->size;
+
+		ruleng_arena_release();
+		arena = ruleng_arena_block_new(size);
+	}
+
+	if (arena)
+		arena->used = 0;
+
+	arena_last = NULL;
+	arena_used = 0;
+	arena_allocs = 0;
+}
+
+void ruleng_arena_get_stats(struct ruleng_arena_stats *stats)
+{
+	struct ruleng_arena_block *b = NULL;
+
+	*stats = arena_stats;
+	stats->size = 0;
+
+	for (b = arena; b; b = b->next)
+		stats->size += b->size;
+}
+
+void ruleng_arena_free(void)
+{
+	ruleng_arena_release();
+	arena_last = NULL;
+	arena_used = 0;
+	arena_allocs = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libubox/blob.h>
+
+/*
+ * Bump allocator for the data one event needs while it is dispatched,
+ * released all at once by ruleng_arena_reset(). Only used from the uloop
+ * thread.
+ */
+
+/* size of the first block, grown to the largest event seen so far */
+#define RULENG_ARENA_BLOCK_SIZE (16 * 1024)
+
+struct ruleng_arena_stats {
+	/* events dispatched */
+	uint64_t events;
+	/* heap allocations made while dispatching them */
+	uint64_t allocs;
+	/* of those, data promoted to outlive its event */
+	uint64_t promoted;
+	/* allocations of the last event and of the worst one */
+	uint32_t last_allocs;
+	uint32_t max_allocs;
+	/* bytes the arena holds and the most one event used */
+	size_t size;
+	size_t peak;
+};
+
+/* zeroed memory valid until the next reset, NULL if out of memory */
+void *ruleng_arena_alloc(size_t size);
+
+/*
+ * Resize the arena block 'p' of 'old' bytes, in place if it is the latest
+ * one. Bytes past 'old' are zeroed.
+ */
+void *ruleng_arena_realloc(void *p, size_t old, size_t size);
+
+char *ruleng_arena_strdup(const char *s);
+
+/*
+ * Heap copy of 'size' bytes at 'p' for data used once the event is done,
+ * like a pending request. A NULL 'p' gives zeroed memory. Released with
+ * free().
+ */
+void *ruleng_arena_promote(const void *p, size_t size);
+
+/* set up 'buf' to grow in the arena, it must not be passed to blob_buf_free() */
+int ruleng_arena_blob_buf_init(struct blob_buf *buf, int id);
+
+/* end of an event, everything allocated from the arena is released */
+void ruleng_arena_reset(void);
+
+void ruleng_arena_get_stats(struct ruleng_arena_stats *stats);
+
+void ruleng_arena_free(void);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* bit sets of any width, as arrays of words */
+
+#define RULENG_BITSET_BITS 64
+#define RULENG_BITSET_WORDS(n) (((n) + RULENG_BITSET_BITS - 1) / RULENG_BITSET_BITS)
+
+static inline bool ruleng_bitset_test(const uint64_t *set, int n)
+{
+	return set[n / RULENG_BITSET_BITS] & (1ULL << (n % RULENG_BITSET_BITS));
+}
+
+static inline void ruleng_bitset_set(uint64_t *set, int n)
+{
+	set[n / RULENG_BITSET_BITS] |= 1ULL << (n % RULENG_BITSET_BITS);
+}
+
+/* clear bit 'n', telling whether it was set */
+static inline bool ruleng_bitset_test_clear(uint64_t *set, int n)
+{
+	uint64_t bit = 1ULL << (n % RULENG_BITSET_BITS);
+	bool was = set[n / RULENG_BITSET_BITS] & bit;
+
+	set[n / RULENG_BITSET_BITS] &= ~bit;
+
+	return was;
+}
+
+/* set the first 'n' bits of a set 'n' bits wide */
+static inline void ruleng_bitset_fill(uint64_t *set, int n)
+{
+	int words = RULENG_BITSET_WORDS(n);
+
+	if (words == 0)
+		return;
+
+	memset(set, 0xff, words * sizeof(*set));
+
+	if (n % RULENG_BITSET_BITS)
+		set[words - 1] = (1ULL << (n % RULENG_BITSET_BITS)) - 1;
+}
+
+static inline int ruleng_bitset_count(const uint64_t *set, int n)
+{
+	int count = 0;
+
+	for (int i = 0; i < RULENG_BITSET_WORDS(n); i++)
+		count += __builtin_popcountll(set[i]);
+
+	return count;
+}
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
+#include <libubox/blobmsg.h>
+#include <libubox/list.h>
+
+#include "ruleng_blob.h"
+#include "utils.h"
+
+static struct blob_attr *ruleng_blob_find_key(
+  struct blob_attr *b,
+  const char *k
+) {
+	struct blob_attr *e = NULL;
+	int r = 0;
+
+	blob_for_each_attr(e, b, r) {
+		if (strcmp(k, blobmsg_name(e)) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/* like ruleng_blob_find_key(), for a table nested in a message */
+static struct blob_attr *ruleng_blob_find_member(
+  struct blob_attr *b,
+  const char *k
+) {
+	struct blob_attr *e = NULL;
+	int r = 0;
+
+	blobmsg_for_each_attr(e, b, r) {
+		if (strcmp(k, blobmsg_name(e)) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/* most compiled patterns kept, the ones used longest ago are dropped first */
+#define REGEX_CACHE_MAX 256
+
+/* compiled match patterns, kept across events and keyed by the pattern */
+struct ruleng_blob_regex {
+	struct avl_node avl;
+	/* in regex_lru, most recently used first */
+	struct list_head lru;
+	regex_t exp;
+	bool valid;
+	char pattern[];
+};
+
+static AVL_TREE(regex_cache, avl_strcmp, false, NULL);
+static LIST_HEAD(regex_lru);
+
+static void ruleng_blob_regex_drop(struct ruleng_blob_regex *re)
+{
+	avl_delete(&regex_cache, &re->avl);
+	list_del(&re->lru);
+
+	if (re->valid)
+		regfree(&re->exp);
+	free(re);
+}
+
+static regex_t *ruleng_blob_regex_get(const char *pattern)
+{
+	struct ruleng_blob_regex *re = NULL;
+	size_t len = strlen(pattern) + 1;
+
+	re = avl_find_element(&regex_cache, pattern, re, avl);
+
+	if (re) {
+		list_move(&re->lru, &regex_lru);
+		goto exit;
+	}
+
+	// patterns of rules removed since are not tracked, they age out
+	if (regex_cache.count >= REGEX_CACHE_MAX)
+		ruleng_blob_regex_drop(list_last_entry(&regex_lru, struct ruleng_blob_regex, lru));
+
+	re = calloc(1, sizeof(*re) + len);
+
+	if (re == NULL)
+		return NULL;
+
+	memcpy(re->pattern, pattern, len);
+	re->avl.key = re->pattern;
+	re->valid = regcomp(&re->exp, pattern, 0) == 0;
+	avl_insert(&regex_cache, &re->avl);
+	list_add(&re->lru, &regex_lru);
+
+exit:
+	return re->valid ? &re->exp : NULL;
+}
+
+void ruleng_blob_regex_free(void)
+{
+	struct ruleng_blob_regex *re = NULL, *tmp = NULL;
+
+	list_for_each_entry_safe(re, tmp, &regex_lru, lru)
+		ruleng_blob_regex_drop(re);
+}
+
+bool ruleng_blob_compare_primitive(
+  struct blob_attr *a,
+  struct blob_attr *b,
+  bool regex
+) {
+	bool rc = false;
+	regex_t *regex_exp = NULL;
+	int reti;
+	char msgbuf[100];
+
+	switch(blobmsg_type(a)) {
+		case BLOBMSG_TYPE_STRING:
+			if (!regex) {
+				if (strcmp(blobmsg_get_string(a), blobmsg_get_string(b)) != 0)
+					goto exit;
+			} else {
+				regex_exp = ruleng_blob_regex_get(blobmsg_get_string(a));
+
+				if (regex_exp == NULL) {
+					RULENG_ERR("Could not compile regex\n");
+					goto exit;
+				}
+
+				reti = regexec(regex_exp, blobmsg_get_string(b), 0, NULL, 0);
+
+				if (!reti) {
+					RULENG_INFO("Match");
+				} else if (reti == REG_NOMATCH) {
+					goto exit;
+				} else {
+					regerror(reti, regex_exp, msgbuf, sizeof(msgbuf));
+					RULENG_ERR("Regex match failed: %s\n", msgbuf);
+					goto exit;
+				}
+			}
+			break;
+		case BLOBMSG_TYPE_INT64:
+			if (blobmsg_get_u64(a) != blobmsg_get_u64(b))
+				goto exit;
+			break;
+		case BLOBMSG_TYPE_INT32:
+			if (blobmsg_get_u32(a) != blobmsg_get_u32(b))
+				goto exit;
+			break;
+		case BLOBMSG_TYPE_INT16:
+			if (blobmsg_get_u16(a) != blobmsg_get_u16(b))
+				goto exit;
+			break;
+		case BLOBMSG_TYPE_BOOL:
+			if (blobmsg_get_bool(a) != blobmsg_get_bool(b))
+				goto exit;
+			break;
+		default:
+			goto exit;
+	}
+
+	rc = true;
+exit:
+	return rc;
+}
+
+static bool ruleng_blob_is_int(struct blob_attr *a)
+{
+	switch (blobmsg_type(a)) {
+	case BLOBMSG_TYPE_INT16:
+	case BLOBMSG_TYPE_INT32:
+	case BLOBMSG_TYPE_INT64:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int64_t ruleng_blob_get_int(struct blob_attr *a)
+{
+	switch (blobmsg_type(a)) {
+	case BLOBMSG_TYPE_INT16:
+		return (int16_t) blobmsg_get_u16(a);
+	case BLOBMSG_TYPE_INT32:
+		return (int32_t) blobmsg_get_u32(a);
+	default:
+		return (int64_t) blobmsg_get_u64(a);
+	}
+}
+
+/*
+ * Whether two values print as the same JSON: integers are compared by value
+ * whatever their width, names only matter for members of tables.
+ */
+static bool ruleng_blob_equal(struct blob_attr *a, struct blob_attr *b)
+{
+	struct blob_attr *e = NULL, *f = NULL;
+	int r = 0, s = 0;
+
+	if (ruleng_blob_is_int(a) && ruleng_blob_is_int(b))
+		return ruleng_blob_get_int(a) == ruleng_blob_get_int(b);
+
+	if (blobmsg_type(a) != blobmsg_type(b))
+		return false;
+
+	switch (blobmsg_type(a)) {
+	case BLOBMSG_TYPE_STRING:
+		return strcmp(blobmsg_get_string(a), blobmsg_get_string(b)) == 0;
+	case BLOBMSG_TYPE_BOOL:
+		return blobmsg_get_bool(a) == blobmsg_get_bool(b);
+	case BLOBMSG_TYPE_TABLE:
+	case BLOBMSG_TYPE_ARRAY:
+		break;
+	default:
+		return blobmsg_data_len(a) == blobmsg_data_len(b) &&
+			memcmp(blobmsg_data(a), blobmsg_data(b), blobmsg_data_len(a)) == 0;
+	}
+
+	f = blobmsg_data(b);
+	s = blobmsg_data_len(b);
+
+	blobmsg_for_each_attr(e, a, r) {
+		if (s <= 0 || (int) blob_pad_len(f) > s)
+			return false;
+
+		if (blobmsg_type(a) == BLOBMSG_TYPE_TABLE &&
+			strcmp(blobmsg_name(e), blobmsg_name(f)) != 0)
+			return false;
+
+		if (!ruleng_blob_equal(e, f))
+			return false;
+
+		s -= blob_pad_len(f);
+		f = blob_next(f);
+	}
+
+	return s == 0;
+}
+
+bool ruleng_blob_compare_array(
+  struct blob_attr *a,
+  struct blob_attr *b
+) {
+	return ruleng_blob_equal(a, b);
+}
+
+bool ruleng_blob_check_subset(
+  struct blob_attr *a,
+  struct blob_attr *b,
+  bool regex
+) {
+	bool rc = false;
+	struct blob_attr *e = NULL;
+	int r = 0;
+
+	blobmsg_for_each_attr(e, a, r) {
+		struct blob_attr *k = ruleng_blob_find_key(b, blobmsg_name(e));
+
+		if (k == NULL || blobmsg_type(e) != blobmsg_type(k))
+			goto exit;
+
+		switch(blobmsg_type(e)) {
+			case BLOBMSG_TYPE_ARRAY:
+				if (ruleng_blob_compare_array(e, k) == false)
+					goto exit;
+				break;
+			case BLOBMSG_TYPE_TABLE:
+				goto exit;
+			default:
+				if (ruleng_blob_compare_primitive(e, k, regex) == false)
+					goto exit;
+		}
+	}
+
+	rc = true;
+exit:
+	return rc;
+}
+
+/* the n-th element of a table or array */
+static struct blob_attr *ruleng_blob_get_idx(
+  struct blob_attr *b,
+  unsigned int n
+) {
+	struct blob_attr *e = NULL;
+	int r = 0;
+
+	blobmsg_for_each_attr(e, b, r) {
+		if (n-- == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/*
+ * Resolve a "&event->path.to.value[2]" reference against the message of
+ * an event. Returns NULL if the value is missing.
+ */
+struct blob_attr *ruleng_blob_extract_value(const char *val, struct blob_attr *msg)
+{
+	char value[1024] = {0};
+
+	if (msg == NULL)
+		return NULL;
+
+	snprintf(value, sizeof(value), "%s", val);
+
+	// the message itself has no name header, lookups start in its members
+	struct blob_attr *data = NULL;
+	char *tmp = strstr(value, "->");
+	if (tmp == NULL)
+		return NULL;
+
+	char *tok = strtok_r(tmp+2, ".", &tmp);
+	while (tok != NULL) {
+		if (data && blobmsg_type(data) != BLOBMSG_TYPE_TABLE)
+			return NULL;
+
+		// check if an array like abc[4]
+		char *arr = strchr(tok, '[');
+		if (arr != NULL) {
+			char obj_name[64] = {0};
+			int obj_len = arr - tok + 1;
+			snprintf(obj_name, obj_len, "%s", tok);
+
+			// get the index
+			unsigned int index = 0;
+			if (1 != sscanf(arr, "[%u]", &index))
+				return NULL;
+
+			struct blob_attr *tmp_obj = data ?
+				ruleng_blob_find_member(data, obj_name) :
+				ruleng_blob_find_key(msg, obj_name);
+			if (!tmp_obj || blobmsg_type(tmp_obj) != BLOBMSG_TYPE_ARRAY)
+				return NULL;
+
+			data = ruleng_blob_get_idx(tmp_obj, index);
+		} else {
+			data = data ?
+				ruleng_blob_find_member(data, tok) :
+				ruleng_blob_find_key(msg, tok);
+		}
+
+		if (!data)
+			return NULL;
+
+		tok = strtok_r(NULL, ".", &tmp);
+	}
+
+	return data;
+}
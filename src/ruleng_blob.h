@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <libubox/blob.h>
+
+/* Matching of rule conditions against event messages, all blobmsg. */
+
+/*
+ * Whether every member of table 'a' is in message 'b' with an equal value,
+ * string values of 'a' are taken as regular expressions if 'regex' is set.
+ */
+bool ruleng_blob_check_subset(struct blob_attr *a, struct blob_attr *b, bool regex);
+
+/* compare two values of the type of 'a', which must be the one of 'b' */
+bool ruleng_blob_compare_primitive(struct blob_attr *a, struct blob_attr *b, bool regex);
+
+/* whether two arrays hold equal values, integers of any width compare by value */
+bool ruleng_blob_compare_array(struct blob_attr *a, struct blob_attr *b);
+
+/*
+ * Resolve a "&event->path.to.value[2]" reference against the message of
+ * an event. Returns NULL if the value is missing.
+ */
+struct blob_attr *ruleng_blob_extract_value(const char *val, struct blob_attr *msg);
+
+/* release the regular expressions compiled so far */
+void ruleng_blob_regex_free(void);
@@ -4,8 +4,21 @@
 #include <libubus.h>
 #include <libubox/blobmsg_json.h>
 #include <libubox/list.h>
+#include <libubox/avl.h>
 #include "ruleng_rules.h"
 #include "ruleng_json.h"
+#include "ruleng_trie.h"
+#include "ruleng_capture.h"
+
+/*
+ * ubusd drops a client sending a message over UBUS_MAX_MSGLEN, event names
+ * which would not fit in a registration with room to spare are refused
+ */
+#define RULENG_BUS_EVENT_NAME_MAX (UBUS_MAX_MSGLEN - 1024)
+
+/* rule engines ruleng_bus_dispatch() runs */
+#define RULENG_BUS_DISPATCH_RULES	0x1
+#define RULENG_BUS_DISPATCH_JSON	0x2
 
 enum ruleng_bus_rc {
     RULENG_BUS_OK = 0,
@@ -14,6 +27,9 @@ enum ruleng_bus_rc {
     RULENG_BUS_ERR_RULES_NOT_FOUND,
     RULENG_BUS_ERR_RULES_GET,
     RULENG_BUS_ERR_REGISTER_EVENT,
+    RULENG_BUS_ERR_ADD_OBJECT,
+    RULENG_BUS_ERR_RULE_INVALID,
+    RULENG_BUS_ERR_RULE_NOT_FOUND,
 };
 
 struct ruleng_bus_ctx {
@@ -21,12 +37,71 @@ struct ruleng_bus_ctx {
     struct ruleng_rules_ctx *com_ctx;
     struct ubus_event_handler handler;
     struct ubus_event_handler json_handler;
+    struct ubus_object object;
+    struct avl_tree events;
+    struct ruleng_trie trie;
+    struct list_head subs;
+    /* handler new subscriptions are registered on */
+    struct ruleng_bus_sub *sub;
+    struct avl_tree recipes;
+    struct avl_tree runtime_rules;
+    struct ruleng_watch *watch;
     struct list_head rules;
     struct list_head json_rules;
+    char *rules_path;
+    /* compiled rule cache, NULL when not used */
+    char *cache_path;
+    /* state of the UCI package files the rules were read from, for the cache */
+    struct ruleng_json_file package[2];
+    /* log of the events dispatched, NULL when not capturing */
+    struct ruleng_capture *capture;
+    /* events are fed in, not subscribed to on ubusd */
+    bool detached;
+};
+
+/* ubus handler object event names are registered on */
+struct ruleng_bus_sub {
+    struct list_head list;
+    struct ubus_event_handler handler;
+    struct ruleng_bus_ctx *ctx;
+    /* subscriptions registered on the handler */
+    struct list_head events;
+    /* number of those some rule refers to */
+    int live;
 };
 
+/*
+ * Subscription to one distinct event name or "prefix*" pattern, keyed by
+ * it. Names covered by a registered pattern are not registered themselves.
+ */
+struct ruleng_bus_event {
+    struct avl_node avl;
+    struct list_head list;
+    /* handler the name is registered on, NULL when covered by a pattern */
+    struct ruleng_bus_sub *sub;
+    /* registered subscription the event is delivered through */
+    struct ruleng_bus_event *cover;
+    /* UCI rules and recipe conditions waiting for the event, in dispatch order */
+    struct list_head rules;
+    struct list_head json_conds;
+    int refs;
+    /* referenced subscriptions delivered through this registration */
+    int users;
+};
 
 enum ruleng_bus_rc ruleng_bus_init(
+  struct ruleng_bus_ctx **ctx,
+  struct ruleng_rules_ctx *com_ctx,
+  char *rules, const char *sock,
+  const char *cache
+);
+
+/*
+ * Load the rules as ruleng_bus_init() does, for a tool which feeds the
+ * events in itself: no event is subscribed to and no object is added on
+ * ubusd, which only receives the actions.
+ */
+enum ruleng_bus_rc ruleng_bus_init_detached(
   struct ruleng_bus_ctx **ctx,
   struct ruleng_rules_ctx *com_ctx,
   char *rules, const char *sock
@@ -42,6 +117,36 @@ void ruleng_ubus_call(struct ubus_context *ubus_ctx, struct ruleng_rule *r, stru
 
 void ruleng_cli_call(struct ubus_context *ubus_ctx, struct ruleng_rule *r, struct blob_attr *msg);
 
+/* receives the actions of matching rules in place of running them */
+typedef void (*ruleng_bus_action_hook)(
+  void *priv,
+  struct ubus_context *ubus_ctx,
+  const char *rule,
+  const struct ruleng_rule *action,
+  struct blob_attr *msg
+);
+
+/*
+ * Hand the actions of matching rules to 'hook' instead of running them,
+ * NULL runs them again. 'ubus_ctx' is the one of the rule set the action
+ * is from, 'rule' the recipe rule name, NULL for UCI rules.
+ */
+void ruleng_bus_set_action_hook(ruleng_bus_action_hook hook, void *priv);
+
+/*
+ * Log the memory taken by loading the rules at start-up. The peak is
+ * measured by resetting the RSS high-water mark of the whole process.
+ */
+void ruleng_bus_set_mem_trace(bool on);
+
+/* pass an action to the hook, false when none is set and it is to be run */
+bool ruleng_bus_action_hook_run(
+  struct ubus_context *ubus_ctx,
+  const char *rule,
+  const struct ruleng_rule *action,
+  struct blob_attr *msg
+);
+
 void ruleng_event_cb(
   struct ubus_context *ubus_ctx,
   struct ubus_event_handler *handler,
@@ -49,7 +154,41 @@ void ruleng_event_cb(
   struct blob_attr *msg
 );
 
+/*
+ * Run the rules of the given engines whose event name or pattern matches
+ * 'type', recording the event first when capturing. The event arena is
+ * reset once they are done.
+ */
+void ruleng_bus_dispatch(
+  struct ruleng_bus_ctx *ctx,
+  struct ubus_context *ubus_ctx,
+  const char *type,
+  struct blob_attr *msg,
+  int engines
+);
+
 int ruleng_bus_register_events(
   struct ruleng_bus_ctx *ctx, char *rules,
   enum ruleng_bus_rc *rc
 );
+
+/*
+ * Reload the rules, UCI sections and recipe files which did not change are
+ * taken over from the running set unless 'force' is set.
+ */
+enum ruleng_bus_rc ruleng_bus_reload(struct ruleng_bus_ctx *ctx, bool force);
+
+/*
+ * Add a recipe rule to the dispatch index, subscribing to the events it
+ * needs which nobody listens to yet.
+ */
+enum ruleng_bus_rc ruleng_bus_json_rule_bind(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_json_rule *r
+);
+
+/* remove a rule from the dispatch index, dropping subscriptions left unused */
+void ruleng_bus_json_rule_unbind(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_json_rule *r
+);
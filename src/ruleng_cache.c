@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libubox/blobmsg.h>
+#include <libubox/list.h>
+#include <libubox/avl.h>
+#include <libubox/md5.h>
+#include <uci.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_cache.h"
+#include "ruleng_json.h"
+#include "ruleng_rules.h"
+#include "utils.h"
+
+enum {
+	CACHE_PACKAGE,
+	CACHE_SOURCES,
+	CACHE_RULES,
+	CACHE_RECIPES,
+	__CACHE_MAX,
+};
+
+static const struct blobmsg_policy cache_policy[__CACHE_MAX] = {
+	[CACHE_PACKAGE] = { .name = "package", .type = BLOBMSG_TYPE_STRING },
+	[CACHE_SOURCES] = { .name = "sources", .type = BLOBMSG_TYPE_ARRAY },
+	[CACHE_RULES] = { .name = "rules", .type = BLOBMSG_TYPE_ARRAY },
+	[CACHE_RECIPES] = { .name = "recipes", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+/* recipe rules are stored in runs of rules from the same file */
+enum {
+	GROUP_SOURCE,
+	GROUP_RULES,
+	__GROUP_MAX,
+};
+
+static const struct blobmsg_policy group_policy[__GROUP_MAX] = {
+	[GROUP_SOURCE] = { .name = "source", .type = BLOBMSG_TYPE_STRING },
+	[GROUP_RULES] = { .name = "rules", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+enum {
+	SOURCE_PATH,
+	SOURCE_SIZE,
+	SOURCE_MTIME,
+	SOURCE_MTIME_NSEC,
+	SOURCE_INO,
+	SOURCE_DIGEST,
+	SOURCE_RECIPE,
+	__SOURCE_MAX,
+};
+
+static const struct blobmsg_policy source_policy[__SOURCE_MAX] = {
+	[SOURCE_PATH] = { .name = "path", .type = BLOBMSG_TYPE_STRING },
+	[SOURCE_SIZE] = { .name = "size", .type = BLOBMSG_TYPE_INT64 },
+	[SOURCE_MTIME] = { .name = "mtime", .type = BLOBMSG_TYPE_INT64 },
+	[SOURCE_MTIME_NSEC] = { .name = "mtime_nsec", .type = BLOBMSG_TYPE_INT32 },
+	[SOURCE_INO] = { .name = "ino", .type = BLOBMSG_TYPE_INT64 },
+	[SOURCE_DIGEST] = { .name = "digest", .type = BLOBMSG_TYPE_UNSPEC },
+	[SOURCE_RECIPE] = { .name = "recipe", .type = BLOBMSG_TYPE_BOOL },
+};
+
+void ruleng_cache_map_put(struct ruleng_cache_map *map)
+{
+	if (--map->refs > 0)
+		return;
+
+	munmap(map->addr, map->len);
+	free(map);
+}
+
+/* record the state of a file in 'file', a missing one with a size of -1 */
+static bool ruleng_cache_file_read(const char *path, struct ruleng_json_file *file)
+{
+	char buf[4096];
+	struct stat st = {0};
+	ssize_t n = 0;
+	md5_ctx_t md5;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	file->size = -1;
+
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+
+	md5_begin(&md5);
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		md5_hash(buf, n, &md5);
+
+	md5_end(file->digest, &md5);
+	close(fd);
+
+	if (n != 0)
+		return false;
+
+	file->size = st.st_size;
+	file->ino = st.st_ino;
+	file->mtime = st.st_mtim;
+	return true;
+}
+
+/*
+ * The files the rule set is built from besides the recipes: the UCI
+ * package and the changes to it not committed yet.
+ */
+static int ruleng_cache_package_paths(
+  struct ruleng_bus_ctx *ctx,
+  char paths[2][PATH_MAX]
+) {
+	struct uci_context *uci_ctx = ctx->com_ctx->uci_ctx;
+
+	// a package name is looked up in the uci config directory
+	if (strchr(ctx->rules_path, '/')) {
+		snprintf(paths[0], PATH_MAX, "%s", ctx->rules_path);
+		return 1;
+	}
+
+	snprintf(paths[0], PATH_MAX, "%s/%s", uci_ctx->confdir, ctx->rules_path);
+	snprintf(paths[1], PATH_MAX, "%s/%s", uci_ctx->savedir, ctx->rules_path);
+	return 2;
+}
+
+void ruleng_cache_package_record(struct ruleng_bus_ctx *ctx)
+{
+	char paths[2][PATH_MAX];
+	int n = ruleng_cache_package_paths(ctx, paths);
+
+	for (int i = 0; i < n; ++i)
+		ruleng_cache_file_read(paths[i], &ctx->package[i]);
+}
+
+/*
+ * Add the state a source file was in when its rules were read. Missing
+ * files are recorded too, they must still be missing.
+ */
+static void ruleng_cache_add_source(
+  struct blob_buf *b,
+  const char *path,
+  const struct ruleng_json_file *file,
+  bool recipe
+) {
+	void *t = blobmsg_open_table(b, "");
+	blobmsg_add_string(b, source_policy[SOURCE_PATH].name, path);
+	blobmsg_add_u64(b, source_policy[SOURCE_SIZE].name, (uint64_t) file->size);
+	blobmsg_add_u64(b, source_policy[SOURCE_MTIME].name, (uint64_t) file->mtime.tv_sec);
+	blobmsg_add_u32(b, source_policy[SOURCE_MTIME_NSEC].name, (uint32_t) file->mtime.tv_nsec);
+	blobmsg_add_u64(b, source_policy[SOURCE_INO].name, (uint64_t) file->ino);
+	blobmsg_add_field(b, BLOBMSG_TYPE_UNSPEC, source_policy[SOURCE_DIGEST].name,
+					  file->digest, sizeof(file->digest));
+	blobmsg_add_u8(b, source_policy[SOURCE_RECIPE].name, recipe);
+	blobmsg_close_table(b, t);
+}
+
+/*
+ * Whether a source file is in the state recorded in the cache, which is
+ * then its state in 'file'. Files whose times changed are digested again,
+ * '*touched' is set if the contents are the same.
+ */
+static bool ruleng_cache_source_valid(
+  struct blob_attr **tb,
+  struct ruleng_json_file *file,
+  bool *touched
+) {
+	const char *path = blobmsg_get_string(tb[SOURCE_PATH]);
+	int64_t size = (int64_t) blobmsg_get_u64(tb[SOURCE_SIZE]);
+	struct stat st = {0};
+
+	if (blobmsg_data_len(tb[SOURCE_DIGEST]) != sizeof(file->digest))
+		return false;
+
+	if (stat(path, &st) != 0) {
+		memset(file, 0, sizeof(*file));
+		file->size = -1;
+		return size < 0;
+	}
+
+	if (size < 0 || st.st_size != size)
+		return false;
+
+	if (st.st_ino == (ino_t) blobmsg_get_u64(tb[SOURCE_INO]) &&
+		st.st_mtim.tv_sec == (time_t) blobmsg_get_u64(tb[SOURCE_MTIME]) &&
+		st.st_mtim.tv_nsec == (long) blobmsg_get_u32(tb[SOURCE_MTIME_NSEC])) {
+		file->size = st.st_size;
+		file->ino = st.st_ino;
+		file->mtime = st.st_mtim;
+		memcpy(file->digest, blobmsg_data(tb[SOURCE_DIGEST]), sizeof(file->digest));
+		return true;
+	}
+
+	if (!ruleng_cache_file_read(path, file) ||
+		memcmp(file->digest, blobmsg_data(tb[SOURCE_DIGEST]), sizeof(file->digest)) != 0)
+		return false;
+
+	*touched = true;
+	return true;
+}
+
+static enum ruleng_cache_rc ruleng_cache_sources_check(
+  struct ruleng_bus_ctx *ctx,
+  struct blob_attr *sources,
+  bool *touched
+) {
+	struct blob_attr *cur = NULL;
+	size_t n = 0;
+	int rem = 0;
+
+	blobmsg_for_each_attr(cur, sources, rem) {
+		struct blob_attr *tb[__SOURCE_MAX];
+		struct ruleng_json_file file = {0};
+
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+			return RULENG_CACHE_ERR_INVALID;
+
+		blobmsg_parse(source_policy, __SOURCE_MAX, tb,
+					  blobmsg_data(cur), blobmsg_data_len(cur));
+
+		for (int i = 0; i < __SOURCE_MAX; ++i) {
+			if (tb[i] == NULL)
+				return RULENG_CACHE_ERR_INVALID;
+		}
+
+		if (!ruleng_cache_source_valid(tb, &file, touched)) {
+			RULENG_INFO("%s: changed since the rule cache was written",
+						blobmsg_get_string(tb[SOURCE_PATH]));
+			return RULENG_CACHE_ERR_STALE;
+		}
+
+		// package files are written first, in ruleng_cache_package_paths() order
+		if (!blobmsg_get_bool(tb[SOURCE_RECIPE])) {
+			if (n == ARRAY_SIZE(ctx->package))
+				return RULENG_CACHE_ERR_INVALID;
+
+			ctx->package[n++] = file;
+			continue;
+		}
+
+		// later reloads tell changed recipes apart by this state
+		if (ruleng_json_recipe_set(&ctx->recipes, blobmsg_get_string(tb[SOURCE_PATH]),
+								   &file) != RULENG_BUS_OK)
+			return RULENG_CACHE_ERR_ALLOC;
+	}
+
+	return RULENG_CACHE_OK;
+}
+
+static enum ruleng_cache_rc ruleng_cache_rules_load(
+  struct ruleng_cache_map *map,
+  struct blob_attr *data,
+  struct list_head *rules
+) {
+	struct blob_attr *cur = NULL;
+	int rem = 0;
+
+	blobmsg_for_each_attr(cur, data, rem) {
+		struct ruleng_rule *r = NULL;
+
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+			return RULENG_CACHE_ERR_INVALID;
+
+		switch (ruleng_rules_rule_load(cur, &r)) {
+		case RULENG_RULES_OK:
+			break;
+		case RULENG_RULES_ERR_ALLOC:
+			return RULENG_CACHE_ERR_ALLOC;
+		default:
+			return RULENG_CACHE_ERR_INVALID;
+		}
+
+		r->id = ruleng_rules_next_id();
+		r->map = map;
+		++map->refs;
+		list_add_tail(&r->list, rules);
+	}
+
+	return RULENG_CACHE_OK;
+}
+
+static enum ruleng_cache_rc ruleng_cache_json_rules_load(
+  struct ruleng_cache_map *map,
+  struct blob_attr *data,
+  struct list_head *rules
+) {
+	struct blob_attr *group = NULL, *cur = NULL;
+	int rem = 0, grem = 0;
+
+	blobmsg_for_each_attr(group, data, grem) {
+		struct blob_attr *tb[__GROUP_MAX];
+
+		if (blobmsg_type(group) != BLOBMSG_TYPE_TABLE)
+			return RULENG_CACHE_ERR_INVALID;
+
+		blobmsg_parse(group_policy, __GROUP_MAX, tb,
+					  blobmsg_data(group), blobmsg_data_len(group));
+
+		if (!tb[GROUP_SOURCE] || !tb[GROUP_RULES])
+			return RULENG_CACHE_ERR_INVALID;
+
+		blobmsg_for_each_attr(cur, tb[GROUP_RULES], rem) {
+			struct ruleng_json_rule *r = NULL;
+
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+				return RULENG_CACHE_ERR_INVALID;
+
+			switch (ruleng_json_rule_load(cur, blobmsg_get_string(tb[GROUP_SOURCE]), &r)) {
+			case RULENG_BUS_OK:
+				break;
+			case RULENG_BUS_ERR_ALLOC:
+				return RULENG_CACHE_ERR_ALLOC;
+			default:
+				return RULENG_CACHE_ERR_INVALID;
+			}
+
+			r->id = ruleng_rules_next_id();
+			r->map = map;
+			++map->refs;
+			list_add_tail(&r->list, rules);
+		}
+	}
+
+	return RULENG_CACHE_OK;
+}
+
+static struct ruleng_cache_map *ruleng_cache_map(const char *path)
+{
+	struct ruleng_cache_map *map = NULL;
+	struct stat st = {0};
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		goto exit;
+
+	if (fstat(fd, &st) != 0 ||
+		st.st_size < (off_t) (sizeof(struct ruleng_cache_header) + sizeof(struct blob_attr)))
+		goto cleanup_fd;
+
+	map = calloc(1, sizeof(*map));
+
+	if (map == NULL)
+		goto cleanup_fd;
+
+	map->len = st.st_size;
+	map->refs = 1;
+	map->addr = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (map->addr == MAP_FAILED) {
+		free(map);
+		map = NULL;
+	}
+
+cleanup_fd:
+	close(fd);
+exit:
+	return map;
+}
+
+enum ruleng_cache_rc ruleng_cache_load(struct ruleng_bus_ctx *ctx, bool *refresh)
+{
+	enum ruleng_cache_rc rc = RULENG_CACHE_OK;
+	struct ruleng_cache_header *hdr = NULL;
+	struct ruleng_cache_map *map = NULL;
+	struct blob_attr *tb[__CACHE_MAX];
+	struct blob_attr *data = NULL;
+	LIST_HEAD(rules);
+	LIST_HEAD(json_rules);
+
+	*refresh = false;
+	map = ruleng_cache_map(ctx->cache_path);
+
+	if (map == NULL) {
+		RULENG_INFO("%s: no usable rule cache", ctx->cache_path);
+		rc = RULENG_CACHE_ERR_IO;
+		goto exit;
+	}
+
+	hdr = map->addr;
+	data = (struct blob_attr *) (hdr + 1);
+
+	if (memcmp(hdr->magic, RULENG_CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != RULENG_CACHE_VERSION ||
+		hdr->len != map->len - sizeof(*hdr) ||
+		blob_pad_len(data) != hdr->len ||
+		hdr->checksum != ruleng_hash(RULENG_HASH_INIT, data, hdr->len)) {
+		RULENG_INFO("%s: rule cache is not valid", ctx->cache_path);
+		rc = RULENG_CACHE_ERR_INVALID;
+		goto cleanup_map;
+	}
+
+	blobmsg_parse(cache_policy, __CACHE_MAX, tb, blob_data(data), blob_len(data));
+
+	for (int i = 0; i < __CACHE_MAX; ++i) {
+		if (tb[i] == NULL) {
+			rc = RULENG_CACHE_ERR_INVALID;
+			goto cleanup_map;
+		}
+	}
+
+	if (strcmp(blobmsg_get_string(tb[CACHE_PACKAGE]), ctx->rules_path) != 0) {
+		rc = RULENG_CACHE_ERR_STALE;
+		goto cleanup_map;
+	}
+
+	rc = ruleng_cache_sources_check(ctx, tb[CACHE_SOURCES], refresh);
+
+	if (rc != RULENG_CACHE_OK)
+		goto cleanup_recipes;
+
+	rc = ruleng_cache_rules_load(map, tb[CACHE_RULES], &rules);
+
+	if (rc != RULENG_CACHE_OK)
+		goto cleanup_rules;
+
+	rc = ruleng_cache_json_rules_load(map, tb[CACHE_RECIPES], &json_rules);
+
+	if (rc != RULENG_CACHE_OK)
+		goto cleanup_rules;
+
+	list_splice_tail(&rules, &ctx->rules);
+	list_splice_tail(&json_rules, &ctx->json_rules);
+
+	// the rules hold their own references
+	ruleng_cache_map_put(map);
+	goto exit;
+
+cleanup_rules:
+	ruleng_rules_free(&rules);
+	ruleng_json_rules_free(&json_rules);
+cleanup_recipes:
+	ruleng_json_recipes_free(&ctx->recipes);
+cleanup_map:
+	ruleng_cache_map_put(map);
+exit:
+	return rc;
+}
+
+static bool ruleng_cache_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+enum ruleng_cache_rc ruleng_cache_save(struct ruleng_bus_ctx *ctx)
+{
+	enum ruleng_cache_rc rc = RULENG_CACHE_OK;
+	struct ruleng_cache_header hdr = {0};
+	struct ruleng_json_recipe *recipe = NULL;
+	struct ruleng_json_rule *jr = NULL;
+	struct ruleng_rule *r = NULL;
+	struct blob_buf b = {0};
+	const char *source = NULL;
+	void *t = NULL, *g = NULL;
+	char paths[2][PATH_MAX];
+	char tmp[PATH_MAX];
+	int n = ruleng_cache_package_paths(ctx, paths);
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_string(&b, cache_policy[CACHE_PACKAGE].name, ctx->rules_path);
+
+	void *a = blobmsg_open_array(&b, cache_policy[CACHE_SOURCES].name);
+
+	// the state the files were in when read, a later change makes the cache stale
+	for (int i = 0; i < n; ++i)
+		ruleng_cache_add_source(&b, paths[i], &ctx->package[i], false);
+
+	avl_for_each_element(&ctx->recipes, recipe, avl)
+		ruleng_cache_add_source(&b, recipe->avl.key, &recipe->file, true);
+
+	blobmsg_close_array(&b, a);
+
+	a = blobmsg_open_array(&b, cache_policy[CACHE_RULES].name);
+
+	list_for_each_entry(r, &ctx->rules, list)
+		blobmsg_add_blob(&b, r->data);
+
+	blobmsg_close_array(&b, a);
+
+	a = blobmsg_open_array(&b, cache_policy[CACHE_RECIPES].name);
+
+	list_for_each_entry(jr, &ctx->json_rules, list) {
+		// sources are interned, equal paths are the same pointer
+		if (jr->source != source) {
+			if (source) {
+				blobmsg_close_array(&b, g);
+				blobmsg_close_table(&b, t);
+			}
+
+			source = jr->source;
+			t = blobmsg_open_table(&b, "");
+			blobmsg_add_string(&b, group_policy[GROUP_SOURCE].name, source);
+			g = blobmsg_open_array(&b, group_policy[GROUP_RULES].name);
+		}
+
+		blobmsg_add_blob(&b, jr->data);
+	}
+
+	if (source) {
+		blobmsg_close_array(&b, g);
+		blobmsg_close_table(&b, t);
+	}
+
+	blobmsg_close_array(&b, a);
+
+	memcpy(hdr.magic, RULENG_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = RULENG_CACHE_VERSION;
+	hdr.len = blob_pad_len(b.head);
+	hdr.checksum = ruleng_hash(RULENG_HASH_INIT, b.head, hdr.len);
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", ctx->cache_path) >= (int) sizeof(tmp)) {
+		RULENG_ERR("%s: path too long", ctx->cache_path);
+		rc = RULENG_CACHE_ERR_IO;
+		goto cleanup_buf;
+	}
+
+	// written next to the old cache and renamed, a mapped cache stays intact
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if (fd < 0) {
+		RULENG_ERR("%s: failed to open: %s", tmp, strerror(errno));
+		rc = RULENG_CACHE_ERR_IO;
+		goto cleanup_buf;
+	}
+
+	if (!ruleng_cache_write(fd, &hdr, sizeof(hdr)) ||
+		!ruleng_cache_write(fd, b.head, hdr.len) ||
+		fsync(fd) != 0) {
+		RULENG_ERR("%s: failed to write: %s", tmp, strerror(errno));
+		rc = RULENG_CACHE_ERR_IO;
+		close(fd);
+		goto cleanup_tmp;
+	}
+
+	close(fd);
+
+	if (rename(tmp, ctx->cache_path) != 0) {
+		RULENG_ERR("%s: failed to rename: %s", tmp, strerror(errno));
+		rc = RULENG_CACHE_ERR_IO;
+		goto cleanup_tmp;
+	}
+
+	RULENG_INFO("%s: rule cache written, %u bytes", ctx->cache_path, hdr.len);
+	goto cleanup_buf;
+
+cleanup_tmp:
+	unlink(tmp);
+cleanup_buf:
+	blob_buf_free(&b);
+	return rc;
+}
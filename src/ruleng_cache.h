@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "ruleng_bus.h"
+
+#define RULENG_CACHE_MAGIC "RULENGC"
+/* bump whenever the file layout or the compiled form of a rule changes */
+#define RULENG_CACHE_VERSION 3
+
+enum ruleng_cache_rc {
+	RULENG_CACHE_OK = 0,
+	RULENG_CACHE_ERR_ALLOC,
+	RULENG_CACHE_ERR_IO,
+	RULENG_CACHE_ERR_INVALID,
+	RULENG_CACHE_ERR_STALE,
+};
+
+/*
+ * Cache file header, followed by 'len' bytes of blobmsg data holding the
+ * state of the source files and the compiled rules.
+ */
+struct ruleng_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t len;
+	/* FNV-1a of the data */
+	uint32_t checksum;
+};
+
+/* a mapped cache file, shared by the rules pointing into it */
+struct ruleng_cache_map {
+	void *addr;
+	size_t len;
+	int refs;
+};
+
+void ruleng_cache_map_put(struct ruleng_cache_map *map);
+
+/*
+ * Map the cache at ctx->cache_path and load its rules into ctx->rules and
+ * ctx->json_rules. Fails with RULENG_CACHE_ERR_STALE once the UCI package
+ * or a recipe changed since the cache was written. '*refresh' is set when
+ * files were rewritten with the same contents and the cache should be
+ * written again.
+ */
+enum ruleng_cache_rc ruleng_cache_load(struct ruleng_bus_ctx *ctx, bool *refresh);
+
+/*
+ * Record the state of the UCI package files in ctx->package. Called before
+ * the rules are read from them, a change after that makes the cache stale.
+ */
+void ruleng_cache_package_record(struct ruleng_bus_ctx *ctx);
+
+/* replace the cache at ctx->cache_path with the running rule set */
+enum ruleng_cache_rc ruleng_cache_save(struct ruleng_bus_ctx *ctx);
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
+#include <libubox/blob.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_capture.h"
+#include "ruleng_clock.h"
+#include "utils.h"
+
+/* buffered records are written out at least that often */
+#define CAPTURE_FLUSH_US 1000000
+#define CAPTURE_VARINT_MAX 10
+
+struct ruleng_capture_type {
+	struct avl_node avl;
+	uint32_t idx;
+	char name[];
+};
+
+static size_t ruleng_capture_varint(uint8_t *buf, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (uint8_t) (v | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (uint8_t) v;
+
+	return n;
+}
+
+static void ruleng_capture_put(struct ruleng_capture *cap, const void *p, size_t len)
+{
+	fwrite(p, 1, len, cap->f);
+	cap->bytes += len;
+}
+
+static void ruleng_capture_put_varint(struct ruleng_capture *cap, uint64_t v)
+{
+	uint8_t buf[CAPTURE_VARINT_MAX];
+
+	ruleng_capture_put(cap, buf, ruleng_capture_varint(buf, v));
+}
+
+static void ruleng_capture_types_free(struct avl_tree *types)
+{
+	struct ruleng_capture_type *t = NULL, *tmp = NULL;
+
+	avl_remove_all_elements(types, t, avl, tmp)
+		free(t);
+}
+
+enum ruleng_capture_rc ruleng_capture_open(struct ruleng_capture **cap, const char *path)
+{
+	enum ruleng_capture_rc rc = RULENG_CAPTURE_OK;
+	char magic[8] = RULENG_CAPTURE_MAGIC;
+	uint8_t tag = RULENG_CAPTURE_SESSION;
+	struct ruleng_capture *c = calloc(1, sizeof(*c));
+
+	if (c == NULL) {
+		rc = RULENG_CAPTURE_ERR_ALLOC;
+		goto exit;
+	}
+
+	c->path = strdup(path);
+	if (c->path == NULL) {
+		rc = RULENG_CAPTURE_ERR_ALLOC;
+		goto cleanup_cap;
+	}
+
+	c->f = fopen(path, "ab");
+	if (c->f == NULL) {
+		RULENG_ERR("%s: failed to open capture log", path);
+		rc = RULENG_CAPTURE_ERR_IO;
+		goto cleanup_path;
+	}
+
+	avl_init(&c->types, avl_strcmp, false, NULL);
+
+	ruleng_capture_put(c, &tag, 1);
+	ruleng_capture_put(c, magic, sizeof(magic));
+	ruleng_capture_put_varint(c, RULENG_CAPTURE_VERSION);
+	ruleng_capture_put_varint(c, (uint64_t) time(NULL));
+	fflush(c->f);
+
+	c->last_us = c->flushed_us = ruleng_clock_now_us();
+	RULENG_INFO("capturing events to %s", path);
+
+	*cap = c;
+	goto exit;
+
+cleanup_path:
+	free(c->path);
+cleanup_cap:
+	free(c);
+exit:
+	return rc;
+}
+
+/* write the reference to 'type', adding it to the session when new */
+static void ruleng_capture_put_type(struct ruleng_capture *cap, const char *type)
+{
+	struct ruleng_capture_type *t = avl_find_element(&cap->types, type, t, avl);
+	size_t len = strlen(type);
+
+	if (t) {
+		ruleng_capture_put_varint(cap, t->idx + 1);
+		return;
+	}
+
+	ruleng_capture_put_varint(cap, 0);
+	ruleng_capture_put_varint(cap, len);
+	ruleng_capture_put(cap, type, len);
+
+	// the reader numbers names in the order they appear, keep in step
+	t = malloc(sizeof(*t) + len + 1);
+	if (t == NULL) {
+		// not indexed, the name is written in full again next time
+		++cap->n_types;
+		return;
+	}
+
+	t->idx = cap->n_types++;
+	memcpy(t->name, type, len + 1);
+	t->avl.key = t->name;
+	avl_insert(&cap->types, &t->avl);
+}
+
+void ruleng_capture_write(
+  struct ruleng_capture *cap,
+  const char *type,
+  struct blob_attr *msg,
+  int engines
+) {
+	uint8_t tag = (uint8_t) engines;
+	uint64_t now = 0;
+
+	if (cap->f == NULL)
+		return;
+
+	now = ruleng_clock_now_us();
+
+	ruleng_capture_put(cap, &tag, 1);
+	ruleng_capture_put_varint(cap, now - cap->last_us);
+	ruleng_capture_put_type(cap, type);
+	ruleng_capture_put_varint(cap, blob_raw_len(msg));
+	ruleng_capture_put(cap, msg, blob_raw_len(msg));
+
+	cap->last_us = now;
+	++cap->events;
+
+	if (now - cap->flushed_us >= CAPTURE_FLUSH_US) {
+		fflush(cap->f);
+		cap->flushed_us = now;
+	}
+
+	if (ferror(cap->f)) {
+		RULENG_ERR("%s: failed to write capture log, stopped", cap->path);
+		fclose(cap->f);
+		cap->f = NULL;
+	}
+}
+
+void ruleng_capture_close(struct ruleng_capture *cap)
+{
+	if (cap->f) {
+		fclose(cap->f);
+		RULENG_INFO("captured %llu events to %s", (unsigned long long) cap->events, cap->path);
+	}
+
+	ruleng_capture_types_free(&cap->types);
+	free(cap->path);
+	free(cap);
+}
+
+enum ruleng_capture_rc ruleng_capture_reader_open(
+  struct ruleng_capture_reader *r,
+  const char *path
+) {
+	memset(r, 0, sizeof(*r));
+
+	r->f = fopen(path, "rb");
+	if (r->f == NULL)
+		return RULENG_CAPTURE_ERR_IO;
+
+	return RULENG_CAPTURE_OK;
+}
+
+static bool ruleng_capture_get_varint(FILE *f, uint64_t *v)
+{
+	int c = 0;
+
+	*v = 0;
+
+	for (int shift = 0; shift < 7 * CAPTURE_VARINT_MAX; shift += 7) {
+		c = fgetc(f);
+		if (c == EOF)
+			return false;
+
+		*v |= (uint64_t) (c & 0x7f) << shift;
+
+		if (!(c & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+static void ruleng_capture_reader_types_free(struct ruleng_capture_reader *r)
+{
+	for (uint32_t i = 0; i < r->n_types; i++)
+		free(r->types[i]);
+
+	r->n_types = 0;
+}
+
+static enum ruleng_capture_rc ruleng_capture_read_session(struct ruleng_capture_reader *r)
+{
+	char magic[8] = {0};
+	uint64_t version = 0, wall = 0;
+
+	if (fread(magic, 1, sizeof(magic), r->f) != sizeof(magic) ||
+		memcmp(magic, RULENG_CAPTURE_MAGIC, sizeof(magic)) != 0 ||
+		!ruleng_capture_get_varint(r->f, &version) ||
+		version != RULENG_CAPTURE_VERSION ||
+		!ruleng_capture_get_varint(r->f, &wall))
+		return RULENG_CAPTURE_ERR_INVALID;
+
+	// names are numbered per session, times carry on from the last one
+	ruleng_capture_reader_types_free(r);
+
+	return RULENG_CAPTURE_OK;
+}
+
+static enum ruleng_capture_rc ruleng_capture_read_type(
+  struct ruleng_capture_reader *r,
+  const char **type
+) {
+	uint64_t ref = 0, len = 0;
+	char *name = NULL;
+
+	if (!ruleng_capture_get_varint(r->f, &ref))
+		return RULENG_CAPTURE_ERR_INVALID;
+
+	if (ref) {
+		if (ref > r->n_types)
+			return RULENG_CAPTURE_ERR_INVALID;
+
+		*type = r->types[ref - 1];
+		return RULENG_CAPTURE_OK;
+	}
+
+	if (!ruleng_capture_get_varint(r->f, &len) || len > UINT16_MAX)
+		return RULENG_CAPTURE_ERR_INVALID;
+
+	if (r->n_types == r->size_types) {
+		uint32_t size = r->size_types ? 2 * r->size_types : 16;
+		char **types = realloc(r->types, size * sizeof(*types));
+
+		if (types == NULL)
+			return RULENG_CAPTURE_ERR_ALLOC;
+
+		r->types = types;
+		r->size_types = size;
+	}
+
+	name = malloc(len + 1);
+	if (name == NULL)
+		return RULENG_CAPTURE_ERR_ALLOC;
+
+	if (fread(name, 1, len, r->f) != len) {
+		free(name);
+		return RULENG_CAPTURE_ERR_INVALID;
+	}
+
+	name[len] = '\0';
+	r->types[r->n_types++] = name;
+	*type = name;
+
+	return RULENG_CAPTURE_OK;
+}
+
+static enum ruleng_capture_rc ruleng_capture_read_payload(
+  struct ruleng_capture_reader *r,
+  struct blob_attr **msg
+) {
+	uint64_t len = 0;
+
+	if (!ruleng_capture_get_varint(r->f, &len) ||
+		len < sizeof(struct blob_attr) || len > BLOB_ATTR_LEN_MASK)
+		return RULENG_CAPTURE_ERR_INVALID;
+
+	if (len > r->buf_size) {
+		void *buf = realloc(r->buf, len);
+
+		if (buf == NULL)
+			return RULENG_CAPTURE_ERR_ALLOC;
+
+		r->buf = buf;
+		r->buf_size = len;
+	}
+
+	if (fread(r->buf, 1, len, r->f) != len || blob_raw_len(r->buf) != len)
+		return RULENG_CAPTURE_ERR_INVALID;
+
+	*msg = r->buf;
+
+	return RULENG_CAPTURE_OK;
+}
+
+enum ruleng_capture_rc ruleng_capture_reader_next(
+  struct ruleng_capture_reader *r,
+  struct ruleng_capture_event *ev
+) {
+	enum ruleng_capture_rc rc = RULENG_CAPTURE_OK;
+	uint64_t delta = 0;
+	int tag = 0;
+
+	while ((tag = fgetc(r->f)) == RULENG_CAPTURE_SESSION) {
+		rc = ruleng_capture_read_session(r);
+		if (rc != RULENG_CAPTURE_OK)
+			return rc;
+	}
+
+	if (tag == EOF)
+		return RULENG_CAPTURE_END;
+
+	if (!(tag & (RULENG_BUS_DISPATCH_RULES | RULENG_BUS_DISPATCH_JSON)) ||
+		(tag & ~(RULENG_BUS_DISPATCH_RULES | RULENG_BUS_DISPATCH_JSON)) ||
+		!ruleng_capture_get_varint(r->f, &delta))
+		return RULENG_CAPTURE_ERR_INVALID;
+
+	rc = ruleng_capture_read_type(r, &ev->type);
+	if (rc != RULENG_CAPTURE_OK)
+		return rc;
+
+	rc = ruleng_capture_read_payload(r, &ev->msg);
+	if (rc != RULENG_CAPTURE_OK)
+		return rc;
+
+	r->ts_us += delta;
+	ev->ts_us = r->ts_us;
+	ev->engines = tag;
+
+	return RULENG_CAPTURE_OK;
+}
+
+void ruleng_capture_reader_close(struct ruleng_capture_reader *r)
+{
+	if (r->f)
+		fclose(r->f);
+
+	ruleng_capture_reader_types_free(r);
+	free(r->types);
+	free(r->buf);
+	memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <libubox/avl.h>
+#include <libubox/blob.h>
+
+#define RULENG_CAPTURE_MAGIC "RULENGE"
+/* bump whenever the record layout changes */
+#define RULENG_CAPTURE_VERSION 1
+
+/*
+ * A capture log is a sequence of records, each starting with a tag byte.
+ *
+ * A session record starts every capture, logs are appended to:
+ *   RULENG_CAPTURE_SESSION, magic[8], version, varint wall clock seconds
+ *
+ * An event record is tagged with the rule engines the event went to:
+ *   engines, varint microseconds since the previous record,
+ *   varint type, varint payload length, payload
+ *
+ * The type is the index of an event name within the session plus one, or
+ * 0 when the name appears for the first time and follows as varint length
+ * and bytes. The payload is the blob attribute as received, header
+ * included. Varints are LEB128, least significant group first.
+ */
+#define RULENG_CAPTURE_SESSION 0x80
+
+enum ruleng_capture_rc {
+	RULENG_CAPTURE_OK = 0,
+	RULENG_CAPTURE_END,
+	RULENG_CAPTURE_ERR_ALLOC,
+	RULENG_CAPTURE_ERR_IO,
+	RULENG_CAPTURE_ERR_INVALID,
+};
+
+struct ruleng_capture {
+	FILE *f;
+	char *path;
+	/* event names written in this session, by name */
+	struct avl_tree types;
+	uint32_t n_types;
+	uint64_t last_us;
+	uint64_t flushed_us;
+	uint64_t events;
+	uint64_t bytes;
+};
+
+struct ruleng_capture_event {
+	/* monotonic time the event was received, microseconds */
+	uint64_t ts_us;
+	/* RULENG_BUS_DISPATCH_* engines it was dispatched to */
+	int engines;
+	const char *type;
+	struct blob_attr *msg;
+};
+
+struct ruleng_capture_reader {
+	FILE *f;
+	char **types;
+	uint32_t n_types;
+	uint32_t size_types;
+	uint64_t ts_us;
+	/* payload of the latest event, kept aligned */
+	void *buf;
+	size_t buf_size;
+};
+
+/* start appending the events dispatched to the log at 'path' */
+enum ruleng_capture_rc ruleng_capture_open(struct ruleng_capture **cap, const char *path);
+
+void ruleng_capture_write(
+  struct ruleng_capture *cap,
+  const char *type,
+  struct blob_attr *msg,
+  int engines
+);
+
+void ruleng_capture_close(struct ruleng_capture *cap);
+
+enum ruleng_capture_rc ruleng_capture_reader_open(
+  struct ruleng_capture_reader *r,
+  const char *path
+);
+
+/*
+ * Read the next event. Its type and payload stay valid until the next
+ * call. Returns RULENG_CAPTURE_END at the end of the log.
+ */
+enum ruleng_capture_rc ruleng_capture_reader_next(
+  struct ruleng_capture_reader *r,
+  struct ruleng_capture_event *ev
+);
+
+void ruleng_capture_reader_close(struct ruleng_capture_reader *r);
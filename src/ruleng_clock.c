@@ -0,0 +1,61 @@
+#include <stddef.h>
+#include <time.h>
+
+#include "ruleng_clock.h"
+
+static uint64_t ruleng_clock_system_now(void *priv)
+{
+	struct timespec ts;
+
+	(void) priv;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t virtual_us;
+
+static uint64_t ruleng_clock_virtual_now(void *priv)
+{
+	(void) priv;
+
+	return virtual_us;
+}
+
+static const struct ruleng_clock system_clock = {
+	.now = ruleng_clock_system_now,
+};
+
+static const struct ruleng_clock virtual_clock = {
+	.now = ruleng_clock_virtual_now,
+};
+
+static const struct ruleng_clock *clock_cur = &system_clock;
+
+void ruleng_clock_set(const struct ruleng_clock *clock)
+{
+	clock_cur = clock ? clock : &system_clock;
+}
+
+void ruleng_clock_virtual(uint64_t start)
+{
+	virtual_us = start;
+	clock_cur = &virtual_clock;
+}
+
+void ruleng_clock_advance(uint64_t us)
+{
+	virtual_us += us;
+}
+
+void ruleng_clock_set_time(uint64_t us)
+{
+	if (us > virtual_us)
+		virtual_us = us;
+}
+
+uint64_t ruleng_clock_now_us(void)
+{
+	return clock_cur->now(clock_cur->priv);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Time source of the engine. Everything time dependent, correlation
+ * windows and rule timers, reads it instead of the system clock, so tests
+ * and replays can run on a virtual clock they move on themselves.
+ */
+struct ruleng_clock {
+	/* monotonic time, microseconds */
+	uint64_t (*now)(void *priv);
+	void *priv;
+};
+
+/* use 'clock' from now on, NULL goes back to the system clock */
+void ruleng_clock_set(const struct ruleng_clock *clock);
+
+/*
+ * Switch to the virtual clock, standing at 'start' microseconds. It only
+ * moves on through ruleng_clock_advance() and ruleng_clock_set_time(),
+ * timers due by then fire on ruleng_timer_run().
+ */
+void ruleng_clock_virtual(uint64_t start);
+
+void ruleng_clock_advance(uint64_t us);
+
+/* move the virtual clock to 'us', it never goes back */
+void ruleng_clock_set_time(uint64_t us);
+
+uint64_t ruleng_clock_now_us(void);
+
+static inline uint64_t ruleng_clock_now_ms(void)
+{
+	return ruleng_clock_now_us() / 1000;
+}
@@ -1,17 +1,33 @@
 #include <syslog.h>
 #include <uci.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <inttypes.h>
 #include <time.h>
 #include <libubox/uloop.h>
 #include <libubus.h>
 #include <libubox/blobmsg_json.h>
 #include <libubox/list.h>
 #include <regex.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
+#include <libubox/md5.h>
 
 #include "utils.h"
+#include "ruleng_arena.h"
+#include "ruleng_bitset.h"
+#include "ruleng_blob.h"
 #include "ruleng_bus.h"
+#include "ruleng_clock.h"
 #include "ruleng_rules.h"
 #include "ruleng_json.h"
+#include "ruleng_cache.h"
+#include "ruleng_strpool.h"
 
 int get_json_int_object(struct json_object *obj, const char *str)
 {
@@ -31,155 +47,1722 @@ const char *get_json_string_object(struct json_object *obj, const char *str)
 		return NULL;
 }
 
+/* field of a compiled recipe rule, besides the recipe's own ones */
+#define JSON_NAME_FIELD "name"
+
+/* size of the chunks recipe files are read in */
+#define JSON_READ_CHUNK 4096
+/* room the key buffer of a recipe scanner starts with */
+#define JSON_NAME_SIZE 64
+/* most threads recipe files are parsed on, the main thread included */
+#define JSON_WORKERS_MAX 8
+/* most correlation keys a rule tracks when its recipe does not say */
+#define JSON_KEYS_MAX 256
+/* buckets the window of a COUNT rule is counted in, per key */
+#define JSON_COUNT_BUCKETS 16
+/* window of rules without if_event_period, matches less than a second apart */
+#define JSON_WINDOW_DEFAULT_MS 999
+
+enum {
+	RECIPE_NAME,
+	RECIPE_IF,
+	RECIPE_IF_OPERATOR,
+	RECIPE_THEN,
+	RECIPE_TOTAL_WAIT,
+	RECIPE_SLEEP,
+	RECIPE_REGEX,
+	RECIPE_KEY,
+	RECIPE_KEY_MAX,
+	RECIPE_COUNT,
+	__RECIPE_MAX,
+};
+
+static const struct blobmsg_policy recipe_policy[__RECIPE_MAX] = {
+	[RECIPE_NAME] = { .name = JSON_NAME_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[RECIPE_IF] = { .name = JSON_IF_FIELD, .type = BLOBMSG_TYPE_ARRAY },
+	[RECIPE_IF_OPERATOR] = { .name = JSON_IF_OPERATOR_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[RECIPE_THEN] = { .name = JSON_THEN_FIELD, .type = BLOBMSG_TYPE_ARRAY },
+	[RECIPE_TOTAL_WAIT] = { .name = JSON_TOTAL_WAIT_FIELD, .type = BLOBMSG_TYPE_INT32 },
+	[RECIPE_SLEEP] = { .name = JSON_SLEEP_FIELD, .type = BLOBMSG_TYPE_INT32 },
+	[RECIPE_REGEX] = { .name = JSON_REGEX_FIELD, .type = BLOBMSG_TYPE_BOOL },
+	[RECIPE_KEY] = { .name = JSON_KEY_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[RECIPE_KEY_MAX] = { .name = JSON_KEY_MAX_FIELD, .type = BLOBMSG_TYPE_INT32 },
+	[RECIPE_COUNT] = { .name = JSON_COUNT_FIELD, .type = BLOBMSG_TYPE_INT32 },
+};
+
+static const char * const operator_names[] = {
+	[AND] = "AND",
+	[OR] = "OR",
+	[SEQUENCE] = "SEQUENCE",
+	[ABSENCE] = "ABSENCE",
+	[COUNT] = "COUNT",
+};
+
+enum {
+	COND_EVENT,
+	COND_MATCH,
+	COND_REGEX,
+	__COND_MAX,
+};
+
+static const struct blobmsg_policy cond_policy[__COND_MAX] = {
+	[COND_EVENT] = { .name = JSON_EVENT_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[COND_MATCH] = { .name = JSON_MATCH_FIELD, .type = BLOBMSG_TYPE_TABLE },
+	[COND_REGEX] = { .name = JSON_REGEX_FIELD, .type = BLOBMSG_TYPE_BOOL },
+};
+
+enum {
+	ACTION_OBJECT,
+	ACTION_CLI,
+	ACTION_METHOD,
+	ACTION_TIMEOUT,
+	ACTION_ARGS,
+	ACTION_ENVS,
+	__ACTION_MAX,
+};
+
+static const struct blobmsg_policy action_policy[__ACTION_MAX] = {
+	[ACTION_OBJECT] = { .name = JSON_OBJECT_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[ACTION_CLI] = { .name = JSON_CLI_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[ACTION_METHOD] = { .name = JSON_METHOD_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[ACTION_TIMEOUT] = { .name = JSON_TIMEOUT_FIELD, .type = BLOBMSG_TYPE_INT32 },
+	[ACTION_ARGS] = { .name = JSON_ARGS_FIELD, .type = BLOBMSG_TYPE_TABLE },
+	[ACTION_ENVS] = { .name = JSON_ENVS_FIELD, .type = BLOBMSG_TYPE_TABLE },
+};
+
+/* the actions of a fired rule left to run once then_exec_interval passed */
+struct ruleng_json_run {
+	struct list_head list;
+	struct ruleng_timer timer;
+	struct ruleng_json_rule *rule;
+	struct ubus_context *ubus_ctx;
+	/* index of the next action in 'then' */
+	int next;
+	/* the event which fired the rule */
+	struct blob_attr *msg;
+};
+
+static void ruleng_json_run_free(struct ruleng_json_run *run)
+{
+	ruleng_timer_cancel(&run->timer);
+	list_del(&run->list);
+	free(run);
+}
+
+static void ruleng_json_run_cb(struct ruleng_timer *t);
+
+static void ruleng_json_run_defer(
+  struct ubus_context *u_ctx,
+  struct ruleng_json_rule *r,
+  struct blob_attr *msg,
+  int next
+) {
+	struct ruleng_json_run *run = NULL;
+	struct blob_attr *m = NULL;
+
+	run = calloc_a(sizeof(*run), &m, blob_raw_len(msg));
+
+	if (run == NULL) {
+		RULENG_ERR("%s: failed to allocate the remaining actions", r->name);
+		return;
+	}
+
+	memcpy(m, msg, blob_raw_len(msg));
+	run->timer.cb = ruleng_json_run_cb;
+	run->rule = r;
+	run->ubus_ctx = u_ctx;
+	run->next = next;
+	run->msg = m;
+	list_add_tail(&run->list, &r->runs);
+
+	RULENG_INFO("next action in [%d] s", r->time.sleep_time);
+	ruleng_timer_set(&run->timer, (uint64_t) r->time.sleep_time * 1000);
+}
+
+/* run the actions of 'r' from the 'first' on, up to one which has to wait */
 static void ruleng_take_json_action(
   struct ubus_context *u_ctx,
   struct ruleng_json_rule *r,
+  struct blob_attr *msg,
+  int first
+) {
+	struct blob_attr *cur = NULL;
+	int rem = 0, i = 0;
+
+	blobmsg_for_each_attr(cur, r->action.args, rem) {
+		struct blob_attr *tb[__ACTION_MAX];
+		struct ruleng_rule rr = {0};
+
+		if (i++ < first)
+			continue;
+
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+			continue;
+
+		blobmsg_parse(action_policy, __ACTION_MAX, tb,
+					  blobmsg_data(cur), blobmsg_data_len(cur));
+
+		rr.action.args = tb[ACTION_ARGS];
+		rr.action.envs = tb[ACTION_ENVS];
+
+		if (tb[ACTION_TIMEOUT])
+			rr.action.timeout = (int) blobmsg_get_u32(tb[ACTION_TIMEOUT]);
+
+		// if there's no "object" field, we check for a "cli" field
+		// otherwise we continue with the "method" field
+		if (!tb[ACTION_OBJECT]) {
+			if (!tb[ACTION_CLI])
+				continue;
+
+			rr.action.object = blobmsg_get_string(tb[ACTION_CLI]);
+			RULENG_INFO("calling [%s]", rr.action.object);
+
+			// nothing runs, there is nothing to wait for before the next action
+			if (ruleng_bus_action_hook_run(u_ctx, r->name, &rr, msg))
+				continue;
+
+			ruleng_cli_call(u_ctx, &rr, msg);
+		} else {
+			if (!tb[ACTION_METHOD])
+				continue;
+
+			rr.action.object = blobmsg_get_string(tb[ACTION_OBJECT]);
+			rr.action.name = blobmsg_get_string(tb[ACTION_METHOD]);
+			RULENG_INFO("calling[%s->%s]", rr.action.object, rr.action.name);
+
+			if (ruleng_bus_action_hook_run(u_ctx, r->name, &rr, msg))
+				continue;
+
+			ruleng_ubus_call(u_ctx, &rr, msg);
+		}
+
+		// more actions follow
+		if (rem > (int) blob_pad_len(cur) && r->time.sleep_time > 0) {
+			ruleng_json_run_defer(u_ctx, r, msg, i);
+			return;
+		}
+	}
+}
+
+static void ruleng_json_run_cb(struct ruleng_timer *t)
+{
+	struct ruleng_json_run *run = container_of(t, struct ruleng_json_run, timer);
+
+	ruleng_log_set_rule(run->rule->id);
+	ruleng_take_json_action(run->ubus_ctx, run->rule, run->msg, run->next);
+	ruleng_log_set_rule(0);
+
+	ruleng_json_run_free(run);
+	// the actions allocated from the arena as they do for an event
+	ruleng_arena_reset();
+}
+
+/* the window of 'r' in milliseconds, all its conditions must match within */
+static uint64_t ruleng_json_rule_window(const struct ruleng_json_rule *r)
+{
+	// whole second timestamps used to let matches of the same second combine
+	if (r->time.total_wait <= 0)
+		return JSON_WINDOW_DEFAULT_MS;
+
+	return (uint64_t) r->time.total_wait * 1000;
+}
+
+static void ruleng_json_state_expire_cb(struct ruleng_timer *t);
+static void ruleng_json_absence_cb(struct ruleng_timer *t);
+static void ruleng_json_count_cb(struct ruleng_timer *t);
+
+/* start 's' over, with no condition matched */
+static void ruleng_json_state_reset(struct ruleng_json_state *s)
+{
+	ruleng_timer_cancel(&s->expire);
+	ruleng_bitset_fill(s->rules_hit, s->rule->n_conds);
+	s->n_left = s->rule->n_conds;
+	free(s->msg);
+	s->msg = NULL;
+
+	if (s->buckets) {
+		memset(s->buckets, 0, JSON_COUNT_BUCKETS * sizeof(*s->buckets));
+		s->count = 0;
+	}
+}
+
+/* whether 's' waits for nothing */
+static bool ruleng_json_state_idle(const struct ruleng_json_state *s)
+{
+	if (s->rule->operator == COUNT)
+		return s->count == 0;
+
+	return s->n_left == s->rule->n_conds;
+}
+
+static void ruleng_json_state_init(
+  struct ruleng_json_state *s,
+  struct ruleng_json_rule *r,
+  uint64_t *rules_hit,
+  uint64_t *hit_ms,
+  uint32_t *buckets
+) {
+	s->rule = r;
+	s->rules_hit = rules_hit;
+	s->hit_ms = hit_ms;
+	s->buckets = r->operator == COUNT ? buckets : NULL;
+
+	if (r->operator == ABSENCE)
+		s->expire.cb = ruleng_json_absence_cb;
+	else if (r->operator == COUNT)
+		s->expire.cb = ruleng_json_count_cb;
+	else
+		s->expire.cb = ruleng_json_state_expire_cb;
+
+	ruleng_json_state_reset(s);
+}
+
+/* counters of a state of a rule with 'op', COUNT rules only have any */
+static size_t ruleng_json_state_buckets(enum Operators op)
+{
+	return op == COUNT ? JSON_COUNT_BUCKETS : 0;
+}
+
+/* bytes a state of 'r' takes, with its key if it has one */
+static size_t ruleng_json_state_size(const struct ruleng_json_rule *r, const char *key)
+{
+	return (RULENG_BITSET_WORDS(r->n_conds) + r->n_conds) * sizeof(uint64_t) +
+		ruleng_json_state_buckets(r->operator) * sizeof(uint32_t) +
+		(key ? sizeof(struct ruleng_json_state) + strlen(key) + 1 : 0);
+}
+
+static void ruleng_json_state_free(struct ruleng_json_state *s)
+{
+	ruleng_json_state_reset(s);
+	avl_delete(&s->rule->keys, &s->avl);
+	list_del(&s->lru);
+	free(s);
+}
+
+/* done with the partial matches of 's', a keyed state goes along */
+static void ruleng_json_state_drop(struct ruleng_json_state *s)
+{
+	if (s == &s->rule->state)
+		ruleng_json_state_reset(s);
+	else
+		ruleng_json_state_free(s);
+}
+
+/* the state of 'key' if it has one, as the most recently matched key */
+static struct ruleng_json_state *ruleng_json_state_find(
+  struct ruleng_json_rule *r,
+  const char *key
+) {
+	struct ruleng_json_state *s = NULL;
+
+	s = avl_find_element(&r->keys, key, s, avl);
+
+	if (s)
+		list_move_tail(&s->lru, &r->lru);
+
+	return s;
+}
+
+/* the state of 'key', made on its first match */
+static struct ruleng_json_state *ruleng_json_state_get(
+  struct ruleng_json_rule *r,
+  const char *key
+) {
+	struct ruleng_json_state *s = NULL;
+	uint64_t *rules_hit = NULL, *hit_ms = NULL;
+	uint32_t *buckets = NULL;
+	char *k = NULL;
+
+	s = ruleng_json_state_find(r, key);
+
+	if (s)
+		return s;
+
+	// the least recently matched key makes room
+	if ((int) r->keys.count >= r->keys_max) {
+		s = list_first_entry(&r->lru, struct ruleng_json_state, lru);
+		RULENG_INFO("%s: dropping key [%s]", r->name, (const char *) s->avl.key);
+		ruleng_json_state_free(s);
+		++r->evicted;
+	}
+
+	s = calloc_a(sizeof(*s),
+				 &rules_hit, RULENG_BITSET_WORDS(r->n_conds) * sizeof(*rules_hit),
+				 &hit_ms, r->n_conds * sizeof(*hit_ms),
+				 &buckets, ruleng_json_state_buckets(r->operator) * sizeof(*buckets),
+				 &k, strlen(key) + 1);
+
+	if (s == NULL) {
+		RULENG_ERR("%s: failed to allocate key [%s]", r->name, key);
+		return NULL;
+	}
+
+	strcpy(k, key);
+	ruleng_json_state_init(s, r, rules_hit, hit_ms, buckets);
+	s->avl.key = k;
+	avl_insert(&r->keys, &s->avl);
+	list_add_tail(&s->lru, &r->lru);
+
+	return s;
+}
+
+/*
+ * The correlation key of 'r' in 'msg', formatted into 'buf' unless it is a
+ * string. NULL if the event lacks it.
+ */
+static const char *ruleng_json_rule_key(
+  const struct ruleng_json_rule *r,
+  struct blob_attr *msg,
+  char *buf,
+  size_t len
+) {
+	struct blob_attr *v = ruleng_blob_extract_value(r->key, msg);
+
+	if (v == NULL)
+		return NULL;
+
+	switch (blobmsg_type(v)) {
+		case BLOBMSG_TYPE_STRING:
+			return blobmsg_get_string(v);
+		case BLOBMSG_TYPE_INT64:
+			snprintf(buf, len, "%" PRId64, (int64_t) blobmsg_get_u64(v));
+			return buf;
+		case BLOBMSG_TYPE_INT32:
+			snprintf(buf, len, "%d", (int32_t) blobmsg_get_u32(v));
+			return buf;
+		case BLOBMSG_TYPE_INT16:
+			snprintf(buf, len, "%d", (int16_t) blobmsg_get_u16(v));
+			return buf;
+		case BLOBMSG_TYPE_INT8:
+			snprintf(buf, len, "%d", (int8_t) blobmsg_get_u8(v));
+			return buf;
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Forget the partial matches of 's' which fell out of the window by 'now',
+ * and wait for the oldest one left to do so.
+ */
+static void ruleng_json_state_expire(struct ruleng_json_state *s, uint64_t now)
+{
+	struct ruleng_json_rule *r = s->rule;
+	uint64_t window = ruleng_json_rule_window(r), oldest = UINT64_MAX, left = 0;
+
+	for (int i = 0; i < r->n_conds; i++) {
+		if (ruleng_bitset_test(s->rules_hit, i))
+			continue;
+
+		if (now - s->hit_ms[i] > window) {
+			ruleng_bitset_set(s->rules_hit, i);
+			++s->n_left;
+			continue;
+		}
+
+		if (s->hit_ms[i] < oldest)
+			oldest = s->hit_ms[i];
+	}
+
+	if (s->n_left == r->n_conds) {
+		ruleng_timer_cancel(&s->expire);
+		return;
+	}
+
+	left = oldest + window - now + 1;
+	ruleng_timer_set(&s->expire, left);
+}
+
+static void ruleng_json_state_expire_cb(struct ruleng_timer *t)
+{
+	struct ruleng_json_state *s = container_of(t, struct ruleng_json_state, expire);
+
+	ruleng_json_state_expire(s, ruleng_clock_now_ms());
+
+	// a key with nothing left to wait for is gone
+	if (ruleng_json_state_idle(s))
+		ruleng_json_state_drop(s);
+}
+
+/* the event arming an ABSENCE rule was not followed in time, run its actions */
+static void ruleng_json_absence_fire(struct ruleng_json_state *s)
+{
+	struct ruleng_json_rule *r = s->rule;
+	struct ubus_context *ubus_ctx = s->ubus_ctx;
+	struct blob_attr *msg = s->msg;
+
+	s->msg = NULL;
+	ruleng_json_state_reset(s);
+
+	RULENG_INFO("Nothing matched within time [%s]", r->name);
+	ruleng_take_json_action(ubus_ctx, r, msg, 0);
+	free(msg);
+}
+
+static void ruleng_json_absence_cb(struct ruleng_timer *t)
+{
+	struct ruleng_json_state *s = container_of(t, struct ruleng_json_state, expire);
+
+	ruleng_log_set_rule(s->rule->id);
+	ruleng_json_absence_fire(s);
+	ruleng_log_set_rule(0);
+
+	ruleng_json_state_drop(s);
+	// the actions allocated from the arena as they do for an event
+	ruleng_arena_reset();
+}
+
+/*
+ * COUNT rules count their matches in a ring of JSON_COUNT_BUCKETS buckets
+ * a slice of the window wide. A match stays counted for between all of the
+ * window and all but a slice of it, and counting or dropping one takes
+ * constant time however many there are.
+ */
+static uint64_t ruleng_json_count_width(const struct ruleng_json_rule *r)
+{
+	uint64_t width = ruleng_json_rule_window(r) / JSON_COUNT_BUCKETS;
+
+	return width ? width : 1;
+}
+
+/* move the ring of 's' on to the bucket of 'now', dropping what falls out */
+static void ruleng_json_count_advance(struct ruleng_json_state *s, uint64_t now)
+{
+	uint64_t bucket = now / ruleng_json_count_width(s->rule);
+
+	// a turn of the ring clears it, however long it was idle
+	for (uint64_t i = s->bucket + 1; i <= bucket && i <= s->bucket + JSON_COUNT_BUCKETS; i++) {
+		uint32_t *b = &s->buckets[i % JSON_COUNT_BUCKETS];
+
+		s->count -= *b;
+		*b = 0;
+	}
+
+	if (bucket > s->bucket)
+		s->bucket = bucket;
+}
+
+/* wait for the newest bucket of 's' to fall out */
+static void ruleng_json_count_arm(struct ruleng_json_state *s, uint64_t now)
+{
+	uint64_t deadline = (s->bucket + JSON_COUNT_BUCKETS) * ruleng_json_count_width(s->rule);
+
+	ruleng_timer_set(&s->expire, deadline > now ? deadline - now : 0);
+}
+
+static void ruleng_json_count_cb(struct ruleng_timer *t)
+{
+	struct ruleng_json_state *s = container_of(t, struct ruleng_json_state, expire);
+	uint64_t now = ruleng_clock_now_ms();
+
+	ruleng_json_count_advance(s, now);
+
+	// newer matches came since the timer was set
+	if (s->count)
+		ruleng_json_count_arm(s, now);
+	else
+		ruleng_json_state_drop(s);
+}
+
+/* catch up with the timer of 's' when it is due by 'now' but did not run yet */
+static void ruleng_json_state_catch_up(struct ruleng_json_state *s, uint64_t now)
+{
+	if (!s->expire.pending || s->expire.expires > now)
+		return;
+
+	// counts are dropped as the ring moves on
+	if (s->rule->operator == ABSENCE)
+		ruleng_json_absence_fire(s);
+	else if (s->rule->operator != COUNT)
+		ruleng_json_state_expire(s, now);
+}
+
+/* wait for the window of 's' again, after it changed rules */
+static void ruleng_json_state_rearm(struct ruleng_json_state *s, uint64_t now)
+{
+	uint64_t deadline = s->hit_ms[0] + ruleng_json_rule_window(s->rule) + 1;
+
+	if (ruleng_json_state_idle(s))
+		return;
+
+	if (s->rule->operator == ABSENCE)
+		ruleng_timer_set(&s->expire, deadline > now ? deadline - now : 0);
+	else if (s->rule->operator == COUNT)
+		ruleng_json_count_arm(s, now);
+	else
+		ruleng_json_state_expire(s, now);
+}
+
+void ruleng_json_rule_reset(struct ruleng_json_rule *r)
+{
+	struct ruleng_json_state *s = NULL, *tmp = NULL;
+
+	ruleng_json_state_reset(&r->state);
+
+	list_for_each_entry_safe(s, tmp, &r->lru, lru)
+		ruleng_json_state_free(s);
+}
+
+/* a condition of an AND rule matched, whether all of them did within the window */
+static bool ruleng_json_and_step(struct ruleng_json_state *s, int idx, uint64_t now)
+{
+	struct ruleng_json_rule *r = s->rule;
+
+	// only the last match of each condition counts, the timer waits
+	// for the oldest one and catches up with the newer ones on expiry
+	s->hit_ms[idx] = now;
+	if (ruleng_bitset_test_clear(s->rules_hit, idx) &&
+		--s->n_left == r->n_conds - 1)
+		ruleng_timer_set(&s->expire, ruleng_json_rule_window(r) + 1);
+
+	return s->n_left == 0;
+}
+
+/*
+ * A step of a SEQUENCE rule matched, whether it completed the sequence
+ * within the window. The steps make a linear NFA: a run in state j matched
+ * steps 0..j-1 and waits for step j. Bit j of rules_hit is clear while a
+ * run in state j + 1 is live, hit_ms[j] telling when its first step came.
+ * Of two runs in a state only the later started one counts, it is the
+ * last to expire, so a key takes one slot per step however many runs.
+ */
+static bool ruleng_json_seq_step(struct ruleng_json_state *s, int idx, uint64_t now)
+{
+	struct ruleng_json_rule *r = s->rule;
+	uint64_t start = now;
+
+	if (idx > 0) {
+		// no run waits for this step
+		if (ruleng_bitset_test(s->rules_hit, idx - 1))
+			return false;
+
+		// the run moves on
+		start = s->hit_ms[idx - 1];
+		ruleng_bitset_set(s->rules_hit, idx - 1);
+		++s->n_left;
+	}
+
+	if (idx == r->n_conds - 1)
+		return true;
+
+	if (ruleng_bitset_test_clear(s->rules_hit, idx)) {
+		s->hit_ms[idx] = start;
+		--s->n_left;
+	} else if (start > s->hit_ms[idx]) {
+		s->hit_ms[idx] = start;
+	}
+
+	// a pending timer waits for an older run
+	if (!s->expire.pending)
+		ruleng_timer_set(&s->expire, start + ruleng_json_rule_window(r) - now + 1);
+
+	return false;
+}
+
+/* a condition of a COUNT rule matched, whether it did if_count times within the window */
+static bool ruleng_json_count_step(struct ruleng_json_state *s, uint64_t now)
+{
+	ruleng_json_count_advance(s, now);
+	++s->buckets[s->bucket % JSON_COUNT_BUCKETS];
+	++s->count;
+
+	// a pending timer waits for an older bucket
+	if (!s->expire.pending)
+		ruleng_json_count_arm(s, now);
+
+	return s->count >= (uint32_t) s->rule->threshold;
+}
+
+/*
+ * A condition of an ABSENCE rule matched. The first one arms the rule, again
+ * if it was, to run its actions once the window passed; any other disarms it.
+ */
+static void ruleng_json_absence_step(
+  struct ruleng_json_state *s,
+  int idx,
+  struct ubus_context *ubus_ctx,
+  struct blob_attr *msg,
+  uint64_t now
+) {
+	struct blob_attr *m = NULL;
+
+	if (idx > 0) {
+		// what was waited for came
+		ruleng_json_state_reset(s);
+		return;
+	}
+
+	// the actions get the event which armed the rule
+	m = ruleng_arena_promote(msg, blob_raw_len(msg));
+
+	if (m == NULL) {
+		RULENG_ERR("%s: failed to allocate the event", s->rule->name);
+		return;
+	}
+
+	free(s->msg);
+	s->msg = m;
+	s->ubus_ctx = ubus_ctx;
+
+	if (ruleng_bitset_test_clear(s->rules_hit, 0))
+		--s->n_left;
+
+	s->hit_ms[0] = now;
+	ruleng_timer_set(&s->expire, ruleng_json_rule_window(s->rule) + 1);
+}
+
+/* process one condition of a rule matched by event name */
+static void ruleng_json_cond_process(
+  struct ubus_context *ubus_ctx,
+  struct ruleng_json_cond *c,
+  const char *type,
+  struct blob_attr *msg,
+  uint64_t now
+) {
+	struct ruleng_json_rule *r = c->rule;
+	struct ruleng_json_state *s = &r->state;
+
+	RULENG_INFO("Event match |%s:%s|", c->event, type);
+
+	bool match = true;
+
+	if (c->match) {
+		RULENG_INFO("event data regex: %d\n", c->regex);
+		match = ruleng_bus_take_action(c->match, msg, c->regex);
+	}
+
+	if (true == match && r->operator != OR) {
+		bool done = false;
+
+		++r->hits;
+
+		if (r->key) {
+			char buf[32];
+			const char *key = ruleng_json_rule_key(r, msg, buf, sizeof(buf));
+
+			if (key == NULL) {
+				RULENG_INFO("no key [%s] in the event", r->key);
+				return;
+			}
+
+			// only the first condition arms an ABSENCE rule or starts a
+			// SEQUENCE run, the others must not make a key, let alone
+			// push out one in use
+			if ((r->operator == ABSENCE || r->operator == SEQUENCE) && c->idx > 0)
+				s = ruleng_json_state_find(r, key);
+			else
+				s = ruleng_json_state_get(r, key);
+
+			if (s == NULL)
+				return;
+		}
+
+		// matches out of the window go first, their timer may not have run yet
+		ruleng_json_state_catch_up(s, now);
+
+		if (r->operator == AND)
+			done = ruleng_json_and_step(s, c->idx, now);
+		else if (r->operator == SEQUENCE)
+			done = ruleng_json_seq_step(s, c->idx, now);
+		else if (r->operator == COUNT)
+			done = ruleng_json_count_step(s, now);
+		else
+			ruleng_json_absence_step(s, c->idx, ubus_ctx, msg, now);
+
+		if (done) {
+			ruleng_json_state_drop(s);
+			RULENG_INFO("All rules matched within time [%s]", c->event);
+			ruleng_take_json_action(ubus_ctx, r, msg, 0);
+		} else if (ruleng_json_state_idle(s)) {
+			// a step no run waited for, the key was made for nothing
+			ruleng_json_state_drop(s);
+		}
+	} else if (match == true) {
+		ruleng_json_rule_reset(r);
+		RULENG_INFO("One rule matched [%s]", c->event);
+		ruleng_take_json_action(ubus_ctx, r, msg, 0);
+	}
+}
+
+/* a condition an event matched, in the order it was found */
+struct ruleng_json_match {
+	struct ruleng_json_cond *cond;
+	int pos;
+};
+
+static int ruleng_json_match_cmp(const void *a, const void *b)
+{
+	const struct ruleng_json_match *x = a, *y = b;
+
+	if (x->cond->idx != y->cond->idx)
+		return y->cond->idx - x->cond->idx;
+
+	return x->pos - y->pos;
+}
+
+void ruleng_json_event_dispatch(
+  struct ubus_context *ubus_ctx,
+  struct ruleng_bus_event **evs,
+  int n_evs,
+  const char *type,
   struct blob_attr *msg
 ) {
-	int len = json_object_array_length(r->action.args);
+	uint64_t now = ruleng_clock_now_ms();
+	struct ruleng_json_match *matches = NULL;
+	struct ruleng_json_cond *c = NULL;
+	int n = 0;
+
+	// each list runs the conditions of a rule last first, so that an event
+	// takes a SEQUENCE run one step; across lists they are sorted that way
+	if (n_evs > 1) {
+		for (int i = 0; i < n_evs; i++)
+			list_for_each_entry(c, &evs[i]->json_conds, list)
+				++n;
+
+		matches = ruleng_arena_alloc(n * sizeof(*matches));
+	}
+
+	if (matches == NULL) {
+		if (n_evs > 1)
+			RULENG_ERR("%s: failed to order the conditions", type);
+
+		for (int i = 0; i < n_evs; i++) {
+			list_for_each_entry(c, &evs[i]->json_conds, list) {
+				ruleng_log_set_rule(c->rule->id);
+				ruleng_json_cond_process(ubus_ctx, c, type, msg, now);
+			}
+		}
+
+		goto exit;
+	}
+
+	n = 0;
+	for (int i = 0; i < n_evs; i++) {
+		list_for_each_entry(c, &evs[i]->json_conds, list) {
+			matches[n].cond = c;
+			matches[n].pos = n;
+			++n;
+		}
+	}
+
+	qsort(matches, n, sizeof(*matches), ruleng_json_match_cmp);
+
+	for (int i = 0; i < n; i++) {
+		ruleng_log_set_rule(matches[i].cond->rule->id);
+		ruleng_json_cond_process(ubus_ctx, matches[i].cond, type, msg, now);
+	}
+
+exit:
+	ruleng_log_set_rule(0);
+}
+
+void ruleng_event_json_cb(
+  struct ubus_context *ubus_ctx,
+  struct ubus_event_handler *handler,
+  const char *type,
+  struct blob_attr *msg
+) {
+	ruleng_log_event_begin();
+
+	if (ruleng_log_enabled(LOG_INFO)) {
+		char *data = blobmsg_format_json(msg, true);
+		RULENG_INFO("json_cb { '%s': %s }", type, data);
+		free(data);
+	}
+
+	struct ruleng_bus_ctx *ctx =
+		container_of(handler, struct ruleng_bus_ctx, json_handler);
+
+	ruleng_bus_dispatch(ctx, ubus_ctx, type, msg, RULENG_BUS_DISPATCH_JSON);
+}
+
+static bool ruleng_json_rule_equal(
+  struct ruleng_json_rule *a,
+  struct ruleng_json_rule *b
+) {
+	// the compiled rule holds the name besides the recipe entry
+	return a->source == b->source && blob_attr_equal(a->data, b->data);
+}
+
+static int ruleng_json_carry_cmp(const void *k1, const void *k2, void *ptr)
+{
+	const struct ruleng_json_rule *a = k1, *b = k2;
+
+	(void) ptr;
+
+	// sources are interned, only their order has to be stable
+	if (a->source != b->source)
+		return (uintptr_t) a->source < (uintptr_t) b->source ? -1 : 1;
+
+	return strcmp(a->name, b->name);
+}
+
+/* unchanged rule, keep its AND-window, sequence progress or counts */
+static void ruleng_json_rule_carry(
+  struct ruleng_json_rule *o,
+  struct ruleng_json_rule *r
+) {
+	struct ruleng_json_run *run = NULL;
+	struct ruleng_json_state *s = NULL;
+
+	r->id = o->id;
+	memcpy(r->state.rules_hit, o->state.rules_hit,
+		   RULENG_BITSET_WORDS(r->n_conds) * sizeof(*r->state.rules_hit));
+	memcpy(r->state.hit_ms, o->state.hit_ms,
+		   r->n_conds * sizeof(*r->state.hit_ms));
+	r->state.n_left = ruleng_bitset_count(r->state.rules_hit, r->n_conds);
+	r->state.ubus_ctx = o->state.ubus_ctx;
+	r->state.msg = o->state.msg;
+	o->state.msg = NULL;
+
+	if (r->state.buckets) {
+		memcpy(r->state.buckets, o->state.buckets,
+			   JSON_COUNT_BUCKETS * sizeof(*r->state.buckets));
+		r->state.count = o->state.count;
+		r->state.bucket = o->state.bucket;
+	}
+
+	r->hits = o->hits;
+	r->evicted = o->evicted;
+	r->disabled = o->disabled;
+
+	// the keys move over, their timers keep running
+	list_for_each_entry(s, &o->lru, lru) {
+		avl_delete(&o->keys, &s->avl);
+		avl_insert(&r->keys, &s->avl);
+		s->rule = r;
+	}
+	list_splice_init(&o->lru, &r->lru);
+
+	// same actions, the pending ones carry on
+	list_splice_init(&o->runs, &r->runs);
+	list_for_each_entry(run, &r->runs, list)
+		run->rule = r;
+
+	ruleng_json_state_rearm(&r->state, ruleng_clock_now_ms());
+}
+
+void ruleng_json_rules_carry_state(
+  struct list_head *old,
+  struct list_head *rules
+) {
+	struct ruleng_json_rule *r = NULL, *o = NULL;
+	struct avl_node *nodes = NULL, *node = NULL;
+	struct avl_tree index;
+	int n = 0;
+
+	list_for_each_entry(o, old, list)
+		++n;
+
+	nodes = calloc(n ? n : 1, sizeof(*nodes));
+
+	if (nodes == NULL) {
+		RULENG_ERR("Failed to index the running rules, their state is dropped");
+		return;
+	}
+
+	// a rule is only compared with the old one of its recipe and name
+	avl_init(&index, ruleng_json_carry_cmp, false, NULL);
+	n = 0;
+
+	list_for_each_entry(o, old, list) {
+		nodes[n].key = o;
+		avl_insert(&index, &nodes[n++]);
+	}
+
+	list_for_each_entry(r, rules, list) {
+		node = avl_find(&index, r);
+
+		if (node == NULL)
+			continue;
+
+		o = (struct ruleng_json_rule *) node->key;
+
+		if (ruleng_json_rule_equal(o, r))
+			ruleng_json_rule_carry(o, r);
+	}
+
+	free(nodes);
+}
+
+void ruleng_json_rule_free(struct ruleng_json_rule *rule)
+{
+	struct ruleng_json_run *run = NULL, *tmp = NULL;
+
+	list_for_each_entry_safe(run, tmp, &rule->runs, list)
+		ruleng_json_run_free(run);
+
+	ruleng_json_rule_reset(rule);
+
+	if (rule->map)
+		ruleng_cache_map_put(rule->map);
+	else
+		free(rule->data);
+
+	ruleng_strpool_put(rule->event.name);
+	ruleng_strpool_put(rule->source);
+	free(rule);
+}
+
+size_t ruleng_json_rule_size(const struct ruleng_json_rule *rule)
+{
+	size_t size = sizeof(*rule) + rule->n_conds * sizeof(*rule->conds) +
+		ruleng_json_state_size(rule, NULL);
+	struct ruleng_json_state *s = NULL;
+
+	size += rule->state.msg ? blob_raw_len(rule->state.msg) : 0;
+
+	list_for_each_entry(s, &rule->lru, lru)
+		size += ruleng_json_state_size(rule, s->avl.key) +
+			(s->msg ? blob_raw_len(s->msg) : 0);
+
+	return size + (rule->map ? 0 : blob_pad_len(rule->data));
+}
+
+/* the events of 'r' joined by JSON_EVENT_SEP, interned */
+static const char *ruleng_json_rule_event_name(const struct ruleng_json_rule *r)
+{
+	char buf[256];
+	char *name = buf;
+	const char *pooled = NULL;
+	size_t len = 1, off = 0;
+
+	for (int i = 0; i < r->n_conds; i++)
+		len += strlen(r->conds[i].event ? r->conds[i].event : "") + strlen(JSON_EVENT_SEP);
+
+	// long recipes only take the heap
+	if (len > sizeof(buf) && (name = malloc(len)) == NULL)
+		return NULL;
+
+	name[0] = '\0';
+
+	for (int i = 0; i < r->n_conds; i++)
+		off += (size_t) sprintf(name + off, "%s%s",
+								r->conds[i].event ? r->conds[i].event : "", JSON_EVENT_SEP);
+
+	pooled = ruleng_strpool_get(name);
+
+	if (name != buf)
+		free(name);
+
+	return pooled;
+}
+
+enum ruleng_bus_rc ruleng_json_rule_load(
+  struct blob_attr *data,
+  const char *source,
+  struct ruleng_json_rule **rule
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct blob_attr *tb[__RECIPE_MAX];
+	struct blob_attr *cur = NULL;
+	struct ruleng_json_rule *r = NULL;
+	struct ruleng_json_cond *conds = NULL;
+	uint64_t *rules_hit = NULL, *hit_ms = NULL;
+	uint32_t *buckets = NULL;
+	enum Operators op = OR;
+	int rem = 0, len = 0, i = 0;
 
-	for(int i=0; i<len; ++i) {
-		json_object *temp = json_object_array_get_idx(r->action.args, i);
-		struct ruleng_rule *rr = malloc(sizeof(struct ruleng_rule));
-		json_object_object_get_ex(temp, JSON_ARGS_FIELD, &rr->action.args);
-		json_object_object_get_ex(temp, JSON_ENVS_FIELD, &rr->action.envs);
+	blobmsg_parse(recipe_policy, __RECIPE_MAX, tb,
+				  blobmsg_data(data), blobmsg_data_len(data));
 
-		rr->action.timeout = get_json_int_object(temp, JSON_TIMEOUT_FIELD);
+	if (!tb[RECIPE_IF]) {
+		RULENG_ERR("Invalid JSON recipe at 'if' key!\n");
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
 
-		// if there's no "object" field, we check for a "cli" field
-		// otherwise we continue with the "method" field
-		rr->action.object = get_json_string_object(temp, JSON_OBJECT_FIELD);
+	if (!tb[RECIPE_THEN]) {
+		RULENG_ERR("Invalid JSON recipe at 'then' key!\n");
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
 
-		if (!rr->action.object) {
-			rr->action.object = get_json_string_object(temp, JSON_CLI_FIELD);
+	if (!tb[RECIPE_NAME]) {
+		RULENG_ERR("compiled rule lacks its name");
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
 
-			if (!rr->action.object) {
-				free(rr);
-				continue;
-			}
+	if (tb[RECIPE_KEY] && !strstr(blobmsg_get_string(tb[RECIPE_KEY]), "->")) {
+		RULENG_ERR("Invalid JSON recipe at '%s' key!\n", JSON_KEY_FIELD);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
 
-			RULENG_INFO("calling [%s]", rr->action.object);
-			ruleng_cli_call(u_ctx, rr, msg);
-		} else {
-			rr->action.name = get_json_string_object(temp, JSON_METHOD_FIELD);
+	// anything else stands for OR
+	for (size_t n = 0; tb[RECIPE_IF_OPERATOR] && n < ARRAY_SIZE(operator_names); n++) {
+		if (!strcmp(blobmsg_get_string(tb[RECIPE_IF_OPERATOR]), operator_names[n]))
+			op = (enum Operators) n;
+	}
 
-			if (!rr->action.name) {
-				free(rr);
-				continue;
-			}
-			
-			RULENG_INFO("calling[%s->%s]", rr->action.object, rr->action.name);
-			ruleng_ubus_call(u_ctx, rr, msg);
+	// these wait for the period to pass
+	if ((op == ABSENCE || op == COUNT) &&
+		(!tb[RECIPE_TOTAL_WAIT] || (int) blobmsg_get_u32(tb[RECIPE_TOTAL_WAIT]) < 1)) {
+		RULENG_ERR("Invalid JSON recipe at '%s' key!\n", JSON_TOTAL_WAIT_FIELD);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
+
+	if (op == COUNT && (!tb[RECIPE_COUNT] || (int) blobmsg_get_u32(tb[RECIPE_COUNT]) < 1)) {
+		RULENG_ERR("Invalid JSON recipe at '%s' key!\n", JSON_COUNT_FIELD);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
+
+	if (tb[RECIPE_KEY_MAX] && (int) blobmsg_get_u32(tb[RECIPE_KEY_MAX]) < 1) {
+		RULENG_ERR("Invalid JSON recipe at '%s' key!\n", JSON_KEY_MAX_FIELD);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
+
+	blobmsg_for_each_attr(cur, tb[RECIPE_IF], rem)
+		++len;
+
+	// the conditions and the partial match state are allocated along with the rule
+	r = calloc_a(sizeof(*r), &conds, len * sizeof(*conds),
+				 &rules_hit, RULENG_BITSET_WORDS(len) * sizeof(*rules_hit),
+				 &hit_ms, len * sizeof(*hit_ms),
+				 &buckets, ruleng_json_state_buckets(op) * sizeof(*buckets));
+
+	if (r == NULL) {
+		RULENG_ERR("Failed to allocate rule");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto exit;
+	}
+
+	r->data = data;
+	r->name = blobmsg_get_string(tb[RECIPE_NAME]);
+	r->conds = conds;
+	r->n_conds = len;
+	r->action.args = tb[RECIPE_THEN];
+
+	if (tb[RECIPE_TOTAL_WAIT])
+		r->time.total_wait = (int) blobmsg_get_u32(tb[RECIPE_TOTAL_WAIT]);
+
+	if (tb[RECIPE_SLEEP])
+		r->time.sleep_time = (int) blobmsg_get_u32(tb[RECIPE_SLEEP]);
+
+	r->operator = op;
+
+	if (tb[RECIPE_COUNT])
+		r->threshold = (int) blobmsg_get_u32(tb[RECIPE_COUNT]);
+
+	if (tb[RECIPE_REGEX]) {
+		r->regex = blobmsg_get_bool(tb[RECIPE_REGEX]);
+		RULENG_INFO("Regex set to %d\n", r->regex);
+	}
+
+	r->key = tb[RECIPE_KEY] ? blobmsg_get_string(tb[RECIPE_KEY]) : NULL;
+	r->keys_max = tb[RECIPE_KEY_MAX] ? (int) blobmsg_get_u32(tb[RECIPE_KEY_MAX]) : JSON_KEYS_MAX;
+	avl_init(&r->keys, avl_strcmp, false, NULL);
+	INIT_LIST_HEAD(&r->lru);
+
+	blobmsg_for_each_attr(cur, tb[RECIPE_IF], rem) {
+		struct ruleng_json_cond *c = &r->conds[i];
+		struct blob_attr *ctb[__COND_MAX] = {0};
+
+		if (blobmsg_type(cur) == BLOBMSG_TYPE_TABLE)
+			blobmsg_parse(cond_policy, __COND_MAX, ctb,
+						  blobmsg_data(cur), blobmsg_data_len(cur));
+
+		c->rule = r;
+		c->idx = i++;
+		c->event = ctb[COND_EVENT] ? blobmsg_get_string(ctb[COND_EVENT]) : NULL;
+		c->match = ctb[COND_MATCH];
+		c->regex = ctb[COND_REGEX] ? blobmsg_get_bool(ctb[COND_REGEX]) : false;
+	}
+
+	ruleng_json_state_init(&r->state, r, rules_hit, hit_ms, buckets);
+	INIT_LIST_HEAD(&r->runs);
+	r->event.name = ruleng_json_rule_event_name(r);
+	r->source = ruleng_strpool_get(source);
+
+	if (r->event.name == NULL || r->source == NULL) {
+		RULENG_ERR("Failed to allocate rule");
+		ruleng_strpool_put(r->event.name);
+		ruleng_strpool_put(r->source);
+		free(r);
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto exit;
+	}
+
+	*rule = r;
+exit:
+	return rc;
+}
+
+enum ruleng_bus_rc ruleng_json_rule_parse(
+  const char *name,
+  struct blob_attr *val,
+  const char *source,
+  struct ruleng_json_rule **rule
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct blob_attr *cur = NULL, *data = NULL;
+	struct blob_buf b = {0};
+	int rem = 0;
+
+	if (blobmsg_type(val) != BLOBMSG_TYPE_TABLE) {
+		RULENG_ERR("Invalid JSON recipe at '%s'!\n", name);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto exit;
+	}
+
+	blob_buf_init(&b, 0);
+
+	void *t = blobmsg_open_table(&b, "");
+	blobmsg_add_string(&b, JSON_NAME_FIELD, name);
+
+	blobmsg_for_each_attr(cur, val, rem) {
+		if (!strcmp(blobmsg_name(cur), JSON_NAME_FIELD))
+			continue;
+
+		blobmsg_add_blob(&b, cur);
+	}
+
+	blobmsg_close_table(&b, t);
+	data = blob_memdup(blob_data(b.head));
+
+	if (data == NULL) {
+		RULENG_ERR("Failed to allocate rule");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto cleanup_buf;
+	}
+
+	rc = ruleng_json_rule_load(data, source, rule);
+
+	if (rc != RULENG_BUS_OK)
+		free(data);
+
+cleanup_buf:
+	blob_buf_free(&b);
+exit:
+	return rc;
+}
+
+/* state of the scanner walking the top level object of a recipe file */
+enum ruleng_json_stream_state {
+	JSON_STREAM_OPEN,
+	JSON_STREAM_KEY,
+	JSON_STREAM_NAME,
+	JSON_STREAM_COLON,
+	JSON_STREAM_VALUE,
+	JSON_STREAM_NEXT,
+	JSON_STREAM_DONE,
+};
+
+/* a top level member of a recipe file, by name */
+struct ruleng_json_member {
+	struct avl_node avl;
+	/* in the order the names first appear in the file */
+	struct list_head list;
+	/* the rule of the last value given for the name, NULL if it is not one */
+	struct ruleng_json_rule *rule;
+};
+
+/*
+ * Recipe files are read in chunks. Only the value of the member being
+ * parsed is held as a json-c tree, it is lowered into a compiled rule and
+ * released before the next member is read.
+ */
+struct ruleng_json_stream {
+	enum ruleng_json_stream_state state;
+	json_tokener *tok;
+	const char *source;
+	/* the name being read, quoted and escaped as in the file */
+	char *key;
+	size_t key_len;
+	size_t key_size;
+	bool escape;
+	/* a name given twice keeps its place and takes the later value, as in json-c */
+	struct avl_tree members;
+	struct list_head order;
+	struct ruleng_json_member *member;
+};
+
+static enum ruleng_bus_rc ruleng_json_stream_key_add(
+  struct ruleng_json_stream *s,
+  char c
+) {
+	if (s->key_len == s->key_size) {
+		size_t size = s->key_size ? s->key_size * 2 : JSON_NAME_SIZE;
+		char *key = realloc(s->key, size);
+
+		if (key == NULL) {
+			RULENG_ERR("Failed to allocate rule name");
+			return RULENG_BUS_ERR_ALLOC;
 		}
 
-		if (i < len-1) {
-			RULENG_INFO("sleeping for [%d]", r->time.sleep_time);
-			sleep(r->time.sleep_time);
+		s->key = key;
+		s->key_size = size;
+	}
+
+	s->key[s->key_len++] = c;
+	return RULENG_BUS_OK;
+}
+
+/* decode the name just read and look up the member it refers to */
+static enum ruleng_bus_rc ruleng_json_stream_key_end(struct ruleng_json_stream *s)
+{
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_json_member *m = NULL;
+	const char *name = NULL;
+	json_object *key = NULL;
+	char *m_name = NULL;
+
+	rc = ruleng_json_stream_key_add(s, '"');
+
+	if (rc != RULENG_BUS_OK)
+		goto exit;
+
+	// json-c decodes the escapes, the name is the same as a tree would have
+	key = json_tokener_parse_ex(s->tok, s->key, (int) s->key_len);
+	json_tokener_reset(s->tok);
+
+	if (!json_object_is_type(key, json_type_string)) {
+		RULENG_ERR("%s: invalid rule name", s->source);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto cleanup_key;
+	}
+
+	name = json_object_get_string(key);
+	m = avl_find_element(&s->members, name, m, avl);
+
+	if (m == NULL) {
+		m = calloc_a(sizeof(*m), &m_name, strlen(name) + 1);
+
+		if (m == NULL) {
+			RULENG_ERR("Failed to allocate rule name");
+			rc = RULENG_BUS_ERR_ALLOC;
+			goto cleanup_key;
 		}
-		free(rr);
+
+		m->avl.key = strcpy(m_name, name);
+		avl_insert(&s->members, &m->avl);
+		list_add_tail(&m->list, &s->order);
 	}
+
+	s->member = m;
+
+cleanup_key:
+	json_object_put(key);
+exit:
+	return rc;
 }
 
-void ruleng_event_json_cb(
-  struct ubus_context *ubus_ctx,
-  struct ubus_event_handler *handler,
-  const char *type,
-  struct blob_attr *msg
+static enum ruleng_bus_rc ruleng_json_stream_member(
+  struct ruleng_json_stream *s,
+  json_object *val
 ) {
-	time_t now = time(NULL);
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_json_member *m = s->member;
+	struct ruleng_json_rule *rule = NULL;
+	struct blob_buf b = {0};
 
-	char *data = blobmsg_format_json(msg, true);
-	RULENG_INFO("json_cb { '%s': %s }\n", type, data);
-	free(data);
+	blob_buf_init(&b, 0);
 
-	struct ruleng_bus_ctx *ctx =
-		container_of(handler, struct ruleng_bus_ctx, json_handler);
-	struct ruleng_json_rule *r = NULL;
+	if (m->rule) {
+		ruleng_json_rule_free(m->rule);
+		m->rule = NULL;
+	}
 
-	list_for_each_entry(r, &ctx->json_rules, list) {
-		RULENG_INFO("Process event [%s]", r->event.name);
-		char *event_titles = strdup(r->event.name);
-		char *orig = event_titles;
-		char *event = NULL;
+	if (!blobmsg_add_json_element(&b, "", val) || blob_len(b.head) == 0)
+		goto exit;
 
-		for(int i=0; (event = strsep(&event_titles, JSON_EVENT_SEP)); ++i) {
-			if (strcmp(event, type) != 0)
-				continue;
+	rc = ruleng_json_rule_parse(m->avl.key, blob_data(b.head), s->source, &rule);
+
+	if (rc == RULENG_BUS_ERR_RULE_INVALID) {
+		rc = RULENG_BUS_OK;
+		goto exit;
+	}
 
-			RULENG_INFO("Event match |%s:%s|", event, type);
+	if (rc != RULENG_BUS_OK)
+		goto exit;
+
+	m->rule = rule;
+
+exit:
+	blob_buf_free(&b);
+	return rc;
+}
 
-			bool event_data_regex = false;
-			json_object *jobj = json_object_array_get_idx(r->event.args, i);
-			json_object *args;
+/* feed the next chunk of the file, fails with RULENG_BUS_ERR_RULE_INVALID on malformed input */
+static enum ruleng_bus_rc ruleng_json_stream_feed(
+  struct ruleng_json_stream *s,
+  const char *buf,
+  size_t len
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	const char *p = buf, *end = buf + len;
 
-			if (json_object_object_get_ex(jobj, JSON_REGEX_FIELD, &args)) {
-				event_data_regex = json_object_get_boolean(args);
-				RULENG_INFO("event data regex: %d\n", event_data_regex);
+	while (p < end && rc == RULENG_BUS_OK) {
+		if (s->state == JSON_STREAM_NAME) {
+			if (s->escape) {
+				s->escape = false;
+			} else if (*p == '\\') {
+				s->escape = true;
+			} else if (*p == '"') {
+				rc = ruleng_json_stream_key_end(s);
+				s->state = JSON_STREAM_COLON;
+				p++;
+				continue;
 			}
 
-			bool match = true;
-			struct blob_buf eargs = {0};
-			blob_buf_init(&eargs, 0);
+			rc = ruleng_json_stream_key_add(s, *p++);
+			continue;
+		}
+
+		if (s->state == JSON_STREAM_VALUE) {
+			json_object *val = json_tokener_parse_ex(s->tok, p, end - p);
+			enum json_tokener_error err = json_tokener_get_error(s->tok);
 
-			json_object_object_get_ex(jobj, JSON_MATCH_FIELD, &args);
-			if (args) {
-				blobmsg_add_object(&eargs, args);
-				match = ruleng_bus_take_action(eargs.head, msg, event_data_regex);
+			if (err == json_tokener_continue)
+				break;
+
+			if (err != json_tokener_success) {
+				RULENG_ERR("%s: '%s': %s", s->source, (const char *) s->member->avl.key,
+						   json_tokener_error_desc(err));
+				return RULENG_BUS_ERR_RULE_INVALID;
 			}
 
-			if (true == match && r->operator == AND) {
-				++r->hits;
-
-				if (r->last_hit_time == 0)
-					r->last_hit_time = now;
-				
-				r->time_wasted += (now - r->last_hit_time);
-				r->last_hit_time = now;
-
-				if (r->time_wasted > r->time.total_wait) {
-					r->time_wasted = 0;
-					r->last_hit_time = now;
-					r->rules_hit = r->rules_bitmask;
-					B_UNSET(r->rules_hit, i);
-					blob_buf_free(&eargs);
-					break;
-				}
-
-				B_UNSET(r->rules_hit, i);
-
-				if (r->rules_hit == 0) {
-					// Clear couters and take action
-					r->time_wasted = 0;
-					r->last_hit_time = 0;
-					r->rules_hit = r->rules_bitmask;
-					RULENG_INFO("All rules matched within time [%s]", event);
-					ruleng_take_json_action(ubus_ctx, r, msg);
-				}
-			} else if (match == true) {
-				// Clear couters and take action
-				r->time_wasted = 0;
-				r->last_hit_time = 0;
-				r->rules_hit = r->rules_bitmask;
-				RULENG_INFO("One rule matched [%s]", event);
-				ruleng_take_json_action(ubus_ctx, r, msg);
+			p += json_tokener_get_parse_end(s->tok);
+			json_tokener_reset(s->tok);
+			rc = ruleng_json_stream_member(s, val);
+			json_object_put(val);
+			s->state = JSON_STREAM_NEXT;
+			continue;
+		}
+
+		if (isspace((unsigned char) *p)) {
+			p++;
+			continue;
+		}
+
+		switch (s->state) {
+		case JSON_STREAM_OPEN:
+			if (*p != '{')
+				goto invalid;
+
+			s->state = JSON_STREAM_KEY;
+			break;
+		case JSON_STREAM_KEY:
+			if (*p == '}') {
+				s->state = JSON_STREAM_DONE;
+				break;
 			}
 
-			blob_buf_free(&eargs);
+			if (*p != '"')
+				goto invalid;
+
+			s->key_len = 0;
+			rc = ruleng_json_stream_key_add(s, '"');
+			s->state = JSON_STREAM_NAME;
+			break;
+		case JSON_STREAM_COLON:
+			if (*p != ':')
+				goto invalid;
+
+			s->state = JSON_STREAM_VALUE;
+			break;
+		case JSON_STREAM_NEXT:
+			if (*p == '}')
+				s->state = JSON_STREAM_DONE;
+			else if (*p == ',')
+				s->state = JSON_STREAM_KEY;
+			else
+				goto invalid;
+
+			break;
+		default:
+			goto invalid;
 		}
 
-		free(orig);
+		p++;
 	}
+
+	return rc;
+
+invalid:
+	RULENG_ERR("%s: unexpected '%c' at top level", s->source, *p);
+	return RULENG_BUS_ERR_RULE_INVALID;
 }
 
-enum ruleng_bus_rc ruleng_process_json(
+/*
+ * Parse a recipe into 'rules'. The state of the file is recorded in 'file'
+ * if set, from the bytes the rules are parsed from.
+ */
+static enum ruleng_bus_rc ruleng_process_json_file(
+  struct list_head *rules,
+  const char *r_name,
+  struct ruleng_json_file *file
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_json_stream s = {
+		.state = JSON_STREAM_OPEN,
+		.source = r_name,
+	};
+	struct ruleng_json_member *m = NULL, *tmp = NULL;
+	char buf[JSON_READ_CHUNK];
+	struct stat st = {0};
+	size_t len = 0;
+	md5_ctx_t md5;
+	FILE *f = fopen(r_name, "r");
+
+	if (file)
+		file->size = -1;
+
+	if (f == NULL)
+		return rc;
+
+	avl_init(&s.members, avl_strcmp, false, NULL);
+	INIT_LIST_HEAD(&s.order);
+	s.tok = json_tokener_new();
+
+	if (s.tok == NULL) {
+		RULENG_ERR("Failed to allocate json tokener");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto cleanup_file;
+	}
+
+	// taken from the open file, a later rename over the path is not mistaken for it
+	if (file && fstat(fileno(f), &st) == 0) {
+		file->size = st.st_size;
+		file->ino = st.st_ino;
+		file->mtime = st.st_mtim;
+	}
+
+	md5_begin(&md5);
+
+	// a malformed recipe is still read to the end, its digest covers the whole file
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+		if (file)
+			md5_hash(buf, len, &md5);
+
+		if (rc == RULENG_BUS_OK)
+			rc = ruleng_json_stream_feed(&s, buf, len);
+		else if (file == NULL)
+			break;
+	}
+
+	if (file)
+		md5_end(file->digest, &md5);
+
+	if (rc == RULENG_BUS_OK && s.state != JSON_STREAM_DONE) {
+		RULENG_ERR("%s: unexpected end of file", r_name);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+	}
+
+	list_for_each_entry_safe(m, tmp, &s.order, list) {
+		if (m->rule && rc == RULENG_BUS_OK)
+			list_add(&m->rule->list, rules);
+		else if (m->rule)
+			ruleng_json_rule_free(m->rule);
+
+		free(m);
+	}
+
+	// a malformed recipe is skipped as a whole
+	if (rc == RULENG_BUS_ERR_RULE_INVALID)
+		rc = RULENG_BUS_OK;
+
+	json_tokener_free(s.tok);
+	free(s.key);
+cleanup_file:
+	fclose(f);
+	return rc;
+}
+
+/* a recipe file to parse, the rules end up in the order sequential parsing would produce */
+struct ruleng_json_job {
+	const char *path;
+	/* where the file state is recorded, NULL if it is not tracked */
+	struct ruleng_json_file *file;
+	struct list_head rules;
+	enum ruleng_bus_rc rc;
+};
+
+struct ruleng_json_pool {
+	struct ruleng_json_job *jobs;
+	int n_jobs;
+	atomic_int next;
+};
+
+static void *ruleng_json_worker(void *arg)
+{
+	struct ruleng_json_pool *pool = arg;
+	int i = 0;
+
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->n_jobs) {
+		struct ruleng_json_job *job = &pool->jobs[i];
+
+		job->rc = ruleng_process_json_file(&job->rules, job->path, job->file);
+	}
+
+	return NULL;
+}
+
+/*
+ * Parse the recipe files on up to one thread per core. Each file is parsed
+ * into its own list, and the lists are merged in 'jobs' order, so the rule
+ * set and rule ids do not depend on which thread finished first.
+ */
+static enum ruleng_bus_rc ruleng_json_jobs_run(
+  struct list_head *rules,
+  struct ruleng_json_job *jobs,
+  int n_jobs
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_json_pool pool = {
+		.jobs = jobs,
+		.n_jobs = n_jobs,
+	};
+	pthread_t threads[JSON_WORKERS_MAX - 1];
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int n_threads = 0, workers = n_jobs;
+
+	if (cores > 0 && workers > cores)
+		workers = cores;
+
+	if (workers > JSON_WORKERS_MAX)
+		workers = JSON_WORKERS_MAX;
+
+	atomic_init(&pool.next, 0);
+
+	for (; n_threads < workers - 1; n_threads++) {
+		if (pthread_create(&threads[n_threads], NULL, ruleng_json_worker, &pool)) {
+			RULENG_ERR("Failed to start recipe worker, continuing with %d", n_threads + 1);
+			break;
+		}
+	}
+
+	ruleng_json_worker(&pool);
+
+	for (int i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i = 0; i < n_jobs; i++) {
+		struct ruleng_json_rule *r = NULL;
+
+		if (rc == RULENG_BUS_OK)
+			rc = jobs[i].rc;
+
+		if (rc != RULENG_BUS_OK) {
+			ruleng_json_rules_free(&jobs[i].rules);
+			continue;
+		}
+
+		// rules of a file are listed last to first
+		list_for_each_entry_reverse(r, &jobs[i].rules, list) {
+			r->id = ruleng_rules_next_id();
+			RULENG_DEBUG("%s: loaded rule '%s' as id %u", jobs[i].path, r->name, r->id);
+		}
+
+		list_splice(&jobs[i].rules, rules);
+	}
+
+	return rc;
+}
+
+static bool ruleng_json_recipe_changed(
+  struct ruleng_json_recipe *recipe,
+  struct stat *st
+) {
+	return recipe->file.size != st->st_size ||
+		   recipe->file.ino != st->st_ino ||
+		   recipe->file.mtime.tv_sec != st->st_mtim.tv_sec ||
+		   recipe->file.mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+/* move the rules loaded from 'source' over from the running set */
+static void ruleng_json_rules_take(
+  struct list_head *rules,
+  struct list_head *old,
+  const char *source
+) {
+	struct ruleng_json_rule *r = NULL, *tmp = NULL;
+
+	list_for_each_entry_safe(r, tmp, old, list) {
+		if (r->source && strcmp(r->source, source) == 0)
+			list_move(&r->list, rules);
+	}
+}
+
+static struct ruleng_json_recipe *ruleng_json_recipe_get(
+  struct avl_tree *recipes,
+  const char *path
+) {
+	struct ruleng_json_recipe *recipe = NULL;
+	char *recipe_path = NULL;
+
+	recipe = avl_find_element(recipes, path, recipe, avl);
+
+	if (recipe)
+		return recipe;
+
+	recipe = calloc_a(sizeof(*recipe), &recipe_path, strlen(path) + 1);
+
+	if (recipe == NULL)
+		return NULL;
+
+	strcpy(recipe_path, path);
+	recipe->avl.key = recipe_path;
+	recipe->file.size = -1;
+	avl_insert(recipes, &recipe->avl);
+
+	return recipe;
+}
+
+enum ruleng_bus_rc ruleng_json_recipe_set(
+  struct avl_tree *recipes,
+  const char *path,
+  const struct ruleng_json_file *file
+) {
+	struct ruleng_json_recipe *recipe = ruleng_json_recipe_get(recipes, path);
+
+	if (recipe == NULL)
+		return RULENG_BUS_ERR_ALLOC;
+
+	recipe->used = true;
+	recipe->file = *file;
+
+	return RULENG_BUS_OK;
+}
+
+void ruleng_json_recipes_invalidate(struct avl_tree *recipes)
+{
+	struct ruleng_json_recipe *recipe = NULL;
+
+	avl_for_each_element(recipes, recipe, avl)
+		recipe->file.size = -1;
+}
+
+void ruleng_json_recipes_free(struct avl_tree *recipes)
+{
+	struct ruleng_json_recipe *recipe = NULL, *tmp = NULL;
+
+	avl_for_each_element_safe(recipes, recipe, avl, tmp) {
+		avl_delete(recipes, &recipe->avl);
+		free(recipe);
+	}
+}
+
+enum ruleng_bus_rc ruleng_process_json_update(
   struct ruleng_rules_ctx *ctx,
   struct list_head *rules,
-  char *package
+  struct list_head *old,
+  struct list_head *reused,
+  struct avl_tree *recipes,
+  char *package,
+  bool force
 ) {
 	enum ruleng_bus_rc rc = RULENG_BUS_OK;
 	struct uci_package *p = NULL;
 	struct uci_element *e = NULL;
 	struct uci_section *s = NULL;
+	struct ruleng_json_recipe *recipe = NULL, *tmp = NULL;
+	struct ruleng_json_job *jobs = NULL;
+	int n_jobs = 0;
 
 	// parse uci and initialize data
 	if (uci_load(ctx->uci_ctx, package, &p)) {
@@ -187,6 +1770,24 @@ enum ruleng_bus_rc ruleng_process_json(
 		return rc;
 	}
 
+	if (recipes) {
+		avl_for_each_element(recipes, recipe, avl)
+			recipe->used = false;
+	}
+
+	uci_foreach_element(&p->sections, e)
+		++n_jobs;
+
+	jobs = calloc(n_jobs ? n_jobs : 1, sizeof(*jobs));
+
+	if (jobs == NULL) {
+		RULENG_ERR("Failed to allocate recipe jobs");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto cleanup_package;
+	}
+
+	n_jobs = 0;
+
 	uci_foreach_element(&p->sections, e) {
 		s = uci_to_section(e);
 		const char *r_name = uci_lookup_option_string(ctx->uci_ctx, s, JSON_RECIPE_FIELD);
@@ -194,87 +1795,72 @@ enum ruleng_bus_rc ruleng_process_json(
 		if (!r_name)
 			continue;
 
-		json_object *root = json_object_from_file(r_name);
+		if (recipes) {
+			struct stat st = {0};
+			bool changed = true;
 
-		if (!root)
-			continue;
-		
-		json_object_object_foreach(root, key, val) {
-			(void)key;		// Prevent compiler "not used" warning
+			if (stat(r_name, &st) != 0)
+				st.st_size = -1;
 
-			struct ruleng_json_rule *rule = calloc(1, sizeof(struct ruleng_json_rule));
+			recipe = ruleng_json_recipe_get(recipes, r_name);
 
-			if (rule == NULL) {
+			if (recipe == NULL) {
 				rc = RULENG_BUS_ERR_ALLOC;
-				RULENG_ERR("Failed to allocate rule");
-				json_object_put(root);
-				return(rc);
+				RULENG_ERR("Failed to allocate recipe");
+				break;
 			}
 
-			struct json_object *tmp, *if_field, *then_field;
-
-			rule->time.total_wait = get_json_int_object(val, JSON_TOTAL_WAIT_FIELD);
-			rule->time.sleep_time = get_json_int_object(val, JSON_SLEEP_FIELD);
-
-			char if_operator[64] = {0};
-			snprintf(if_operator, sizeof(if_operator), "%s",
-					 get_json_string_object(val, JSON_IF_OPERATOR_FIELD));
+			if (recipe->used)
+				continue;
 
-			if (!strcmp(if_operator, "AND"))
-				rule->operator = AND;
-			else
-				rule->operator = OR;
+			if (!force && old && !ruleng_json_recipe_changed(recipe, &st))
+				changed = false;
 
-			json_object_object_get_ex(val, JSON_IF_FIELD, &if_field);
+			recipe->used = true;
 
-			if (!json_object_is_type(if_field, json_type_array)) {
-				RULENG_ERR("Invalid JSON recipe at 'if' key!\n");
-				free(rule);
+			// the recorded state of an unchanged recipe still holds
+			if (!changed) {
+				ruleng_json_rules_take(reused, old, r_name);
 				continue;
 			}
 
-			rule->event.args = if_field;
-
-			json_object_object_get_ex(val, JSON_REGEX_FIELD, &tmp);
-
-			if (tmp) {
-				rule->regex = json_object_get_boolean(tmp);
-				RULENG_INFO("Regex set to %d\n", rule->regex);
-			}
+			RULENG_INFO("%s: parsing recipe", r_name);
+			jobs[n_jobs].file = &recipe->file;
+		}
 
-			int len = json_object_array_length(rule->event.args);
-			char event_name[256] = {0};
+		jobs[n_jobs].path = r_name;
+		INIT_LIST_HEAD(&jobs[n_jobs].rules);
+		++n_jobs;
+	}
 
-			for(int i=0; i<len; ++i) {
-				B_SET(rule->rules_bitmask, i);
-				json_object *temp = json_object_array_get_idx(rule->event.args, i);
-				sprintf(event_name+strlen(event_name), "%s%s",
-						get_json_string_object(temp, JSON_EVENT_FIELD),
-						JSON_EVENT_SEP);
-			}
+	if (rc == RULENG_BUS_OK && n_jobs > 0)
+		rc = ruleng_json_jobs_run(rules, jobs, n_jobs);
 
-			rule->rules_hit = rule->rules_bitmask;
-			rule->event.name = strdup(event_name);
+	free(jobs);
 
-			json_object_object_get_ex(val, JSON_THEN_FIELD, &then_field);
+	// hand the rules taken over back, 'old' stays intact on failure
+	if (rc != RULENG_BUS_OK && old)
+		list_splice_init(reused, old);
 
-			if (!json_object_is_type(then_field, json_type_array)) {
-				RULENG_ERR("Invalid JSON recipe at 'then' key!\n");
-				free(rule->event.name);
-				free(rule);
+	if (recipes) {
+		avl_for_each_element_safe(recipes, recipe, avl, tmp) {
+			if (recipe->used)
 				continue;
-			}
-
-			rule->action.args = then_field;
 
-			list_add(&rule->list, rules);
-			json_object_get(rule->event.args);
-			json_object_get(rule->action.args);
+			avl_delete(recipes, &recipe->avl);
+			free(recipe);
 		}
-
-		json_object_put(root);
 	}
 
+cleanup_package:
 	uci_unload(ctx->uci_ctx, p);
 	return rc;
 }
+
+enum ruleng_bus_rc ruleng_process_json(
+  struct ruleng_rules_ctx *ctx,
+  struct list_head *rules,
+  char *package
+) {
+	return ruleng_process_json_update(ctx, rules, NULL, NULL, NULL, package, true);
+}
@@ -2,8 +2,12 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <sys/stat.h>
 #include <libubox/list.h>
+#include <libubox/avl.h>
+#include <libubox/blob.h>
 #include "ruleng_rules.h"
+#include "ruleng_timer.h"
 
 #define JSON_RECIPE_FIELD "recipe"
 #define JSON_IF_FIELD "if"
@@ -20,44 +24,133 @@
 #define JSON_TIMEOUT_FIELD "timeout"
 #define JSON_ARGS_FIELD "args"
 #define JSON_ENVS_FIELD "envs"
+#define JSON_KEY_FIELD "if_key"
+#define JSON_KEY_MAX_FIELD "if_key_max"
+#define JSON_COUNT_FIELD "if_count"
 #define JSON_EVENT_SEP "+"
 
-/* set n-th bit in x */
-#define B_SET(x, n)		((x) |= (1<<(n)))
-/* unset n-th bit in x */
-#define B_UNSET(x, n)	((x) &= ~(1<<(n)))
-/* Return number of set bits in a number */
-#define B_COUNT(x)		(__builtin_popcount(x))
-
 enum Operators {
 	AND,
-	OR
+	OR,
+	/* the conditions match in their order */
+	SEQUENCE,
+	/* the first condition is not followed by any other in time */
+	ABSENCE,
+	/* the conditions match if_count times in all within the window */
+	COUNT
+};
+
+struct ruleng_bus_event;
+struct ruleng_json_rule;
+
+/* one 'if' entry of a rule, linked into the dispatch index of its event */
+struct ruleng_json_cond {
+	struct list_head list;
+	struct ruleng_json_rule *rule;
+	struct ruleng_bus_event *ev;
+	const char *event;
+	/* event data to look for, NULL matches any */
+	struct blob_attr *match;
+	bool regex;
+	int idx;
+};
+
+/*
+ * Partial matches of an AND, SEQUENCE, ABSENCE or COUNT rule. Rules with a correlation key keep one per
+ * value of the key, created on its first match, the others a single one.
+ */
+struct ruleng_json_state {
+	/* in the keys of the rule, by key value */
+	struct avl_node avl;
+	/* in the lru list of the rule, the least recently matched first */
+	struct list_head lru;
+	struct ruleng_json_rule *rule;
+	/* conditions not matched within the window yet, a ruleng_bitset */
+	uint64_t *rules_hit;
+	/* bits set in rules_hit, the rule fires when none is left */
+	int n_left;
+	/* last match of each condition, ms of ruleng_clock */
+	uint64_t *hit_ms;
+	/* drops partial matches once they fall out of the window */
+	struct ruleng_timer expire;
+	/* event which armed an ABSENCE rule, for its actions */
+	struct blob_attr *msg;
+	struct ubus_context *ubus_ctx;
+	/* matches of a COUNT rule by bucket, a ring, NULL for the other rules */
+	uint32_t *buckets;
+	/* matches in the ring and the bucket the ring is at */
+	uint32_t count;
+	uint64_t bucket;
 };
 
 struct ruleng_json_rule {
 	struct list_head list;
+	uint32_t id;
+	const char *name;
+	/* recipe file the rule comes from, interned */
+	const char *source;
 	bool regex;
-	
+	bool disabled;
+	bool bound;
+	/* compiled rule the fields point into, see ruleng_json_rule_load() */
+	struct blob_attr *data;
+	/* rule cache 'data' is mapped from, NULL when it is owned */
+	struct ruleng_cache_map *map;
+
 	struct ruleng_rules_time {
 		int total_wait;
 		int sleep_time;
 	} time;
 
+	/* names of the awaited events joined by JSON_EVENT_SEP, interned */
 	struct ruleng_rules_if {
-		char *name;
-		struct json_object *args;
+		const char *name;
 	} event;
 
+	/* allocated along with the rule */
+	struct ruleng_json_cond *conds;
+	int n_conds;
+
 	struct ruleng_rules_then {
-		struct json_object *args;
+		struct blob_attr *args;
 	} action;
 
 	enum Operators operator;
-	uint8_t rules_bitmask;
-	uint8_t rules_hit;
-	uint8_t hits;
-	int time_wasted;
-	time_t last_hit_time;
+	/* matches a COUNT rule fires at */
+	int threshold;
+	uint32_t hits;
+	/* partial matches when there is no correlation key */
+	struct ruleng_json_state state;
+
+	/* "&event->..." value conditions are correlated by, NULL for none */
+	const char *key;
+	/* partial matches by key, at most 'keys_max' of them */
+	struct avl_tree keys;
+	struct list_head lru;
+	int keys_max;
+	/* keys dropped to make room for new ones */
+	uint32_t evicted;
+
+	/* actions waiting for then_exec_interval to pass, see ruleng_json_run */
+	struct list_head runs;
+};
+
+/* bytes of the MD5 digest files are recorded with */
+#define RULENG_JSON_DIGEST_LEN 16
+
+/* state of a file rules are read from, taken as it is read; size is -1 if missing */
+struct ruleng_json_file {
+	struct timespec mtime;
+	off_t size;
+	ino_t ino;
+	uint8_t digest[RULENG_JSON_DIGEST_LEN];
+};
+
+/* a recipe file referenced from the UCI rules, keyed by its path */
+struct ruleng_json_recipe {
+	struct avl_node avl;
+	struct ruleng_json_file file;
+	bool used;
 };
 
 int get_file_contents(const char* filename, char** outbuffer);
@@ -68,12 +161,80 @@ enum ruleng_bus_rc ruleng_process_json(
   char *package
 );
 
+/*
+ * Load the recipes referenced from 'package' into 'rules'. Recipes are
+ * tracked in 'recipes'; unless 'force' is set, rules of a recipe whose file
+ * did not change since the last update are moved over from 'old' to
+ * 'reused' instead of being parsed again. They are still indexed, so the
+ * caller hands them back to 'old' if it does not go on with the update.
+ * On failure they are back in 'old' already.
+ */
+enum ruleng_bus_rc ruleng_process_json_update(
+  struct ruleng_rules_ctx *ctx,
+  struct list_head *rules,
+  struct list_head *old,
+  struct list_head *reused,
+  struct avl_tree *recipes,
+  char *package,
+  bool force
+);
+
+/* forget the recorded file state, the next update parses every recipe */
+void ruleng_json_recipes_invalidate(struct avl_tree *recipes);
+void ruleng_json_recipes_free(struct avl_tree *recipes);
+
 void ruleng_event_json_cb(
   struct ubus_context *ubus_ctx,
   struct ubus_event_handler *handler,
   const char *type, struct blob_attr *msg
 );
 
+/*
+ * Build a rule from one recipe entry, a blobmsg table. Returns
+ * RULENG_BUS_ERR_RULE_INVALID if the entry is not a valid rule.
+ */
+enum ruleng_bus_rc ruleng_json_rule_parse(
+  const char *name,
+  struct blob_attr *val,
+  const char *source,
+  struct ruleng_json_rule **rule
+);
+
+/*
+ * Set up a rule from its compiled form, the recipe entry with its name
+ * added. The rule points into 'data', which must outlive it. Rules are
+ * numbered by the caller, with ruleng_rules_next_id().
+ */
+enum ruleng_bus_rc ruleng_json_rule_load(
+  struct blob_attr *data,
+  const char *source,
+  struct ruleng_json_rule **rule
+);
+
+/* record the file state of a recipe loaded by other means than parsing it */
+enum ruleng_bus_rc ruleng_json_recipe_set(
+  struct avl_tree *recipes,
+  const char *path,
+  const struct ruleng_json_file *file
+);
+
+/* run the recipe conditions indexed under the 'n_evs' events of 'evs' against an event */
+void ruleng_json_event_dispatch(
+  struct ubus_context *ubus_ctx,
+  struct ruleng_bus_event **evs,
+  int n_evs,
+  const char *type,
+  struct blob_attr *msg
+);
+
 int get_json_int_object(struct json_object *obj, const char *str);
 const char *get_json_string_object(struct json_object *obj, const char *str);
+void ruleng_json_rule_free(struct ruleng_json_rule *rule);
 void ruleng_json_rules_free(struct list_head *rules);
+void ruleng_json_rules_carry_state(struct list_head *old, struct list_head *rules);
+
+/* drop the partial matches of a rule, of every key */
+void ruleng_json_rule_reset(struct ruleng_json_rule *rule);
+
+/* bytes of heap a rule takes, without the interned strings it shares */
+size_t ruleng_json_rule_size(const struct ruleng_json_rule *rule);
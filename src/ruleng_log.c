@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "ruleng_log.h"
+
+enum ruleng_log_sink {
+	RULENG_LOG_SINK_CONSOLE,
+	RULENG_LOG_SINK_SYSLOG,
+	RULENG_LOG_SINK_FILE,
+};
+
+/*
+ * One slot of the bounded multi-producer/single-consumer ring. A slot is
+ * free for the producer claiming position 'pos' when seq == pos and holds a
+ * record for the consumer at position 'pos' when seq == pos + 1.
+ */
+struct ruleng_log_record {
+	atomic_size_t seq;
+	int prio;
+	const char *func;
+	uint32_t rule_id;
+	uint32_t event_seq;
+	struct timespec ts;
+	char msg[RULENG_LOG_MSG_SIZE];
+};
+
+static struct ruleng_log_ctx {
+	struct ruleng_log_record *ring;
+	atomic_size_t enqueue_pos;
+	size_t dequeue_pos;
+	atomic_uint_fast64_t written;
+	atomic_uint_fast64_t dropped;
+	uint64_t dropped_reported;
+	atomic_bool running;
+	atomic_bool stopping;
+	sem_t pending;
+	pthread_t thread;
+	pthread_mutex_t sink_lock;
+	enum ruleng_log_sink sink;
+	char *path;
+	FILE *file;
+	long file_size;
+	int level;
+} log_ctx = {
+	.sink_lock = PTHREAD_MUTEX_INITIALIZER,
+	.sink = RULENG_LOG_SINK_CONSOLE,
+	.level = LOG_DEBUG,
+};
+
+static atomic_uint log_event_counter;
+static __thread uint32_t log_event_seq;
+static __thread uint32_t log_rule_id;
+
+static const char *ruleng_log_prio_name(int prio)
+{
+	if (prio <= LOG_ERR)
+		return "ERROR";
+	if (prio == LOG_WARNING)
+		return "WARNING";
+	if (prio <= LOG_INFO)
+		return "INFO";
+	return "DEBUG";
+}
+
+static void ruleng_log_rotate(void)
+{
+	char rotated[PATH_MAX];
+
+	fclose(log_ctx.file);
+	snprintf(rotated, sizeof(rotated), "%s.1", log_ctx.path);
+	rename(log_ctx.path, rotated);
+
+	log_ctx.file = fopen(log_ctx.path, "a");
+	log_ctx.file_size = 0;
+
+	if (log_ctx.file == NULL) {
+		fprintf(stderr, "ERROR: %s(): failed to reopen %s, logging to console\n",
+				__func__, log_ctx.path);
+		log_ctx.sink = RULENG_LOG_SINK_CONSOLE;
+	}
+}
+
+/* called with sink_lock held */
+static void ruleng_log_write(const struct ruleng_log_record *rec)
+{
+	char tag[48] = {0};
+	struct tm tm;
+	int len;
+
+	if (rec->event_seq && rec->rule_id)
+		snprintf(tag, sizeof(tag), "[ev %u rule %u] ", rec->event_seq, rec->rule_id);
+	else if (rec->event_seq)
+		snprintf(tag, sizeof(tag), "[ev %u] ", rec->event_seq);
+	else if (rec->rule_id)
+		snprintf(tag, sizeof(tag), "[rule %u] ", rec->rule_id);
+
+	switch (log_ctx.sink) {
+		case RULENG_LOG_SINK_SYSLOG:
+			syslog(rec->prio, "%s(): %s%s", rec->func, tag, rec->msg);
+			break;
+		case RULENG_LOG_SINK_FILE:
+			localtime_r(&rec->ts.tv_sec, &tm);
+			len = fprintf(log_ctx.file,
+						  "%04d-%02d-%02d %02d:%02d:%02d.%03ld %s: %s(): %s%s\n",
+						  tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+						  tm.tm_hour, tm.tm_min, tm.tm_sec,
+						  rec->ts.tv_nsec / 1000000,
+						  ruleng_log_prio_name(rec->prio), rec->func, tag, rec->msg);
+
+			if (len > 0)
+				log_ctx.file_size += len;
+
+			if (log_ctx.file_size > RULENG_LOG_FILE_MAX_SIZE)
+				ruleng_log_rotate();
+			break;
+		default:
+			fprintf(rec->prio <= LOG_ERR ? stderr : stdout, "%s: %s(): %s%s\n",
+					ruleng_log_prio_name(rec->prio), rec->func, tag, rec->msg);
+	}
+
+	atomic_fetch_add_explicit(&log_ctx.written, 1, memory_order_relaxed);
+}
+
+static void ruleng_log_format(
+  struct ruleng_log_record *rec,
+  int prio, const char *func,
+  const char *fmt, va_list ap
+) {
+	int len = 0;
+
+	rec->prio = prio;
+	rec->func = func;
+	rec->rule_id = log_rule_id;
+	rec->event_seq = log_event_seq;
+	clock_gettime(CLOCK_REALTIME, &rec->ts);
+
+	len = vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+	if (len < 0)
+		len = 0;
+	else if (len >= (int) sizeof(rec->msg))
+		len = sizeof(rec->msg) - 1;
+
+	/* callers are used to terminate messages with a newline */
+	while (len > 0 && rec->msg[len - 1] == '\n')
+		rec->msg[--len] = '\0';
+}
+
+static void ruleng_log_enqueue(
+  int prio, const char *func,
+  const char *fmt, va_list ap
+) {
+	struct ruleng_log_record *rec = NULL;
+	size_t pos = atomic_load_explicit(&log_ctx.enqueue_pos, memory_order_relaxed);
+
+	for (;;) {
+		rec = &log_ctx.ring[pos & (RULENG_LOG_RING_SIZE - 1)];
+		size_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+		intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_explicit(&log_ctx.enqueue_pos,
+					&pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			/* ring is full, never block the caller */
+			atomic_fetch_add_explicit(&log_ctx.dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&log_ctx.enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	ruleng_log_format(rec, prio, func, fmt, ap);
+	atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+	sem_post(&log_ctx.pending);
+}
+
+static bool ruleng_log_dequeue(void)
+{
+	struct ruleng_log_record *rec =
+		&log_ctx.ring[log_ctx.dequeue_pos & (RULENG_LOG_RING_SIZE - 1)];
+	size_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+
+	if ((intptr_t) seq - (intptr_t) (log_ctx.dequeue_pos + 1) < 0)
+		return false;
+
+	pthread_mutex_lock(&log_ctx.sink_lock);
+	ruleng_log_write(rec);
+	pthread_mutex_unlock(&log_ctx.sink_lock);
+
+	atomic_store_explicit(&rec->seq, log_ctx.dequeue_pos + RULENG_LOG_RING_SIZE,
+						  memory_order_release);
+	++log_ctx.dequeue_pos;
+
+	return true;
+}
+
+static void ruleng_log_report_dropped(void)
+{
+	uint64_t dropped = atomic_load_explicit(&log_ctx.dropped, memory_order_relaxed);
+	struct ruleng_log_record rec = {0};
+
+	if (dropped == log_ctx.dropped_reported)
+		return;
+
+	rec.prio = LOG_WARNING;
+	rec.func = __func__;
+	clock_gettime(CLOCK_REALTIME, &rec.ts);
+	snprintf(rec.msg, sizeof(rec.msg), "log ring overflow, %llu messages dropped",
+			 (unsigned long long) (dropped - log_ctx.dropped_reported));
+	log_ctx.dropped_reported = dropped;
+
+	pthread_mutex_lock(&log_ctx.sink_lock);
+	ruleng_log_write(&rec);
+	pthread_mutex_unlock(&log_ctx.sink_lock);
+}
+
+static void *ruleng_log_drain(void *arg)
+{
+	(void) arg;
+
+	for (;;) {
+		while (ruleng_log_dequeue())
+			;
+
+		ruleng_log_report_dropped();
+
+		pthread_mutex_lock(&log_ctx.sink_lock);
+		if (log_ctx.sink == RULENG_LOG_SINK_FILE)
+			fflush(log_ctx.file);
+		else if (log_ctx.sink == RULENG_LOG_SINK_CONSOLE)
+			fflush(stdout);
+		pthread_mutex_unlock(&log_ctx.sink_lock);
+
+		if (atomic_load_explicit(&log_ctx.stopping, memory_order_acquire))
+			break;
+
+		while (sem_wait(&log_ctx.pending) != 0 && errno == EINTR)
+			;
+	}
+
+	return NULL;
+}
+
+/* fork() must not happen while the drain thread is inside stdio or syslog */
+static void ruleng_log_atfork_prepare(void)
+{
+	pthread_mutex_lock(&log_ctx.sink_lock);
+}
+
+static void ruleng_log_atfork_parent(void)
+{
+	pthread_mutex_unlock(&log_ctx.sink_lock);
+}
+
+static void ruleng_log_atfork_child(void)
+{
+	/* there is no drain thread in the child, fall back to synchronous writes */
+	atomic_store(&log_ctx.running, false);
+	pthread_mutex_unlock(&log_ctx.sink_lock);
+}
+
+enum ruleng_log_rc ruleng_log_init(const char *target, int level)
+{
+	static bool atfork_registered = false;
+	enum ruleng_log_rc rc = RULENG_LOG_OK;
+	struct stat st;
+
+	log_ctx.level = level;
+
+	if (target == NULL || strcmp(target, RULENG_LOG_TARGET_CONSOLE) == 0) {
+		log_ctx.sink = RULENG_LOG_SINK_CONSOLE;
+	} else if (strcmp(target, RULENG_LOG_TARGET_SYSLOG) == 0) {
+		openlog("rulengd", LOG_PID, LOG_DAEMON);
+		log_ctx.sink = RULENG_LOG_SINK_SYSLOG;
+	} else {
+		log_ctx.path = strdup(target);
+
+		if (log_ctx.path == NULL) {
+			rc = RULENG_LOG_ERR_ALLOC;
+			goto exit;
+		}
+
+		log_ctx.file = fopen(log_ctx.path, "a");
+
+		if (log_ctx.file == NULL) {
+			fprintf(stderr, "ERROR: %s(): failed to open %s\n", __func__, target);
+			rc = RULENG_LOG_ERR_OPEN;
+			goto cleanup_path;
+		}
+
+		log_ctx.file_size = fstat(fileno(log_ctx.file), &st) == 0 ? st.st_size : 0;
+		log_ctx.sink = RULENG_LOG_SINK_FILE;
+	}
+
+	log_ctx.ring = calloc(RULENG_LOG_RING_SIZE, sizeof(*log_ctx.ring));
+
+	if (log_ctx.ring == NULL) {
+		rc = RULENG_LOG_ERR_ALLOC;
+		goto cleanup_sink;
+	}
+
+	for (size_t i = 0; i < RULENG_LOG_RING_SIZE; ++i)
+		atomic_init(&log_ctx.ring[i].seq, i);
+
+	atomic_init(&log_ctx.enqueue_pos, 0);
+	log_ctx.dequeue_pos = 0;
+	atomic_store(&log_ctx.stopping, false);
+	sem_init(&log_ctx.pending, 0, 0);
+
+	if (!atfork_registered) {
+		pthread_atfork(ruleng_log_atfork_prepare, ruleng_log_atfork_parent,
+					   ruleng_log_atfork_child);
+		atfork_registered = true;
+	}
+
+	if (pthread_create(&log_ctx.thread, NULL, ruleng_log_drain, NULL) != 0) {
+		fprintf(stderr, "ERROR: %s(): failed to start log thread\n", __func__);
+		rc = RULENG_LOG_ERR_THREAD;
+		goto cleanup_ring;
+	}
+
+	atomic_store_explicit(&log_ctx.running, true, memory_order_release);
+	goto exit;
+
+cleanup_ring:
+	sem_destroy(&log_ctx.pending);
+	free(log_ctx.ring);
+	log_ctx.ring = NULL;
+cleanup_sink:
+	if (log_ctx.file)
+		fclose(log_ctx.file);
+	log_ctx.file = NULL;
+	log_ctx.sink = RULENG_LOG_SINK_CONSOLE;
+cleanup_path:
+	free(log_ctx.path);
+	log_ctx.path = NULL;
+exit:
+	return rc;
+}
+
+void ruleng_log_free(void)
+{
+	if (atomic_load(&log_ctx.running)) {
+		atomic_store_explicit(&log_ctx.stopping, true, memory_order_release);
+		sem_post(&log_ctx.pending);
+		pthread_join(log_ctx.thread, NULL);
+		atomic_store(&log_ctx.running, false);
+
+		sem_destroy(&log_ctx.pending);
+		free(log_ctx.ring);
+		log_ctx.ring = NULL;
+	}
+
+	if (log_ctx.sink == RULENG_LOG_SINK_SYSLOG)
+		closelog();
+
+	if (log_ctx.file)
+		fclose(log_ctx.file);
+
+	free(log_ctx.path);
+	log_ctx.file = NULL;
+	log_ctx.path = NULL;
+	log_ctx.sink = RULENG_LOG_SINK_CONSOLE;
+}
+
+bool ruleng_log_enabled(int prio)
+{
+	return prio <= log_ctx.level;
+}
+
+void ruleng_log(int prio, const char *func, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!ruleng_log_enabled(prio))
+		return;
+
+	va_start(ap, fmt);
+
+	if (atomic_load_explicit(&log_ctx.running, memory_order_acquire)) {
+		ruleng_log_enqueue(prio, func, fmt, ap);
+	} else {
+		struct ruleng_log_record rec;
+
+		ruleng_log_format(&rec, prio, func, fmt, ap);
+		pthread_mutex_lock(&log_ctx.sink_lock);
+		ruleng_log_write(&rec);
+		pthread_mutex_unlock(&log_ctx.sink_lock);
+	}
+
+	va_end(ap);
+}
+
+uint32_t ruleng_log_event_begin(void)
+{
+	log_event_seq = atomic_fetch_add_explicit(&log_event_counter, 1,
+											  memory_order_relaxed) + 1;
+	log_rule_id = 0;
+
+	return log_event_seq;
+}
+
+void ruleng_log_set_rule(uint32_t id)
+{
+	log_rule_id = id;
+}
+
+void ruleng_log_get_stats(struct ruleng_log_stats *stats)
+{
+	stats->written = atomic_load_explicit(&log_ctx.written, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&log_ctx.dropped, memory_order_relaxed);
+}
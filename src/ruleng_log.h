@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <syslog.h>
+
+/* number of records in the log ring, must be a power of two */
+#define RULENG_LOG_RING_SIZE 1024
+/* maximum length of a single formatted message */
+#define RULENG_LOG_MSG_SIZE 256
+/* log file is rotated to "<path>.1" once it grows past this size */
+#define RULENG_LOG_FILE_MAX_SIZE (512 * 1024)
+
+#define RULENG_LOG_TARGET_SYSLOG "syslog"
+#define RULENG_LOG_TARGET_CONSOLE "stdout"
+
+enum ruleng_log_rc {
+	RULENG_LOG_OK = 0,
+	RULENG_LOG_ERR_ALLOC,
+	RULENG_LOG_ERR_OPEN,
+	RULENG_LOG_ERR_THREAD,
+};
+
+struct ruleng_log_stats {
+	uint64_t written;
+	uint64_t dropped;
+};
+
+/*
+ * Start the asynchronous logger. Target is either "syslog", "stdout" (or
+ * NULL) for the console, or a path to a log file which gets rotated. Until
+ * this is called, and after ruleng_log_free(), messages are written
+ * synchronously to the console.
+ */
+enum ruleng_log_rc ruleng_log_init(const char *target, int level);
+
+void ruleng_log_free(void);
+
+void ruleng_log(int prio, const char *func, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+bool ruleng_log_enabled(int prio);
+
+/* start a new event, returns its sequence number */
+uint32_t ruleng_log_event_begin(void);
+
+/* tag the following messages of the calling thread with a rule id, 0 clears */
+void ruleng_log_set_rule(uint32_t id);
+
+void ruleng_log_get_stats(struct ruleng_log_stats *stats);
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubus.h>
+#include <libubox/blobmsg.h>
+#include <libubox/list.h>
+
+#include "ruleng_arena.h"
+#include "ruleng_bus.h"
+#include "ruleng_capture.h"
+#include "ruleng_object.h"
+#include "ruleng_runtime.h"
+#include "ruleng_strpool.h"
+#include "utils.h"
+
+static struct blob_buf reply;
+
+enum {
+	RELOAD_FORCE,
+	__RELOAD_MAX,
+};
+
+static const struct blobmsg_policy reload_policy[__RELOAD_MAX] = {
+	[RELOAD_FORCE] = { .name = "force", .type = BLOBMSG_TYPE_BOOL },
+};
+
+enum {
+	RULE_NAME,
+	RULE_RULE,
+	RULE_TTL,
+	__RULE_MAX,
+};
+
+static const struct blobmsg_policy add_policy[__RULE_MAX] = {
+	[RULE_NAME] = { .name = "name", .type = BLOBMSG_TYPE_STRING },
+	[RULE_RULE] = { .name = "rule", .type = BLOBMSG_TYPE_TABLE },
+	[RULE_TTL] = { .name = "ttl", .type = BLOBMSG_TYPE_INT32 },
+};
+
+static const struct blobmsg_policy name_policy[] = {
+	[RULE_NAME] = { .name = "name", .type = BLOBMSG_TYPE_STRING },
+};
+
+enum {
+	CAPTURE_PATH,
+	__CAPTURE_MAX,
+};
+
+static const struct blobmsg_policy capture_policy[__CAPTURE_MAX] = {
+	[CAPTURE_PATH] = { .name = "path", .type = BLOBMSG_TYPE_STRING },
+};
+
+static int ruleng_object_status(enum ruleng_bus_rc rc)
+{
+	switch (rc) {
+		case RULENG_BUS_OK:
+			return UBUS_STATUS_OK;
+		case RULENG_BUS_ERR_RULE_INVALID:
+			return UBUS_STATUS_INVALID_ARGUMENT;
+		case RULENG_BUS_ERR_RULE_NOT_FOUND:
+			return UBUS_STATUS_NOT_FOUND;
+		default:
+			return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+}
+
+static int ruleng_object_add(
+  struct ubus_context *ubus_ctx,
+  struct ubus_object *obj,
+  struct ubus_request_data *req,
+  const char *method,
+  struct blob_attr *msg
+) {
+	(void) method;
+
+	struct ruleng_bus_ctx *ctx =
+		container_of(obj, struct ruleng_bus_ctx, object);
+	struct blob_attr *tb[__RULE_MAX];
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	uint32_t id = 0;
+	int ttl = 0;
+
+	blobmsg_parse(add_policy, __RULE_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (!tb[RULE_NAME] || !tb[RULE_RULE])
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	if (tb[RULE_TTL])
+		ttl = (int) blobmsg_get_u32(tb[RULE_TTL]);
+
+	if (ttl < 0)
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	rc = ruleng_runtime_add(ctx, blobmsg_get_string(tb[RULE_NAME]),
+							tb[RULE_RULE], ttl, &id);
+
+	if (rc != RULENG_BUS_OK)
+		return ruleng_object_status(rc);
+
+	blob_buf_init(&reply, 0);
+	blobmsg_add_string(&reply, "name", blobmsg_get_string(tb[RULE_NAME]));
+	blobmsg_add_u32(&reply, "id", id);
+	ubus_send_reply(ubus_ctx, req, reply.head);
+
+	return UBUS_STATUS_OK;
+}
+
+static int ruleng_object_rule(
+  struct ubus_context *ubus_ctx,
+  struct ubus_object *obj,
+  struct ubus_request_data *req,
+  const char *method,
+  struct blob_attr *msg
+) {
+	(void) ubus_ctx;
+	(void) req;
+
+	struct ruleng_bus_ctx *ctx =
+		container_of(obj, struct ruleng_bus_ctx, object);
+	struct blob_attr *tb[ARRAY_SIZE(name_policy)];
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+
+	blobmsg_parse(name_policy, ARRAY_SIZE(name_policy), tb,
+				  blob_data(msg), blob_len(msg));
+
+	if (!tb[RULE_NAME])
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	const char *name = blobmsg_get_string(tb[RULE_NAME]);
+
+	if (strcmp(method, "remove") == 0)
+		rc = ruleng_runtime_remove(ctx, name);
+	else
+		rc = ruleng_runtime_set_enabled(ctx, name, strcmp(method, "enable") == 0);
+
+	return ruleng_object_status(rc);
+}
+
+static int ruleng_object_reload(
+  struct ubus_context *ubus_ctx,
+  struct ubus_object *obj,
+  struct ubus_request_data *req,
+  const char *method,
+  struct blob_attr *msg
+) {
+	(void) method;
+
+	struct ruleng_bus_ctx *ctx =
+		container_of(obj, struct ruleng_bus_ctx, object);
+	struct blob_attr *tb[__RELOAD_MAX];
+	struct list_head *p = NULL;
+	struct ruleng_bus_event *ev = NULL;
+	uint32_t rules = 0, recipes = 0, events = 0;
+	bool force = false;
+
+	blobmsg_parse(reload_policy, __RELOAD_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (tb[RELOAD_FORCE])
+		force = blobmsg_get_bool(tb[RELOAD_FORCE]);
+
+	if (ruleng_bus_reload(ctx, force) != RULENG_BUS_OK)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	list_for_each(p, &ctx->rules)
+		++rules;
+
+	list_for_each(p, &ctx->json_rules)
+		++recipes;
+
+	avl_for_each_element(&ctx->events, ev, avl) {
+		if (ev->refs > 0)
+			++events;
+	}
+
+	blob_buf_init(&reply, 0);
+	blobmsg_add_u32(&reply, "rules", rules);
+	blobmsg_add_u32(&reply, "recipes", recipes);
+	blobmsg_add_u32(&reply, "runtime", ctx->runtime_rules.count);
+	blobmsg_add_u32(&reply, "events", events);
+	ubus_send_reply(ubus_ctx, req, reply.head);
+
+	return UBUS_STATUS_OK;
+}
+
+static int ruleng_object_memory(
+  struct ubus_context *ubus_ctx,
+  struct ubus_object *obj,
+  struct ubus_request_data *req,
+  const char *method,
+  struct blob_attr *msg
+) {
+	(void) method;
+	(void) msg;
+
+	struct ruleng_bus_ctx *ctx =
+		container_of(obj, struct ruleng_bus_ctx, object);
+	struct ruleng_rule *r = NULL;
+	struct ruleng_json_rule *jr = NULL;
+	struct ruleng_runtime_rule *rr = NULL;
+	struct ruleng_arena_stats arena = {0};
+	size_t bytes = 0, mapped = 0, strings = 0, string_bytes = 0;
+	uint32_t rules = 0, keys = 0, evicted = 0;
+	void *t = NULL;
+
+	list_for_each_entry(r, &ctx->rules, list) {
+		bytes += ruleng_rules_rule_size(r);
+		mapped += r->map ? blob_pad_len(r->data) : 0;
+		++rules;
+	}
+
+	list_for_each_entry(jr, &ctx->json_rules, list) {
+		bytes += ruleng_json_rule_size(jr);
+		mapped += jr->map ? blob_pad_len(jr->data) : 0;
+		keys += jr->keys.count;
+		evicted += jr->evicted;
+		++rules;
+	}
+
+	avl_for_each_element(&ctx->runtime_rules, rr, avl) {
+		bytes += sizeof(*rr) + ruleng_json_rule_size(rr->rule);
+		keys += rr->rule->keys.count;
+		evicted += rr->rule->evicted;
+		++rules;
+	}
+
+	ruleng_strpool_stats(&strings, &string_bytes);
+	bytes += string_bytes;
+
+	blob_buf_init(&reply, 0);
+	blobmsg_add_u32(&reply, "rules", rules);
+	blobmsg_add_u64(&reply, "bytes", bytes);
+	blobmsg_add_u64(&reply, "mapped_bytes", mapped);
+	blobmsg_add_u32(&reply, "strings", strings);
+	blobmsg_add_u64(&reply, "string_bytes", string_bytes);
+	blobmsg_add_u32(&reply, "bytes_per_rule", rules ? bytes / rules : 0);
+
+	ruleng_arena_get_stats(&arena);
+
+	t = blobmsg_open_table(&reply, "events");
+	blobmsg_add_u64(&reply, "count", arena.events);
+	blobmsg_add_u64(&reply, "allocs", arena.allocs);
+	blobmsg_add_u64(&reply, "promoted", arena.promoted);
+	blobmsg_add_u32(&reply, "last_allocs", arena.last_allocs);
+	blobmsg_add_u32(&reply, "max_allocs", arena.max_allocs);
+	blobmsg_add_u64(&reply, "arena_bytes", arena.size);
+	blobmsg_add_u64(&reply, "peak_bytes", arena.peak);
+	blobmsg_close_table(&reply, t);
+
+	// correlation keys of the AND rules with partial matches
+	t = blobmsg_open_table(&reply, "keys");
+	blobmsg_add_u32(&reply, "count", keys);
+	blobmsg_add_u32(&reply, "evicted", evicted);
+	blobmsg_close_table(&reply, t);
+	ubus_send_reply(ubus_ctx, req, reply.head);
+
+	return UBUS_STATUS_OK;
+}
+
+/* start capturing to 'path', or stop without it, telling what was captured */
+static int ruleng_object_capture(
+  struct ubus_context *ubus_ctx,
+  struct ubus_object *obj,
+  struct ubus_request_data *req,
+  const char *method,
+  struct blob_attr *msg
+) {
+	(void) method;
+
+	struct ruleng_bus_ctx *ctx =
+		container_of(obj, struct ruleng_bus_ctx, object);
+	struct blob_attr *tb[__CAPTURE_MAX];
+	struct ruleng_capture *cap = NULL;
+
+	blobmsg_parse(capture_policy, __CAPTURE_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (tb[CAPTURE_PATH] &&
+		ruleng_capture_open(&cap, blobmsg_get_string(tb[CAPTURE_PATH])) != RULENG_CAPTURE_OK)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	blob_buf_init(&reply, 0);
+
+	if (ctx->capture) {
+		blobmsg_add_string(&reply, "path", ctx->capture->path);
+		blobmsg_add_u64(&reply, "events", ctx->capture->events);
+		blobmsg_add_u64(&reply, "bytes", ctx->capture->bytes);
+		ruleng_capture_close(ctx->capture);
+	}
+
+	ctx->capture = cap;
+	ubus_send_reply(ubus_ctx, req, reply.head);
+
+	return UBUS_STATUS_OK;
+}
+
+static const struct ubus_method ruleng_object_methods[] = {
+	UBUS_METHOD("reload", ruleng_object_reload, reload_policy),
+	UBUS_METHOD("add", ruleng_object_add, add_policy),
+	UBUS_METHOD("remove", ruleng_object_rule, name_policy),
+	UBUS_METHOD("enable", ruleng_object_rule, name_policy),
+	UBUS_METHOD("disable", ruleng_object_rule, name_policy),
+	UBUS_METHOD_NOARG("memory", ruleng_object_memory),
+	UBUS_METHOD("capture", ruleng_object_capture, capture_policy),
+};
+
+static struct ubus_object_type ruleng_object_type =
+	UBUS_OBJECT_TYPE(RULENG_OBJECT_NAME, ruleng_object_methods);
+
+enum ruleng_bus_rc ruleng_object_init(struct ruleng_bus_ctx *ctx)
+{
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+
+	ctx->object.name = RULENG_OBJECT_NAME;
+	ctx->object.type = &ruleng_object_type;
+	ctx->object.methods = ruleng_object_methods;
+	ctx->object.n_methods = ARRAY_SIZE(ruleng_object_methods);
+
+	if (ubus_add_object(ctx->ubus_ctx, &ctx->object)) {
+		RULENG_ERR("failed to add ubus object %s", RULENG_OBJECT_NAME);
+		rc = RULENG_BUS_ERR_ADD_OBJECT;
+	}
+
+	return rc;
+}
+
+void ruleng_object_free(struct ruleng_bus_ctx *ctx)
+{
+	if (ctx->object.id)
+		ubus_remove_object(ctx->ubus_ctx, &ctx->object);
+
+	blob_buf_free(&reply);
+}
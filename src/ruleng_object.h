@@ -0,0 +1,10 @@
+#pragma once
+
+#include "ruleng_bus.h"
+
+#define RULENG_OBJECT_NAME "rulengd"
+
+/* publish the "rulengd" ubus object used to control the daemon at runtime */
+enum ruleng_bus_rc ruleng_object_init(struct ruleng_bus_ctx *ctx);
+
+void ruleng_object_free(struct ruleng_bus_ctx *ctx);
@@ -14,6 +14,7 @@
 
 #include "ruleng_rules.h"
 #include "ruleng_json.h"
+#include "ruleng_cache.h"
 #include "utils.h"
 
 #define RULENG_EVENT_FIELD "event"
@@ -21,32 +22,52 @@
 #define RULENG_METHOD_FIELD "method"
 #define RULENG_METHOD_ARG_FIELD "method_data"
 #define RULENG_METHOD_ENV_FIELD "method_envs"
+/* fields of a compiled rule besides the ones named after UCI options */
+#define RULENG_HASH_FIELD "hash"
+#define RULENG_OBJECT_FIELD "object"
+
+enum {
+	RULE_HASH,
+	RULE_EVENT,
+	RULE_EVENT_ARGS,
+	RULE_OBJECT,
+	RULE_METHOD,
+	RULE_METHOD_ARGS,
+	RULE_METHOD_ENVS,
+	__RULE_MAX,
+};
+
+static const struct blobmsg_policy rule_policy[__RULE_MAX] = {
+	[RULE_HASH] = { .name = RULENG_HASH_FIELD, .type = BLOBMSG_TYPE_INT32 },
+	[RULE_EVENT] = { .name = RULENG_EVENT_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[RULE_EVENT_ARGS] = { .name = RULENG_EVENT_ARG_FIELD, .type = BLOBMSG_TYPE_TABLE },
+	[RULE_OBJECT] = { .name = RULENG_OBJECT_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[RULE_METHOD] = { .name = RULENG_METHOD_FIELD, .type = BLOBMSG_TYPE_STRING },
+	[RULE_METHOD_ARGS] = { .name = RULENG_METHOD_ARG_FIELD, .type = BLOBMSG_TYPE_TABLE },
+	[RULE_METHOD_ENVS] = { .name = RULENG_METHOD_ENV_FIELD, .type = BLOBMSG_TYPE_TABLE },
+};
+
+uint32_t ruleng_rules_next_id(void)
+{
+	static uint32_t id = 0;
+
+	return ++id;
+}
 
 void ruleng_json_rules_free(struct list_head *rules)
 {
 	struct ruleng_json_rule *rule = NULL, *tmp = NULL;
 
-	list_for_each_entry_safe(rule, tmp, rules, list) {
-		json_object_put(rule->action.args);
-		json_object_put(rule->event.args);
-		free(rule->event.name);
-		free(rule);
-	}
+	list_for_each_entry_safe(rule, tmp, rules, list)
+		ruleng_json_rule_free(rule);
 }
 
 void ruleng_rules_free(struct list_head *rules)
 {
 	struct ruleng_rule *rule = NULL, *tmp = NULL;
 
-	list_for_each_entry_safe(rule, tmp, rules, list) {
-		json_object_put(rule->action.args);
-		json_object_put(rule->action.envs);
-		json_object_put(rule->event.args);
-		free((void *) rule->event.name);
-		free((void *) rule->action.name);
-		free((void *) rule->action.object);
-		free(rule);
-	}
+	list_for_each_entry_safe(rule, tmp, rules, list)
+		ruleng_rules_rule_free(rule);
 }
 
 enum ruleng_rules_rc ruleng_rules_ctx_init(struct ruleng_rules_ctx **ctx)
@@ -209,33 +230,48 @@ exit:
 	return rc;
 }
 
-static enum ruleng_rules_rc ruleng_rules_rules_parse_event(
+/* add the merged JSON objects of a UCI list option as a table named 'field' */
+static enum ruleng_rules_rc ruleng_rules_rules_compile_args(
   struct uci_context *ctx,
+  const char *field,
   struct uci_section *s,
-  struct ruleng_rules_event *ev
+  const char *ev,
+  struct blob_buf *b
 ) {
 	enum ruleng_rules_rc rc = RULENG_RULES_OK;
-	char *name = NULL;
-	rc = ruleng_rules_rules_parse_event_name(ctx, s, &name);
+	struct json_object *args = NULL;
+	rc = ruleng_rules_rules_parse_args(ctx, field, s, ev, &args);
 
 	if (rc != RULENG_RULES_OK)
 		goto exit;
 
-	struct json_object *args = NULL;
-	rc = ruleng_rules_rules_parse_args(ctx, RULENG_EVENT_ARG_FIELD, s, name, &args);
+	RULENG_INFO("%s %s: %s", ev, field, json_object_to_json_string(args));
 
-	if (rc != RULENG_RULES_OK)
-		goto cleanup_name;
+	void *t = blobmsg_open_table(b, field);
+	blobmsg_add_object(b, args);
+	blobmsg_close_table(b, t);
+	json_object_put(args);
 
-	RULENG_INFO("%s event data: %s", name, json_object_to_json_string(args));
+exit:
+	return rc;
+}
 
-	ev->name = name;
-	ev->args = args;
+static enum ruleng_rules_rc ruleng_rules_rules_parse_event(
+  struct uci_context *ctx,
+  struct uci_section *s,
+  struct blob_buf *b
+) {
+	enum ruleng_rules_rc rc = RULENG_RULES_OK;
+	char *name = NULL;
+	rc = ruleng_rules_rules_parse_event_name(ctx, s, &name);
 
-	goto exit;
+	if (rc != RULENG_RULES_OK)
+		goto exit;
 
-cleanup_name:
+	blobmsg_add_string(b, RULENG_EVENT_FIELD, name);
+	rc = ruleng_rules_rules_compile_args(ctx, RULENG_EVENT_ARG_FIELD, s, name, b);
 	free(name);
+
 exit:
 	return rc;
 }
@@ -243,7 +279,7 @@ exit:
 static enum ruleng_rules_rc ruleng_rules_rules_parse_action(
   struct uci_context *ctx,
   struct uci_section *s,
-  struct ruleng_rules_action *ac
+  struct blob_buf *b
 ) {
 	enum ruleng_rules_rc rc = RULENG_RULES_OK;
 	char *name = NULL, *object = NULL;
@@ -252,36 +288,199 @@ static enum ruleng_rules_rc ruleng_rules_rules_parse_action(
 	if (rc != RULENG_RULES_OK)
 		goto exit;
 
-	struct json_object *args = NULL;
-	rc = ruleng_rules_rules_parse_args(ctx, RULENG_METHOD_ARG_FIELD, s, name, &args);
-
-	if (rc != RULENG_RULES_OK)
+	if (name == NULL || object == NULL) {
+		RULENG_ERR("%s: failed to allocate object method", s->type);
+		rc = RULENG_RULES_ERR_ALLOC;
 		goto cleanup_object;
+	}
 
-	struct json_object *envs = NULL;
-	rc = ruleng_rules_rules_parse_args(ctx, RULENG_METHOD_ENV_FIELD, s, name, &envs);
+	blobmsg_add_string(b, RULENG_OBJECT_FIELD, object);
+	blobmsg_add_string(b, RULENG_METHOD_FIELD, name);
 
-	if (rc != RULENG_RULES_OK)
-		goto cleanup_args;
+	rc = ruleng_rules_rules_compile_args(ctx, RULENG_METHOD_ARG_FIELD, s, name, b);
 
-	ac->name = name;
-	ac->object = object;
-	ac->args = args;
-	ac->envs = envs;
+	if (rc != RULENG_RULES_OK)
+		goto cleanup_object;
 
-	goto exit;
+	rc = ruleng_rules_rules_compile_args(ctx, RULENG_METHOD_ENV_FIELD, s, name, b);
 
-cleanup_args:
-	json_object_put(args);
 cleanup_object:
+	free(name);
 	free(object);
 exit:
 	return rc;
 }
 
+enum ruleng_rules_rc ruleng_rules_rule_load(
+  struct blob_attr *data,
+  struct ruleng_rule **rule
+) {
+	enum ruleng_rules_rc rc = RULENG_RULES_OK;
+	struct blob_attr *tb[__RULE_MAX];
+	struct ruleng_rule *r = NULL;
+
+	blobmsg_parse(rule_policy, __RULE_MAX, tb,
+				  blobmsg_data(data), blobmsg_data_len(data));
+
+	for (int i = 0; i < __RULE_MAX; ++i) {
+		if (tb[i] == NULL) {
+			RULENG_ERR("compiled rule lacks '%s'", rule_policy[i].name);
+			rc = RULENG_RULES_ERR_NOT_VALID;
+			goto exit;
+		}
+	}
+
+	r = calloc(1, sizeof(*r));
+
+	if (r == NULL) {
+		RULENG_ERR("failed to allocate rule");
+		rc = RULENG_RULES_ERR_ALLOC;
+		goto exit;
+	}
+
+	r->data = data;
+	r->hash = blobmsg_get_u32(tb[RULE_HASH]);
+	r->event.name = blobmsg_get_string(tb[RULE_EVENT]);
+	r->event.args = tb[RULE_EVENT_ARGS];
+	r->action.object = blobmsg_get_string(tb[RULE_OBJECT]);
+	r->action.name = blobmsg_get_string(tb[RULE_METHOD]);
+	r->action.args = tb[RULE_METHOD_ARGS];
+	r->action.envs = tb[RULE_METHOD_ENVS];
+	r->id = ruleng_rules_next_id();
+	*rule = r;
+
+exit:
+	return rc;
+}
+
+void ruleng_rules_rule_free(struct ruleng_rule *rule)
+{
+	if (rule->map)
+		ruleng_cache_map_put(rule->map);
+	else
+		free(rule->data);
+
+	free(rule);
+}
+
+size_t ruleng_rules_rule_size(const struct ruleng_rule *rule)
+{
+	return sizeof(*rule) + (rule->map ? 0 : blob_pad_len(rule->data));
+}
+
+/* compile a UCI section into a rule */
+static enum ruleng_rules_rc ruleng_rules_rule_parse(
+  struct uci_context *ctx,
+  struct uci_section *s,
+  uint32_t hash,
+  struct ruleng_rule **rule
+) {
+	enum ruleng_rules_rc rc = RULENG_RULES_OK;
+	struct blob_buf b = {0};
+	struct blob_attr *data = NULL;
+
+	blob_buf_init(&b, 0);
+
+	void *t = blobmsg_open_table(&b, "");
+	blobmsg_add_u32(&b, RULENG_HASH_FIELD, hash);
+
+	rc = ruleng_rules_rules_parse_event(ctx, s, &b);
+
+	if (rc != RULENG_RULES_OK)
+		goto cleanup_buf;
+
+	rc = ruleng_rules_rules_parse_action(ctx, s, &b);
+
+	if (rc != RULENG_RULES_OK)
+		goto cleanup_buf;
+
+	blobmsg_close_table(&b, t);
+	data = blob_memdup(blob_data(b.head));
+
+	if (data == NULL) {
+		RULENG_ERR("%s: failed to allocate rule", s->type);
+		rc = RULENG_RULES_ERR_ALLOC;
+		goto cleanup_buf;
+	}
+
+	rc = ruleng_rules_rule_load(data, rule);
+
+	if (rc != RULENG_RULES_OK)
+		free(data);
+
+cleanup_buf:
+	blob_buf_free(&b);
+	return rc;
+}
+
+static uint32_t ruleng_rules_section_hash(struct uci_section *s)
+{
+	uint32_t hash = ruleng_hash(RULENG_HASH_INIT, s->type, strlen(s->type) + 1);
+	struct uci_element *e = NULL, *v = NULL;
+
+	uci_foreach_element(&s->options, e) {
+		struct uci_option *o = uci_to_option(e);
+
+		hash = ruleng_hash(hash, e->name, strlen(e->name) + 1);
+
+		if (o->type == UCI_TYPE_STRING) {
+			hash = ruleng_hash(hash, o->v.string, strlen(o->v.string) + 1);
+			continue;
+		}
+
+		uci_foreach_element(&o->v.list, v)
+			hash = ruleng_hash(hash, v->name, strlen(v->name) + 1);
+	}
+
+	return hash;
+}
+
+static bool ruleng_rules_has_id(struct list_head *rules, uint32_t id)
+{
+	struct ruleng_rule *rule = NULL;
+
+	list_for_each_entry(rule, rules, list) {
+		if (rule->id == id)
+			return true;
+	}
+
+	return false;
+}
+
+/* the rule of 'old' compiled the same as 'rule' whose id is not taken in 'rules' yet */
+static struct ruleng_rule *ruleng_rules_find_equal(
+  struct list_head *old,
+  struct list_head *rules,
+  const struct ruleng_rule *rule
+) {
+	struct ruleng_rule *o = NULL;
+
+	if (old == NULL)
+		return NULL;
+
+	// the hash only narrows the search down, a collision must not keep a stale rule;
+	// rules are listed last section first, identical sections keep their ids in order
+	list_for_each_entry_reverse(o, old, list) {
+		if (o->hash == rule->hash && blob_attr_equal(o->data, rule->data) &&
+			!ruleng_rules_has_id(rules, o->id))
+			return o;
+	}
+
+	return NULL;
+}
+
 enum ruleng_rules_rc ruleng_rules_get(
   struct ruleng_rules_ctx *ctx,
   struct list_head *rules, char *path
+) {
+	return ruleng_rules_update(ctx, rules, NULL, path);
+}
+
+enum ruleng_rules_rc ruleng_rules_update(
+  struct ruleng_rules_ctx *ctx,
+  struct list_head *rules,
+  struct list_head *old,
+  char *path
 ) {
 	enum ruleng_rules_rc rc = RULENG_RULES_OK;
 	struct uci_ptr ptr;
@@ -296,43 +495,31 @@ enum ruleng_rules_rc ruleng_rules_get(
 
 	uci_foreach_element(&ptr.p->sections, e) {
 		struct uci_section *s = uci_to_section(e);
-		struct ruleng_rule *rule = calloc(1, sizeof *rule);
+		struct ruleng_rule *rule = NULL, *prev = NULL;
 
-		if (rule == NULL) {
-			RULENG_ERR("%s: failed to allocate rule", path);
-			rc = RULENG_RULES_ERR_ALLOC;
-			goto cleanup_rules;
-		}
+		rc = ruleng_rules_rule_parse(ctx->uci_ctx, s, ruleng_rules_section_hash(s), &rule);
 
-		rc = ruleng_rules_rules_parse_event(ctx->uci_ctx, s, &rule->event);
+		// sections which are not valid rules are skipped
+		if (rc == RULENG_RULES_ERR_NOT_VALID) {
+			rc = RULENG_RULES_OK;
+			continue;
+		}
 
 		if (rc != RULENG_RULES_OK)
-			goto cleanup_rule;
+			goto cleanup_rules;
 
-		rc = ruleng_rules_rules_parse_action(ctx->uci_ctx, s, &rule->action);
+		prev = ruleng_rules_find_equal(old, rules, rule);
 
-		if (rc != RULENG_RULES_OK)
-			goto cleanup_event_args;
+		if (prev)
+			rule->id = prev->id;
 
 		list_add(&rule->list, rules);
-
-		continue;
-
-	cleanup_event_args:
-		free((char *) rule->event.name);
-		json_object_put(rule->event.args);
-	cleanup_rule:
-		if (rc == RULENG_RULES_ERR_NOT_VALID) {
-			rc = RULENG_RULES_OK;
-			free(rule);
-		} else {
-			goto cleanup_rules;
-		}
 	}
 	uci_unload(ctx->uci_ctx, ptr.p);
 	goto exit;
 
 cleanup_rules:
+	uci_unload(ctx->uci_ctx, ptr.p);
 	ruleng_rules_free(rules);
 exit:
 	return rc;
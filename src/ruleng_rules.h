@@ -1,7 +1,9 @@
 #pragma once
 
+#include <stdint.h>
 #include <json-c/json.h>
 #include <libubox/list.h>
+#include <libubox/blob.h>
 
 enum ruleng_rules_rc {
 	RULENG_RULES_OK = 0,
@@ -14,20 +16,30 @@ struct ruleng_rules_ctx {
 	struct uci_context *uci_ctx;
 };
 
+struct ruleng_cache_map;
+
 struct ruleng_rule {
 	struct list_head list;
+	/* entry in the dispatch list of the event */
+	struct list_head index;
+	uint32_t id;
+	uint32_t hash;
+	/* compiled rule the fields below point into, see ruleng_rules_rule_load() */
+	struct blob_attr *data;
+	/* rule cache 'data' is mapped from, NULL when it is owned */
+	struct ruleng_cache_map *map;
 
 	struct ruleng_rules_event {
 		const char *name;
-		struct json_object *args;
+		struct blob_attr *args;
 	} event;
 
 	struct ruleng_rules_action {
 		int timeout;
 		const char *object;
 		const char *name;
-		struct json_object *args;
-		struct json_object *envs;
+		struct blob_attr *args;
+		struct blob_attr *envs;
 	} action;
 };
 
@@ -40,4 +52,31 @@ enum ruleng_rules_rc ruleng_rules_get(
   struct list_head *rules, char *path
 );
 
+/*
+ * Like ruleng_rules_get(), but rules of sections which did not change since
+ * 'old' was loaded keep their ids. 'old' is left as it is.
+ */
+enum ruleng_rules_rc ruleng_rules_update(
+  struct ruleng_rules_ctx *ctx,
+  struct list_head *rules,
+  struct list_head *old,
+  char *path
+);
+
 void ruleng_rules_ctx_free(struct ruleng_rules_ctx *ctx);
+
+/*
+ * Set up a rule from its compiled form, a blobmsg table as built when the
+ * UCI section is parsed. The rule points into 'data', which must outlive it.
+ */
+enum ruleng_rules_rc ruleng_rules_rule_load(
+  struct blob_attr *data,
+  struct ruleng_rule **rule
+);
+
+void ruleng_rules_rule_free(struct ruleng_rule *rule);
+
+/* bytes of heap a rule takes, a compiled rule mapped from the cache is not counted */
+size_t ruleng_rules_rule_size(const struct ruleng_rule *rule);
+
+uint32_t ruleng_rules_next_id(void);
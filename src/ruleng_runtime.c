@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubox/avl.h>
+#include <libubox/list.h>
+#include <libubox/blob.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_json.h"
+#include "ruleng_runtime.h"
+#include "utils.h"
+
+static void ruleng_runtime_rule_free(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_runtime_rule *rr
+) {
+	ruleng_timer_cancel(&rr->ttl);
+	ruleng_bus_json_rule_unbind(ctx, rr->rule);
+	avl_delete(&ctx->runtime_rules, &rr->avl);
+	ruleng_json_rule_free(rr->rule);
+	free(rr);
+}
+
+static void ruleng_runtime_ttl_cb(struct ruleng_timer *t)
+{
+	struct ruleng_runtime_rule *rr =
+		container_of(t, struct ruleng_runtime_rule, ttl);
+
+	RULENG_INFO("%s: rule expired", rr->rule->name);
+	ruleng_runtime_rule_free(rr->ctx, rr);
+}
+
+enum ruleng_bus_rc ruleng_runtime_add(
+  struct ruleng_bus_ctx *ctx,
+  const char *name,
+  struct blob_attr *val,
+  int ttl,
+  uint32_t *id
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_runtime_rule *rr = NULL, *old = NULL;
+	struct ruleng_json_rule *r = NULL;
+	bool events = false;
+
+	rc = ruleng_json_rule_parse(name, val, RULENG_RUNTIME_SOURCE, &r);
+
+	if (rc != RULENG_BUS_OK)
+		goto exit;
+
+	r->id = ruleng_rules_next_id();
+
+	for (int i = 0; i < r->n_conds; ++i)
+		events |= r->conds[i].event != NULL;
+
+	if (!events) {
+		RULENG_ERR("%s: rule does not wait for any event", name);
+		rc = RULENG_BUS_ERR_RULE_INVALID;
+		goto cleanup_rule;
+	}
+
+	rr = calloc(1, sizeof(*rr));
+
+	if (rr == NULL) {
+		RULENG_ERR("%s: failed to allocate rule", name);
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto cleanup_rule;
+	}
+
+	// bind before dropping a replaced rule, shared subscriptions stay
+	rc = ruleng_bus_json_rule_bind(ctx, r);
+
+	if (rc != RULENG_BUS_OK)
+		goto cleanup_rr;
+
+	old = avl_find_element(&ctx->runtime_rules, name, old, avl);
+
+	if (old)
+		ruleng_runtime_rule_free(ctx, old);
+
+	rr->avl.key = r->name;
+	rr->ctx = ctx;
+	rr->rule = r;
+	rr->ttl.cb = ruleng_runtime_ttl_cb;
+	avl_insert(&ctx->runtime_rules, &rr->avl);
+
+	if (ttl > 0)
+		ruleng_timer_set(&rr->ttl, (uint64_t) ttl * 1000);
+
+	RULENG_INFO("%s: added rule as id %u, ttl %d", name, r->id, ttl);
+	*id = r->id;
+	goto exit;
+
+cleanup_rr:
+	free(rr);
+cleanup_rule:
+	ruleng_json_rule_free(r);
+exit:
+	return rc;
+}
+
+enum ruleng_bus_rc ruleng_runtime_remove(
+  struct ruleng_bus_ctx *ctx,
+  const char *name
+) {
+	struct ruleng_runtime_rule *rr = NULL;
+
+	rr = avl_find_element(&ctx->runtime_rules, name, rr, avl);
+
+	if (rr == NULL)
+		return RULENG_BUS_ERR_RULE_NOT_FOUND;
+
+	RULENG_INFO("%s: removing rule", name);
+	ruleng_runtime_rule_free(ctx, rr);
+
+	return RULENG_BUS_OK;
+}
+
+static enum ruleng_bus_rc ruleng_runtime_rule_enable(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_json_rule *r,
+  bool enabled
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+
+	if (enabled) {
+		r->disabled = false;
+		rc = ruleng_bus_json_rule_bind(ctx, r);
+
+		if (rc != RULENG_BUS_OK)
+			r->disabled = true;
+
+		return rc;
+	}
+
+	r->disabled = true;
+	ruleng_bus_json_rule_unbind(ctx, r);
+
+	// a disabled rule starts over once enabled again
+	ruleng_json_rule_reset(r);
+
+	return rc;
+}
+
+enum ruleng_bus_rc ruleng_runtime_set_enabled(
+  struct ruleng_bus_ctx *ctx,
+  const char *name,
+  bool enabled
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_ERR_RULE_NOT_FOUND;
+	struct ruleng_runtime_rule *rr = NULL;
+	struct ruleng_json_rule *r = NULL;
+
+	RULENG_INFO("%s: %s rule", name, enabled ? "enabling" : "disabling");
+
+	rr = avl_find_element(&ctx->runtime_rules, name, rr, avl);
+
+	if (rr)
+		return ruleng_runtime_rule_enable(ctx, rr->rule, enabled);
+
+	list_for_each_entry(r, &ctx->json_rules, list) {
+		if (r->name == NULL || strcmp(r->name, name) != 0)
+			continue;
+
+		rc = ruleng_runtime_rule_enable(ctx, r, enabled);
+
+		if (rc != RULENG_BUS_OK)
+			break;
+	}
+
+	return rc;
+}
+
+void ruleng_runtime_free(struct ruleng_bus_ctx *ctx)
+{
+	struct ruleng_runtime_rule *rr = NULL, *tmp = NULL;
+
+	avl_for_each_element_safe(&ctx->runtime_rules, rr, avl, tmp)
+		ruleng_runtime_rule_free(ctx, rr);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/avl.h>
+#include <libubox/blob.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_timer.h"
+
+/* source recorded for rules installed over ubus */
+#define RULENG_RUNTIME_SOURCE "ubus"
+
+/* a rule installed over ubus, keyed by its name */
+struct ruleng_runtime_rule {
+	struct avl_node avl;
+	struct ruleng_timer ttl;
+	struct ruleng_bus_ctx *ctx;
+	struct ruleng_json_rule *rule;
+};
+
+/*
+ * Install a rule given in recipe format as a blobmsg table, replacing the
+ * runtime rule of the same name. The rule is removed after 'ttl' seconds, or
+ * kept until removed when 'ttl' is 0.
+ */
+enum ruleng_bus_rc ruleng_runtime_add(
+  struct ruleng_bus_ctx *ctx,
+  const char *name,
+  struct blob_attr *val,
+  int ttl,
+  uint32_t *id
+);
+
+enum ruleng_bus_rc ruleng_runtime_remove(
+  struct ruleng_bus_ctx *ctx,
+  const char *name
+);
+
+/* enable or disable the runtime rule, or else every recipe rule, named 'name' */
+enum ruleng_bus_rc ruleng_runtime_set_enabled(
+  struct ruleng_bus_ctx *ctx,
+  const char *name,
+  bool enabled
+);
+
+void ruleng_runtime_free(struct ruleng_bus_ctx *ctx);
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
+
+#include "ruleng_strpool.h"
+
+struct ruleng_strpool_entry {
+	struct avl_node avl;
+	int refs;
+	char str[];
+};
+
+static AVL_TREE(pool, avl_strcmp, false, NULL);
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t pool_bytes;
+
+const char *ruleng_strpool_get(const char *s)
+{
+	struct ruleng_strpool_entry *e = NULL;
+	size_t len = strlen(s) + 1;
+
+	pthread_mutex_lock(&pool_lock);
+	e = avl_find_element(&pool, s, e, avl);
+
+	if (e) {
+		++e->refs;
+		goto exit;
+	}
+
+	e = calloc(1, sizeof(*e) + len);
+
+	if (e == NULL)
+		goto exit;
+
+	memcpy(e->str, s, len);
+	e->avl.key = e->str;
+	e->refs = 1;
+	avl_insert(&pool, &e->avl);
+	pool_bytes += sizeof(*e) + len;
+
+exit:
+	pthread_mutex_unlock(&pool_lock);
+	return e ? e->str : NULL;
+}
+
+void ruleng_strpool_put(const char *s)
+{
+	struct ruleng_strpool_entry *e = NULL;
+
+	if (s == NULL)
+		return;
+
+	e = (struct ruleng_strpool_entry *) (s - offsetof(struct ruleng_strpool_entry, str));
+
+	pthread_mutex_lock(&pool_lock);
+
+	if (--e->refs == 0) {
+		avl_delete(&pool, &e->avl);
+		pool_bytes -= sizeof(*e) + strlen(e->str) + 1;
+		free(e);
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void ruleng_strpool_stats(size_t *count, size_t *bytes)
+{
+	pthread_mutex_lock(&pool_lock);
+	*count = pool.count;
+	*bytes = pool_bytes;
+	pthread_mutex_unlock(&pool_lock);
+}
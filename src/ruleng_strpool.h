@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Interned, reference counted strings shared by the rules. Equal strings
+ * get the same pointer, so they can also be compared by address. Safe to
+ * use from the recipe workers.
+ */
+
+/* shared copy of 's', NULL if memory could not be allocated */
+const char *ruleng_strpool_get(const char *s);
+
+/* drop a reference taken by ruleng_strpool_get(), NULL is ignored */
+void ruleng_strpool_put(const char *s);
+
+/* number of distinct strings held and the bytes they take */
+void ruleng_strpool_stats(size_t *count, size_t *bytes);
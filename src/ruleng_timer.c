@@ -0,0 +1,241 @@
+#include <limits.h>
+#include <stddef.h>
+
+#include <libubox/uloop.h>
+
+#include "ruleng_clock.h"
+#include "ruleng_timer.h"
+
+/*
+ * Level l has WHEEL_SLOTS slots of 2^(l * WHEEL_BITS) ms each. A timer
+ * goes to the lowest level whose slot it is less than WHEEL_SLOTS slots
+ * away from, and is moved down a level when the wheel reaches its slot.
+ * Six levels cover over two years; later timers wait in the last slot.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6
+
+static struct {
+	struct list_head slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	/* slots which may hold timers, cleared once found empty */
+	uint64_t used[WHEEL_LEVELS];
+	/* timers due, fired on the next run */
+	struct list_head due;
+	/* time the wheel has run up to */
+	uint64_t now;
+	uint32_t count;
+	bool init;
+	bool running;
+	struct uloop_timeout tick;
+	/* time 'tick' is set for */
+	uint64_t armed;
+} wheel;
+
+static void ruleng_timer_tick_cb(struct uloop_timeout *t);
+
+static void ruleng_timer_init(void)
+{
+	for (int l = 0; l < WHEEL_LEVELS; l++)
+		for (int i = 0; i < WHEEL_SLOTS; i++)
+			INIT_LIST_HEAD(&wheel.slots[l][i]);
+
+	INIT_LIST_HEAD(&wheel.due);
+	wheel.tick.cb = ruleng_timer_tick_cb;
+	wheel.init = true;
+}
+
+static void ruleng_timer_add(struct ruleng_timer *t)
+{
+	int l = 0, shift = 0, idx = 0;
+
+	if (t->expires <= wheel.now) {
+		list_add_tail(&t->list, &wheel.due);
+		return;
+	}
+
+	for (l = 0; l < WHEEL_LEVELS; l++) {
+		shift = l * WHEEL_BITS;
+
+		if ((t->expires >> shift) - (wheel.now >> shift) < WHEEL_SLOTS)
+			break;
+	}
+
+	if (l < WHEEL_LEVELS) {
+		idx = (int) ((t->expires >> shift) & WHEEL_MASK);
+	} else {
+		l = WHEEL_LEVELS - 1;
+		idx = (int) (((wheel.now >> shift) + WHEEL_MASK) & WHEEL_MASK);
+	}
+
+	list_add_tail(&t->list, &wheel.slots[l][idx]);
+	wheel.used[l] |= 1ULL << idx;
+}
+
+/* the first time after the wheel's past 'limit' a slot is reached which holds timers */
+static uint64_t ruleng_timer_next(uint64_t limit)
+{
+	uint64_t next = limit;
+
+	for (int l = 0; l < WHEEL_LEVELS; l++) {
+		int shift = l * WHEEL_BITS;
+		uint64_t base = (wheel.now >> shift) + 1;
+		int rot = (int) (base & WHEEL_MASK);
+		// bit k stands for the slot k after the current one
+		uint64_t bits = rot ? (wheel.used[l] >> rot) | (wheel.used[l] << (WHEEL_SLOTS - rot))
+							: wheel.used[l];
+
+		while (bits) {
+			int k = __builtin_ctzll(bits);
+			int idx = (int) ((base + k) & WHEEL_MASK);
+
+			if (list_empty(&wheel.slots[l][idx])) {
+				wheel.used[l] &= ~(1ULL << idx);
+				bits &= bits - 1;
+				continue;
+			}
+
+			if ((base + k) << shift < next)
+				next = (base + k) << shift;
+			break;
+		}
+	}
+
+	return next;
+}
+
+/* move the timers of the slots the wheel just reached a level down */
+static void ruleng_timer_cascade(void)
+{
+	for (int l = WHEEL_LEVELS - 1; l > 0; l--) {
+		int shift = l * WHEEL_BITS;
+		int idx = (int) ((wheel.now >> shift) & WHEEL_MASK);
+		struct ruleng_timer *t = NULL, *tmp = NULL;
+		LIST_HEAD(moved);
+
+		if (wheel.now & ((1ULL << shift) - 1))
+			continue;
+
+		list_splice_init(&wheel.slots[l][idx], &moved);
+		wheel.used[l] &= ~(1ULL << idx);
+
+		list_for_each_entry_safe(t, tmp, &moved, list)
+			ruleng_timer_add(t);
+	}
+}
+
+static void ruleng_timer_arm(void)
+{
+	uint64_t next = 0, now = 0, delay = 0;
+
+	if (wheel.count == 0) {
+		uloop_timeout_cancel(&wheel.tick);
+		return;
+	}
+
+	next = list_empty(&wheel.due) ? ruleng_timer_next(UINT64_MAX) : wheel.now;
+
+	if (wheel.tick.pending && wheel.armed <= next)
+		return;
+
+	now = ruleng_clock_now_ms();
+	delay = next > now ? next - now : 0;
+
+	wheel.armed = next;
+	uloop_timeout_set(&wheel.tick, delay > INT_MAX ? INT_MAX : (int) delay);
+}
+
+static void ruleng_timer_tick_cb(struct uloop_timeout *t)
+{
+	(void) t;
+
+	ruleng_timer_run();
+}
+
+void ruleng_timer_set(struct ruleng_timer *t, uint64_t ms)
+{
+	uint64_t now = ruleng_clock_now_ms();
+
+	if (!wheel.init)
+		ruleng_timer_init();
+
+	if (t->pending)
+		ruleng_timer_cancel(t);
+
+	// an empty wheel starts over from now, the clock may have been switched
+	if (wheel.count == 0 && !wheel.running)
+		wheel.now = now;
+
+	t->expires = now + ms;
+	t->pending = true;
+	++wheel.count;
+	ruleng_timer_add(t);
+
+	if (!wheel.running && (!wheel.tick.pending || t->expires < wheel.armed))
+		ruleng_timer_arm();
+}
+
+void ruleng_timer_cancel(struct ruleng_timer *t)
+{
+	if (!t->pending)
+		return;
+
+	list_del(&t->list);
+	t->pending = false;
+
+	if (--wheel.count == 0 && !wheel.running)
+		uloop_timeout_cancel(&wheel.tick);
+}
+
+void ruleng_timer_run(void)
+{
+	uint64_t now = ruleng_clock_now_ms();
+
+	if (!wheel.init || wheel.running)
+		return;
+
+	wheel.running = true;
+
+	for (;;) {
+		int idx = (int) (wheel.now & WHEEL_MASK);
+
+		ruleng_timer_cascade();
+		list_splice_tail_init(&wheel.slots[0][idx], &wheel.due);
+		wheel.used[0] &= ~(1ULL << idx);
+
+		// handlers may set and cancel timers, the due ones included
+		while (!list_empty(&wheel.due)) {
+			struct ruleng_timer *t = list_first_entry(&wheel.due, struct ruleng_timer, list);
+
+			list_del(&t->list);
+			t->pending = false;
+			--wheel.count;
+			t->cb(t);
+		}
+
+		if (wheel.now >= now)
+			break;
+
+		wheel.now = ruleng_timer_next(now);
+	}
+
+	wheel.running = false;
+	ruleng_timer_arm();
+}
+
+uint32_t ruleng_timer_count(void)
+{
+	return wheel.count;
+}
+
+uint64_t ruleng_timer_next_ms(void)
+{
+	if (wheel.count == 0)
+		return UINT64_MAX;
+
+	if (!list_empty(&wheel.due))
+		return wheel.now;
+
+	return ruleng_timer_next(UINT64_MAX);
+}
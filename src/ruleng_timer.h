@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libubox/list.h>
+
+/*
+ * Rule timers: correlation windows, delayed actions, action deadlines and
+ * runtime rule lifetimes. They are kept in a hierarchical timer wheel, so
+ * setting and cancelling one takes constant time however many are live,
+ * and a single uloop timeout wakes the wheel up for the earliest of them.
+ * Times are milliseconds of ruleng_clock. Only used from the uloop thread.
+ */
+struct ruleng_timer;
+
+typedef void (*ruleng_timer_handler)(struct ruleng_timer *t);
+
+struct ruleng_timer {
+	struct list_head list;
+	ruleng_timer_handler cb;
+	uint64_t expires;
+	bool pending;
+};
+
+/* fire 't' in 'ms' milliseconds, rescheduling it when pending */
+void ruleng_timer_set(struct ruleng_timer *t, uint64_t ms);
+
+void ruleng_timer_cancel(struct ruleng_timer *t);
+
+/*
+ * Fire the timers due by now. The wheel runs them on its own under the
+ * system clock; whoever moves a virtual clock calls this after it.
+ */
+void ruleng_timer_run(void);
+
+/* timers pending */
+uint32_t ruleng_timer_count(void);
+
+/*
+ * Time from which the earliest pending timer may be due, UINT64_MAX with
+ * none. A virtual clock moved there and run again reaches the next one.
+ */
+uint64_t ruleng_timer_next_ms(void);
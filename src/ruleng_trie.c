@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "ruleng_trie.h"
+
+struct ruleng_trie_node {
+	/* children, sorted by their label */
+	struct ruleng_trie_node **children;
+	uint16_t n_children;
+	uint16_t size;
+	unsigned char label;
+	void *exact;
+	void *wild;
+};
+
+static struct ruleng_trie_node *ruleng_trie_child(
+  struct ruleng_trie_node *node,
+  unsigned char c,
+  int *pos
+) {
+	int lo = 0, hi = node->n_children;
+
+	// at most one child per byte value, so this is bounded by log2(256)
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (node->children[mid]->label < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (pos)
+		*pos = lo;
+
+	if (lo < node->n_children && node->children[lo]->label == c)
+		return node->children[lo];
+
+	return NULL;
+}
+
+static struct ruleng_trie_node *ruleng_trie_child_add(
+  struct ruleng_trie_node *node,
+  unsigned char c
+) {
+	struct ruleng_trie_node *child = NULL;
+	int pos = 0;
+
+	child = ruleng_trie_child(node, c, &pos);
+
+	if (child)
+		return child;
+
+	if (node->n_children == node->size) {
+		uint16_t size = node->size ? node->size * 2 : 2;
+		struct ruleng_trie_node **children =
+			realloc(node->children, size * sizeof(*children));
+
+		if (children == NULL)
+			return NULL;
+
+		node->children = children;
+		node->size = size;
+	}
+
+	child = calloc(1, sizeof(*child));
+
+	if (child == NULL)
+		return NULL;
+
+	child->label = c;
+	memmove(&node->children[pos + 1], &node->children[pos],
+			(node->n_children - pos) * sizeof(*node->children));
+	node->children[pos] = child;
+	++node->n_children;
+
+	return child;
+}
+
+static bool ruleng_trie_node_empty(struct ruleng_trie_node *node)
+{
+	return node->n_children == 0 && node->exact == NULL && node->wild == NULL;
+}
+
+static void ruleng_trie_node_free(struct ruleng_trie_node *node)
+{
+	for (int i = 0; i < node->n_children; ++i)
+		ruleng_trie_node_free(node->children[i]);
+
+	free(node->children);
+	free(node);
+}
+
+int ruleng_trie_insert(struct ruleng_trie *trie, const char *pattern, void *val)
+{
+	size_t len = strlen(pattern);
+	bool wild = len > 0 && pattern[len - 1] == RULENG_TRIE_WILDCARD;
+	struct ruleng_trie_node *node = NULL;
+
+	if (trie->root == NULL)
+		trie->root = calloc(1, sizeof(*trie->root));
+
+	node = trie->root;
+
+	if (wild)
+		--len;
+
+	// nodes added before a failure stay empty and are dropped on removal
+	for (size_t i = 0; node && i < len; ++i)
+		node = ruleng_trie_child_add(node, (unsigned char) pattern[i]);
+
+	if (node == NULL)
+		return -1;
+
+	if (wild)
+		node->wild = val;
+	else
+		node->exact = val;
+
+	return 0;
+}
+
+static void *ruleng_trie_node_remove(
+  struct ruleng_trie_node *node,
+  const char *pattern,
+  size_t len,
+  bool wild
+) {
+	void *val = NULL;
+
+	if (len == 0) {
+		if (wild) {
+			val = node->wild;
+			node->wild = NULL;
+		} else {
+			val = node->exact;
+			node->exact = NULL;
+		}
+
+		return val;
+	}
+
+	int pos = 0;
+	struct ruleng_trie_node *child =
+		ruleng_trie_child(node, (unsigned char) *pattern, &pos);
+
+	if (child == NULL)
+		return NULL;
+
+	val = ruleng_trie_node_remove(child, pattern + 1, len - 1, wild);
+
+	if (ruleng_trie_node_empty(child)) {
+		ruleng_trie_node_free(child);
+		memmove(&node->children[pos], &node->children[pos + 1],
+				(node->n_children - pos - 1) * sizeof(*node->children));
+		--node->n_children;
+	}
+
+	return val;
+}
+
+void *ruleng_trie_remove(struct ruleng_trie *trie, const char *pattern)
+{
+	size_t len = strlen(pattern);
+	bool wild = len > 0 && pattern[len - 1] == RULENG_TRIE_WILDCARD;
+
+	if (trie->root == NULL)
+		return NULL;
+
+	return ruleng_trie_node_remove(trie->root, pattern, wild ? len - 1 : len, wild);
+}
+
+void ruleng_trie_match(
+  struct ruleng_trie *trie,
+  const char *key,
+  ruleng_trie_cb cb,
+  void *priv
+) {
+	struct ruleng_trie_node *node = trie->root;
+
+	for (const char *p = key; node; ++p) {
+		if (node->wild)
+			cb(node->wild, priv);
+
+		if (*p == '\0') {
+			if (node->exact)
+				cb(node->exact, priv);
+			break;
+		}
+
+		node = ruleng_trie_child(node, (unsigned char) *p, NULL);
+	}
+}
+
+void ruleng_trie_free(struct ruleng_trie *trie)
+{
+	if (trie->root)
+		ruleng_trie_node_free(trie->root);
+
+	trie->root = NULL;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+/* a pattern ending in this character matches every name it is a prefix of */
+#define RULENG_TRIE_WILDCARD '*'
+
+struct ruleng_trie_node;
+
+/* byte-wise prefix trie over event names and wildcard patterns */
+struct ruleng_trie {
+	struct ruleng_trie_node *root;
+};
+
+typedef void (*ruleng_trie_cb)(void *val, void *priv);
+
+/* returns -1 if memory could not be allocated */
+int ruleng_trie_insert(struct ruleng_trie *trie, const char *pattern, void *val);
+
+/* returns the value stored under 'pattern', if any */
+void *ruleng_trie_remove(struct ruleng_trie *trie, const char *pattern);
+
+/*
+ * Call 'cb' for every value whose pattern matches 'key': the wildcard
+ * patterns from the shortest prefix on, then the exact name. The cost only
+ * depends on the length of 'key'.
+ */
+void ruleng_trie_match(
+  struct ruleng_trie *trie,
+  const char *key,
+  ruleng_trie_cb cb,
+  void *priv
+);
+
+void ruleng_trie_free(struct ruleng_trie *trie);
@@ -3,23 +3,49 @@
 #include <ctype.h>
 
 #include <libubus.h>
-#include <regex.h>
 
 #include <libubox/uloop.h>
 #include <libubus.h>
 #include <libubox/blobmsg_json.h>
 #include <libubox/list.h>
+#include <libubox/avl-cmp.h>
 #include <uci.h>
-#include <json-c/json.h>
 
+#include "ruleng_arena.h"
+#include "ruleng_blob.h"
 #include "ruleng_bus.h"
+#include "ruleng_cache.h"
 #include "ruleng_json.h"
+#include "ruleng_object.h"
+#include "ruleng_runtime.h"
+#include "ruleng_timer.h"
+#include "ruleng_trie.h"
+#include "ruleng_watch.h"
 #include "utils.h"
 
+/* an action call waiting for its reply, given up on past its timeout */
+struct ruleng_ubus_req {
+	struct ubus_request req;
+	struct ruleng_timer deadline;
+	struct ubus_context *ubus_ctx;
+};
+
 static void ruleng_ubus_complete_cb(struct ubus_request *req, int ret)
 {
+	struct ruleng_ubus_req *r = container_of(req, struct ruleng_ubus_req, req);
+
 	RULENG_INFO("ubus call completed, ret = %d", ret);
-	free(req);
+	ruleng_timer_cancel(&r->deadline);
+	free(r);
+}
+
+static void ruleng_ubus_deadline_cb(struct ruleng_timer *t)
+{
+	struct ruleng_ubus_req *r = container_of(t, struct ruleng_ubus_req, deadline);
+
+	RULENG_ERR("ubus call got no reply in time, aborted");
+	ubus_abort_request(r->ubus_ctx, &r->req);
+	free(r);
 }
 
 static void ruleng_ubus_data_cb(
@@ -29,311 +55,162 @@ static void ruleng_ubus_data_cb(
 	(void) req;
 	(void) type;
 
+	if (!ruleng_log_enabled(LOG_INFO))
+		return;
+
 	char *json = blobmsg_format_json(msg, true);
 	RULENG_INFO("ubus call response: %s", json);
 	free(json);
 }
 
-static struct blob_attr *ruleng_bus_blob_find_key(
-  struct blob_attr *b,
-  const char *k
-) {
-	struct blob_attr *e = NULL;
-	int r = 0;
+static bool ruleng_bus_is_ref(const char *val)
+{
+	return val[0] == '&';
+}
 
-	blob_for_each_attr(e, b, r) {
-		if (strcmp(k, blobmsg_name(e)) == 0)
-			return e;
+/* add 'val' under 'key', integers are passed on as 32 bits */
+static void ruleng_bus_blob_add_value(
+  struct blob_buf *bb,
+  const char *key,
+  struct blob_attr *val
+) {
+	switch (blobmsg_type(val)) {
+	case BLOBMSG_TYPE_STRING:
+		blobmsg_add_string(bb, key, blobmsg_get_string(val));
+		break;
+	case BLOBMSG_TYPE_BOOL:
+		blobmsg_add_u8(bb, key, blobmsg_get_bool(val));
+		break;
+	case BLOBMSG_TYPE_INT16:
+		blobmsg_add_u32(bb, key, (int16_t) blobmsg_get_u16(val));
+		break;
+	case BLOBMSG_TYPE_INT32:
+		blobmsg_add_u32(bb, key, blobmsg_get_u32(val));
+		break;
+	case BLOBMSG_TYPE_INT64:
+		blobmsg_add_u32(bb, key, (uint32_t) blobmsg_get_u64(val));
+		break;
+	case BLOBMSG_TYPE_TABLE:
+	case BLOBMSG_TYPE_ARRAY:
+		blobmsg_add_field(bb, blobmsg_type(val), key,
+						  blobmsg_data(val), blobmsg_data_len(val));
+		break;
+	default:
+		break;
 	}
-	return NULL;
 }
 
-static bool ruleng_bus_blob_compare_primitive(
-  struct blob_attr *a,
-  struct blob_attr *b,
-  bool regex
+/* print a value the way it is put on a command line */
+static bool ruleng_bus_blob_format_value(
+  char *buf,
+  size_t size,
+  struct blob_attr *val
 ) {
-	bool rc = false;
-	regex_t regex_exp;
-	int reti;
-	char msgbuf[100];
-
-	switch(blobmsg_type(a)) {
-		case BLOBMSG_TYPE_STRING:
-			if (!regex) {
-				if (strcmp(blobmsg_get_string(a), blobmsg_get_string(b)) != 0)
-					goto exit;
-			} else {
-				reti = regcomp(&regex_exp, blobmsg_get_string(a), 0);
-
-				if (reti) {
-					RULENG_ERR("Could not compile regex\n");
-					goto exit;
-				}
-
-				reti = regexec(&regex_exp, blobmsg_get_string(b), 0, NULL, 0);
-
-				if (!reti) {
-					RULENG_INFO("Match");
-				} else if (reti == REG_NOMATCH) {
-					regfree(&regex_exp);
-					goto exit;
-				} else {
-					regerror(reti, &regex_exp, msgbuf, sizeof(msgbuf));
-					RULENG_ERR("Regex match failed: %s\n", msgbuf);
-					regfree(&regex_exp);
-					goto exit;
-				}
-
-				regfree(&regex_exp);
-			}
-			break;
-		case BLOBMSG_TYPE_INT64:
-			if (blobmsg_get_u64(a) != blobmsg_get_u64(b))
-				goto exit;
-			break;
-		case BLOBMSG_TYPE_INT32:
-			if (blobmsg_get_u32(a) != blobmsg_get_u32(b))
-				goto exit;
-			break;
-		case BLOBMSG_TYPE_INT16:
-			if (blobmsg_get_u16(a) != blobmsg_get_u16(b))
-				goto exit;
-			break;
-		case BLOBMSG_TYPE_BOOL:
-			if (blobmsg_get_bool(a) != blobmsg_get_bool(b))
-				goto exit;
-			break;
-		default:
-			goto exit;
+	char *json = NULL;
+
+	switch (blobmsg_type(val)) {
+	case BLOBMSG_TYPE_STRING:
+		snprintf(buf, size, "%s", blobmsg_get_string(val));
+		break;
+	case BLOBMSG_TYPE_BOOL:
+		snprintf(buf, size, "%d", blobmsg_get_bool(val));
+		break;
+	case BLOBMSG_TYPE_INT16:
+		snprintf(buf, size, "%d", (int16_t) blobmsg_get_u16(val));
+		break;
+	case BLOBMSG_TYPE_INT32:
+		snprintf(buf, size, "%d", (int32_t) blobmsg_get_u32(val));
+		break;
+	case BLOBMSG_TYPE_INT64:
+		snprintf(buf, size, "%lld", (long long) blobmsg_get_u64(val));
+		break;
+	case BLOBMSG_TYPE_TABLE:
+	case BLOBMSG_TYPE_ARRAY:
+		json = blobmsg_format_json(val, true);
+		if (json == NULL)
+			return false;
+		snprintf(buf, size, "%s", json);
+		free(json);
+		break;
+	default:
+		return false;
 	}
 
-	rc = true;
-exit:
-	return rc;
+	return true;
 }
 
-static bool ruleng_bus_blob_compare_array(
-  struct blob_attr *a,
-  struct blob_attr *b
-) {
-	char *as = blobmsg_format_json(a, true);
-	char *bs = blobmsg_format_json(b, true);
+static void prepare_ubus_args(struct blob_buf *bb, struct blob_attr *args, struct blob_attr *msg)
+{
+	struct blob_attr *cur = NULL, *value = NULL;
+	int rem = 0;
 
-	bool rc = !strcmp(as, bs);
+	if (bb == NULL || args == NULL)
+		return;
 
-	free(as);
-	free(bs);
+	blobmsg_for_each_attr(cur, args, rem) {
+		value = cur;
 
-	return rc;
-}
+		if (blobmsg_type(cur) == BLOBMSG_TYPE_STRING &&
+			ruleng_bus_is_ref(blobmsg_get_string(cur)))
+			value = ruleng_blob_extract_value(blobmsg_get_string(cur), msg);
 
-static bool ruleng_bus_blob_check_subset(
-  struct blob_attr *a,
-  struct blob_attr *b,
-  bool regex
-) {
-	bool rc = false;
-	struct blob_attr *e = NULL;
-	int r = 0;
-
-	blob_for_each_attr(e, a, r) {
-		struct blob_attr *k = ruleng_bus_blob_find_key(b, blobmsg_name(e));
-
-		if (k == NULL || blobmsg_type(e) != blobmsg_type(k))
-			goto exit;
-
-		switch(blobmsg_type(e)) {
-			case BLOBMSG_TYPE_ARRAY:
-				if (ruleng_bus_blob_compare_array(e, k) == false)
-					goto exit;
-				break;
-			case BLOBMSG_TYPE_TABLE:
-				goto exit;
-			default:
-				if (ruleng_bus_blob_compare_primitive(e, k, regex) == false)
-					goto exit;
-		}
-	}
+		if (!value)
+			continue;
 
-	rc = true;
-exit:
-	return rc;
+		ruleng_bus_blob_add_value(bb, blobmsg_name(cur), value);
+	}
 }
 
-static struct json_object* extract_arg_value(struct json_object *val, struct json_object *json_data)
+/* append 'arg' to a command line, separated by a space */
+static char *ruleng_bus_cmd_append(char *cmd, const char *arg)
 {
-	char value[1024] = {0};
-
-	if (val == NULL)
-		return NULL;
+	size_t len = cmd ? strlen(cmd) : 0;
+	size_t n = strlen(arg);
+	char *p = ruleng_arena_realloc(cmd, cmd ? len + 1 : 0, len + n + 2);
 
-	snprintf(value, sizeof(value), "%s", json_object_get_string(val));
-	if (value[0] == '&') {
-		if (json_data == NULL)
-			return NULL;
-
-		// get the actual value from msg and add in blob
-		struct json_object *data_obj = json_data;
-		char *tmp = strstr(value, "->");
-		if (tmp == NULL)
-			return NULL;
-
-		char *tok = strtok_r(tmp+2, ".", &tmp);
-		while (tok != NULL) {
-			// check if an array like abc[4]
-			char *arr = strchr(tok, '[');
-			if (arr != NULL) {
-				char obj_name[64] = {0};
-				int obj_len = arr - tok + 1;
-				snprintf(obj_name, obj_len, "%s", tok);
-
-				// get the index
-				unsigned int index = 0;
-				if (1 != sscanf(arr, "[%u]", &index))
-					return NULL;
-
-				struct json_object *tmp_obj = NULL;
-				json_object_object_get_ex(data_obj, obj_name, &tmp_obj);
-				if (!tmp_obj || !json_object_is_type(tmp_obj, json_type_array))
-					return NULL;
-
-				data_obj = json_object_array_get_idx(tmp_obj, index);
-			} else {
-				struct json_object *tmp_obj = NULL;
-				json_object_object_get_ex(data_obj, tok, &tmp_obj);
-				if (!tmp_obj)
-					return NULL;
-
-				data_obj = tmp_obj;
-			}
-
-			tok = strtok_r(NULL, ".", &tmp);
-		}
+	if (p == NULL)
+		return cmd;
 
-		return data_obj;
-	}
+	p[len] = ' ';
+	memcpy(p + len + 1, arg, n + 1);
 
-	return val;
+	return p;
 }
 
-static void prepare_ubus_args(struct blob_buf *bb, struct json_object *args, struct json_object *msg_data)
+/* the "key=value" environment assignments a command line starts with */
+static char *prepare_ubus_envs(struct blob_attr *envs, struct blob_attr *msg)
 {
-	struct json_object *value = NULL;
-	if (bb == NULL || args == NULL)
-		return;
+	char env_param[2048] = {0};
+	char value[2048] = {0};
+	struct blob_attr *cur = NULL, *val = NULL;
+	char *cmd = NULL;
+	int rem = 0;
 
-	json_object_object_foreach(args, key, val) {
-		enum json_type type = json_object_get_type(val);
-		switch (type) {
-		case json_type_string:
-			value = extract_arg_value(val, msg_data);
-			if (!value)
-				continue;
-
-			enum json_type val_type = json_object_get_type(value);
-			switch (val_type) {
-			case json_type_string:
-				blobmsg_add_string(bb, key, json_object_get_string(value));
-				break;
-			case json_type_boolean:
-				blobmsg_add_u8(bb, key, json_object_get_boolean(value));
-				break;
-			case json_type_int:
-				blobmsg_add_u32(bb, key, json_object_get_int(value));
-				break;
-			case json_type_object:
-			case json_type_array:
-				blobmsg_add_json_element(bb, key, value);
-				break;
-			default:
-				break;
-			}
+	blobmsg_for_each_attr(cur, envs, rem) {
+		val = cur;
 
+		switch (blobmsg_type(cur)) {
+		case BLOBMSG_TYPE_STRING:
+			if (ruleng_bus_is_ref(blobmsg_get_string(cur)))
+				val = ruleng_blob_extract_value(blobmsg_get_string(cur), msg);
 			break;
-		case json_type_boolean:
-			blobmsg_add_u8(bb, key, json_object_get_boolean(val));
-			break;
-		case json_type_int:
-			blobmsg_add_u32(bb, key, json_object_get_int(val));
-			break;
-		case json_type_object:
-		case json_type_array:
-			blobmsg_add_json_element(bb, key, val);
+		case BLOBMSG_TYPE_TABLE:
+		case BLOBMSG_TYPE_ARRAY:
+			// only values taken from the event may be objects
+			val = NULL;
 			break;
 		default:
 			break;
 		}
-	}
-}
 
-static struct json_object* prepare_ubus_envs(
-  struct json_object *envs,
-  struct json_object *msg_data
-) {
-	char env_param[2048] = {0};
-	struct json_object *value = NULL;
-
-	if (!envs)
-		return NULL;
-
-	json_object *jarray = json_object_new_array();
-	if (!jarray)
-		return NULL;
+		if (!val || !ruleng_bus_blob_format_value(value, sizeof(value), val))
+			continue;
 
-	json_object_object_foreach(envs, key, val) {
-		json_object *jstring = NULL;
-		enum json_type type = json_object_get_type(val);
-		switch (type) {
-		case json_type_string:
-			value = extract_arg_value(val, msg_data);
-			if (!value)
-				continue;
-
-			enum json_type val_type = json_object_get_type(value);
-			switch (val_type) {
-			case json_type_string:
-				snprintf(env_param, sizeof(env_param), "%s=%s", key, json_object_get_string(value));
-				jstring = json_object_new_string(env_param);
-				break;
-			case json_type_boolean:
-				snprintf(env_param, sizeof(env_param), "%s=%d", key, json_object_get_boolean(value));
-			jstring = json_object_new_string(env_param);
-				break;
-			case json_type_int:
-				snprintf(env_param, sizeof(env_param), "%s=%d", key, json_object_get_int(value));
-				jstring = json_object_new_string(env_param);
-				break;
-			case json_type_object:
-			case json_type_array:
-				snprintf(env_param, sizeof(env_param), "%s=%s", key, json_object_to_json_string(value));
-				jstring = json_object_new_string(env_param);
-				break;
-			default:
-				break;
-			}
-
-			if (jstring)
-				json_object_array_add(jarray, jstring);
-			break;
-		case json_type_boolean:
-			snprintf(env_param, sizeof(env_param), "%s=%d", key, json_object_get_boolean(val));
-			jstring = json_object_new_string(env_param);
-			if (jstring)
-				json_object_array_add(jarray, jstring);
-			break;
-		case json_type_int:
-			snprintf(env_param, sizeof(env_param), "%s=%d", key, json_object_get_int(val));
-			jstring = json_object_new_string(env_param);
-			if (jstring)
-				json_object_array_add(jarray, jstring);
-			break;
-		default:
-			break;
-		}
+		snprintf(env_param, sizeof(env_param), "%s=%s", blobmsg_name(cur), value);
+		cmd = ruleng_bus_cmd_append(cmd, env_param);
 	}
 
-	return jarray;
+	return cmd;
 }
 
 void ruleng_ubus_call(
@@ -342,51 +219,38 @@ void ruleng_ubus_call(
   struct blob_attr *msg
 ) {
 	uint32_t id;
-	struct json_object *msg_data = NULL;
 
 	if (ubus_lookup_id(ubus_ctx, r->action.object, &id)) {
 		RULENG_ERR("%s: failed to find ubus object", r->action.object);
 		goto exit;
 	}
 
-	struct blob_buf buff = {0};
-	blob_buf_init(&buff, 0);
-
-	if (msg) {
-		char *data = blobmsg_format_json(msg, true);
-		if (data) {
-			msg_data = json_tokener_parse(data);
-			free(data);
-		}
-
-		if (msg_data && !json_object_is_type(msg_data, json_type_object)) {
-			json_object_put(msg_data);
-			msg_data = NULL;
-		}
-	}
+	struct blob_buf buff;
+	ruleng_arena_blob_buf_init(&buff, 0);
 
 	// Add argumets
-	prepare_ubus_args(&buff, r->action.args, msg_data);
-
-	if (msg_data)
-		json_object_put(msg_data);
+	prepare_ubus_args(&buff, r->action.args, msg);
 
-	struct ubus_request *req = calloc(1, sizeof(*req));
+	// the request is completed after the event is done with
+	struct ruleng_ubus_req *req = ruleng_arena_promote(NULL, sizeof(*req));
 
 	if (req == NULL) {
 		RULENG_ERR("error allocating ubus request");
-		goto cleanup_buff;
+		goto exit;
 	}
 
-	ubus_invoke_async(ubus_ctx, id, r->action.name, buff.head, req);
+	ubus_invoke_async(ubus_ctx, id, r->action.name, buff.head, &req->req);
+
+	req->req.complete_cb = ruleng_ubus_complete_cb;
+	req->req.data_cb = ruleng_ubus_data_cb;
+	req->ubus_ctx = ubus_ctx;
+	req->deadline.cb = ruleng_ubus_deadline_cb;
 
-	req->complete_cb = ruleng_ubus_complete_cb;
-	req->data_cb = ruleng_ubus_data_cb;
+	if (r->action.timeout > 0)
+		ruleng_timer_set(&req->deadline, (uint64_t) r->action.timeout * 1000);
 
-	ubus_complete_request_async(ubus_ctx, req);
+	ubus_complete_request_async(ubus_ctx, &req->req);
 
-cleanup_buff:
-	blob_buf_free(&buff);
 exit:
 	return;
 }
@@ -397,18 +261,17 @@ void ruleng_cli_call(
   struct blob_attr *msg
 )
 {
-	char tmp[5096] = {0};
+	char value[5096] = {0};
 	char *action = NULL;
 	char *tok = NULL;
 	char *cmd = NULL;
-	struct json_object *msg_data = NULL;
 
 	if (!r->action.object) {
 		RULENG_DEBUG("No command to execute");
 		return;
 	}
 
-	action = strdup(r->action.object);
+	action = ruleng_arena_strdup(r->action.object);
 	if (!action) {
 		RULENG_ERR("Internal failure");
 		return;
@@ -416,84 +279,28 @@ void ruleng_cli_call(
 
 	RULENG_DEBUG("action: %s", action);
 
-	if (msg) {
-		char *data = blobmsg_format_json(msg, true);
-		if (data) {
-			msg_data = json_tokener_parse(data);
-			free(data);
-		}
-
-		if (msg_data && !json_object_is_type(msg_data, json_type_object)) {
-			json_object_put(msg_data);
-			msg_data = NULL;
-		}
-	}
-
 	// Add environment variables if any
-	struct json_object *jarray = prepare_ubus_envs(r->action.envs, msg_data);
-	if (jarray) {
-		size_t i = 0;
-		for (; i < json_object_array_length(jarray); i++) {
-			struct json_object *arr_ob = json_object_array_get_idx(jarray, i);
-			const char *env = json_object_get_string(arr_ob);
-			if (!env)
-				continue;
-
-			snprintf(tmp, sizeof(tmp), "%s %s", cmd ? cmd : "", env);
-
-			if (cmd)
-				free(cmd);
-			cmd = strdup(tmp);
-		}
-		json_object_put(jarray);
-	}
+	cmd = prepare_ubus_envs(r->action.envs, msg);
 
 	// Add arguments if any
 	char *ptr = strtok_r(action, " ", &tok);
 	while (ptr) {
-		struct json_object *arg = json_object_new_string(ptr);
-		if (!arg) {
-			continue;
-		}
+		const char *arg = ptr;
 
-		struct json_object *value = extract_arg_value(arg, msg_data);
-		if (!value) {
-			ptr = strtok_r(NULL, " ", &tok);
-			json_object_put(arg);
-			continue;
-		}
+		if (ruleng_bus_is_ref(ptr)) {
+			struct blob_attr *val = ruleng_blob_extract_value(ptr, msg);
 
-		enum json_type val_type = json_object_get_type(value);
-		switch (val_type) {
-		case json_type_string:
-			snprintf(tmp, sizeof(tmp), "%s %s", cmd ? cmd : "", json_object_get_string(value));
-			break;
-		case json_type_boolean:
-			snprintf(tmp, sizeof(tmp), "%s %d", cmd ? cmd : "", json_object_get_boolean(value));
-			break;
-		case json_type_int:
-			snprintf(tmp, sizeof(tmp), "%s %d", cmd ? cmd : "", json_object_get_int(value));
-			break;
-		case json_type_object:
-		case json_type_array:
-			snprintf(tmp, sizeof(tmp), "%s %s", cmd ? cmd : "", json_object_to_json_string(value));
-			break;
-		default:
-			break;
+			arg = value;
+			if (!val || !ruleng_bus_blob_format_value(value, sizeof(value), val))
+				arg = NULL;
 		}
 
-		if (cmd)
-			free(cmd);
-		cmd = strdup(tmp);
+		if (arg)
+			cmd = ruleng_bus_cmd_append(cmd, arg);
 
 		ptr = strtok_r(NULL, " ", &tok);
-		json_object_put(arg);
 	}
 
-	free(action);
-	if (msg_data)
-		json_object_put(msg_data);
-
 	if (!cmd) {
 		RULENG_DEBUG("Command is empty");
 		return;
@@ -503,7 +310,6 @@ void ruleng_cli_call(
 
 	int fd[2];
 	if (pipe(fd) < 0) {
-		free(cmd);
 		RULENG_ERR("Pipe error");
 		return;
 	}
@@ -512,7 +318,6 @@ void ruleng_cli_call(
 
 	if (child == -1) {
 		RULENG_ERR("Fork error");
-		free(cmd);
 		return;
 	} else if (child == 0) {
 		// child process
@@ -551,7 +356,28 @@ void ruleng_cli_call(
 	close(fd[0]);
 	write(fd[1], cmd, strlen(cmd));
 	close(fd[1]);
-	free(cmd);
+}
+
+static ruleng_bus_action_hook action_hook;
+static void *action_hook_priv;
+
+void ruleng_bus_set_action_hook(ruleng_bus_action_hook hook, void *priv)
+{
+	action_hook = hook;
+	action_hook_priv = priv;
+}
+
+bool ruleng_bus_action_hook_run(
+  struct ubus_context *ubus_ctx,
+  const char *rule,
+  const struct ruleng_rule *action,
+  struct blob_attr *msg
+) {
+	if (action_hook == NULL)
+		return false;
+
+	action_hook(action_hook_priv, ubus_ctx, rule, action, msg);
+	return true;
 }
 
 bool ruleng_bus_take_action(
@@ -559,7 +385,90 @@ bool ruleng_bus_take_action(
   struct blob_attr *b,
   bool regex
 ) {
-	return ruleng_bus_blob_check_subset(a, b, regex);
+	return ruleng_blob_check_subset(a, b, regex);
+}
+
+static void ruleng_bus_rules_dispatch(
+  struct ubus_context *ubus_ctx,
+  struct ruleng_bus_event *ev,
+  const char *type,
+  struct blob_attr *msg
+) {
+	struct ruleng_rule *r = NULL;
+
+	list_for_each_entry(r, &ev->rules, index) {
+		if (!ruleng_bus_take_action(r->event.args, msg, false))
+			continue;
+
+		ruleng_log_set_rule(r->id);
+		RULENG_INFO("%s: found matching event name and data, doing ubus call", type);
+
+		if (!ruleng_bus_action_hook_run(ubus_ctx, NULL, r, msg))
+			ruleng_ubus_call(ubus_ctx, r, msg);
+	}
+
+	ruleng_log_set_rule(0);
+}
+
+struct ruleng_bus_dispatch {
+	struct ubus_context *ubus_ctx;
+	const char *type;
+	struct blob_attr *msg;
+	int engines;
+	/* events with recipe conditions, run together once all are found */
+	struct ruleng_bus_event **evs;
+	int n_evs;
+};
+
+static void ruleng_bus_dispatch_cb(void *val, void *priv)
+{
+	struct ruleng_bus_event *ev = val;
+	struct ruleng_bus_dispatch *d = priv;
+
+	if (ev->refs == 0)
+		return;
+
+	if (d->engines & RULENG_BUS_DISPATCH_RULES)
+		ruleng_bus_rules_dispatch(d->ubus_ctx, ev, d->type, d->msg);
+
+	if (!(d->engines & RULENG_BUS_DISPATCH_JSON) || list_empty(&ev->json_conds))
+		return;
+
+	if (d->evs)
+		d->evs[d->n_evs++] = ev;
+	else
+		ruleng_json_event_dispatch(d->ubus_ctx, &ev, 1, d->type, d->msg);
+}
+
+void ruleng_bus_dispatch(
+  struct ruleng_bus_ctx *ctx,
+  struct ubus_context *ubus_ctx,
+  const char *type,
+  struct blob_attr *msg,
+  int engines
+) {
+	struct ruleng_bus_dispatch d = {
+		.ubus_ctx = ubus_ctx,
+		.type = type,
+		.msg = msg,
+		.engines = engines,
+	};
+
+	if (ctx->capture)
+		ruleng_capture_write(ctx->capture, type, msg, engines);
+
+	// the steps of a SEQUENCE may be under both a pattern and a name, see
+	// ruleng_json_event_dispatch(); a name matches at most one pattern
+	// per prefix, and itself
+	if (engines & RULENG_BUS_DISPATCH_JSON)
+		d.evs = ruleng_arena_alloc((strlen(type) + 2) * sizeof(*d.evs));
+
+	ruleng_trie_match(&ctx->trie, type, ruleng_bus_dispatch_cb, &d);
+
+	if (d.n_evs)
+		ruleng_json_event_dispatch(ubus_ctx, d.evs, d.n_evs, type, msg);
+
+	ruleng_arena_reset();
 }
 
 void ruleng_event_cb(
@@ -568,156 +477,990 @@ void ruleng_event_cb(
   const char *type,
   struct blob_attr *msg
 ) {
-	char *data = blobmsg_format_json(msg, true);
-	RULENG_INFO("{ \"%s\": %s }\n", type, data);
-	free(data);
+	ruleng_log_event_begin();
+
+	if (ruleng_log_enabled(LOG_INFO)) {
+		char *data = blobmsg_format_json(msg, true);
+		RULENG_INFO("{ \"%s\": %s }", type, data);
+		free(data);
+	}
 
 	struct ruleng_bus_ctx *ctx =
 		container_of(handler, struct ruleng_bus_ctx, handler);
 
-	struct ruleng_rule *r = NULL;
+	ruleng_bus_dispatch(ctx, ubus_ctx, type, msg, RULENG_BUS_DISPATCH_RULES);
+}
 
-	list_for_each_entry(r, &ctx->rules, list) {
-		if (strcmp(r->event.name, type) != 0)
-			continue;
+static void ruleng_bus_event_cb(
+  struct ubus_context *ubus_ctx,
+  struct ubus_event_handler *handler,
+  const char *type,
+  struct blob_attr *msg
+) {
+	struct ruleng_bus_sub *sub =
+		container_of(handler, struct ruleng_bus_sub, handler);
 
-		struct blob_buf eargs = {0};
-		blob_buf_init(&eargs, 0);
-		blobmsg_add_object(&eargs, r->event.args);
+	ruleng_log_event_begin();
 
-		bool match = false;
-		match = ruleng_bus_take_action(eargs.head, msg, false);
+	if (ruleng_log_enabled(LOG_INFO)) {
+		char *data = blobmsg_format_json(msg, true);
+		RULENG_INFO("{ \"%s\": %s }", type, data);
+		free(data);
+	}
 
-		if (match == false) {
-			blob_buf_free(&eargs);
-			continue;
-		}
+	ruleng_bus_dispatch(sub->ctx, ubus_ctx, type, msg,
+						RULENG_BUS_DISPATCH_RULES | RULENG_BUS_DISPATCH_JSON);
+}
 
-		RULENG_INFO("%s: found matching event name and data, doing ubus call", type);
-		blob_buf_free(&eargs);
+/* whether events matching 'name' are all delivered through 'pattern' */
+static bool ruleng_bus_pattern_covers(const char *pattern, const char *name)
+{
+	size_t len = strlen(pattern);
 
-		ruleng_ubus_call(ubus_ctx, r, msg);
-	}
+	if (len == 0 || pattern[len - 1] != RULENG_TRIE_WILDCARD)
+		return false;
 
-	return;
+	return strncmp(pattern, name, len - 1) == 0;
 }
 
-int ruleng_bus_register_events(
+static void ruleng_bus_event_free(
   struct ruleng_bus_ctx *ctx,
-  char *rules,
-  enum ruleng_bus_rc *rc
+  struct ruleng_bus_event *ev
 ) {
-	int listeners = 0;
-	*rc = RULENG_BUS_OK;
-	INIT_LIST_HEAD(&ctx->rules);
+	ruleng_trie_remove(&ctx->trie, ev->avl.key);
+	avl_delete(&ctx->events, &ev->avl);
+	free(ev);
+}
 
-	if (ruleng_rules_get(ctx->com_ctx, &ctx->rules, rules)
-		!= RULENG_RULES_OK) {
-		*rc = RULENG_BUS_ERR_RULES_GET;
-		goto exit;
+static struct ruleng_bus_sub *ruleng_bus_sub_new(struct ruleng_bus_ctx *ctx)
+{
+	struct ruleng_bus_sub *sub = calloc(1, sizeof(*sub));
+
+	if (sub == NULL) {
+		RULENG_ERR("failed to allocate event handler");
+		return NULL;
 	}
 
-	ctx->handler.cb = ruleng_event_cb;
-	struct ruleng_rule *r = NULL;
+	sub->ctx = ctx;
+	sub->handler.cb = ruleng_bus_event_cb;
+	INIT_LIST_HEAD(&sub->events);
 
-	list_for_each_entry(r, &ctx->rules, list) {
-		if (ubus_register_event_handler(ctx->ubus_ctx,
-			&ctx->handler, r->event.name)) {
-			RULENG_ERR("failed to register event handler");
-			*rc = RULENG_BUS_ERR_REGISTER_EVENT;
-			goto exit;
-		}
+	return sub;
+}
 
-		++listeners;
-	}
+/* register 'name' on the handler object of 'sub', unless the events are fed in */
+static int ruleng_bus_sub_add(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_bus_sub *sub,
+  const char *name
+) {
+	if (ctx->detached)
+		return 0;
 
-	INIT_LIST_HEAD(&ctx->json_rules);
-	*rc = ruleng_process_json(ctx->com_ctx, &ctx->json_rules, rules);
-	ctx->json_handler.cb = ruleng_event_json_cb;
+	return ubus_register_event_handler(ctx->ubus_ctx, &sub->handler, name);
+}
 
-	//Register for ubus events here
-	struct ruleng_json_rule *jr = NULL;
+/* removing the handler object drops every name registered on it */
+static void ruleng_bus_sub_remove(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_bus_sub *sub
+) {
+	if (sub->handler.obj.id)
+		ubus_unregister_event_handler(ctx->ubus_ctx, &sub->handler);
 
-	list_for_each_entry(jr, &ctx->json_rules, list) {
-		for(int i=0; i<B_COUNT(jr->rules_bitmask); ++i) {
-			const char *event_name = get_json_string_object(
-									 	json_object_array_get_idx(
-											 jr->event.args, i
-										),
-									 	JSON_EVENT_FIELD);
+	if (ctx->sub == sub)
+		ctx->sub = NULL;
 
-			if (!event_name)
-				continue;
+	if (sub->list.next)
+		list_del(&sub->list);
+
+	free(sub);
+}
 
-			RULENG_INFO("Register ubus event[%s]", event_name);
+/* release a handler together with every event delivered through it */
+static void ruleng_bus_sub_free(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_bus_sub *sub
+) {
+	struct ruleng_bus_event *ev = NULL, *tmp = NULL;
 
-			if (ubus_register_event_handler(ctx->ubus_ctx,
-				&ctx->json_handler, event_name)) {
-				RULENG_ERR("failed to register event handler");
-				*rc = RULENG_BUS_ERR_REGISTER_EVENT;
-				goto exit;
-			}
+	// names covered by a pattern of this handler go first, then the patterns
+	avl_for_each_element_safe(&ctx->events, ev, avl, tmp) {
+		if (ev->sub == NULL && ev->cover->sub == sub)
+			ruleng_bus_event_free(ctx, ev);
+	}
 
-			++listeners;
-		}
+	list_for_each_entry_safe(ev, tmp, &sub->events, list) {
+		RULENG_INFO("Unregister ubus event[%s]", (const char *) ev->avl.key);
+		ruleng_bus_event_free(ctx, ev);
 	}
 
-exit:
-	return listeners;
+	ruleng_bus_sub_remove(ctx, sub);
 }
 
-enum ruleng_bus_rc ruleng_bus_init(
-  struct ruleng_bus_ctx **ctx,
-  struct ruleng_rules_ctx *com_ctx,
-  char *rules, const char *sock
+/*
+ * ubusd cannot drop a single name from a handler object, so names no rule
+ * refers to anymore stay registered and are still delivered. Move the names
+ * in use over to a new handler object and remove the old one with the rest.
+ */
+static void ruleng_bus_sub_rotate(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_bus_sub *sub
 ) {
-	enum ruleng_bus_rc rc = RULENG_BUS_OK;
-	*ctx = calloc(1, sizeof(struct ruleng_bus_ctx));
+	struct ruleng_bus_sub *new = ruleng_bus_sub_new(ctx);
+	struct ruleng_bus_event *ev = NULL, *tmp = NULL;
 
-	if (*ctx == NULL) {
-		RULENG_ERR("error allocating main bus context");
-		rc = RULENG_BUS_ERR_ALLOC;
-		goto exit;
+	if (new == NULL)
+		return;
+
+	list_for_each_entry(ev, &sub->events, list) {
+		if (ev->users == 0)
+			continue;
+
+		if (ruleng_bus_sub_add(ctx, new, (const char *) ev->avl.key))
+			goto cleanup_new;
 	}
 
-	struct ruleng_bus_ctx *_ctx = *ctx;
-	struct ubus_context *ubus_ctx = ubus_connect(sock);
+	// nothing can fail from here on
+	avl_for_each_element_safe(&ctx->events, ev, avl, tmp) {
+		if (ev->sub == NULL && ev->cover->sub == sub && ev->cover->users == 0)
+			ruleng_bus_event_free(ctx, ev);
+	}
 
-	if (ubus_ctx == NULL) {
-		RULENG_ERR("error ubus connect: %s", sock);
-		rc = RULENG_BUS_ERR_CONNECT;
-		goto cleanup_ctx;
+	list_for_each_entry_safe(ev, tmp, &sub->events, list) {
+		if (ev->users > 0) {
+			ev->sub = new;
+			list_move_tail(&ev->list, &new->events);
+			continue;
+		}
+
+		RULENG_INFO("Unregister ubus event[%s]", (const char *) ev->avl.key);
+		list_del(&ev->list);
+		ruleng_bus_event_free(ctx, ev);
 	}
 
-	_ctx->com_ctx = com_ctx;
-	_ctx->ubus_ctx = ubus_ctx;
-	ruleng_bus_register_events(_ctx, rules, &rc);
+	new->live = sub->live;
 
-	if (rc != RULENG_BUS_OK)
-		goto cleanup_bus_ctx;
+	if (ctx->sub == sub)
+		ctx->sub = new;
 
-	goto exit;
+	ruleng_bus_sub_remove(ctx, sub);
+	list_add_tail(&new->list, &ctx->subs);
+	return;
 
-cleanup_bus_ctx:
-	ubus_free(ubus_ctx);
-cleanup_ctx:
-	free(_ctx);
-exit:
-	return rc;
+cleanup_new:
+	RULENG_ERR("failed to register event handler");
+	ruleng_bus_sub_remove(ctx, new);
 }
 
-void ruleng_bus_uloop_run(struct ruleng_bus_ctx *ctx)
+/*
+ * Drop the handler objects none of whose subscriptions is referenced, and
+ * renew those with at least as many stale names as names in use, so each
+ * stale name costs at most one registration later on.
+ */
+static void ruleng_bus_subs_prune(struct ruleng_bus_ctx *ctx)
 {
-	uloop_init();
-	ubus_add_uloop(ctx->ubus_ctx);
+	struct ruleng_bus_sub *sub = NULL, *tmp = NULL;
+	struct ruleng_bus_event *ev = NULL, *next = NULL;
+
+	// names covered by a pattern are not registered on their own
+	avl_for_each_element_safe(&ctx->events, ev, avl, next) {
+		if (ev->sub == NULL && ev->refs == 0)
+			ruleng_bus_event_free(ctx, ev);
+	}
+
+	list_for_each_entry_safe(sub, tmp, &ctx->subs, list) {
+		int stale = 0;
+
+		if (sub->live == 0) {
+			ruleng_bus_sub_free(ctx, sub);
+			continue;
+		}
+
+		list_for_each_entry(ev, &sub->events, list) {
+			if (ev->users == 0)
+				++stale;
+		}
+
+		if (stale >= sub->live)
+			ruleng_bus_sub_rotate(ctx, sub);
+	}
+}
+
+static enum ruleng_bus_rc ruleng_bus_event_register(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_bus_event *ev
+) {
+	struct ruleng_bus_sub *sub = ctx->sub;
+	const char *name = ev->avl.key;
+
+	if (sub == NULL) {
+		sub = ruleng_bus_sub_new(ctx);
+
+		if (sub == NULL)
+			return RULENG_BUS_ERR_ALLOC;
+
+		list_add_tail(&sub->list, &ctx->subs);
+		ctx->sub = sub;
+	}
+
+	RULENG_INFO("Register ubus event[%s]", name);
+
+	/*
+	 * Only the first name adds the handler object, every further name
+	 * registered on it costs a single round trip to ubusd.
+	 */
+	if (ruleng_bus_sub_add(ctx, sub, name)) {
+		RULENG_ERR("failed to register event handler");
+		return RULENG_BUS_ERR_REGISTER_EVENT;
+	}
+
+	ev->sub = sub;
+	ev->cover = ev;
+	list_add_tail(&ev->list, &sub->events);
+
+	return RULENG_BUS_OK;
+}
+
+/*
+ * ubusd delivers an event once per matching registration, so registrations
+ * must not overlap. A pattern covering names registered before moves all
+ * subscriptions over to a new handler without those names.
+ */
+static enum ruleng_bus_rc ruleng_bus_event_resubscribe(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_bus_event *pattern
+) {
+	struct ruleng_bus_sub *sub = NULL, *old = NULL, *tmp = NULL;
+	struct ruleng_bus_event *ev = NULL;
+	const char *name = pattern->avl.key;
+
+	sub = ruleng_bus_sub_new(ctx);
+
+	if (sub == NULL)
+		return RULENG_BUS_ERR_ALLOC;
+
+	RULENG_INFO("Register ubus event[%s], resubscribing", name);
+
+	if (ruleng_bus_sub_add(ctx, sub, name))
+		goto cleanup_sub;
+
+	avl_for_each_element(&ctx->events, ev, avl) {
+		if (ev->sub == NULL || ruleng_bus_pattern_covers(name, ev->avl.key))
+			continue;
+
+		if (ruleng_bus_sub_add(ctx, sub, (const char *) ev->avl.key))
+			goto cleanup_sub;
+	}
+
+	// nothing can fail from here on
+	avl_for_each_element(&ctx->events, ev, avl) {
+		if (ruleng_bus_pattern_covers(name, ev->avl.key)) {
+			ev->sub = NULL;
+			ev->cover = pattern;
+			ev->users = 0;
+
+			if (ev->refs > 0)
+				++pattern->users;
+
+			continue;
+		}
+
+		if (ev->sub == NULL)
+			continue;
+
+		ev->sub = sub;
+		list_add_tail(&ev->list, &sub->events);
+
+		if (ev->users > 0)
+			++sub->live;
+	}
+
+	list_for_each_entry_safe(old, tmp, &ctx->subs, list)
+		ruleng_bus_sub_remove(ctx, old);
+
+	pattern->sub = sub;
+	pattern->cover = pattern;
+	list_add_tail(&pattern->list, &sub->events);
+
+	if (pattern->users > 0)
+		++sub->live;
+
+	list_add_tail(&sub->list, &ctx->subs);
+	ctx->sub = sub;
+
+	return RULENG_BUS_OK;
+
+cleanup_sub:
+	RULENG_ERR("failed to register event handler");
+	ruleng_bus_sub_remove(ctx, sub);
+	return RULENG_BUS_ERR_REGISTER_EVENT;
+}
+
+static struct ruleng_bus_event *ruleng_bus_event_add(
+  struct ruleng_bus_ctx *ctx,
+  const char *name
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_bus_event *ev = NULL, *e = NULL;
+	char *ev_name = NULL;
+	bool covers = false;
+
+	if (strlen(name) > RULENG_BUS_EVENT_NAME_MAX) {
+		RULENG_ERR("%.32s...: event name too long to register", name);
+		goto exit;
+	}
+
+	ev = calloc_a(sizeof(*ev), &ev_name, strlen(name) + 1);
+
+	if (ev == NULL) {
+		RULENG_ERR("%s: failed to allocate event", name);
+		goto exit;
+	}
+
+	strcpy(ev_name, name);
+	ev->avl.key = ev_name;
+	INIT_LIST_HEAD(&ev->rules);
+	INIT_LIST_HEAD(&ev->json_conds);
+
+	if (ruleng_trie_insert(&ctx->trie, name, ev)) {
+		RULENG_ERR("%s: failed to allocate event", name);
+		goto cleanup_ev;
+	}
+
+	avl_for_each_element(&ctx->events, e, avl) {
+		if (e->sub == NULL)
+			continue;
+
+		// already delivered through a registered pattern
+		if (ruleng_bus_pattern_covers(e->avl.key, name)) {
+			ev->cover = e;
+			goto insert;
+		}
+
+		covers |= ruleng_bus_pattern_covers(name, e->avl.key);
+	}
+
+	if (covers)
+		rc = ruleng_bus_event_resubscribe(ctx, ev);
+	else
+		rc = ruleng_bus_event_register(ctx, ev);
+
+	if (rc != RULENG_BUS_OK)
+		goto cleanup_trie;
+
+insert:
+	avl_insert(&ctx->events, &ev->avl);
+	goto exit;
+
+cleanup_trie:
+	ruleng_trie_remove(&ctx->trie, name);
+cleanup_ev:
+	free(ev);
+	ev = NULL;
+exit:
+	return ev;
+}
+
+static struct ruleng_bus_event *ruleng_bus_event_get(
+  struct ruleng_bus_ctx *ctx,
+  const char *name
+) {
+	struct ruleng_bus_event *ev = avl_find_element(&ctx->events, name, ev, avl);
+
+	// names nobody waits for stay registered until pruned, see ruleng_bus_subs_prune()
+	if (ev == NULL)
+		ev = ruleng_bus_event_add(ctx, name);
+
+	return ev;
+}
+
+static void ruleng_bus_event_ref(struct ruleng_bus_event *ev)
+{
+	if (ev->refs++ > 0)
+		return;
+
+	if (ev->cover->users++ == 0)
+		++ev->cover->sub->live;
+}
+
+/* may release the event together with the handler it is delivered through */
+static void ruleng_bus_event_unref(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_bus_event *ev
+) {
+	struct ruleng_bus_event *reg = ev->cover;
+
+	if (--ev->refs > 0)
+		return;
+
+	if (--reg->users > 0)
+		return;
+
+	if (--reg->sub->live == 0)
+		ruleng_bus_sub_free(ctx, reg->sub);
+}
+
+static enum ruleng_bus_rc ruleng_bus_json_rules_reserve(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_json_rule *r
+) {
+	if (r->disabled)
+		return RULENG_BUS_OK;
+
+	for (int i = 0; i < r->n_conds; ++i) {
+		if (!r->conds[i].event)
+			continue;
+
+		if (ruleng_bus_event_get(ctx, r->conds[i].event) == NULL)
+			return RULENG_BUS_ERR_REGISTER_EVENT;
+	}
+
+	return RULENG_BUS_OK;
+}
+
+/*
+ * First half of a subscription update: register the event names of the
+ * given rule set which are not subscribed yet, all of them on one handler
+ * object. On failure the handler objects added here are removed again so
+ * the current rule set keeps working.
+ */
+static enum ruleng_bus_rc ruleng_bus_events_reserve(
+  struct ruleng_bus_ctx *ctx,
+  struct list_head *rules,
+  struct list_head *json_rules
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_rule *r = NULL;
+	struct ruleng_json_rule *jr = NULL;
+	struct ruleng_runtime_rule *rr = NULL;
+
+	list_for_each_entry(r, rules, list) {
+		if (ruleng_bus_event_get(ctx, r->event.name) == NULL) {
+			rc = RULENG_BUS_ERR_REGISTER_EVENT;
+			goto rollback;
+		}
+	}
+
+	list_for_each_entry(jr, json_rules, list) {
+		rc = ruleng_bus_json_rules_reserve(ctx, jr);
+
+		if (rc != RULENG_BUS_OK)
+			goto rollback;
+	}
+
+	// runtime rules are kept across reloads
+	avl_for_each_element(&ctx->runtime_rules, rr, avl) {
+		rc = ruleng_bus_json_rules_reserve(ctx, rr->rule);
+
+		if (rc != RULENG_BUS_OK)
+			goto rollback;
+	}
+
+	goto exit;
+
+rollback:
+	ruleng_bus_subs_prune(ctx);
+exit:
+	return rc;
+}
+
+static void ruleng_bus_json_rule_link(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_json_rule *r
+) {
+	r->bound = false;
+
+	if (r->disabled)
+		return;
+
+	// last first, see ruleng_bus_json_rule_bind()
+	for (int i = r->n_conds - 1; i >= 0; --i) {
+		struct ruleng_json_cond *c = &r->conds[i];
+
+		c->ev = NULL;
+
+		if (!c->event)
+			continue;
+
+		c->ev = avl_find_element(&ctx->events, c->event, c->ev, avl);
+
+		if (c->ev) {
+			list_add_tail(&c->list, &c->ev->json_conds);
+			ruleng_bus_event_ref(c->ev);
+		}
+	}
+
+	r->bound = true;
+}
+
+/*
+ * Rebuild the dispatch index and the reference counts from the running
+ * rule set, once every event it needs has been reserved.
+ */
+static void ruleng_bus_index_build(struct ruleng_bus_ctx *ctx)
+{
+	struct ruleng_bus_sub *sub = NULL;
+	struct ruleng_bus_event *ev = NULL;
+	struct ruleng_rule *r = NULL;
+	struct ruleng_json_rule *jr = NULL;
+	struct ruleng_runtime_rule *rr = NULL;
+
+	list_for_each_entry(sub, &ctx->subs, list)
+		sub->live = 0;
+
+	avl_for_each_element(&ctx->events, ev, avl) {
+		INIT_LIST_HEAD(&ev->rules);
+		INIT_LIST_HEAD(&ev->json_conds);
+		ev->refs = 0;
+		ev->users = 0;
+	}
+
+	list_for_each_entry(r, &ctx->rules, list) {
+		ev = avl_find_element(&ctx->events, r->event.name, ev, avl);
+
+		if (ev) {
+			list_add_tail(&r->index, &ev->rules);
+			ruleng_bus_event_ref(ev);
+		}
+	}
+
+	list_for_each_entry(jr, &ctx->json_rules, list)
+		ruleng_bus_json_rule_link(ctx, jr);
+
+	avl_for_each_element(&ctx->runtime_rules, rr, avl)
+		ruleng_bus_json_rule_link(ctx, rr->rule);
+}
+
+enum ruleng_bus_rc ruleng_bus_json_rule_bind(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_json_rule *r
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+
+	if (r->bound)
+		goto exit;
+
+	for (int i = 0; i < r->n_conds; ++i) {
+		struct ruleng_json_cond *c = &r->conds[i];
+
+		c->ev = NULL;
+
+		if (!c->event)
+			continue;
+
+		c->ev = ruleng_bus_event_get(ctx, c->event);
+
+		if (c->ev == NULL) {
+			rc = RULENG_BUS_ERR_REGISTER_EVENT;
+			goto rollback;
+		}
+	}
+
+	// last first, an event matching consecutive steps of a sequence
+	// moves a run on by one step only
+	for (int i = r->n_conds - 1; i >= 0; --i) {
+		struct ruleng_json_cond *c = &r->conds[i];
+
+		if (c->ev) {
+			list_add_tail(&c->list, &c->ev->json_conds);
+			ruleng_bus_event_ref(c->ev);
+		}
+	}
+
+	r->bound = true;
+	goto exit;
+
+rollback:
+	ruleng_bus_subs_prune(ctx);
+exit:
+	return rc;
+}
+
+void ruleng_bus_json_rule_unbind(
+  struct ruleng_bus_ctx *ctx,
+  struct ruleng_json_rule *r
+) {
+	if (!r->bound)
+		return;
+
+	for (int i = 0; i < r->n_conds; ++i) {
+		struct ruleng_json_cond *c = &r->conds[i];
+
+		if (c->ev == NULL)
+			continue;
+
+		list_del(&c->list);
+		ruleng_bus_event_unref(ctx, c->ev);
+		c->ev = NULL;
+	}
+
+	r->bound = false;
+	ruleng_bus_subs_prune(ctx);
+}
+
+/*
+ * Second half of a subscription update, once the new rule set is in place:
+ * drop the handler objects no rule refers to anymore.
+ */
+static int ruleng_bus_events_prune(struct ruleng_bus_ctx *ctx)
+{
+	struct ruleng_bus_event *ev = NULL;
+	int listeners = 0;
+
+	ruleng_bus_subs_prune(ctx);
+
+	avl_for_each_element(&ctx->events, ev, avl) {
+		if (ev->refs > 0)
+			++listeners;
+	}
+
+	return listeners;
+}
+
+static void ruleng_bus_events_free(struct ruleng_bus_ctx *ctx)
+{
+	struct ruleng_bus_sub *sub = NULL, *tmp = NULL;
+
+	list_for_each_entry_safe(sub, tmp, &ctx->subs, list)
+		ruleng_bus_sub_free(ctx, sub);
+
+	ruleng_trie_free(&ctx->trie);
+}
+
+/* resident set size and its high-water mark in kB, 0 when unknown */
+static void ruleng_bus_mem_usage(unsigned long *rss, unsigned long *peak)
+{
+	char line[128];
+	FILE *f = fopen("/proc/self/status", "r");
+
+	*rss = 0;
+	*peak = 0;
+
+	if (f == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "VmRSS: %lu", rss) == 1)
+			continue;
+
+		sscanf(line, "VmHWM: %lu", peak);
+	}
+
+	fclose(f);
+}
+
+static bool mem_trace;
+
+void ruleng_bus_set_mem_trace(bool on)
+{
+	mem_trace = on;
+}
+
+/* restart the RSS high-water mark, see proc(5), returns the current RSS */
+static unsigned long ruleng_bus_mem_mark(void)
+{
+	unsigned long rss = 0, peak = 0;
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+
+	if (f) {
+		fputs("5", f);
+		fclose(f);
+	}
+
+	ruleng_bus_mem_usage(&rss, &peak);
+	return rss;
+}
+
+/* log the memory taken by loading the rules, relative to 'base' */
+static void ruleng_bus_mem_report(struct ruleng_bus_ctx *ctx, unsigned long base)
+{
+	unsigned long rss = 0, peak = 0, steady = 0, load = 0, n = 0;
+	struct list_head *p = NULL;
+
+	ruleng_bus_mem_usage(&rss, &peak);
+
+	list_for_each(p, &ctx->rules)
+		++n;
+
+	list_for_each(p, &ctx->json_rules)
+		++n;
+
+	if (rss == 0 || n == 0)
+		return;
+
+	steady = rss > base ? rss - base : 0;
+	load = peak > base ? peak - base : 0;
+
+	RULENG_INFO("%lu rules take %lu kB, %lu kB at peak while loading (RSS %lu kB)",
+				n, steady, load, rss);
+
+	// small sets are dominated by allocator and page granularity
+	if (n >= 1000)
+		RULENG_INFO("per 1000 rules: %lu kB steady, %lu kB peak",
+					steady * 1000 / n, load * 1000 / n);
+}
+
+int ruleng_bus_register_events(
+  struct ruleng_bus_ctx *ctx,
+  char *rules,
+  enum ruleng_bus_rc *rc
+) {
+	int listeners = 0;
+	bool refresh = false;
+	unsigned long base = mem_trace ? ruleng_bus_mem_mark() : 0;
+	*rc = RULENG_BUS_OK;
+	INIT_LIST_HEAD(&ctx->rules);
+	INIT_LIST_HEAD(&ctx->json_rules);
+
+	// contexts set up by hand are zeroed, the trees are then initialized here
+	if (ctx->events.comp == NULL)
+		avl_init(&ctx->events, avl_strcmp, false, NULL);
+
+	if (ctx->recipes.comp == NULL)
+		avl_init(&ctx->recipes, avl_strcmp, false, NULL);
+
+	if (ctx->runtime_rules.comp == NULL)
+		avl_init(&ctx->runtime_rules, avl_strcmp, false, NULL);
+
+	if (ctx->subs.next == NULL)
+		INIT_LIST_HEAD(&ctx->subs);
+
+	ctx->handler.cb = ruleng_event_cb;
+	ctx->json_handler.cb = ruleng_event_json_cb;
+
+	if (ctx->cache_path && ruleng_cache_load(ctx, &refresh) == RULENG_CACHE_OK) {
+		RULENG_INFO("rules loaded from %s", ctx->cache_path);
+		goto reserve;
+	}
+
+	refresh = ctx->cache_path != NULL;
+
+	if (refresh)
+		ruleng_cache_package_record(ctx);
+
+	if (ruleng_rules_get(ctx->com_ctx, &ctx->rules, rules)
+		!= RULENG_RULES_OK) {
+		*rc = RULENG_BUS_ERR_RULES_GET;
+		goto exit;
+	}
+
+	*rc = ruleng_process_json_update(ctx->com_ctx, &ctx->json_rules, NULL, NULL,
+									 &ctx->recipes, rules, true);
+
+	if (*rc != RULENG_BUS_OK)
+		goto exit;
+
+reserve:
+	*rc = ruleng_bus_events_reserve(ctx, &ctx->rules, &ctx->json_rules);
+
+	if (*rc != RULENG_BUS_OK)
+		goto exit;
+
+	ruleng_bus_index_build(ctx);
+	listeners = ruleng_bus_events_prune(ctx);
+
+	if (mem_trace)
+		ruleng_bus_mem_report(ctx, base);
+
+	if (refresh)
+		ruleng_cache_save(ctx);
+
+exit:
+	return listeners;
+}
+
+enum ruleng_bus_rc ruleng_bus_reload(struct ruleng_bus_ctx *ctx, bool force)
+{
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	LIST_HEAD(rules);
+	LIST_HEAD(json_rules);
+	LIST_HEAD(json_reused);
+
+	RULENG_INFO("reloading rules from %s", ctx->rules_path);
+
+	if (ctx->cache_path)
+		ruleng_cache_package_record(ctx);
+
+	// build the new rule set next to the one in use
+	if (ruleng_rules_update(ctx->com_ctx, &rules,
+							force ? NULL : &ctx->rules, ctx->rules_path)
+		!= RULENG_RULES_OK) {
+		rc = RULENG_BUS_ERR_RULES_GET;
+		goto exit;
+	}
+
+	// rules of unchanged recipes are borrowed from the running set until the swap
+	rc = ruleng_process_json_update(ctx->com_ctx, &json_rules, &ctx->json_rules,
+									&json_reused, &ctx->recipes, ctx->rules_path, force);
+
+	if (rc != RULENG_BUS_OK)
+		goto cleanup_rules;
+
+	rc = ruleng_bus_events_reserve(ctx, &rules, &json_rules);
+
+	if (rc != RULENG_BUS_OK)
+		goto cleanup_rules;
+
+	ruleng_json_rules_carry_state(&ctx->json_rules, &json_rules);
+
+	/*
+	 * Events are dispatched from uloop on this same thread, so no event
+	 * can observe the rule set between releasing the old one and
+	 * splicing in the new one.
+	 */
+	ruleng_rules_free(&ctx->rules);
+	ruleng_json_rules_free(&ctx->json_rules);
+	INIT_LIST_HEAD(&ctx->rules);
+	INIT_LIST_HEAD(&ctx->json_rules);
+	list_splice_init(&rules, &ctx->rules);
+	list_splice_init(&json_rules, &ctx->json_rules);
+	list_splice_init(&json_reused, &ctx->json_rules);
+	ruleng_bus_index_build(ctx);
+
+	int listeners = ruleng_bus_events_prune(ctx);
+	RULENG_INFO("rules reloaded, %d event subscriptions", listeners);
+
+	ruleng_watch_sync(ctx);
+
+	if (ctx->cache_path)
+		ruleng_cache_save(ctx);
+	goto exit;
+
+cleanup_rules:
+	ruleng_json_recipes_invalidate(&ctx->recipes);
+	// the borrowed rules are still indexed, the running set must get them back
+	list_splice_init(&json_reused, &ctx->json_rules);
+	ruleng_rules_free(&rules);
+	ruleng_json_rules_free(&json_rules);
+exit:
+	return rc;
+}
+
+static enum ruleng_bus_rc ruleng_bus_ctx_init(
+  struct ruleng_bus_ctx **ctx,
+  struct ruleng_rules_ctx *com_ctx,
+  char *rules, const char *sock,
+  const char *cache,
+  bool detached
+) {
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	*ctx = calloc(1, sizeof(struct ruleng_bus_ctx));
+
+	if (*ctx == NULL) {
+		RULENG_ERR("error allocating main bus context");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto exit;
+	}
+
+	struct ruleng_bus_ctx *_ctx = *ctx;
+	struct ubus_context *ubus_ctx = ubus_connect(sock);
+
+	if (ubus_ctx == NULL) {
+		RULENG_ERR("error ubus connect: %s", sock);
+		rc = RULENG_BUS_ERR_CONNECT;
+		goto cleanup_ctx;
+	}
+
+	_ctx->com_ctx = com_ctx;
+	_ctx->ubus_ctx = ubus_ctx;
+	_ctx->detached = detached;
+	_ctx->rules_path = strdup(rules);
+
+	if (_ctx->rules_path == NULL) {
+		RULENG_ERR("error allocating rules path");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto cleanup_bus_ctx;
+	}
+
+	if (cache) {
+		_ctx->cache_path = strdup(cache);
+
+		if (_ctx->cache_path == NULL) {
+			RULENG_ERR("error allocating cache path");
+			rc = RULENG_BUS_ERR_ALLOC;
+			goto cleanup_rules_path;
+		}
+	}
+
+	ruleng_bus_register_events(_ctx, rules, &rc);
+
+	if (rc != RULENG_BUS_OK)
+		goto cleanup_rules;
+
+	// whoever feeds the events in does not answer for rulengd either
+	if (detached)
+		goto exit;
+
+	rc = ruleng_object_init(_ctx);
+
+	if (rc != RULENG_BUS_OK)
+		goto cleanup_rules;
+
+	goto exit;
+
+cleanup_rules:
+	ruleng_runtime_free(_ctx);
+	ruleng_bus_events_free(_ctx);
+	ruleng_json_recipes_free(&_ctx->recipes);
+	ruleng_rules_free(&_ctx->rules);
+	ruleng_json_rules_free(&_ctx->json_rules);
+	free(_ctx->cache_path);
+cleanup_rules_path:
+	free(_ctx->rules_path);
+cleanup_bus_ctx:
+	ubus_free(ubus_ctx);
+cleanup_ctx:
+	free(_ctx);
+exit:
+	return rc;
+}
+
+enum ruleng_bus_rc ruleng_bus_init(
+  struct ruleng_bus_ctx **ctx,
+  struct ruleng_rules_ctx *com_ctx,
+  char *rules, const char *sock,
+  const char *cache
+) {
+	return ruleng_bus_ctx_init(ctx, com_ctx, rules, sock, cache, false);
+}
+
+enum ruleng_bus_rc ruleng_bus_init_detached(
+  struct ruleng_bus_ctx **ctx,
+  struct ruleng_rules_ctx *com_ctx,
+  char *rules, const char *sock
+) {
+	return ruleng_bus_ctx_init(ctx, com_ctx, rules, sock, NULL, true);
+}
+
+void ruleng_bus_uloop_run(struct ruleng_bus_ctx *ctx)
+{
+	uloop_init();
+	ubus_add_uloop(ctx->ubus_ctx);
+
+	if (ruleng_watch_init(ctx) != RULENG_BUS_OK)
+		RULENG_ERR("rules will not be reloaded on configuration changes");
+
 	RULENG_INFO("running uloop...");
 	uloop_run();
 }
 
 void ruleng_bus_free(struct ruleng_bus_ctx *ctx)
 {
+	if (ctx->capture)
+		ruleng_capture_close(ctx->capture);
+
+	ruleng_blob_regex_free();
+	ruleng_arena_free();
+	ruleng_watch_free(ctx);
+	ruleng_object_free(ctx);
+	ruleng_runtime_free(ctx);
+	ruleng_bus_events_free(ctx);
+	ruleng_json_recipes_free(&ctx->recipes);
 	ruleng_rules_free(&ctx->rules);
 	ruleng_json_rules_free(&ctx->json_rules);
 	ubus_free(ctx->ubus_ctx);
+	free(ctx->rules_path);
+	free(ctx->cache_path);
 	free(ctx);
 }
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/inotify.h>
+
+#include <libubox/uloop.h>
+#include <libubox/list.h>
+#include <libubox/avl.h>
+#include <libubus.h>
+#include <uci.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_watch.h"
+#include "utils.h"
+
+#define RULENG_WATCH_MASK \
+	(IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+struct ruleng_watch_dir {
+	struct list_head list;
+	int wd;
+	bool used;
+	char *path;
+};
+
+struct ruleng_watch {
+	struct ruleng_bus_ctx *ctx;
+	struct uloop_fd fd;
+	struct uloop_timeout debounce;
+	struct ubus_event_handler config_handler;
+	struct list_head dirs;
+	char *package_dir;
+	char *package;
+};
+
+/* split 'path' into a directory, as written in the path, and a file name */
+static char *ruleng_watch_dirname(const char *path, const char **name)
+{
+	const char *slash = strrchr(path, '/');
+
+	if (slash == NULL) {
+		*name = path;
+		return strdup("");
+	}
+
+	*name = slash + 1;
+
+	if (slash == path)
+		return strdup("/");
+
+	return strndup(path, slash - path);
+}
+
+static void ruleng_watch_join(
+  char *buf, size_t len,
+  const char *dir, const char *name
+) {
+	size_t dlen = strlen(dir);
+
+	if (dlen == 0)
+		snprintf(buf, len, "%s", name);
+	else if (dir[dlen - 1] == '/')
+		snprintf(buf, len, "%s%s", dir, name);
+	else
+		snprintf(buf, len, "%s/%s", dir, name);
+}
+
+static void ruleng_watch_schedule(struct ruleng_watch *w, const char *what)
+{
+	RULENG_DEBUG("%s changed, reloading in %d ms", what, RULENG_WATCH_DEBOUNCE_MS);
+
+	// every change restarts the timer, a burst of writes reloads once
+	uloop_timeout_set(&w->debounce, RULENG_WATCH_DEBOUNCE_MS);
+}
+
+static void ruleng_watch_debounce_cb(struct uloop_timeout *t)
+{
+	struct ruleng_watch *w = container_of(t, struct ruleng_watch, debounce);
+
+	if (ruleng_bus_reload(w->ctx, false) != RULENG_BUS_OK)
+		RULENG_ERR("failed to reload rules, keeping the running set");
+}
+
+static struct ruleng_watch_dir *ruleng_watch_dir_find_wd(
+  struct ruleng_watch *w,
+  int wd
+) {
+	struct ruleng_watch_dir *dir = NULL;
+
+	list_for_each_entry(dir, &w->dirs, list) {
+		if (dir->wd == wd)
+			return dir;
+	}
+
+	return NULL;
+}
+
+static bool ruleng_watch_relevant(
+  struct ruleng_watch *w,
+  struct ruleng_watch_dir *dir,
+  const char *name
+) {
+	char path[PATH_MAX];
+
+	if (strcmp(dir->path, w->package_dir) == 0 && strcmp(name, w->package) == 0)
+		return true;
+
+	ruleng_watch_join(path, sizeof(path), dir->path, name);
+
+	return avl_find(&w->ctx->recipes, path) != NULL;
+}
+
+static void ruleng_watch_fd_cb(struct uloop_fd *fd, unsigned int events)
+{
+	(void) events;
+
+	struct ruleng_watch *w = container_of(fd, struct ruleng_watch, fd);
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len = 0;
+
+	while ((len = read(fd->fd, buf, sizeof(buf))) > 0) {
+		const struct inotify_event *ev = NULL;
+
+		for (char *p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) p;
+
+			// changes were dropped, any of them may have been to the rules
+			if (ev->mask & IN_Q_OVERFLOW) {
+				RULENG_ERR("inotify queue overflowed");
+				ruleng_watch_schedule(w, "a watched file");
+				continue;
+			}
+
+			struct ruleng_watch_dir *dir = ruleng_watch_dir_find_wd(w, ev->wd);
+
+			if (dir == NULL)
+				continue;
+
+			// the directory went away or was unmounted, and its watch with it
+			if (ev->mask & IN_IGNORED) {
+				ruleng_watch_schedule(w, dir->path);
+				list_del(&dir->list);
+				free(dir->path);
+				free(dir);
+				ruleng_watch_sync(w->ctx);
+				continue;
+			}
+
+			if (ev->len > 0 && ruleng_watch_relevant(w, dir, ev->name))
+				ruleng_watch_schedule(w, ev->name);
+		}
+	}
+}
+
+static void ruleng_watch_config_cb(
+  struct ubus_context *ubus_ctx,
+  struct ubus_event_handler *handler,
+  const char *type,
+  struct blob_attr *msg
+) {
+	(void) ubus_ctx;
+	(void) type;
+
+	struct ruleng_watch *w =
+		container_of(handler, struct ruleng_watch, config_handler);
+	struct blob_attr *cur = NULL;
+	int rem = 0;
+
+	blobmsg_for_each_attr(cur, msg, rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+			continue;
+
+		if (strcmp(blobmsg_name(cur), "config") != 0 &&
+			strcmp(blobmsg_name(cur), "package") != 0)
+			continue;
+
+		if (strcmp(blobmsg_get_string(cur), w->package) == 0)
+			ruleng_watch_schedule(w, w->package);
+	}
+}
+
+static void ruleng_watch_dir_use(struct ruleng_watch *w, const char *path)
+{
+	struct ruleng_watch_dir *dir = NULL;
+
+	list_for_each_entry(dir, &w->dirs, list) {
+		if (strcmp(dir->path, path) == 0) {
+			dir->used = true;
+			return;
+		}
+	}
+
+	dir = calloc(1, sizeof(*dir));
+
+	if (dir == NULL) {
+		RULENG_ERR("%s: failed to allocate watch", path);
+		return;
+	}
+
+	dir->path = strdup(path);
+	dir->wd = inotify_add_watch(w->fd.fd, *path ? path : ".", RULENG_WATCH_MASK);
+
+	if (dir->path == NULL || dir->wd < 0) {
+		RULENG_ERR("%s: failed to watch directory", path);
+		free(dir->path);
+		free(dir);
+		return;
+	}
+
+	RULENG_DEBUG("%s: watching for changes", path);
+	dir->used = true;
+	list_add(&dir->list, &w->dirs);
+}
+
+static void ruleng_watch_dir_free(struct ruleng_watch *w, struct ruleng_watch_dir *dir)
+{
+	inotify_rm_watch(w->fd.fd, dir->wd);
+	list_del(&dir->list);
+	free(dir->path);
+	free(dir);
+}
+
+void ruleng_watch_sync(struct ruleng_bus_ctx *ctx)
+{
+	struct ruleng_watch *w = ctx->watch;
+	struct ruleng_watch_dir *dir = NULL, *tmp = NULL;
+	struct ruleng_json_recipe *recipe = NULL;
+
+	if (w == NULL)
+		return;
+
+	list_for_each_entry(dir, &w->dirs, list)
+		dir->used = false;
+
+	ruleng_watch_dir_use(w, w->package_dir);
+
+	avl_for_each_element(&ctx->recipes, recipe, avl) {
+		const char *name = NULL;
+		char *path = ruleng_watch_dirname(recipe->avl.key, &name);
+
+		if (path == NULL)
+			continue;
+
+		ruleng_watch_dir_use(w, path);
+		free(path);
+	}
+
+	list_for_each_entry_safe(dir, tmp, &w->dirs, list) {
+		if (!dir->used)
+			ruleng_watch_dir_free(w, dir);
+	}
+}
+
+enum ruleng_bus_rc ruleng_watch_init(struct ruleng_bus_ctx *ctx)
+{
+	enum ruleng_bus_rc rc = RULENG_BUS_OK;
+	struct ruleng_watch *w = calloc(1, sizeof(*w));
+	char path[PATH_MAX];
+	const char *name = NULL;
+
+	if (w == NULL) {
+		RULENG_ERR("error allocating watch context");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto exit;
+	}
+
+	w->ctx = ctx;
+	INIT_LIST_HEAD(&w->dirs);
+	w->debounce.cb = ruleng_watch_debounce_cb;
+
+	// a package name is looked up in the uci config directory
+	if (strchr(ctx->rules_path, '/'))
+		snprintf(path, sizeof(path), "%s", ctx->rules_path);
+	else
+		ruleng_watch_join(path, sizeof(path),
+						  ctx->com_ctx->uci_ctx->confdir, ctx->rules_path);
+
+	w->package_dir = ruleng_watch_dirname(path, &name);
+	w->package = strdup(name);
+
+	if (w->package_dir == NULL || w->package == NULL) {
+		RULENG_ERR("error allocating watch context");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto cleanup_w;
+	}
+
+	w->fd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (w->fd.fd < 0) {
+		RULENG_ERR("failed to initialize inotify");
+		rc = RULENG_BUS_ERR_ALLOC;
+		goto cleanup_w;
+	}
+
+	w->fd.cb = ruleng_watch_fd_cb;
+	uloop_fd_add(&w->fd, ULOOP_READ);
+
+	w->config_handler.cb = ruleng_watch_config_cb;
+
+	if (ubus_register_event_handler(ctx->ubus_ctx, &w->config_handler,
+									RULENG_WATCH_CONFIG_EVENT))
+		RULENG_ERR("failed to register %s handler", RULENG_WATCH_CONFIG_EVENT);
+
+	ctx->watch = w;
+	ruleng_watch_sync(ctx);
+
+	goto exit;
+
+cleanup_w:
+	free(w->package_dir);
+	free(w->package);
+	free(w);
+exit:
+	return rc;
+}
+
+void ruleng_watch_free(struct ruleng_bus_ctx *ctx)
+{
+	struct ruleng_watch *w = ctx->watch;
+	struct ruleng_watch_dir *dir = NULL, *tmp = NULL;
+
+	if (w == NULL)
+		return;
+
+	uloop_timeout_cancel(&w->debounce);
+
+	if (w->config_handler.obj.id)
+		ubus_unregister_event_handler(ctx->ubus_ctx, &w->config_handler);
+
+	list_for_each_entry_safe(dir, tmp, &w->dirs, list)
+		ruleng_watch_dir_free(w, dir);
+
+	uloop_fd_delete(&w->fd);
+	close(w->fd.fd);
+
+	free(w->package_dir);
+	free(w->package);
+	free(w);
+	ctx->watch = NULL;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ruleng_bus.h"
+
+/* quiet period after the last change before the rules are reloaded */
+#define RULENG_WATCH_DEBOUNCE_MS 500
+#define RULENG_WATCH_CONFIG_EVENT "config.change"
+
+/*
+ * Watch the UCI rules package and the recipe files it references, and
+ * reload the rules once they are modified. Must be called after uloop_init().
+ */
+enum ruleng_bus_rc ruleng_watch_init(struct ruleng_bus_ctx *ctx);
+
+/* update the set of watched directories after the recipe set changed */
+void ruleng_watch_sync(struct ruleng_bus_ctx *ctx);
+
+void ruleng_watch_free(struct ruleng_bus_ctx *ctx);
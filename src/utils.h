@@ -1,19 +1,39 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ruleng_log.h"
+
+#define RULENG_HASH_INIT 2166136261u
+
+/* FNV-1a, chain calls by passing the previous result as 'hash' */
+static inline uint32_t ruleng_hash(uint32_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
 #define RULENG_ERR(fmt, ...)						\
 	do {											\
-		fprintf(stderr, "ERROR: %s(): " #fmt "\n",	\
-				__func__, ##__VA_ARGS__);			\
+		ruleng_log(LOG_ERR, __func__, fmt,			\
+				##__VA_ARGS__);						\
 	} while(0)
 
 #define RULENG_INFO(fmt, ...)						\
 	do {											\
-		fprintf(stdout, "INFO: %s(): " #fmt "\n",	\
-				__func__, ##__VA_ARGS__);			\
+		ruleng_log(LOG_INFO, __func__, fmt,			\
+				##__VA_ARGS__);						\
 	} while(0)
 
 #define RULENG_DEBUG(fmt, ...)						\
 	do {											\
-		fprintf(stdout, "DEBUG: %s(): " #fmt "\n",	\
-				__func__, ##__VA_ARGS__);			\
+		ruleng_log(LOG_DEBUG, __func__, fmt,		\
+				##__VA_ARGS__);						\
 	} while(0)
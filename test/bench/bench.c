@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+
+#include "bench.h"
+#include "ruleng_log.h"
+
+const int bench_sizes[] = { 1, 2, 5, 10, 20, 50, 100, 200 };
+const int bench_n_sizes = sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+
+volatile uintptr_t bench_sink;
+
+enum bench_cycles_source {
+	BENCH_CYCLES_NONE,
+	BENCH_CYCLES_PERF,
+	BENCH_CYCLES_TSC,
+};
+
+static enum bench_cycles_source cycles_source;
+static int cycles_fd = -1;
+static void *report_results;
+
+static const char *const cycles_names[] = {
+	[BENCH_CYCLES_NONE] = "none",
+	[BENCH_CYCLES_PERF] = "perf",
+	[BENCH_CYCLES_TSC] = "tsc",
+};
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n\n"
+		"  -r <samples> samples taken of each case [11]\n"
+		"  -n <iterations> iterations of a sample [calibrated]\n"
+		"  -t <ms> time a calibrated sample takes [20]\n"
+		"  -c <cpu> run on the given CPU\n"
+		"  -h help\n\n"
+		"Results are printed as JSON, cycles are counted with perf events\n"
+		"if they are available, the time stamp counter otherwise.\n"
+		, prog);
+}
+
+/* user space CPU cycles of the calling thread */
+static void bench_cycles_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	cycles_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+	if (cycles_fd >= 0) {
+		cycles_source = BENCH_CYCLES_PERF;
+		return;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	cycles_source = BENCH_CYCLES_TSC;
+#endif
+}
+
+static uint64_t bench_cycles(void)
+{
+	uint64_t n = 0;
+
+	switch (cycles_source) {
+	case BENCH_CYCLES_PERF:
+		if (read(cycles_fd, &n, sizeof(n)) != sizeof(n))
+			n = 0;
+		break;
+#if defined(__x86_64__) || defined(__i386__)
+	case BENCH_CYCLES_TSC:
+		n = __rdtsc();
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return n;
+}
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int bench_init(int argc, char **argv, struct bench_opts *o)
+{
+	int c = -1;
+
+	o->reps = 11;
+	o->iters = 0;
+	o->target_ms = 20;
+	o->cpu = -1;
+
+	while ((c = getopt(argc, argv, "r:n:t:c:h")) != -1) {
+		switch (c) {
+			case 'r':
+				o->reps = atoi(optarg);
+				break;
+			case 'n':
+				o->iters = strtoull(optarg, NULL, 0);
+				break;
+			case 't':
+				o->target_ms = atof(optarg);
+				break;
+			case 'c':
+				o->cpu = atoi(optarg);
+				break;
+			case 'h':
+				bench_usage(argv[0]);
+				return 1;
+			default:
+				bench_usage(argv[0]);
+				return -1;
+		}
+	}
+
+	if (o->reps < 1 || o->target_ms <= 0) {
+		bench_usage(argv[0]);
+		return -1;
+	}
+
+	if (o->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(o->cpu, &set);
+
+		if (sched_setaffinity(0, sizeof(set), &set))
+			perror("sched_setaffinity");
+	}
+
+	// the matching code logs at info level
+	ruleng_log_init(NULL, LOG_ERR);
+	bench_cycles_open();
+
+	return 0;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* iterations taking about the target time */
+static uint64_t bench_calibrate(const struct bench_opts *o, bench_fn fn, void *priv)
+{
+	uint64_t target = o->target_ms * 1e6;
+	uint64_t iters = 1, t = 0;
+
+	for (;;) {
+		t = bench_now();
+		fn(priv, iters);
+		t = bench_now() - t;
+
+		if (t >= target / 10 || iters >= (1ull << 40))
+			break;
+
+		iters *= 10;
+	}
+
+	iters = t ? iters * target / t : iters;
+
+	return iters ? iters : 1;
+}
+
+void bench_measure(const struct bench_opts *o, bench_fn fn, void *priv, struct bench_stats *st)
+{
+	double *ns = calloc(o->reps, sizeof(*ns));
+	double *cycles = calloc(o->reps, sizeof(*cycles));
+	uint64_t iters = o->iters ? o->iters : bench_calibrate(o, fn, priv);
+
+	memset(st, 0, sizeof(*st));
+	st->cycles_per_op = -1;
+
+	if (ns == NULL || cycles == NULL)
+		goto exit;
+
+	// warm up caches and the branch predictor
+	fn(priv, iters / 10 + 1);
+
+	for (int i = 0; i < o->reps; i++) {
+		uint64_t c = bench_cycles();
+		uint64_t t = bench_now();
+
+		fn(priv, iters);
+
+		t = bench_now() - t;
+		c = bench_cycles() - c;
+
+		ns[i] = (double) t / iters;
+		cycles[i] = (double) c / iters;
+	}
+
+	qsort(ns, o->reps, sizeof(*ns), bench_cmp);
+	qsort(cycles, o->reps, sizeof(*cycles), bench_cmp);
+
+	st->iters = iters;
+	st->ns_per_op = ns[o->reps / 2];
+	st->min_ns_per_op = ns[0];
+
+	if (cycles_source != BENCH_CYCLES_NONE)
+		st->cycles_per_op = cycles[o->reps / 2];
+
+exit:
+	free(ns);
+	free(cycles);
+}
+
+void bench_build_message(struct blob_buf *b, int attrs, bool strings)
+{
+	char name[16], value[32];
+
+	blob_buf_init(b, 0);
+
+	for (int i = 0; i < attrs; i++) {
+		snprintf(name, sizeof(name), "attr%d", i);
+		snprintf(value, sizeof(value), "value-%d", i);
+
+		if (strings || i % 2 == 0)
+			blobmsg_add_string(b, name, value);
+		else
+			blobmsg_add_u32(b, name, i);
+	}
+}
+
+void bench_report_begin(struct blob_buf *b, const char *name)
+{
+	memset(b, 0, sizeof(*b));
+	blob_buf_init(b, 0);
+	blobmsg_add_string(b, "bench", name);
+	blobmsg_add_string(b, "cycles", cycles_names[cycles_source]);
+	report_results = blobmsg_open_array(b, "results");
+}
+
+void bench_report_add(
+  struct blob_buf *b,
+  const char *variant,
+  int attrs,
+  const struct bench_stats *st
+) {
+	void *t = blobmsg_open_table(b, NULL);
+
+	blobmsg_add_string(b, "variant", variant);
+	blobmsg_add_u32(b, "attrs", attrs);
+	blobmsg_add_u64(b, "iterations", st->iters);
+	blobmsg_add_double(b, "ns_per_op", st->ns_per_op);
+	blobmsg_add_double(b, "min_ns_per_op", st->min_ns_per_op);
+
+	if (st->cycles_per_op >= 0)
+		blobmsg_add_double(b, "cycles_per_op", st->cycles_per_op);
+
+	blobmsg_close_table(b, t);
+}
+
+void bench_report_end(struct blob_buf *b)
+{
+	char *json = NULL;
+
+	blobmsg_close_array(b, report_results);
+
+	json = blobmsg_format_json(b->head, true);
+	if (json)
+		printf("%s\n", json);
+
+	free(json);
+	blob_buf_free(b);
+}
+
+void bench_free(void)
+{
+	if (cycles_fd >= 0)
+		close(cycles_fd);
+
+	cycles_fd = -1;
+	ruleng_log_free();
+}
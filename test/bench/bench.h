@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/blob.h>
+
+/*
+ * Iteration control and reporting shared by the microbenchmarks. A case is
+ * a function running the measured operation 'iters' times, it is sampled
+ * 'reps' times and the median is reported.
+ */
+
+struct bench_opts {
+	/* samples taken of each case */
+	int reps;
+	/* iterations of a sample, 0 calibrates them to 'target_ms' */
+	uint64_t iters;
+	double target_ms;
+	/* CPU to run on, -1 for any */
+	int cpu;
+};
+
+struct bench_stats {
+	uint64_t iters;
+	double ns_per_op;
+	double min_ns_per_op;
+	/* negative if cycles cannot be counted */
+	double cycles_per_op;
+};
+
+typedef void (*bench_fn)(void *priv, uint64_t iters);
+
+/* payload sizes, in attributes, each case is run with */
+extern const int bench_sizes[];
+extern const int bench_n_sizes;
+
+/* results are added to it so the measured calls are not optimized out */
+extern volatile uintptr_t bench_sink;
+
+/*
+ * A message of 'attrs' members named "attr<i>", strings "value-<i>", every
+ * other one an integer instead unless 'strings' is set.
+ */
+void bench_build_message(struct blob_buf *b, int attrs, bool strings);
+
+/* parse the common options, returns non-zero if the program should exit */
+int bench_init(int argc, char **argv, struct bench_opts *o);
+
+void bench_measure(const struct bench_opts *o, bench_fn fn, void *priv, struct bench_stats *st);
+
+/* results are collected in 'b' and printed as JSON by bench_report_end() */
+void bench_report_begin(struct blob_buf *b, const char *name);
+void bench_report_add(
+  struct blob_buf *b,
+  const char *variant,
+  int attrs,
+  const struct bench_stats *st
+);
+void bench_report_end(struct blob_buf *b);
+
+void bench_free(void);
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libubox/blobmsg.h>
+
+#include "bench.h"
+#include "ruleng_blob.h"
+
+/* members of the message a condition matches on, taken from its end */
+#define MATCH_ATTRS 8
+
+struct subset_case {
+	struct blob_attr *match;
+	struct blob_attr *msg;
+	bool regex;
+};
+
+static void subset_run(void *priv, uint64_t iters)
+{
+	struct subset_case *c = priv;
+
+	for (uint64_t i = 0; i < iters; i++)
+		bench_sink += ruleng_blob_check_subset(c->match, c->msg, c->regex);
+}
+
+/* the last members of the message, as regular expressions if 'regex' is set */
+static void subset_build_match(struct blob_buf *b, struct blob_attr *msg, int attrs, bool regex)
+{
+	struct blob_attr *cur = NULL;
+	char pattern[64];
+	int rem = 0, i = 0;
+
+	blob_buf_init(b, 0);
+
+	blob_for_each_attr(cur, msg, rem) {
+		if (i++ < attrs - MATCH_ATTRS)
+			continue;
+
+		if (regex && blobmsg_type(cur) == BLOBMSG_TYPE_STRING) {
+			snprintf(pattern, sizeof(pattern), "^%s$", blobmsg_get_string(cur));
+			blobmsg_add_string(b, blobmsg_name(cur), pattern);
+		} else {
+			blobmsg_add_blob(b, cur);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o;
+	struct bench_stats st;
+	struct blob_buf report, msg = {0}, match = {0};
+	int rc = bench_init(argc, argv, &o);
+
+	if (rc)
+		return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	bench_report_begin(&report, "check_subset");
+
+	for (int regex = 0; regex <= 1; regex++) {
+		for (int i = 0; i < bench_n_sizes; i++) {
+			struct subset_case c = { .regex = regex };
+
+			bench_build_message(&msg, bench_sizes[i], false);
+			subset_build_match(&match, msg.head, bench_sizes[i], regex);
+			c.msg = msg.head;
+			c.match = match.head;
+
+			bench_measure(&o, subset_run, &c, &st);
+			bench_report_add(&report, regex ? "regex" : "plain", bench_sizes[i], &st);
+		}
+	}
+
+	bench_report_end(&report);
+	blob_buf_free(&msg);
+	blob_buf_free(&match);
+	ruleng_blob_regex_free();
+	bench_free();
+
+	return EXIT_SUCCESS;
+}
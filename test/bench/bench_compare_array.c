@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libubox/blobmsg.h>
+
+#include "bench.h"
+#include "ruleng_blob.h"
+
+struct array_case {
+	struct blob_attr *a;
+	struct blob_attr *b;
+};
+
+static void array_run(void *priv, uint64_t iters)
+{
+	struct array_case *c = priv;
+
+	for (uint64_t i = 0; i < iters; i++)
+		bench_sink += ruleng_blob_compare_array(c->a, c->b);
+}
+
+/* an array of 'n' strings and integers, the last one changed if 'differ' is set */
+static struct blob_attr *array_build(struct blob_buf *b, int n, bool differ, bool wide)
+{
+	char value[32];
+	void *t = NULL;
+
+	blob_buf_init(b, 0);
+	t = blobmsg_open_array(b, "list");
+
+	for (int i = 0; i < n; i++) {
+		int v = (differ && i == n - 1) ? -1 : i;
+
+		if (i % 2 == 0) {
+			snprintf(value, sizeof(value), "value-%d", v);
+			blobmsg_add_string(b, NULL, value);
+		} else if (wide) {
+			blobmsg_add_u64(b, NULL, v);
+		} else {
+			blobmsg_add_u32(b, NULL, v);
+		}
+	}
+
+	blobmsg_close_array(b, t);
+
+	return blob_data(b->head);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		bool differ;
+		/* the message carries 64 bit integers, as decoded from JSON */
+		bool wide;
+	} variants[] = {
+		{ "equal", false, false },
+		{ "differ_last", true, false },
+		{ "equal_int64", false, true },
+	};
+	struct bench_opts o;
+	struct bench_stats st;
+	struct blob_buf report, a = {0}, b = {0};
+	int rc = bench_init(argc, argv, &o);
+
+	if (rc)
+		return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	bench_report_begin(&report, "compare_array");
+
+	for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+		for (int i = 0; i < bench_n_sizes; i++) {
+			struct array_case c = {
+				.a = array_build(&a, bench_sizes[i], false, false),
+				.b = array_build(&b, bench_sizes[i], variants[v].differ, variants[v].wide),
+			};
+
+			bench_measure(&o, array_run, &c, &st);
+			bench_report_add(&report, variants[v].name, bench_sizes[i], &st);
+		}
+	}
+
+	bench_report_end(&report);
+	blob_buf_free(&a);
+	blob_buf_free(&b);
+	bench_free();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libubox/blobmsg.h>
+
+#include "bench.h"
+#include "ruleng_blob.h"
+
+/* one comparison per iteration, going round the members of the message */
+struct primitive_case {
+	struct blob_attr **a;
+	struct blob_attr **b;
+	int n;
+	bool regex;
+};
+
+static void primitive_run(void *priv, uint64_t iters)
+{
+	struct primitive_case *c = priv;
+	int k = 0;
+
+	for (uint64_t i = 0; i < iters; i++) {
+		bench_sink += ruleng_blob_compare_primitive(c->a[k], c->b[k], c->regex);
+
+		if (++k == c->n)
+			k = 0;
+	}
+}
+
+/* pointers to the members of 'msg' */
+static void primitive_collect(struct blob_attr *msg, struct blob_attr **attrs)
+{
+	struct blob_attr *cur = NULL;
+	int rem = 0, i = 0;
+
+	blob_for_each_attr(cur, msg, rem)
+		attrs[i++] = cur;
+}
+
+/* the members of 'msg' turned into regular expressions matching them */
+static void primitive_build_regex(struct blob_buf *b, struct blob_attr *msg)
+{
+	struct blob_attr *cur = NULL;
+	char pattern[64];
+	int rem = 0;
+
+	blob_buf_init(b, 0);
+
+	blob_for_each_attr(cur, msg, rem) {
+		snprintf(pattern, sizeof(pattern), "^%s$", blobmsg_get_string(cur));
+		blobmsg_add_string(b, blobmsg_name(cur), pattern);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o;
+	struct bench_stats st;
+	struct blob_buf report, msg = {0}, pattern = {0};
+	struct blob_attr *a[200], *b[200];
+	int rc = bench_init(argc, argv, &o);
+
+	if (rc)
+		return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	bench_report_begin(&report, "compare_primitive");
+
+	for (int regex = 0; regex <= 1; regex++) {
+		for (int i = 0; i < bench_n_sizes && bench_sizes[i] <= 200; i++) {
+			struct primitive_case c = { .a = a, .b = b, .n = bench_sizes[i], .regex = regex };
+
+			// regular expressions only apply to strings
+			bench_build_message(&msg, bench_sizes[i], regex);
+
+			if (regex)
+				primitive_build_regex(&pattern, msg.head);
+			else
+				bench_build_message(&pattern, bench_sizes[i], false);
+
+			primitive_collect(pattern.head, a);
+			primitive_collect(msg.head, b);
+
+			bench_measure(&o, primitive_run, &c, &st);
+			bench_report_add(&report, regex ? "regex" : "plain", bench_sizes[i], &st);
+		}
+	}
+
+	bench_report_end(&report);
+	blob_buf_free(&msg);
+	blob_buf_free(&pattern);
+	ruleng_blob_regex_free();
+	bench_free();
+
+	return EXIT_SUCCESS;
+}
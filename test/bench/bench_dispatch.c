@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+#include <uci.h>
+
+#include "alloc_count.h"
+#include "ruleng_bus.h"
+#include "ruleng_log.h"
+#include "ruleng_rules.h"
+#include "ubus_stub.h"
+
+#define BENCH_PACKAGE "bench"
+#define BENCH_EVENT "bench.event"
+/* distinct event messages dispatched in turn */
+#define BENCH_MESSAGES 256
+
+struct bench_opts {
+	int rules;
+	int conds;
+	int uci_rules;
+	bool regex;
+	bool array;
+	bool any;
+	int events;
+	int warmup;
+	/* distinct event names and ids the rules are spread over */
+	int types;
+	int ids;
+	unsigned int seed;
+	int log_level;
+};
+
+struct bench_result {
+	double seconds;
+	uint64_t allocs;
+	uint64_t requests;
+	uint64_t *latency;
+};
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n\n"
+		"  -n <rules> recipe rules [1000]\n"
+		"  -k <conditions> conditions per recipe rule [2]\n"
+		"  -u <rules> UCI rules [0]\n"
+		"  -r match on a regex\n"
+		"  -a match on an array\n"
+		"  -o OR the conditions instead of AND\n"
+		"  -e <events> events dispatched [100000]\n"
+		"  -w <events> events dispatched before measuring [1000]\n"
+		"  -t <types> distinct event names [16]\n"
+		"  -i <ids> distinct ids an event matches on [64]\n"
+		"  -s <seed> random seed [1]\n"
+		"  -L <level> log level, 0-7 [%d]\n"
+		"  -h help\n\n"
+		"Results are printed as JSON.\n"
+		, prog, LOG_ERR);
+}
+
+/* the value a condition matches on */
+static void bench_write_match(FILE *f, const struct bench_opts *o, int v)
+{
+	if (o->regex)
+		fprintf(f, "\"mac\": \"^02:00:00:00:%02x:\"", v & 0xff);
+	else
+		fprintf(f, "\"id\": %d", v);
+
+	if (o->array)
+		fprintf(f, ", \"list\": [%d, 1, 2]", v % 8);
+}
+
+static int bench_write_recipe(const char *path, const struct bench_opts *o)
+{
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL)
+		return -1;
+
+	fprintf(f, "{\n");
+
+	for (int i = 0; i < o->rules; i++) {
+		fprintf(f, "\t\"bench_%d\": {\"if_operator\": \"%s\", "
+				"\"if_event_period\": 60, \"if\": [",
+				i, o->any ? "OR" : "AND");
+
+		for (int j = 0; j < o->conds; j++) {
+			fprintf(f, "%s{\"event\": \"" BENCH_EVENT ".%d\", %s\"match\": {",
+					j ? ", " : "", (i + j) % o->types,
+					o->regex ? "\"regex\": true, " : "");
+			bench_write_match(f, o, (i * o->conds + j) % o->ids);
+			fprintf(f, "}}");
+		}
+
+		fprintf(f, "], \"then\": [{\"object\": \"bench\", \"method\": \"noop\", "
+				"\"args\": {\"id\": \"&event->id\", \"mac\": \"&event->mac\"}}]}%s\n",
+				i + 1 < o->rules ? "," : "");
+	}
+
+	fprintf(f, "}\n");
+	fclose(f);
+
+	return 0;
+}
+
+static int bench_write_package(
+  const char *path,
+  const char *recipe,
+  const struct bench_opts *o
+) {
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL)
+		return -1;
+
+	fprintf(f, "config rule\n\toption recipe '%s'\n\n", recipe);
+
+	for (int i = 0; i < o->uci_rules; i++)
+		fprintf(f, "config rule\n"
+				"\toption event '" BENCH_EVENT ".%d'\n"
+				"\tlist event_data \"{'id': %d}\"\n"
+				"\toption method 'bench->noop'\n"
+				"\tlist method_data \"{'id': '&event->id'}\"\n\n",
+				i % o->types, i % o->ids);
+
+	fclose(f);
+
+	return 0;
+}
+
+static void bench_build_event(struct blob_buf *b, const struct bench_opts *o, int n)
+{
+	char mac[32] = {0};
+	int id = rand() % o->ids;
+	void *a = NULL;
+
+	snprintf(mac, sizeof(mac), "02:00:00:00:%02x:%02x", id & 0xff, n & 0xff);
+
+	blob_buf_init(b, 0);
+	blobmsg_add_u32(b, "id", id);
+	blobmsg_add_string(b, "mac", mac);
+	a = blobmsg_open_array(b, "list");
+	blobmsg_add_u32(b, NULL, id % 8);
+	blobmsg_add_u32(b, NULL, 1);
+	blobmsg_add_u32(b, NULL, 2);
+	blobmsg_close_array(b, a);
+	blobmsg_add_u32(b, "rssi", -40);
+}
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t bench_percentile(const uint64_t *sorted, int n, double p)
+{
+	int i = (int) (p * n);
+
+	return sorted[i < n ? i : n - 1];
+}
+
+static void bench_run(
+  struct ruleng_bus_ctx *ctx,
+  const struct bench_opts *o,
+  struct bench_result *res
+) {
+	static struct blob_buf msgs[BENCH_MESSAGES];
+	static char types[BENCH_MESSAGES][32];
+	uint64_t start = 0, t = 0;
+
+	for (int i = 0; i < BENCH_MESSAGES; i++) {
+		snprintf(types[i], sizeof(types[i]), BENCH_EVENT ".%d", rand() % o->types);
+		bench_build_event(&msgs[i], o, i);
+	}
+
+	for (int i = 0; i < o->warmup; i++) {
+		int m = i % BENCH_MESSAGES;
+
+		ruleng_bus_dispatch(ctx, ctx->ubus_ctx, types[m], msgs[m].head,
+							RULENG_BUS_DISPATCH_RULES | RULENG_BUS_DISPATCH_JSON);
+	}
+
+	res->requests = ubus_stub_requests;
+	start = bench_now();
+
+	for (int i = 0; i < o->events; i++) {
+		int m = i % BENCH_MESSAGES;
+
+		t = bench_now();
+		alloc_counting = true;
+		ruleng_log_event_begin();
+		ruleng_bus_dispatch(ctx, ctx->ubus_ctx, types[m], msgs[m].head,
+							RULENG_BUS_DISPATCH_RULES | RULENG_BUS_DISPATCH_JSON);
+		alloc_counting = false;
+		res->latency[i] = bench_now() - t;
+	}
+
+	res->seconds = (bench_now() - start) / 1e9;
+	res->allocs = alloc_count;
+	res->requests = ubus_stub_requests - res->requests;
+
+	for (int i = 0; i < BENCH_MESSAGES; i++)
+		blob_buf_free(&msgs[i]);
+}
+
+static void bench_report(const struct bench_opts *o, struct bench_result *res)
+{
+	struct blob_buf b = {0};
+	char *json = NULL;
+	void *t = NULL;
+	int n = o->events;
+
+	qsort(res->latency, n, sizeof(*res->latency), bench_cmp);
+
+	blob_buf_init(&b, 0);
+
+	t = blobmsg_open_table(&b, "config");
+	blobmsg_add_u32(&b, "rules", o->rules);
+	blobmsg_add_u32(&b, "conditions", o->conds);
+	blobmsg_add_u32(&b, "uci_rules", o->uci_rules);
+	blobmsg_add_u8(&b, "regex", o->regex);
+	blobmsg_add_u8(&b, "array", o->array);
+	blobmsg_add_string(&b, "operator", o->any ? "OR" : "AND");
+	blobmsg_add_u32(&b, "types", o->types);
+	blobmsg_add_u32(&b, "ids", o->ids);
+	blobmsg_close_table(&b, t);
+
+	blobmsg_add_u32(&b, "events", n);
+	blobmsg_add_double(&b, "seconds", res->seconds);
+	blobmsg_add_double(&b, "events_per_sec", res->seconds > 0 ? n / res->seconds : 0);
+
+	t = blobmsg_open_table(&b, "latency_ns");
+	blobmsg_add_u64(&b, "p50", bench_percentile(res->latency, n, 0.5));
+	blobmsg_add_u64(&b, "p99", bench_percentile(res->latency, n, 0.99));
+	blobmsg_add_u64(&b, "p999", bench_percentile(res->latency, n, 0.999));
+	blobmsg_add_u64(&b, "max", res->latency[n - 1]);
+	blobmsg_close_table(&b, t);
+
+	blobmsg_add_u64(&b, "actions", res->requests);
+	blobmsg_add_double(&b, "allocs_per_event", (double) res->allocs / n);
+
+	json = blobmsg_format_json(b.head, true);
+	if (json)
+		printf("%s\n", json);
+
+	free(json);
+	blob_buf_free(&b);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.rules = 1000,
+		.conds = 2,
+		.events = 100000,
+		.warmup = 1000,
+		.types = 16,
+		.ids = 64,
+		.seed = 1,
+		.log_level = LOG_ERR,
+	};
+	struct ruleng_rules_ctx *com_ctx = NULL;
+	struct ruleng_bus_ctx *ctx = NULL;
+	struct bench_result res = {0};
+	char dir[] = "/tmp/rulengd-bench.XXXXXX";
+	char package[sizeof(dir) + 16] = {0};
+	char recipe[sizeof(dir) + 16] = {0};
+	int rc = EXIT_FAILURE;
+	int c = -1;
+
+	while ((c = getopt(argc, argv, "n:k:u:raoe:w:t:i:s:L:h")) != -1) {
+		switch (c) {
+			case 'n':
+				o.rules = atoi(optarg);
+				break;
+			case 'k':
+				o.conds = atoi(optarg);
+				break;
+			case 'u':
+				o.uci_rules = atoi(optarg);
+				break;
+			case 'r':
+				o.regex = true;
+				break;
+			case 'a':
+				o.array = true;
+				break;
+			case 'o':
+				o.any = true;
+				break;
+			case 'e':
+				o.events = atoi(optarg);
+				break;
+			case 'w':
+				o.warmup = atoi(optarg);
+				break;
+			case 't':
+				o.types = atoi(optarg);
+				break;
+			case 'i':
+				o.ids = atoi(optarg);
+				break;
+			case 's':
+				o.seed = (unsigned int) strtoul(optarg, NULL, 0);
+				break;
+			case 'L':
+				o.log_level = atoi(optarg);
+				break;
+			case 'h':
+				bench_usage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				bench_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (o.rules < 0 || o.conds < 1 || o.uci_rules < 0 || o.events < 1 ||
+		o.warmup < 0 || o.types < 1 || o.ids < 1) {
+		bench_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	srand(o.seed);
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(package, sizeof(package), "%s/" BENCH_PACKAGE, dir);
+	snprintf(recipe, sizeof(recipe), "%s/bench.json", dir);
+
+	if (bench_write_recipe(recipe, &o) || bench_write_package(package, recipe, &o)) {
+		perror("writing rules");
+		goto cleanup_files;
+	}
+
+	res.latency = calloc(o.events, sizeof(*res.latency));
+	if (res.latency == NULL)
+		goto cleanup_files;
+
+	if (ruleng_log_init(NULL, o.log_level) != RULENG_LOG_OK)
+		goto cleanup_latency;
+
+	if (ruleng_rules_ctx_init(&com_ctx) != RULENG_RULES_OK)
+		goto cleanup_log;
+
+	uci_set_confdir(com_ctx->uci_ctx, dir);
+
+	if (ruleng_bus_init(&ctx, com_ctx, BENCH_PACKAGE, NULL, NULL) != RULENG_BUS_OK) {
+		fprintf(stderr, "failed to load the rules\n");
+		goto cleanup_rules;
+	}
+
+	bench_run(ctx, &o, &res);
+	bench_report(&o, &res);
+
+	rc = EXIT_SUCCESS;
+
+	ruleng_bus_free(ctx);
+cleanup_rules:
+	ruleng_rules_ctx_free(com_ctx);
+cleanup_log:
+	ruleng_log_free();
+cleanup_latency:
+	free(res.latency);
+cleanup_files:
+	unlink(recipe);
+	unlink(package);
+	rmdir(dir);
+	return rc;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libubox/blobmsg.h>
+
+#include "bench.h"
+#include "ruleng_blob.h"
+
+struct extract_case {
+	const char *ref;
+	struct blob_attr *msg;
+};
+
+static void extract_run(void *priv, uint64_t iters)
+{
+	struct extract_case *c = priv;
+
+	for (uint64_t i = 0; i < iters; i++)
+		bench_sink += (uintptr_t) ruleng_blob_extract_value(c->ref, c->msg);
+}
+
+/* a message whose last member is a table holding an array of 'n' values */
+static void extract_build_nested(struct blob_buf *b, int n)
+{
+	void *t = NULL, *l = NULL;
+
+	bench_build_message(b, n - 1, false);
+
+	t = blobmsg_open_table(b, "nest");
+	l = blobmsg_open_array(b, "list");
+
+	for (int i = 0; i < n; i++)
+		blobmsg_add_u32(b, NULL, i);
+
+	blobmsg_close_array(b, l);
+	blobmsg_close_table(b, t);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o;
+	struct bench_stats st;
+	struct blob_buf report, msg = {0};
+	char ref[64];
+	int rc = bench_init(argc, argv, &o);
+
+	if (rc)
+		return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	bench_report_begin(&report, "extract_value");
+
+	// the referenced value is the last one looked at
+	for (int i = 0; i < bench_n_sizes; i++) {
+		struct extract_case c = { .ref = ref };
+
+		bench_build_message(&msg, bench_sizes[i], false);
+		snprintf(ref, sizeof(ref), "&event->attr%d", bench_sizes[i] - 1);
+		c.msg = msg.head;
+
+		bench_measure(&o, extract_run, &c, &st);
+		bench_report_add(&report, "member", bench_sizes[i], &st);
+	}
+
+	for (int i = 0; i < bench_n_sizes; i++) {
+		struct extract_case c = { .ref = ref };
+
+		extract_build_nested(&msg, bench_sizes[i]);
+		snprintf(ref, sizeof(ref), "&event->nest.list[%d]", bench_sizes[i] - 1);
+		c.msg = msg.head;
+
+		bench_measure(&o, extract_run, &c, &st);
+		bench_report_add(&report, "nested", bench_sizes[i], &st);
+	}
+
+	bench_report_end(&report);
+	blob_buf_free(&msg);
+	bench_free();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Stand-in for libubus, nothing is connected: objects are always found and
+ * requests complete as soon as they are sent.
+ */
+
+/* requests sent and the bytes of their arguments */
+extern uint64_t ubus_stub_requests;
+extern uint64_t ubus_stub_bytes;
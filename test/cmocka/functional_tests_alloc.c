@@ -0,0 +1,211 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+#include <libubus.h>
+
+#include "alloc_count.h"
+#include "ruleng_arena.h"
+#include "ruleng_bus.h"
+#include "ruleng_log.h"
+#include "ruleng_rules.h"
+
+#define ALLOC_RECIPE "/tmp/ruleng-test-alloc.json"
+/* events dispatched before counting, to let caches and buffers settle */
+#define ALLOC_WARMUP 16
+#define ALLOC_ROUNDS 256
+/* heap allocations an event may make besides the ubus requests it sends */
+#define ALLOC_EVENT_BUDGET 0
+
+struct test_env {
+	struct ruleng_rules_ctx *com_ctx;
+	struct ruleng_bus_ctx *ctx;
+	/* whether the actions' ubus object is there to send requests to */
+	bool template;
+};
+
+enum {
+	EVENT_UCI,
+	EVENT_STA,
+	EVENT_CLIENT,
+	__EVENT_MAX,
+};
+
+static const struct {
+	const char *type;
+	const char *data;
+	bool json;
+	/* ubus calls the event triggers */
+	int calls;
+} events[__EVENT_MAX] = {
+	[EVENT_UCI] = { "wifi.radio.channel_changed",
+		"{\"radio\": 0, \"reason\": 1, \"channels\": [1, 2, 3]}", false, 1 },
+	[EVENT_STA] = { "test.alloc.sta",
+		"{\"macaddr\": \"00:11:22:33:44:55\", \"rssi\": -40}", true, 1 },
+	[EVENT_CLIENT] = { "test.alloc.client",
+		"{\"macaddr\": \"00:11:22:33:44:55\", \"ifaces\": [\"wl0\", \"wl1\"]}", true, 2 },
+};
+
+static void write_recipe(const char *path)
+{
+	FILE *f = fopen(path, "w");
+
+	assert_non_null(f);
+	fprintf(f, "{\n"
+			"\t\"alloc_and\": {\"if_operator\": \"AND\", \"if_event_period\": 60, "
+			"\"if\": [{\"event\": \"test.alloc.sta\", \"regex\": true, "
+			"\"match\": {\"macaddr\": \"^00:11:\"}}, "
+			"{\"event\": \"test.alloc.client\", \"match\": {\"ifaces\": [\"wl0\", \"wl1\"]}}], "
+			"\"then\": [{\"object\": \"template\", \"method\": \"increment\", "
+			"\"args\": {\"mac\": \"&event->macaddr\"}}]},\n"
+			"\t\"alloc_or\": {\"if_operator\": \"OR\", "
+			"\"if\": [{\"event\": \"test.alloc.*\"}], "
+			"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}\n"
+			"}\n");
+	fclose(f);
+}
+
+/* wait for the replies to the requests sent, so none is queued meanwhile */
+static void drain(struct ubus_context *ubus_ctx)
+{
+	struct pollfd pfd = { .fd = ubus_ctx->sock.fd, .events = POLLIN };
+
+	while (!list_empty(&ubus_ctx->requests) && poll(&pfd, 1, 1000) > 0)
+		ubus_handle_event(ubus_ctx);
+}
+
+static void dispatch(struct test_env *e, int i, struct blob_attr *msg)
+{
+	struct ruleng_bus_ctx *ctx = e->ctx;
+
+	if (events[i].json)
+		ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, events[i].type, msg);
+	else
+		ruleng_event_cb(ctx->ubus_ctx, &ctx->handler, events[i].type, msg);
+}
+
+static void test_rulengd_alloc_free_dispatch(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_arena_stats stats = {0};
+	struct blob_buf bb[__EVENT_MAX] = {0};
+	uint64_t promoted = 0, calls = 0;
+
+	for (int i = 0; i < __EVENT_MAX; i++) {
+		blob_buf_init(&bb[i], 0);
+		assert_true(blobmsg_add_json_from_string(&bb[i], events[i].data));
+	}
+
+	for (int n = 0; n < ALLOC_WARMUP; n++) {
+		for (int i = 0; i < __EVENT_MAX; i++) {
+			dispatch(e, i, bb[i].head);
+			drain(e->ctx->ubus_ctx);
+		}
+	}
+
+	ruleng_arena_get_stats(&stats);
+	promoted = stats.promoted;
+
+	for (int n = 0; n < ALLOC_ROUNDS; n++) {
+		for (int i = 0; i < __EVENT_MAX; i++) {
+			uint64_t sent = 0;
+
+			alloc_count = 0;
+			alloc_counting = true;
+			dispatch(e, i, bb[i].head);
+			alloc_counting = false;
+
+			ruleng_arena_get_stats(&stats);
+			sent = stats.promoted - promoted;
+			promoted = stats.promoted;
+			calls += sent;
+
+			if (alloc_count > sent + ALLOC_EVENT_BUDGET)
+				fprintf(stderr, "%s: %u allocations for %d requests\n",
+						events[i].type, (unsigned int) alloc_count, (int) sent);
+
+			assert_true(alloc_count <= sent + ALLOC_EVENT_BUDGET);
+			assert_int_equal(stats.last_allocs, sent);
+
+			drain(e->ctx->ubus_ctx);
+		}
+	}
+
+	// without the template object the actions fail before sending anything
+	if (e->template) {
+		int per_round = 0;
+
+		for (int i = 0; i < __EVENT_MAX; i++)
+			per_round += events[i].calls;
+
+		assert_int_equal(calls, ALLOC_ROUNDS * per_round);
+	}
+
+	for (int i = 0; i < __EVENT_MAX; i++)
+		blob_buf_free(&bb[i]);
+}
+
+static int group_setup(void **state)
+{
+	struct test_env *e = calloc(1, sizeof(*e));
+	uint32_t id = 0;
+
+	if (e == NULL)
+		return -1;
+
+	// info messages format every event, they are not part of the budget
+	if (ruleng_log_init(NULL, LOG_NOTICE) != RULENG_LOG_OK)
+		goto cleanup_env;
+
+	write_recipe(ALLOC_RECIPE);
+
+	if (ruleng_rules_ctx_init(&e->com_ctx) != RULENG_RULES_OK)
+		goto cleanup_log;
+
+	if (ruleng_bus_init(&e->ctx, e->com_ctx, "ruleng-test-alloc", NULL, NULL) != RULENG_BUS_OK)
+		goto cleanup_rules;
+
+	e->template = ubus_lookup_id(e->ctx->ubus_ctx, "template", &id) == 0;
+	if (!e->template)
+		fprintf(stdout, "\"template\" is not running, no requests are sent\n");
+
+	*state = e;
+	return 0;
+
+cleanup_rules:
+	ruleng_rules_ctx_free(e->com_ctx);
+cleanup_log:
+	ruleng_log_free();
+	remove(ALLOC_RECIPE);
+cleanup_env:
+	free(e);
+	return -1;
+}
+
+static int group_teardown(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+
+	ruleng_bus_free(e->ctx);
+	ruleng_rules_ctx_free(e->com_ctx);
+	ruleng_log_free();
+	remove(ALLOC_RECIPE);
+	free(e);
+
+	return 0;
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rulengd_alloc_free_dispatch),
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
@@ -47,12 +47,12 @@ static void test_rulengd_test_init(void **state)
 	struct ruleng_ctx *ctx;
     int rv;
 
-    rv = ruleng_init(NULL, "ruleng-test-uci", &ctx);
+    rv = ruleng_init(NULL, "ruleng-test-uci", NULL, NULL, NULL, &ctx);
     assert_int_equal(rv, RULENG_OK);
 
     ruleng_free(ctx);
 
-    rv = ruleng_init(NULL, "asdasd", &ctx);
+    rv = ruleng_init(NULL, "asdasd", NULL, NULL, NULL, &ctx);
     assert_int_equal(rv, RULENG_ERR_BUS_INIT);
 }
 
@@ -38,8 +38,11 @@
 
 #include "ruleng.h"
 #include "ruleng_bus.h"
+#include "ruleng_clock.h"
 #include "ruleng_json.h"
 #include "ruleng_rules.h"
+#include "ruleng_runtime.h"
+#include "ruleng_timer.h"
 
 struct test_env {
 	struct ubus_context *ctx;
@@ -449,7 +452,7 @@ static void test_rulengd_trigger_invoke_multi_condition(void **state)
 	
 	r = rulengd_get_json_rule(ctx, "test.event");
 	assert_non_null(r);
-	/* this one will (could fail, extremely unlikely? if time(NULL) ticks between calls?) work because wasted_time will be 0 and wait_time is unset (0) */
+	/* this one will work, the events come at the same time on the virtual clock and if_event_period is unset (0) */
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
 
 
@@ -465,13 +468,13 @@ static void test_rulengd_trigger_invoke_multi_condition(void **state)
 	invoke_template(state, "status", invoke_status_cb, e);
 	assert_int_equal(1, e->counter);
 
-	/* this one wont work because wasted_time will be 3 and wait_time is unset (0) */
+	/* this one wont work, the second event comes a second after the first and if_event_period is unset (0) */
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
 
 	assert_int_equal(3, r->hits);
 	invoke_template(state, "status", invoke_status_cb, e);
 	assert_int_equal(1, e->counter);
-	sleep(1);
+	ruleng_clock_advance(1 * 1000000);
 
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 	sleep(5);
@@ -508,7 +511,7 @@ static void test_rulengd_trigger_invoke_multi_condition(void **state)
 
 	assert_int_equal(3, r->hits);
 
-	sleep(2);
+	ruleng_clock_advance(2 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 	sleep(5);
 
@@ -520,7 +523,7 @@ static void test_rulengd_trigger_invoke_multi_condition(void **state)
 
 	assert_int_equal(5, r->hits);
 
-	sleep(4);
+	ruleng_clock_advance(4 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 	sleep(5);
 
@@ -543,11 +546,11 @@ static void test_rulengd_trigger_invoke_multi_condition(void **state)
 
 	assert_int_equal(1, r->hits);
 
-	sleep(1);
+	ruleng_clock_advance(1 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 	assert_int_equal(2, r->hits);
 
-	sleep(1);
+	ruleng_clock_advance(1 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.three", bb.head);
 	sleep(5);
 
@@ -558,11 +561,11 @@ static void test_rulengd_trigger_invoke_multi_condition(void **state)
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
 	assert_int_equal(4, r->hits);
 
-	sleep(2);
+	ruleng_clock_advance(2 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 	assert_int_equal(5, r->hits);
 
-	sleep(2);
+	ruleng_clock_advance(2 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.three", bb.head);
 	sleep(5);
 
@@ -598,7 +601,7 @@ static void test_rulengd_trigger_invoke_multi_condition_or(void **state)
 	
 	r = rulengd_get_json_rule(ctx, "test.event");
 	assert_non_null(r);
-	/* this one will (could fail, extremely unlikely? if time(NULL) ticks between calls?) work because wasted_time will be 0 and wait_time is unset (0) */
+	/* this one will work, the events come at the same time on the virtual clock and if_event_period is unset (0) */
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
 
 
@@ -618,7 +621,7 @@ static void test_rulengd_trigger_invoke_multi_condition_or(void **state)
 	assert_int_equal(0, r->hits);
 	invoke_template(state, "status", invoke_status_cb, e);
 	assert_int_equal(3, e->counter);
-	sleep(1);
+	ruleng_clock_advance(1 * 1000000);
 
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 
@@ -644,11 +647,11 @@ static void test_rulengd_trigger_invoke_multi_condition_or(void **state)
 
 	assert_int_equal(0, r->hits);
 
-	sleep(1);
+	ruleng_clock_advance(1 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 	assert_int_equal(0, r->hits);
 
-	sleep(1);
+	ruleng_clock_advance(1 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.three", bb.head);
 
 	assert_int_equal(0, r->hits);
@@ -658,11 +661,11 @@ static void test_rulengd_trigger_invoke_multi_condition_or(void **state)
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
 	assert_int_equal(0, r->hits);
 
-	sleep(2);
+	ruleng_clock_advance(2 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
 	assert_int_equal(0, r->hits);
 
-	sleep(2);
+	ruleng_clock_advance(2 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.three", bb.head);
 
 	assert_int_equal(0, r->hits);
@@ -702,7 +705,7 @@ static void test_rulengd_trigger_invoke_multi_then(void **state)
 	r = rulengd_get_json_rule(ctx, "test.event");
 	assert_non_null(r);
 
-	/* this one will (could fail, yet extremely unlikely? if time(NULL) ticks between calls?) work because wasted_time will be 0 and wait_time is unset (0) */
+	/* this one will work, the events come at the same time on the virtual clock and if_event_period is unset (0) */
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
 
 	assert_int_equal(1, r->hits);
@@ -713,6 +716,12 @@ static void test_rulengd_trigger_invoke_multi_then(void **state)
 
 	assert_int_equal(2, r->hits);
 	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* the second action comes then_exec_interval later */
+	ruleng_clock_advance(1000000);
+	ruleng_timer_run();
+	invoke_template(state, "status", invoke_status_cb, e);
 	assert_int_equal(2, e->counter);
 
 
@@ -729,7 +738,7 @@ static void test_rulengd_trigger_invoke_multi_then(void **state)
 	r = rulengd_get_json_rule(ctx, "test.event");
 	assert_non_null(r);
 
-	/* this one will (could fail, yet extremely unlikely? if time(NULL) ticks between calls?) work because wasted_time will be 0 and wait_time is unset (0) */
+	/* this one will work, the events come at the same time on the virtual clock and if_event_period is unset (0) */
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
 
 	assert_int_equal(1, r->hits);
@@ -740,7 +749,17 @@ static void test_rulengd_trigger_invoke_multi_then(void **state)
 
 	assert_int_equal(2, r->hits);
 	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(3, e->counter);
+
+	ruleng_clock_advance(1000000);
+	ruleng_timer_run();
+	invoke_template(state, "status", invoke_status_cb, e);
 	assert_int_equal(4, e->counter);
+	assert_int_not_equal(0, access("/tmp/test_file.txt", F_OK));
+
+	ruleng_clock_advance(1000000);
+	ruleng_timer_run();
+	invoke_template(state, "status", invoke_status_cb, e);
 	assert_int_equal(0, access("/tmp/test_file.txt", F_OK));
 
 	blob_buf_free(&bb);
@@ -750,7 +769,7 @@ static void test_rulengd_execution_interval(void **state)
 {
 	struct test_env *e = (struct test_env *) *state;
 	struct ruleng_json_rule *r = NULL;
-	int rv, before, after;
+	int rv;
 	enum ruleng_bus_rc rc;
 	struct ruleng_bus_ctx *ctx = e->r_ctx;
 	struct blob_buf bb = {0};
@@ -774,16 +793,542 @@ static void test_rulengd_execution_interval(void **state)
 	r = rulengd_get_json_rule(ctx, "test.event");
 	assert_non_null(r);
 
-	before = time(NULL);
+	/* the second action waits, the event is done with at once */
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	ruleng_clock_advance(4999 * 1000);
+	ruleng_timer_run();
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	ruleng_clock_advance(1000);
+	ruleng_timer_run();
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(2, e->counter);
+
+	blob_buf_free(&bb);
+}
 
+static void test_rulengd_event_period_unset(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	struct blob_buf bb = {0};
+
+	blob_buf_init(&bb, 0);
+	blobmsg_add_u32(&bb, "placeholder", 1);
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "AND", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].match.placeholder", "1", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].event", "test.event.two", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].match.placeholder", "1", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(2, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event");
+	assert_non_null(r);
+
+	/* without if_event_period, events less than a second apart still combine */
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	ruleng_clock_advance(999 * 1000);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
+
+	assert_int_equal(2, r->hits);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* a whole second apart they do not */
+	ruleng_clock_advance(5 * 1000000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	ruleng_clock_advance(1000 * 1000);
 	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
-	after = time(NULL);
 
-	assert_true(before + 5 <= after);
+	assert_int_equal(4, r->hits);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	blob_buf_free(&bb);
+}
+
+static void test_rulengd_event_period_edge(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	struct blob_buf bb = {0};
+
+	blob_buf_init(&bb, 0);
+	blobmsg_add_u32(&bb, "placeholder", 1);
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "AND", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].match.placeholder", "1", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].event", "test.event.two", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].match.placeholder", "1", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "3600", json_type_int);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(2, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event");
+	assert_non_null(r);
+
+	/* the second event comes at the very end of the hour long window */
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	ruleng_clock_advance(3600ULL * 1000000);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
+
+	assert_int_equal(2, r->hits);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* and a millisecond past it */
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	ruleng_clock_advance(3600ULL * 1000000 + 1000);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
+
+	assert_int_equal(4, r->hits);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* the second event of the late pair falls out of the window in turn */
+	ruleng_clock_advance(3600ULL * 1000000 + 1000);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+
+	assert_int_equal(5, r->hits);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* the window slides, a repeated event counts from its last match */
+	ruleng_clock_advance(3000ULL * 1000000);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	ruleng_clock_advance(3000ULL * 1000000);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
+
+	assert_int_equal(7, r->hits);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(2, e->counter);
+
+	blob_buf_free(&bb);
+}
+
+static void test_rulengd_wide_and(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	struct blob_buf bb = {0};
+	char path[64], event[64];
+	const int n = 70;
+
+	blob_buf_init(&bb, 0);
+	blobmsg_add_u32(&bb, "placeholder", 1);
+
+	/* more conditions than a word has bits */
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "AND", json_type_string);
+	for (int i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "test_rule.if[%d].event", i);
+		snprintf(event, sizeof(event), "test.event.wide.%02d", i);
+		json_object_set_by_string(&e->obj, path, event, json_type_string);
+	}
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "10", json_type_int);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(n, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event.wide.00+test.event.wide.01+");
+	assert_non_null(r);
+	assert_int_equal(n, r->n_conds);
+	assert_int_equal(n * strlen("test.event.wide.00+"), strlen(r->event.name));
+
+	/* all but the last condition, the first one twice */
+	for (int i = 0; i < n - 1; i++) {
+		snprintf(event, sizeof(event), "test.event.wide.%02d", i);
+		ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, event, bb.head);
+	}
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.wide.00", bb.head);
+
+	assert_int_equal(1, r->state.n_left);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(0, e->counter);
+
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.wide.69", bb.head);
+
+	assert_int_equal(n + 1, r->hits);
+	assert_int_equal(n, r->state.n_left);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* conditions past the first word expire as well */
+	for (int i = 0; i < n - 1; i++) {
+		snprintf(event, sizeof(event), "test.event.wide.%02d", i);
+		ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, event, bb.head);
+	}
+	ruleng_clock_advance(11 * 1000000);
+	ruleng_timer_run();
+
+	assert_int_equal(n, r->state.n_left);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.wide.69", bb.head);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
 	blob_buf_free(&bb);
 }
 
+static void client_event(struct ruleng_bus_ctx *ctx, const char *type, const char *macaddr)
+{
+	struct blob_buf bb = {0};
+
+	blob_buf_init(&bb, 0);
+	if (macaddr)
+		blobmsg_add_string(&bb, "macaddr", macaddr);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, type, bb.head);
+	blob_buf_free(&bb);
+}
+
+static void test_rulengd_correlation_key(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "AND", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].event", "test.event.two", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "10", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.if_key", "&event->macaddr", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if_key_max", "2", json_type_int);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(2, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event");
+	assert_non_null(r);
+
+	/* events of different clients do not combine */
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+	client_event(ctx, "test.event.two", "00:11:22:33:44:bb");
+	client_event(ctx, "test.event.two", NULL);
+
+	assert_int_equal(2, r->keys.count);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(0, e->counter);
+
+	client_event(ctx, "test.event.two", "00:11:22:33:44:aa");
+
+	assert_int_equal(1, r->keys.count);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* new clients push out the one matched longest ago */
+	client_event(ctx, "test.event", "00:11:22:33:44:cc");
+	client_event(ctx, "test.event", "00:11:22:33:44:dd");
+	client_event(ctx, "test.event", "00:11:22:33:44:bb");
+
+	assert_int_equal(2, r->keys.count);
+	assert_int_equal(2, r->evicted);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* and the ones left go with the window */
+	ruleng_clock_advance(11 * 1000000);
+	ruleng_timer_run();
+
+	assert_int_equal(0, r->keys.count);
+}
+
+static void test_rulengd_sequence(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "SEQUENCE", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[2].event", "test.event.two", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "30", json_type_int);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(2, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event");
+	assert_non_null(r);
+
+	/* an event takes a run one step, even if it matches the next one too */
+	client_event(ctx, "test.event", NULL);
+	client_event(ctx, "test.event.two", NULL);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(0, e->counter);
+
+	client_event(ctx, "test.event", NULL);
+	client_event(ctx, "test.event.two", NULL);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* steps out of order do not count */
+	client_event(ctx, "test.event.two", NULL);
+	client_event(ctx, "test.event", NULL);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* the window counts from the first step */
+	ruleng_clock_advance(20 * 1000000);
+	client_event(ctx, "test.event", NULL);
+	ruleng_clock_advance(11 * 1000000);
+	ruleng_timer_run();
+	client_event(ctx, "test.event.two", NULL);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* the run started 11 s ago is still on */
+	client_event(ctx, "test.event", NULL);
+	client_event(ctx, "test.event.two", NULL);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(2, e->counter);
+	assert_int_equal(r->n_conds, r->state.n_left);
+}
+
+static void test_rulengd_sequence_key_max(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "SEQUENCE", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].event", "test.event.two", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[2].event", "test.event.three", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "30", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.if_key", "&event->macaddr", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if_key_max", "2", json_type_int);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(3, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event");
+	assert_non_null(r);
+
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+	client_event(ctx, "test.event", "00:11:22:33:44:bb");
+
+	/* later steps of clients with no run do not push out the runs */
+	client_event(ctx, "test.event.two", "00:11:22:33:44:cc");
+	client_event(ctx, "test.event.three", "00:11:22:33:44:dd");
+	client_event(ctx, "test.event.two", "00:11:22:33:44:ee");
+
+	assert_int_equal(2, r->keys.count);
+	assert_int_equal(0, r->evicted);
+
+	client_event(ctx, "test.event.two", "00:11:22:33:44:aa");
+	client_event(ctx, "test.event.three", "00:11:22:33:44:aa");
+	client_event(ctx, "test.event.two", "00:11:22:33:44:bb");
+	client_event(ctx, "test.event.three", "00:11:22:33:44:bb");
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(2, e->counter);
+	assert_int_equal(0, r->keys.count);
+}
+
+static void test_rulengd_sequence_pattern(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "SEQUENCE", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.*", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "30", json_type_int);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(2, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.*");
+	assert_non_null(r);
+
+	/* matched by the pattern and the name, an event still takes a run one step */
+	client_event(ctx, "test.event", NULL);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(0, e->counter);
+
+	client_event(ctx, "test.event", NULL);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+	/* and the event which completed it started the next one */
+	assert_int_equal(r->n_conds - 1, r->state.n_left);
+}
+
+static void test_rulengd_absence(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "ABSENCE", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[1].event", "test.event.two", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "120", json_type_int);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(2, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event");
+	assert_non_null(r);
+
+	/* the awaited event comes in time */
+	client_event(ctx, "test.event", NULL);
+	ruleng_clock_advance(60 * 1000000);
+	ruleng_timer_run();
+	client_event(ctx, "test.event.two", NULL);
+	ruleng_clock_advance(120 * 1000000);
+	ruleng_timer_run();
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(0, e->counter);
+
+	/* it does not, the rule fires once the whole period passed */
+	client_event(ctx, "test.event", NULL);
+	ruleng_clock_advance(120 * 1000000);
+	ruleng_timer_run();
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(0, e->counter);
+
+	ruleng_clock_advance(1000);
+	ruleng_timer_run();
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* arming it again starts the period over */
+	client_event(ctx, "test.event", NULL);
+	ruleng_clock_advance(100 * 1000000);
+	ruleng_timer_run();
+	client_event(ctx, "test.event", NULL);
+	ruleng_clock_advance(100 * 1000000);
+	ruleng_timer_run();
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	ruleng_clock_advance(21 * 1000000);
+	ruleng_timer_run();
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(2, e->counter);
+	assert_false(r->state.expire.pending);
+}
+
+static void test_rulengd_count(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+
+	json_object_set_by_string(&e->obj, "test_rule.if_operator", "COUNT", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_set_by_string(&e->obj, "test_rule.if_event_period", "60", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.if_count", "3", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.if_key", "&event->macaddr", json_type_string);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(1, rv);
+
+	r = rulengd_get_json_rule(ctx, "test.event");
+	assert_non_null(r);
+
+	/* each client is counted on its own */
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+	client_event(ctx, "test.event", "00:11:22:33:44:bb");
+	client_event(ctx, "test.event", "00:11:22:33:44:bb");
+	client_event(ctx, "test.event", NULL);
+
+	assert_int_equal(2, r->keys.count);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(0, e->counter);
+
+	/* the count is reached, it starts over */
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+
+	assert_int_equal(1, r->keys.count);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* counts fall out of the period */
+	ruleng_clock_advance(61 * 1000000);
+	ruleng_timer_run();
+
+	assert_int_equal(0, r->keys.count);
+
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+	ruleng_clock_advance(40 * 1000000);
+	ruleng_timer_run();
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+	ruleng_clock_advance(40 * 1000000);
+	ruleng_timer_run();
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	client_event(ctx, "test.event", "00:11:22:33:44:aa");
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(2, e->counter);
+	assert_int_equal(0, r->keys.count);
+}
+
 static void test_rulengd_multi_rule(void **state)
 {
 	struct test_env *e = (struct test_env *) *state;
@@ -880,6 +1425,74 @@ static void test_rulengd_multi_recipe(void **state)
 	blob_buf_free(&bb);
 }
 
+/*
+ * A reload failing on registering the events of the new rule set, here one
+ * too long for ubusd, keeps the running rules, those of the unchanged
+ * recipe included.
+ */
+static void test_rulengd_reload_fail(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	struct blob_buf bb = {0};
+	enum ruleng_bus_rc rc;
+	char *name = NULL;
+	FILE *f = NULL;
+	int rv;
+
+	blob_buf_init(&bb, 0);
+	blobmsg_add_u32(&bb, "placeholder", 1);
+
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event", json_type_string);
+	json_object_set_by_string(&e->obj, "test_rule.if[0].match.placeholder", "1", json_type_int);
+	json_object_set_by_string(&e->obj, "test_rule.then[0]", "{\"object\": \"template\", \"method\": \"increment\"}", json_type_object);
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(1, rv);
+
+	ctx->rules_path = strdup("ruleng-test-recipe");
+	assert_non_null(ctx->rules_path);
+
+	name = malloc(RULENG_BUS_EVENT_NAME_MAX + 2);
+	assert_non_null(name);
+	memset(name, 'x', RULENG_BUS_EVENT_NAME_MAX + 1);
+	name[RULENG_BUS_EVENT_NAME_MAX + 1] = '\0';
+
+	f = fopen("/etc/test_recipe2.json", "w");
+	assert_non_null(f);
+	fprintf(f, "{\"test_long\": {\"if\": [{\"event\": \"%s\"}], "
+			"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}}\n", name);
+	fclose(f);
+	free(name);
+
+	rc = ruleng_bus_reload(ctx, false);
+	assert_int_equal(RULENG_BUS_ERR_REGISTER_EVENT, rc);
+
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	// with the recipe fixed the reload goes through
+	json_object_set_by_string(&e->obj, "test_rule.if[0].event", "test.event.two", json_type_string);
+	json_object_to_file_ext("/etc/test_recipe2.json", e->obj, JSON_C_TO_STRING_PRETTY);
+
+	rc = ruleng_bus_reload(ctx, false);
+	assert_int_equal(RULENG_BUS_OK, rc);
+
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event.two", bb.head);
+
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(3, e->counter);
+
+	free(ctx->rules_path);
+	ctx->rules_path = NULL;
+	blob_buf_free(&bb);
+}
+
 static void test_rulengd_regex(void **state)
 {
 	struct test_env *e = (struct test_env *) *state;
@@ -919,6 +1532,154 @@ static void test_rulengd_regex(void **state)
 	blob_buf_free(&bb);
 }
 
+/* a rule in recipe format as the table the ubus "add" method receives */
+static struct blob_attr *rule_table(struct blob_buf *b, const char *json)
+{
+	blob_buf_init(b, 0);
+
+	void *t = blobmsg_open_table(b, "rule");
+	blobmsg_add_json_from_string(b, json);
+	blobmsg_close_table(b, t);
+
+	return blob_data(b->head);
+}
+
+static void test_rulengd_runtime_rule(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	struct blob_buf bb = {0};
+	struct blob_buf rule = {0};
+	uint32_t id = 0;
+
+	blob_buf_init(&bb, 0);
+	blobmsg_add_u32(&bb, "placeholder", 1);
+
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(0, rv);
+
+	/* invalid rule - not installed */
+	rc = ruleng_runtime_add(ctx, "runtime_rule",
+							rule_table(&rule, "{\"if\": [{\"event\": \"test.event\"}]}"), 0, &id);
+	assert_int_equal(RULENG_BUS_ERR_RULE_INVALID, rc);
+	assert_int_equal(0, ctx->events.count);
+
+	/* valid rule - subscribed on first use */
+	rc = ruleng_runtime_add(ctx, "runtime_rule",
+							rule_table(&rule, "{\"if\": [{\"event\": \"test.event\", \"match\": {\"placeholder\": 1}}],"
+										"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}"),
+							0, &id);
+	assert_int_equal(RULENG_BUS_OK, rc);
+	assert_int_not_equal(0, id);
+	assert_int_equal(1, ctx->events.count);
+
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	/* disabled rule - not dispatched, subscription dropped */
+	rc = ruleng_runtime_set_enabled(ctx, "runtime_rule", false);
+	assert_int_equal(RULENG_BUS_OK, rc);
+	assert_int_equal(0, ctx->events.count);
+
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	rc = ruleng_runtime_set_enabled(ctx, "runtime_rule", true);
+	assert_int_equal(RULENG_BUS_OK, rc);
+	assert_int_equal(1, ctx->events.count);
+
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(2, e->counter);
+
+	/* removed rule - unsubscribed */
+	rc = ruleng_runtime_remove(ctx, "runtime_rule");
+	assert_int_equal(RULENG_BUS_OK, rc);
+	assert_int_equal(0, ctx->events.count);
+
+	rc = ruleng_runtime_remove(ctx, "runtime_rule");
+	assert_int_equal(RULENG_BUS_ERR_RULE_NOT_FOUND, rc);
+
+	/* rule with a ttl - removed once it runs out */
+	rc = ruleng_runtime_add(ctx, "runtime_rule",
+							rule_table(&rule, "{\"if\": [{\"event\": \"test.event\", \"match\": {\"placeholder\": 1}}],"
+										"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}"),
+							60, &id);
+	assert_int_equal(RULENG_BUS_OK, rc);
+	assert_int_equal(1, ctx->events.count);
+
+	ruleng_clock_advance(59999 * 1000);
+	ruleng_timer_run();
+	assert_int_equal(1, ctx->events.count);
+
+	ruleng_clock_advance(1000);
+	ruleng_timer_run();
+	assert_int_equal(0, ctx->events.count);
+
+	rc = ruleng_runtime_remove(ctx, "runtime_rule");
+	assert_int_equal(RULENG_BUS_ERR_RULE_NOT_FOUND, rc);
+
+	blob_buf_free(&rule);
+	blob_buf_free(&bb);
+}
+
+static void test_rulengd_runtime_churn(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	int rv;
+	enum ruleng_bus_rc rc;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	struct blob_buf bb = {0};
+	struct blob_buf rule = {0};
+	char json[256];
+	uint32_t id = 0;
+
+	blob_buf_init(&bb, 0);
+	blobmsg_add_u32(&bb, "placeholder", 1);
+
+	json_object_to_file_ext("/etc/test_recipe1.json", e->obj, JSON_C_TO_STRING_PRETTY);
+	rv = ruleng_bus_register_events(ctx, "ruleng-test-recipe", &rc);
+	assert_int_equal(0, rc);
+	assert_int_equal(0, rv);
+
+	rc = ruleng_runtime_add(ctx, "runtime_keep",
+							rule_table(&rule, "{\"if\": [{\"event\": \"test.event\", \"match\": {\"placeholder\": 1}}],"
+										"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}"),
+							0, &id);
+	assert_int_equal(RULENG_BUS_OK, rc);
+
+	/* names of replaced rules do not pile up on the shared handler */
+	for (int i = 0; i < 64; i++) {
+		snprintf(json, sizeof(json), "{\"if\": [{\"event\": \"test.churn.%d\"}],"
+				 "\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}", i);
+		rc = ruleng_runtime_add(ctx, "runtime_churn", rule_table(&rule, json), 0, &id);
+		assert_int_equal(RULENG_BUS_OK, rc);
+		assert_true(ctx->events.count <= 3);
+	}
+
+	rc = ruleng_runtime_remove(ctx, "runtime_churn");
+	assert_int_equal(RULENG_BUS_OK, rc);
+	assert_true(ctx->events.count <= 2);
+
+	/* the names in use are still delivered */
+	ruleng_event_json_cb(ctx->ubus_ctx, &ctx->json_handler, "test.event", bb.head);
+	invoke_template(state, "status", invoke_status_cb, e);
+	assert_int_equal(1, e->counter);
+
+	rc = ruleng_runtime_remove(ctx, "runtime_keep");
+	assert_int_equal(RULENG_BUS_OK, rc);
+	assert_int_equal(0, ctx->events.count);
+
+	blob_buf_free(&rule);
+	blob_buf_free(&bb);
+}
+
 static int setup(void** state) {
 	struct test_env *e = (struct test_env *) *state;
 
@@ -958,6 +1719,9 @@ static int group_setup(void** state) {
 	ubus_add_uloop(e->ctx);
 	ubus_lookup_id(e->ctx, "template", &e->template_id);
 
+	// correlation windows only move on when the tests say so
+	ruleng_clock_virtual(1000000);
+
 	*state = e;
 
 	return 0;
@@ -967,9 +1731,8 @@ static int group_teardown(void** state) {
 	struct test_env *e = (struct test_env *) *state;
 
     ruleng_rules_ctx_free(e->r_ctx->com_ctx);
-	ubus_free(e->ctx);
+	ruleng_bus_free(e->r_ctx);
 
-    free(e->r_ctx);
 	free(e);
 	return 0;
 }
@@ -987,9 +1750,21 @@ int main(void)
 		cmocka_unit_test_setup_teardown(test_rulengd_trigger_invoke_multi_condition_or, setup, teardown),
 		cmocka_unit_test_setup_teardown(test_rulengd_trigger_invoke_multi_then, setup, teardown), // issue on ruleng_ubus_call if tested individually due to async
 		cmocka_unit_test_setup_teardown(test_rulengd_execution_interval, setup, teardown), // issue on ruleng_ubus_call if tested individually due to async
+		cmocka_unit_test_setup_teardown(test_rulengd_event_period_unset, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_event_period_edge, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_wide_and, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_correlation_key, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_sequence, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_sequence_key_max, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_sequence_pattern, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_absence, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_count, setup, teardown),
 		cmocka_unit_test_setup_teardown(test_rulengd_multi_rule, setup, teardown),
 		cmocka_unit_test_setup_teardown(test_rulengd_multi_recipe, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_reload_fail, setup, teardown),
 		cmocka_unit_test_setup_teardown(test_rulengd_regex, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_runtime_rule, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_runtime_churn, setup, teardown),
 	};
 
 	return cmocka_run_group_tests(tests, group_setup, group_teardown);
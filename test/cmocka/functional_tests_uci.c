@@ -147,15 +147,17 @@ static int setup_bus_ctx(struct ruleng_bus_ctx **ctx)
 	_ctx->ubus_ctx = ubus_ctx;
 
 	INIT_LIST_HEAD(&_ctx->rules);
-	if (RULENG_RULES_OK != ruleng_rules_get(_ctx->com_ctx, &_ctx->rules, "ruleng-test-uci")) {
-		return -1;
-	}
-
 	return 0;
 }
 
 static int setup(void** state) {
 	struct test_env *e = (struct test_env *) *state;
+	enum ruleng_bus_rc rc;
+
+	/* rules are dispatched through the event index built here */
+	ruleng_bus_register_events(e->r_ctx, "ruleng-test-uci", &rc);
+	if (rc != RULENG_BUS_OK)
+		return -1;
 
 	remove("/tmp/test_file.txt");
 	invoke_template(state, "reset", NULL, NULL);
@@ -196,9 +198,8 @@ static int group_teardown(void** state) {
 	struct test_env *e = (struct test_env *) *state;
 
 	ruleng_rules_ctx_free(e->r_ctx->com_ctx);
-	ubus_free(e->ctx);
+	ruleng_bus_free(e->r_ctx);
 
-	free(e->r_ctx);
 	free(e);
 	return 0;
 }
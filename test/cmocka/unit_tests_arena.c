@@ -0,0 +1,114 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubox/blobmsg.h>
+
+#include "ruleng_arena.h"
+
+static void test_rulengd_arena_reset(void **state)
+{
+	(void) state;
+
+	struct ruleng_arena_stats stats = {0};
+	char *s = NULL, *p = NULL;
+
+	ruleng_arena_reset();
+	ruleng_arena_get_stats(&stats);
+	uint64_t events = stats.events;
+
+	/* the first event sets up the arena */
+	s = ruleng_arena_strdup("wifi.ap");
+	assert_non_null(s);
+	assert_string_equal(s, "wifi.ap");
+
+	/* the latest block grows in place */
+	p = ruleng_arena_realloc(s, 8, 64);
+	assert_true(p == s);
+	assert_string_equal(p, "wifi.ap");
+	assert_int_equal(p[63], 0);
+
+	ruleng_arena_reset();
+	ruleng_arena_get_stats(&stats);
+	assert_int_equal(stats.events, events + 1);
+	assert_int_equal(stats.last_allocs, 1);
+	assert_int_equal(stats.size, RULENG_ARENA_BLOCK_SIZE);
+
+	/* later events reuse it */
+	for (int i = 0; i < 100; i++) {
+		assert_non_null(ruleng_arena_alloc(100));
+		ruleng_arena_reset();
+	}
+
+	ruleng_arena_get_stats(&stats);
+	assert_int_equal(stats.last_allocs, 0);
+	assert_int_equal(stats.max_allocs, 1);
+
+	/* an event spilling over is taken in one block afterwards */
+	assert_non_null(ruleng_arena_alloc(RULENG_ARENA_BLOCK_SIZE));
+	assert_non_null(ruleng_arena_alloc(RULENG_ARENA_BLOCK_SIZE));
+	ruleng_arena_reset();
+
+	assert_non_null(ruleng_arena_alloc(RULENG_ARENA_BLOCK_SIZE));
+	assert_non_null(ruleng_arena_alloc(RULENG_ARENA_BLOCK_SIZE));
+	ruleng_arena_reset();
+
+	ruleng_arena_get_stats(&stats);
+	assert_int_equal(stats.last_allocs, 0);
+	assert_int_equal(stats.size, 2 * RULENG_ARENA_BLOCK_SIZE);
+	assert_true(stats.peak >= 2 * RULENG_ARENA_BLOCK_SIZE);
+
+	ruleng_arena_free();
+}
+
+static void test_rulengd_arena_blob_promote(void **state)
+{
+	(void) state;
+
+	struct ruleng_arena_stats stats = {0};
+	struct blob_buf b;
+	struct blob_attr *cur = NULL;
+	char name[16] = {0};
+	int rem = 0, n = 0;
+
+	assert_int_equal(ruleng_arena_blob_buf_init(&b, 0), 0);
+
+	for (int i = 0; i < 200; i++) {
+		snprintf(name, sizeof(name), "key%d", i);
+		blobmsg_add_string(&b, name, "some value of an event");
+	}
+
+	blobmsg_for_each_attr(cur, b.head, rem) {
+		snprintf(name, sizeof(name), "key%d", n++);
+		assert_string_equal(blobmsg_name(cur), name);
+	}
+	assert_int_equal(n, 200);
+
+	char *kept = ruleng_arena_promote(blobmsg_name(blob_data(b.head)), 5);
+	assert_non_null(kept);
+
+	ruleng_arena_reset();
+	ruleng_arena_get_stats(&stats);
+	assert_int_equal(stats.last_allocs, 2);
+	assert_int_equal(stats.promoted, 1);
+
+	/* promoted data outlives the event */
+	assert_string_equal(kept, "key0");
+	free(kept);
+
+	ruleng_arena_free();
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rulengd_arena_reset),
+		cmocka_unit_test(test_rulengd_arena_blob_promote),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
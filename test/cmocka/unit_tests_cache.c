@@ -0,0 +1,352 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <libubox/avl-cmp.h>
+#include <libubox/list.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_cache.h"
+#include "ruleng_json.h"
+#include "ruleng_log.h"
+#include "ruleng_rules.h"
+
+#define CACHE_DIR "/tmp/ruleng-test-cache"
+/* a path rather than a name, the package is the only file besides the recipes */
+#define CACHE_PACKAGE CACHE_DIR "/rules"
+#define CACHE_RECIPE CACHE_DIR "/recipe.json"
+#define CACHE_MISSING CACHE_DIR "/missing.json"
+#define CACHE_FILE CACHE_DIR "/rules.cache"
+
+static const char *package =
+	"config rule\n"
+	"    option event 'test.uci'\n"
+	"    list event_data \"{'radio': 0}\"\n"
+	"    option method 'template->increment'\n"
+	"    list method_data \"{'radio': '&event->radio'}\"\n"
+	"\n"
+	"config rule\n"
+	"    option recipe '" CACHE_RECIPE "'\n"
+	"\n"
+	"config rule\n"
+	"    option recipe '" CACHE_MISSING "'\n";
+
+static const char *recipe =
+	"{\n"
+	"\t\"first\": {\"if\": [{\"event\": \"test.first\"}], "
+	"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]},\n"
+	"\t\"second\": {\"if\": [{\"event\": \"test.second\"}], "
+	"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}\n"
+	"}\n";
+
+static void write_file(const char *path, const char *data)
+{
+	FILE *f = fopen(path, "w");
+
+	assert_non_null(f);
+	assert_int_equal(fputs(data, f) >= 0, 1);
+	fclose(f);
+}
+
+/* move the times of a file an hour back, a rewrite may keep them otherwise */
+static void set_times_back(const char *path)
+{
+	struct stat st = {0};
+	struct timespec times[2];
+
+	assert_int_equal(stat(path, &st), 0);
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+	times[1].tv_sec -= 3600;
+	assert_int_equal(utimensat(AT_FDCWD, path, times, 0), 0);
+}
+
+static int list_count(struct list_head *head)
+{
+	struct list_head *p = NULL;
+	int n = 0;
+
+	list_for_each(p, head)
+		++n;
+
+	return n;
+}
+
+static void cache_clear(struct ruleng_bus_ctx *ctx)
+{
+	ruleng_rules_free(&ctx->rules);
+	ruleng_json_rules_free(&ctx->json_rules);
+	ruleng_json_recipes_free(&ctx->recipes);
+	INIT_LIST_HEAD(&ctx->rules);
+	INIT_LIST_HEAD(&ctx->json_rules);
+}
+
+/* parse the rules as a start without a cache does */
+static void cache_parse(struct ruleng_bus_ctx *ctx)
+{
+	cache_clear(ctx);
+
+	ruleng_cache_package_record(ctx);
+	assert_int_equal(ruleng_rules_get(ctx->com_ctx, &ctx->rules, ctx->rules_path),
+					 RULENG_RULES_OK);
+	assert_int_equal(ruleng_process_json_update(ctx->com_ctx, &ctx->json_rules, NULL, NULL,
+												&ctx->recipes, ctx->rules_path, true),
+					 RULENG_BUS_OK);
+	assert_int_equal(list_count(&ctx->rules), 1);
+	assert_int_equal(list_count(&ctx->json_rules), 2);
+}
+
+/* and write the cache */
+static void cache_build(struct ruleng_bus_ctx *ctx)
+{
+	cache_parse(ctx);
+	assert_int_equal(ruleng_cache_save(ctx), RULENG_CACHE_OK);
+	cache_clear(ctx);
+}
+
+static enum ruleng_cache_rc cache_load(struct ruleng_bus_ctx *ctx, bool *refresh)
+{
+	enum ruleng_cache_rc rc = ruleng_cache_load(ctx, refresh);
+
+	// nothing is left behind by a cache which is not used
+	if (rc != RULENG_CACHE_OK) {
+		assert_int_equal(list_count(&ctx->rules), 0);
+		assert_int_equal(list_count(&ctx->json_rules), 0);
+		assert_int_equal(ctx->recipes.count, 0);
+	}
+
+	return rc;
+}
+
+static void test_rulengd_cache_round_trip(void **state)
+{
+	struct ruleng_bus_ctx *ctx = *state;
+	struct ruleng_json_rule *r = NULL;
+	const char *names[] = { "first", "second" };
+	bool refresh = true;
+	int i = 0;
+
+	cache_build(ctx);
+
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_OK);
+	assert_false(refresh);
+	assert_int_equal(list_count(&ctx->rules), 1);
+	assert_int_equal(list_count(&ctx->json_rules), 2);
+	// the missing recipe is tracked as well, a later reload notices it appear
+	assert_int_equal(ctx->recipes.count, 2);
+
+	list_for_each_entry_reverse(r, &ctx->json_rules, list) {
+		assert_non_null(r->map);
+		assert_string_equal(r->source, CACHE_RECIPE);
+		assert_string_equal(r->name, names[i++]);
+	}
+
+	// a cache written from loaded rules loads the same way
+	assert_int_equal(ruleng_cache_save(ctx), RULENG_CACHE_OK);
+	cache_clear(ctx);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_OK);
+	assert_int_equal(list_count(&ctx->rules), 1);
+	assert_int_equal(list_count(&ctx->json_rules), 2);
+}
+
+static void test_rulengd_cache_corrupt(void **state)
+{
+	struct ruleng_bus_ctx *ctx = *state;
+	struct stat st = {0};
+	bool refresh = false;
+	char c = 0;
+	int fd = -1;
+
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_IO);
+
+	// a flipped byte in the rules fails the checksum
+	cache_build(ctx);
+	fd = open(CACHE_FILE, O_RDWR);
+	assert_true(fd >= 0);
+	assert_int_equal(fstat(fd, &st), 0);
+	assert_int_equal(pread(fd, &c, 1, st.st_size - 8), 1);
+	c ^= 0x20;
+	assert_int_equal(pwrite(fd, &c, 1, st.st_size - 8), 1);
+	close(fd);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_INVALID);
+
+	// and so does a cache cut short
+	cache_build(ctx);
+	assert_int_equal(truncate(CACHE_FILE, st.st_size - 8), 0);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_INVALID);
+
+	assert_int_equal(truncate(CACHE_FILE, sizeof(struct ruleng_cache_header) - 1), 0);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_IO);
+}
+
+static void test_rulengd_cache_stale(void **state)
+{
+	struct ruleng_bus_ctx *ctx = *state;
+	bool refresh = false;
+	char *changed = strdup(recipe);
+
+	assert_non_null(changed);
+
+	// a recipe grown by a rule
+	cache_build(ctx);
+	write_file(CACHE_RECIPE, package);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_STALE);
+
+	// one of the same size, with other contents and times
+	write_file(CACHE_RECIPE, recipe);
+	cache_build(ctx);
+	strstr(changed, "second")[0] = 'S';
+	write_file(CACHE_RECIPE, changed);
+	set_times_back(CACHE_RECIPE);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_STALE);
+
+	// an edited package
+	write_file(CACHE_RECIPE, recipe);
+	cache_build(ctx);
+	write_file(CACHE_PACKAGE, "config rule\n");
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_STALE);
+
+	free(changed);
+}
+
+static void test_rulengd_cache_changed_before_save(void **state)
+{
+	struct ruleng_bus_ctx *ctx = *state;
+	bool refresh = false;
+	char *changed = strdup(recipe);
+
+	assert_non_null(changed);
+	strstr(changed, "second")[0] = 'S';
+
+	// the cache records the recipe the rules were parsed from, not the one saved over it
+	cache_parse(ctx);
+	write_file(CACHE_RECIPE, changed);
+	assert_int_equal(ruleng_cache_save(ctx), RULENG_CACHE_OK);
+	cache_clear(ctx);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_STALE);
+
+	// and the package
+	write_file(CACHE_RECIPE, recipe);
+	cache_parse(ctx);
+	write_file(CACHE_PACKAGE, "config rule\n");
+	assert_int_equal(ruleng_cache_save(ctx), RULENG_CACHE_OK);
+	cache_clear(ctx);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_STALE);
+
+	free(changed);
+}
+
+static void test_rulengd_cache_touched(void **state)
+{
+	struct ruleng_bus_ctx *ctx = *state;
+	bool refresh = false;
+
+	cache_build(ctx);
+
+	// rewritten with the same contents, the cache is used and to be written again
+	write_file(CACHE_RECIPE, recipe);
+	set_times_back(CACHE_RECIPE);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_OK);
+	assert_true(refresh);
+	assert_int_equal(list_count(&ctx->json_rules), 2);
+
+	assert_int_equal(ruleng_cache_save(ctx), RULENG_CACHE_OK);
+	cache_clear(ctx);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_OK);
+	assert_false(refresh);
+}
+
+static void test_rulengd_cache_missing(void **state)
+{
+	struct ruleng_bus_ctx *ctx = *state;
+	bool refresh = false;
+
+	cache_build(ctx);
+
+	// a recipe missing when the cache was written must still be missing
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_OK);
+	cache_clear(ctx);
+
+	write_file(CACHE_MISSING, recipe);
+	assert_int_equal(cache_load(ctx, &refresh), RULENG_CACHE_ERR_STALE);
+}
+
+static int setup(void **state)
+{
+	struct ruleng_bus_ctx *ctx = calloc(1, sizeof(*ctx));
+
+	if (ctx == NULL)
+		return -1;
+
+	if (ruleng_rules_ctx_init(&ctx->com_ctx) != RULENG_RULES_OK) {
+		free(ctx);
+		return -1;
+	}
+
+	mkdir(CACHE_DIR, 0755);
+	write_file(CACHE_PACKAGE, package);
+	write_file(CACHE_RECIPE, recipe);
+	remove(CACHE_MISSING);
+	remove(CACHE_FILE);
+
+	ctx->rules_path = CACHE_PACKAGE;
+	ctx->cache_path = CACHE_FILE;
+	avl_init(&ctx->recipes, avl_strcmp, false, NULL);
+	INIT_LIST_HEAD(&ctx->rules);
+	INIT_LIST_HEAD(&ctx->json_rules);
+
+	*state = ctx;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct ruleng_bus_ctx *ctx = *state;
+
+	cache_clear(ctx);
+	ruleng_rules_ctx_free(ctx->com_ctx);
+	free(ctx);
+
+	remove(CACHE_FILE);
+	remove(CACHE_MISSING);
+	remove(CACHE_RECIPE);
+	remove(CACHE_PACKAGE);
+	rmdir(CACHE_DIR);
+	return 0;
+}
+
+static int group_setup(void **state)
+{
+	(void) state;
+
+	return ruleng_log_init(NULL, LOG_ERR) == RULENG_LOG_OK ? 0 : -1;
+}
+
+static int group_teardown(void **state)
+{
+	(void) state;
+
+	ruleng_log_free();
+	return 0;
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_rulengd_cache_round_trip, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_cache_corrupt, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_cache_stale, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_cache_changed_before_save, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_cache_touched, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rulengd_cache_missing, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
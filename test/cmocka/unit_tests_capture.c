@@ -0,0 +1,154 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_capture.h"
+#include "ruleng_log.h"
+
+#define CAPTURE_LOG "/tmp/ruleng-test-capture.log"
+
+static const struct {
+	const char *type;
+	const char *data;
+	int engines;
+} events[] = {
+	{ "wifi.radio.channel_changed", "{\"radio\": 0, \"channels\": [1, 6, 11]}",
+		RULENG_BUS_DISPATCH_RULES },
+	{ "client", "{\"action\": \"connect\", \"macaddr\": \"00:11:22:33:44:55\"}",
+		RULENG_BUS_DISPATCH_JSON },
+	{ "wifi.radio.channel_changed", "{\"radio\": 1, \"channels\": [36]}",
+		RULENG_BUS_DISPATCH_RULES | RULENG_BUS_DISPATCH_JSON },
+	{ "client", "{}", RULENG_BUS_DISPATCH_JSON },
+};
+
+#define N_EVENTS (sizeof(events) / sizeof(events[0]))
+
+static void capture_session(struct blob_buf *bb)
+{
+	struct ruleng_capture *cap = NULL;
+
+	assert_int_equal(ruleng_capture_open(&cap, CAPTURE_LOG), RULENG_CAPTURE_OK);
+
+	for (size_t i = 0; i < N_EVENTS; i++)
+		ruleng_capture_write(cap, events[i].type, bb[i].head, events[i].engines);
+
+	assert_int_equal(cap->events, N_EVENTS);
+	// event names are written once per session
+	assert_int_equal(cap->n_types, 2);
+
+	ruleng_capture_close(cap);
+}
+
+static void test_rulengd_capture_replay(void **state)
+{
+	(void) state;
+
+	struct blob_buf bb[N_EVENTS] = {0};
+	struct ruleng_capture_reader r;
+	struct ruleng_capture_event ev = {0};
+	uint64_t ts = 0;
+
+	remove(CAPTURE_LOG);
+
+	for (size_t i = 0; i < N_EVENTS; i++) {
+		blob_buf_init(&bb[i], 0);
+		assert_true(blobmsg_add_json_from_string(&bb[i], events[i].data));
+	}
+
+	// a log is appended to, each capture in a session of its own
+	capture_session(bb);
+	capture_session(bb);
+
+	assert_int_equal(ruleng_capture_reader_open(&r, CAPTURE_LOG), RULENG_CAPTURE_OK);
+
+	for (int n = 0; n < 2; n++) {
+		for (size_t i = 0; i < N_EVENTS; i++) {
+			assert_int_equal(ruleng_capture_reader_next(&r, &ev), RULENG_CAPTURE_OK);
+			assert_string_equal(ev.type, events[i].type);
+			assert_int_equal(ev.engines, events[i].engines);
+			assert_true(blob_attr_equal(ev.msg, bb[i].head));
+			assert_true(ev.ts_us >= ts);
+			ts = ev.ts_us;
+		}
+	}
+
+	assert_int_equal(ruleng_capture_reader_next(&r, &ev), RULENG_CAPTURE_END);
+	ruleng_capture_reader_close(&r);
+
+	for (size_t i = 0; i < N_EVENTS; i++)
+		blob_buf_free(&bb[i]);
+
+	remove(CAPTURE_LOG);
+}
+
+static void test_rulengd_capture_truncated(void **state)
+{
+	(void) state;
+
+	struct blob_buf b = {0};
+	struct ruleng_capture *cap = NULL;
+	struct ruleng_capture_reader r;
+	struct ruleng_capture_event ev = {0};
+	FILE *f = NULL;
+	long size = 0;
+
+	remove(CAPTURE_LOG);
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_string(&b, "macaddr", "00:11:22:33:44:55");
+
+	assert_int_equal(ruleng_capture_open(&cap, CAPTURE_LOG), RULENG_CAPTURE_OK);
+	ruleng_capture_write(cap, "client", b.head, RULENG_BUS_DISPATCH_JSON);
+	ruleng_capture_write(cap, "client", b.head, RULENG_BUS_DISPATCH_JSON);
+	ruleng_capture_close(cap);
+
+	// cut the last payload short, as a crash while writing would
+	f = fopen(CAPTURE_LOG, "r+");
+	assert_non_null(f);
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	assert_int_equal(ftruncate(fileno(f), size - 3), 0);
+	fclose(f);
+
+	assert_int_equal(ruleng_capture_reader_open(&r, CAPTURE_LOG), RULENG_CAPTURE_OK);
+	assert_int_equal(ruleng_capture_reader_next(&r, &ev), RULENG_CAPTURE_OK);
+	assert_int_equal(ruleng_capture_reader_next(&r, &ev), RULENG_CAPTURE_ERR_INVALID);
+	ruleng_capture_reader_close(&r);
+
+	blob_buf_free(&b);
+	remove(CAPTURE_LOG);
+}
+
+static int group_setup(void **state)
+{
+	(void) state;
+
+	return ruleng_log_init(NULL, LOG_ERR) == RULENG_LOG_OK ? 0 : -1;
+}
+
+static int group_teardown(void **state)
+{
+	(void) state;
+
+	ruleng_log_free();
+	return 0;
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rulengd_capture_replay),
+		cmocka_unit_test(test_rulengd_capture_truncated),
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
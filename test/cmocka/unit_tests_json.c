@@ -182,6 +182,126 @@ static void test_rulengd_valid_recipe(void **state)
 	assert_int_equal(counter, 2);
 }
 
+/* write 'n' rules, spanning several read chunks, cut short after 'len' bytes if non-zero */
+static void write_recipes(const char *path, const char *prefix, int n, long len)
+{
+	FILE *f = fopen(path, "w");
+
+	assert_non_null(f);
+	fprintf(f, "{\n");
+
+	for (int i = 0; i < n; i++)
+		fprintf(f, "\t\"%s_%d\": {\"if_operator\": \"OR\", "
+				"\"if\": [{\"event\": \"test.event\", \"match\": {\"id\": %d}}], "
+				"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}%s\n",
+				prefix, i, i, i + 1 < n ? "," : "");
+
+	fprintf(f, "}\n");
+
+	if (len)
+		assert_int_equal(ftruncate(fileno(f), len), 0);
+
+	fclose(f);
+}
+
+static void test_rulengd_streamed_recipe(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	int counter = 0;
+
+	write_recipes("/etc/test_recipe1.json", "rule", 200, 0);
+	ruleng_process_json(ctx->com_ctx, &ctx->json_rules, "ruleng-test-recipe");
+	list_for_each_entry(r, &ctx->json_rules, list)
+		++counter;
+
+	assert_int_equal(counter, 200);
+
+	clear_rules_init(ctx);
+
+	/* a recipe cut short is dropped as a whole */
+	write_recipes("/etc/test_recipe1.json", "rule", 200, 10000);
+	ruleng_process_json(ctx->com_ctx, &ctx->json_rules, "ruleng-test-recipe");
+	list_for_each_entry(r, &ctx->json_rules, list)
+		assert_int_equal(0, 1);
+}
+
+static void test_rulengd_recipes_order(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	uint32_t id = 0;
+	char name[32];
+	int counter = 0;
+
+	write_recipes("/etc/test_recipe1.json", "first", 100, 0);
+	write_recipes("/etc/test_recipe2.json", "second", 100, 0);
+	ruleng_process_json(ctx->com_ctx, &ctx->json_rules, "ruleng-test-recipe");
+
+	/* recipes may be parsed in parallel, rules still follow the configuration */
+	list_for_each_entry_reverse(r, &ctx->json_rules, list) {
+		snprintf(name, sizeof(name), "%s_%d",
+				 counter < 100 ? "first" : "second", counter % 100);
+		assert_string_equal(r->name, name);
+		assert_true(r->id > id);
+		id = r->id;
+		++counter;
+	}
+
+	assert_int_equal(counter, 200);
+}
+
+static void test_rulengd_recipe_names(void **state)
+{
+	struct test_env *e = (struct test_env *) *state;
+	struct ruleng_json_rule *r = NULL;
+	struct ruleng_bus_ctx *ctx = e->r_ctx;
+	const char *rule = "{\"if\": [{\"event\": \"%s\"}], "
+		"\"then\": [{\"object\": \"template\", \"method\": \"increment\"}]}";
+	char name[1024];
+	int counter = 0;
+	FILE *f = fopen("/etc/test_recipe1.json", "w");
+
+	assert_non_null(f);
+	memset(name, 'n', sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+
+	/* names are read the way json-c reads them, a repeated one takes its later value */
+	fprintf(f, "{\n\t\"%s\": ", name);
+	fprintf(f, rule, "test.long");
+	fprintf(f, ",\n\t\"dup\": ");
+	fprintf(f, rule, "test.first");
+	fprintf(f, ",\n\t\"line\\nbreak \\u00e9\\ud83d\\ude00\": ");
+	fprintf(f, rule, "test.escaped");
+	fprintf(f, ",\n\t\"dup\": ");
+	fprintf(f, rule, "test.second");
+	fprintf(f, "\n}\n");
+	fclose(f);
+
+	ruleng_process_json(ctx->com_ctx, &ctx->json_rules, "ruleng-test-recipe");
+
+	list_for_each_entry_reverse(r, &ctx->json_rules, list) {
+		switch (counter++) {
+		case 0:
+			assert_string_equal(r->name, name);
+			assert_string_equal(r->conds[0].event, "test.long");
+			break;
+		case 1:
+			assert_string_equal(r->name, "dup");
+			assert_string_equal(r->conds[0].event, "test.second");
+			break;
+		case 2:
+			assert_string_equal(r->name, "line\nbreak \xc3\xa9\xf0\x9f\x98\x80");
+			assert_string_equal(r->conds[0].event, "test.escaped");
+			break;
+		}
+	}
+
+	assert_int_equal(counter, 3);
+}
+
 static int setup(void** state) {
 	struct test_env *e = (struct test_env *) *state;
 
@@ -236,6 +356,9 @@ int main(void)
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test_setup_teardown(test_rulengd_invalid_recipes, setup, teardown), // unit
 		cmocka_unit_test_setup_teardown(test_rulengd_valid_recipe, setup, teardown), // unit
+		cmocka_unit_test_setup_teardown(test_rulengd_streamed_recipe, setup, teardown), // unit
+		cmocka_unit_test_setup_teardown(test_rulengd_recipes_order, setup, teardown), // unit
+		cmocka_unit_test_setup_teardown(test_rulengd_recipe_names, setup, teardown), // unit
 	};
 
 	return cmocka_run_group_tests(tests, group_setup, group_teardown);
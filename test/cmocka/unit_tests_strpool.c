@@ -0,0 +1,50 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ruleng_strpool.h"
+
+static void test_rulengd_strpool_shared(void **state)
+{
+	(void) state;
+
+	char buf[] = "wifi.ap";
+	size_t count = 0, bytes = 0;
+	const char *a = ruleng_strpool_get("wifi.ap");
+	const char *b = ruleng_strpool_get(buf);
+	const char *c = ruleng_strpool_get("led.wps");
+
+	/* equal strings share one copy */
+	assert_non_null(a);
+	assert_true(a == b);
+	assert_true(a != buf);
+	assert_true(a != c);
+	assert_string_equal(c, "led.wps");
+
+	ruleng_strpool_stats(&count, &bytes);
+	assert_int_equal(count, 2);
+	assert_true(bytes >= sizeof("wifi.ap") + sizeof("led.wps"));
+
+	ruleng_strpool_put(a);
+	assert_string_equal(b, "wifi.ap");
+	ruleng_strpool_put(b);
+	ruleng_strpool_put(c);
+	ruleng_strpool_put(NULL);
+
+	ruleng_strpool_stats(&count, &bytes);
+	assert_int_equal(count, 0);
+	assert_int_equal(bytes, 0);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rulengd_strpool_shared),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,153 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+
+#include "ruleng_clock.h"
+#include "ruleng_timer.h"
+
+#define N_TIMERS 20000
+#define DAY_MS (24ULL * 3600 * 1000)
+
+struct test_timer {
+	struct ruleng_timer t;
+	uint64_t due;
+	uint64_t period;
+	/* runs made before the timer was set */
+	uint64_t runs;
+	int fired;
+};
+
+static struct test_timer timers[N_TIMERS];
+/* timers must fire on the first run they are due by */
+static uint64_t runs;
+static uint64_t last_run;
+
+static void timer_cb(struct ruleng_timer *t)
+{
+	struct test_timer *tt = container_of(t, struct test_timer, t);
+	uint64_t now = ruleng_clock_now_ms();
+
+	assert_true(tt->due <= now);
+	assert_true(tt->runs == runs || tt->due > last_run);
+	++tt->fired;
+
+	if (tt->period) {
+		tt->due = now + tt->period;
+		tt->runs = runs;
+		ruleng_timer_set(t, tt->period);
+	}
+}
+
+static void timer_setup(struct test_timer *tt, uint64_t ms)
+{
+	tt->t.cb = timer_cb;
+	tt->due = ruleng_clock_now_ms() + ms;
+	tt->runs = runs;
+	tt->fired = 0;
+	ruleng_timer_set(&tt->t, ms);
+}
+
+static void advance(uint64_t ms)
+{
+	ruleng_clock_advance(ms * 1000);
+	ruleng_timer_run();
+	last_run = ruleng_clock_now_ms();
+	++runs;
+}
+
+static void test_rulengd_timer_fire(void **state)
+{
+	(void) state;
+
+	srand(1);
+
+	// from right away to past the last level of the wheel
+	for (int i = 0; i < N_TIMERS; i++) {
+		uint64_t ms = (uint64_t) rand() % (1ULL << (rand() % 38));
+
+		timer_setup(&timers[i], ms);
+	}
+
+	assert_int_equal(ruleng_timer_count(), N_TIMERS);
+
+	while (ruleng_timer_count())
+		advance((uint64_t) rand() % (1ULL << (rand() % 34)));
+
+	for (int i = 0; i < N_TIMERS; i++)
+		assert_int_equal(timers[i].fired, 1);
+}
+
+static void test_rulengd_timer_cancel(void **state)
+{
+	(void) state;
+
+	for (int i = 0; i < 1000; i++)
+		timer_setup(&timers[i], (uint64_t) i * 1000);
+
+	// every other timer cancelled, every third moved a day later
+	for (int i = 0; i < 1000; i += 2)
+		ruleng_timer_cancel(&timers[i].t);
+
+	for (int i = 0; i < 1000; i += 3)
+		timer_setup(&timers[i], DAY_MS);
+
+	advance(DAY_MS - 1);
+
+	for (int i = 0; i < 1000; i++)
+		assert_int_equal(timers[i].fired, i % 3 ? i % 2 : 0);
+
+	advance(1);
+
+	for (int i = 0; i < 1000; i++)
+		assert_int_equal(timers[i].fired, i % 3 ? i % 2 : 1);
+
+	assert_int_equal(ruleng_timer_count(), 0);
+}
+
+static void test_rulengd_timer_periodic(void **state)
+{
+	(void) state;
+
+	timers[0].period = 250;
+	timer_setup(&timers[0], 250);
+	timers[1].period = 0;
+	timer_setup(&timers[1], 0);
+
+	// due timers fire on the next run, even without the clock moving
+	advance(0);
+	assert_int_equal(timers[1].fired, 1);
+
+	for (int i = 0; i < 40; i++)
+		advance(25);
+
+	assert_int_equal(timers[0].fired, 4);
+
+	// set again from the handler, it counts from the time run up to
+	advance(3600 * 1000);
+	assert_int_equal(timers[0].fired, 5);
+
+	ruleng_timer_cancel(&timers[0].t);
+	timers[0].period = 0;
+	assert_int_equal(ruleng_timer_count(), 0);
+}
+
+static int group_setup(void **state)
+{
+	(void) state;
+
+	ruleng_clock_virtual(1000000);
+	return 0;
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rulengd_timer_fire),
+		cmocka_unit_test(test_rulengd_timer_cancel),
+		cmocka_unit_test(test_rulengd_timer_periodic),
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, NULL);
+}
@@ -0,0 +1,80 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ruleng_trie.h"
+
+static char matched[256];
+
+static void match_cb(void *val, void *priv)
+{
+	(void) priv;
+
+	strcat(matched, (const char *) val);
+	strcat(matched, ",");
+}
+
+static const char *match(struct ruleng_trie *trie, const char *key)
+{
+	matched[0] = '\0';
+	ruleng_trie_match(trie, key, match_cb, NULL);
+
+	return matched;
+}
+
+static void test_rulengd_trie_match(void **state)
+{
+	(void) state;
+
+	struct ruleng_trie trie = {0};
+	const char *patterns[] = {
+		"wifi.*", "wifi.radio.channel_changed", "wifi.radio*", "wifi", "network.interface.*",
+	};
+
+	for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i)
+		assert_int_equal(0, ruleng_trie_insert(&trie, patterns[i], (void *) patterns[i]));
+
+	/* wildcards from the shortest prefix on, then the exact name */
+	assert_string_equal("wifi.*,wifi.radio*,wifi.radio.channel_changed,",
+						match(&trie, "wifi.radio.channel_changed"));
+	assert_string_equal("wifi.*,", match(&trie, "wifi.sta"));
+	assert_string_equal("wifi,", match(&trie, "wifi"));
+	assert_string_equal("network.interface.*,", match(&trie, "network.interface.lan"));
+	assert_string_equal("", match(&trie, "network.interface"));
+	assert_string_equal("", match(&trie, "button.WPS"));
+
+	assert_true(ruleng_trie_remove(&trie, "wifi.*") == patterns[0]);
+	assert_null(ruleng_trie_remove(&trie, "wifi.*"));
+	assert_string_equal("wifi.radio*,wifi.radio.channel_changed,",
+						match(&trie, "wifi.radio.channel_changed"));
+
+	ruleng_trie_free(&trie);
+}
+
+static void test_rulengd_trie_match_all(void **state)
+{
+	(void) state;
+
+	struct ruleng_trie trie = {0};
+
+	assert_string_equal("", match(&trie, "wifi.sta"));
+	assert_int_equal(0, ruleng_trie_insert(&trie, "*", "*"));
+	assert_string_equal("*,", match(&trie, "wifi.sta"));
+	assert_string_equal("*,", match(&trie, ""));
+
+	ruleng_trie_free(&trie);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rulengd_trie_match),
+		cmocka_unit_test(test_rulengd_trie_match_all),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -47,7 +47,7 @@ static void test_rulengd_non_existing_ubus_socket(void **state)
 	struct ruleng_rules_ctx *com_ctx = calloc(1, sizeof(*com_ctx));
 	int error;
 
-	error = ruleng_bus_init(&ctx, com_ctx, "ruleng-test-uci", "invalid_ubus.sock");
+	error = ruleng_bus_init(&ctx, com_ctx, "ruleng-test-uci", "invalid_ubus.sock", NULL);
 
 	free(com_ctx);
 	assert_int_equal(error, 2);
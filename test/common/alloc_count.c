@@ -0,0 +1,40 @@
+#include <stddef.h>
+
+#include "alloc_count.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+__thread bool alloc_counting;
+__thread uint64_t alloc_count;
+
+void *malloc(size_t size)
+{
+	if (alloc_counting)
+		++alloc_count;
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	if (alloc_counting)
+		++alloc_count;
+
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	if (alloc_counting)
+		++alloc_count;
+
+	return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+	__libc_free(p);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * malloc() and friends are interposed to count the allocations the calling
+ * thread makes while 'alloc_counting' is set. Relies on the glibc allocator
+ * entry points, so programs linking this are not run under valgrind.
+ */
+
+extern __thread bool alloc_counting;
+extern __thread uint64_t alloc_count;
@@ -0,0 +1,644 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <syslog.h>
+
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+#include <libubox/uloop.h>
+#include <libubus.h>
+
+#ifndef RULENGD_PATH
+#define RULENGD_PATH "rulengd"
+#endif
+
+#define LOAD_PACKAGE "ruleng-load"
+#define LOAD_EVENT "load.event"
+#define LOAD_OBJECT "load"
+/* how long to wait for ubusd, rulengd and the objects to come up */
+#define LOAD_START_MS 5000
+/* a step is over once no action arrived for that long */
+#define LOAD_DRAIN_MS 500
+/* latency buckets, 8 per power of two */
+#define LOAD_BUCKETS 496
+
+struct load_opts {
+	int rules;
+	int objects;
+	int delay_us;
+	double rate;
+	double growth;
+	double max_rate;
+	int step_ms;
+	int p99_ms;
+	double loss;
+	const char *ubusd;
+	const char *rulengd;
+	int log_level;
+};
+
+/* filled in by the stand-in objects, shared with the harness */
+struct load_shared {
+	uint64_t calls;
+	uint64_t max_ns;
+	uint64_t hist[LOAD_BUCKETS];
+};
+
+struct load_step {
+	double rate;
+	double sent_rate;
+	uint64_t events;
+	uint64_t actions;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t max_ns;
+};
+
+enum {
+	LOAD_TS,
+	__LOAD_MAX,
+};
+
+static const struct blobmsg_policy load_policy[__LOAD_MAX] = {
+	[LOAD_TS] = { .name = "ts", .type = BLOBMSG_TYPE_INT64 },
+};
+
+static struct load_shared *shared;
+static int load_delay_us;
+static volatile sig_atomic_t load_stop;
+
+static uint64_t load_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int load_bucket(uint64_t ns)
+{
+	int msb = 0;
+
+	if (ns < 8)
+		return (int) ns;
+
+	msb = 63 - __builtin_clzll(ns);
+
+	return (msb - 2) * 8 + (int) ((ns >> (msb - 3)) & 7);
+}
+
+/* smallest latency falling into bucket 'i' */
+static uint64_t load_bucket_value(int i)
+{
+	if (i < 8)
+		return i;
+
+	return (uint64_t) (8 + i % 8) << (i / 8 - 1);
+}
+
+static int load_increment(
+  struct ubus_context *ctx,
+  struct ubus_object *obj,
+  struct ubus_request_data *req,
+  const char *method,
+  struct blob_attr *msg
+) {
+	(void) ctx;
+	(void) obj;
+	(void) req;
+	(void) method;
+
+	struct blob_attr *tb[__LOAD_MAX];
+	uint64_t now = load_now(), lat = 0;
+
+	blobmsg_parse(load_policy, __LOAD_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (tb[LOAD_TS] && now > blobmsg_get_u64(tb[LOAD_TS])) {
+		lat = now - blobmsg_get_u64(tb[LOAD_TS]);
+
+		__atomic_fetch_add(&shared->hist[load_bucket(lat)], 1, __ATOMIC_RELAXED);
+
+		uint64_t max = __atomic_load_n(&shared->max_ns, __ATOMIC_RELAXED);
+		while (lat > max && !__atomic_compare_exchange_n(&shared->max_ns, &max, lat,
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	}
+
+	__atomic_fetch_add(&shared->calls, 1, __ATOMIC_RELEASE);
+
+	// a slow target holds up the requests queued behind it
+	if (load_delay_us)
+		usleep(load_delay_us);
+
+	return 0;
+}
+
+static struct ubus_method load_methods[] = {
+	UBUS_METHOD("increment", load_increment, load_policy),
+};
+
+static struct ubus_object_type load_object_type =
+	UBUS_OBJECT_TYPE(LOAD_OBJECT, load_methods);
+
+static struct ubus_context *load_connect(const char *sock)
+{
+	struct ubus_context *ctx = NULL;
+
+	for (int i = 0; i < LOAD_START_MS / 10 && ctx == NULL; i++) {
+		ctx = ubus_connect(sock);
+		if (ctx == NULL)
+			usleep(10 * 1000);
+	}
+
+	return ctx;
+}
+
+static bool load_wait_object(struct ubus_context *ctx, const char *name)
+{
+	uint32_t id = 0;
+
+	for (int i = 0; i < LOAD_START_MS / 10; i++) {
+		if (ubus_lookup_id(ctx, name, &id) == 0)
+			return true;
+
+		usleep(10 * 1000);
+	}
+
+	fprintf(stderr, "\"%s\" did not show up on ubus\n", name);
+	return false;
+}
+
+/* a stand-in action target, run in a child of the harness */
+static int load_object_run(const char *sock, int i)
+{
+	struct ubus_context *ctx = NULL;
+	struct ubus_object obj = {
+		.type = &load_object_type,
+		.methods = load_methods,
+		.n_methods = ARRAY_SIZE(load_methods),
+	};
+	char name[32] = {0};
+
+	snprintf(name, sizeof(name), LOAD_OBJECT "%d", i);
+	obj.name = name;
+
+	uloop_init();
+
+	ctx = load_connect(sock);
+	if (ctx == NULL)
+		return EXIT_FAILURE;
+
+	ubus_add_uloop(ctx);
+
+	if (ubus_add_object(ctx, &obj)) {
+		fprintf(stderr, "failed to publish \"%s\"\n", name);
+		ubus_free(ctx);
+		return EXIT_FAILURE;
+	}
+
+	uloop_run();
+	ubus_free(ctx);
+	uloop_done();
+
+	return EXIT_SUCCESS;
+}
+
+static pid_t load_spawn(char *const argv[])
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+
+	if (pid < 0)
+		perror("fork");
+
+	return pid;
+}
+
+static bool load_alive(pid_t pid)
+{
+	return pid > 0 && waitpid(pid, NULL, WNOHANG) == 0;
+}
+
+static int load_write_recipe(const char *path, const struct load_opts *o)
+{
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL)
+		return -1;
+
+	fprintf(f, "{\n");
+
+	for (int i = 0; i < o->rules; i++)
+		fprintf(f, "\t\"load_%d\": {\"if_operator\": \"OR\", "
+				"\"if\": [{\"event\": \"" LOAD_EVENT "\", \"match\": {\"id\": %d}}], "
+				"\"then\": [{\"object\": \"" LOAD_OBJECT "%d\", \"method\": \"increment\", "
+				"\"args\": {\"ts\": \"&event->ts\"}}]}%s\n",
+				i, i, i % o->objects, i + 1 < o->rules ? "," : "");
+
+	fprintf(f, "}\n");
+	fclose(f);
+
+	return 0;
+}
+
+static int load_write_package(const char *path, const char *recipe)
+{
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL)
+		return -1;
+
+	fprintf(f, "config rule\n\toption recipe '%s'\n", recipe);
+	fclose(f);
+
+	return 0;
+}
+
+static uint64_t load_percentile(const uint64_t *hist, uint64_t total, double p)
+{
+	uint64_t seen = 0;
+
+	for (int i = 0; i < LOAD_BUCKETS; i++) {
+		seen += hist[i];
+
+		if (seen > 0 && seen >= p * total)
+			return load_bucket_value(i + 1);
+	}
+
+	return 0;
+}
+
+/* send events at 'rate' for a step, then wait for the actions they trigger */
+static void load_run_step(
+  struct ubus_context *ctx,
+  const struct load_opts *o,
+  double rate,
+  struct load_step *st
+) {
+	struct blob_buf b = {0};
+	uint64_t start = 0, now = 0, calls = 0, last = 0;
+	uint64_t hist[LOAD_BUCKETS];
+
+	memset(shared, 0, sizeof(*shared));
+	memset(st, 0, sizeof(*st));
+	st->rate = rate;
+	st->events = (uint64_t) (rate * o->step_ms / 1000);
+	if (st->events == 0)
+		st->events = 1;
+
+	start = load_now();
+
+	for (uint64_t n = 0; n < st->events && !load_stop; n++) {
+		uint64_t due = start + (uint64_t) (n * 1e9 / rate);
+
+		now = load_now();
+		if (due > now) {
+			struct timespec ts = {
+				.tv_sec = due / 1000000000ULL,
+				.tv_nsec = due % 1000000000ULL,
+			};
+
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+
+		blob_buf_init(&b, 0);
+		blobmsg_add_u32(&b, "id", n % o->rules);
+		blobmsg_add_u64(&b, "ts", load_now());
+		ubus_send_event(ctx, LOAD_EVENT, b.head);
+	}
+
+	now = load_now();
+	st->sent_rate = st->events * 1e9 / (now - start);
+
+	// every event matches one rule, which calls one object
+	last = now;
+	while (!load_stop) {
+		uint64_t c = __atomic_load_n(&shared->calls, __ATOMIC_ACQUIRE);
+
+		now = load_now();
+		if (c != calls) {
+			calls = c;
+			last = now;
+		}
+
+		if (calls >= st->events || now - last > LOAD_DRAIN_MS * 1000000ULL)
+			break;
+
+		usleep(10 * 1000);
+	}
+
+	for (int i = 0; i < LOAD_BUCKETS; i++)
+		hist[i] = __atomic_load_n(&shared->hist[i], __ATOMIC_RELAXED);
+
+	st->actions = calls;
+	st->p50_ns = load_percentile(hist, calls, 0.5);
+	st->p99_ns = load_percentile(hist, calls, 0.99);
+	st->max_ns = shared->max_ns;
+
+	blob_buf_free(&b);
+}
+
+/* whether rulengd kept up with a step, the reason it did not otherwise */
+static const char *load_step_check(const struct load_opts *o, const struct load_step *st)
+{
+	if (st->sent_rate < 0.95 * st->rate)
+		return "sender";
+
+	if (st->actions < (1 - o->loss / 100) * st->events)
+		return "loss";
+
+	if (st->p99_ns > o->p99_ms * 1000000ULL)
+		return "latency";
+
+	return NULL;
+}
+
+static void load_report(
+  const struct load_opts *o,
+  const struct load_step *steps,
+  int n,
+  double saturation,
+  const char *reason
+) {
+	struct blob_buf b = {0};
+	void *t = NULL, *a = NULL, *l = NULL;
+	char *json = NULL;
+
+	blob_buf_init(&b, 0);
+
+	t = blobmsg_open_table(&b, "config");
+	blobmsg_add_u32(&b, "rules", o->rules);
+	blobmsg_add_u32(&b, "objects", o->objects);
+	blobmsg_add_u32(&b, "delay_us", o->delay_us);
+	blobmsg_add_u32(&b, "step_ms", o->step_ms);
+	blobmsg_add_u32(&b, "p99_ms", o->p99_ms);
+	blobmsg_add_double(&b, "loss_percent", o->loss);
+	blobmsg_close_table(&b, t);
+
+	a = blobmsg_open_array(&b, "steps");
+	for (int i = 0; i < n; i++) {
+		t = blobmsg_open_table(&b, NULL);
+		blobmsg_add_double(&b, "rate", steps[i].rate);
+		blobmsg_add_double(&b, "sent_rate", steps[i].sent_rate);
+		blobmsg_add_u64(&b, "events", steps[i].events);
+		blobmsg_add_u64(&b, "actions", steps[i].actions);
+
+		l = blobmsg_open_table(&b, "latency_us");
+		blobmsg_add_u64(&b, "p50", steps[i].p50_ns / 1000);
+		blobmsg_add_u64(&b, "p99", steps[i].p99_ns / 1000);
+		blobmsg_add_u64(&b, "max", steps[i].max_ns / 1000);
+		blobmsg_close_table(&b, l);
+
+		blobmsg_close_table(&b, t);
+	}
+	blobmsg_close_array(&b, a);
+
+	t = blobmsg_open_table(&b, "saturation");
+	blobmsg_add_double(&b, "rate", saturation);
+	blobmsg_add_string(&b, "reason", reason ? reason : "none");
+	blobmsg_close_table(&b, t);
+
+	json = blobmsg_format_json(b.head, true);
+	if (json)
+		printf("%s\n", json);
+
+	free(json);
+	blob_buf_free(&b);
+}
+
+static void load_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n\n"
+		"Starts a private ubusd, stand-in action objects and rulengd, then sends\n"
+		"events at increasing rates until rulengd no longer keeps up.\n\n"
+		"Options:\n"
+		"  -n <rules> recipe rules, one per event id [64]\n"
+		"  -o <objects> stand-in objects the actions call [4]\n"
+		"  -d <usec> time an object takes to handle a call [0]\n"
+		"  -r <rate> events per second of the first step [1000]\n"
+		"  -g <factor> rate increase from one step to the next [1.5]\n"
+		"  -m <rate> highest rate tried [1000000]\n"
+		"  -t <msec> step duration [2000]\n"
+		"  -p <msec> p99 latency a sustained rate stays under [50]\n"
+		"  -l <percent> actions a sustained rate may lose [1]\n"
+		"  -U <path> ubusd binary [ubusd]\n"
+		"  -R <path> rulengd binary [" RULENGD_PATH "]\n"
+		"  -L <level> rulengd log level, 0-7 [%d]\n"
+		"  -h help\n\n"
+		"Results are printed as JSON.\n"
+		, prog, LOG_ERR);
+}
+
+static void load_signal(int sig)
+{
+	(void) sig;
+
+	load_stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct load_opts o = {
+		.rules = 64,
+		.objects = 4,
+		.rate = 1000,
+		.growth = 1.5,
+		.max_rate = 1000000,
+		.step_ms = 2000,
+		.p99_ms = 50,
+		.loss = 1,
+		.ubusd = "ubusd",
+		.rulengd = RULENGD_PATH,
+		.log_level = LOG_ERR,
+	};
+	struct ubus_context *ctx = NULL;
+	struct load_step *steps = NULL;
+	char dir[] = "/tmp/rulengd-load.XXXXXX";
+	char sock[sizeof(dir) + 16] = {0};
+	char package[sizeof(dir) + 16] = {0};
+	char recipe[sizeof(dir) + 32] = {0};
+	char level[8] = {0};
+	pid_t ubusd = -1, rulengd = -1, *objects = NULL;
+	double saturation = 0;
+	const char *reason = NULL;
+	int rc = EXIT_FAILURE, n = 0, max_steps = 0;
+	int c = -1;
+
+	while ((c = getopt(argc, argv, "n:o:d:r:g:m:t:p:l:U:R:L:h")) != -1) {
+		switch (c) {
+			case 'n':
+				o.rules = atoi(optarg);
+				break;
+			case 'o':
+				o.objects = atoi(optarg);
+				break;
+			case 'd':
+				o.delay_us = atoi(optarg);
+				break;
+			case 'r':
+				o.rate = atof(optarg);
+				break;
+			case 'g':
+				o.growth = atof(optarg);
+				break;
+			case 'm':
+				o.max_rate = atof(optarg);
+				break;
+			case 't':
+				o.step_ms = atoi(optarg);
+				break;
+			case 'p':
+				o.p99_ms = atoi(optarg);
+				break;
+			case 'l':
+				o.loss = atof(optarg);
+				break;
+			case 'U':
+				o.ubusd = optarg;
+				break;
+			case 'R':
+				o.rulengd = optarg;
+				break;
+			case 'L':
+				o.log_level = atoi(optarg);
+				break;
+			case 'h':
+				load_usage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				load_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (o.rules < 1 || o.objects < 1 || o.delay_us < 0 || o.rate <= 0 ||
+		o.growth <= 1 || o.max_rate < o.rate || o.step_ms < 1 || o.p99_ms < 1 ||
+		o.loss < 0) {
+		load_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (double r = o.rate; r <= o.max_rate; r *= o.growth)
+		++max_steps;
+
+	steps = calloc(max_steps, sizeof(*steps));
+	objects = calloc(o.objects, sizeof(*objects));
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (steps == NULL || objects == NULL || shared == MAP_FAILED) {
+		perror("allocating state");
+		goto cleanup_mem;
+	}
+
+	load_delay_us = o.delay_us;
+	signal(SIGINT, load_signal);
+	signal(SIGTERM, load_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		goto cleanup_mem;
+	}
+
+	snprintf(sock, sizeof(sock), "%s/ubus.sock", dir);
+	snprintf(package, sizeof(package), "%s/" LOAD_PACKAGE, dir);
+	snprintf(recipe, sizeof(recipe), "%s/" LOAD_PACKAGE ".json", dir);
+	snprintf(level, sizeof(level), "%d", o.log_level);
+
+	if (load_write_recipe(recipe, &o) || load_write_package(package, recipe)) {
+		perror("writing rules");
+		goto cleanup_files;
+	}
+
+	ubusd = load_spawn((char *[]) { (char *) o.ubusd, "-s", sock, NULL });
+	if (ubusd < 0)
+		goto cleanup_files;
+
+	ctx = load_connect(sock);
+	if (ctx == NULL) {
+		fprintf(stderr, "failed to connect to %s\n", sock);
+		goto cleanup_procs;
+	}
+
+	for (int i = 0; i < o.objects; i++) {
+		char name[32] = {0};
+
+		objects[i] = fork();
+		if (objects[i] == 0) {
+			ubus_free(ctx);
+			_exit(load_object_run(sock, i));
+		}
+
+		snprintf(name, sizeof(name), LOAD_OBJECT "%d", i);
+		if (objects[i] < 0 || !load_wait_object(ctx, name))
+			goto cleanup_procs;
+	}
+
+	rulengd = load_spawn((char *[]) {
+		(char *) o.rulengd, "-s", sock, "-C", dir, "-r", LOAD_PACKAGE,
+		"-L", level, NULL
+	});
+	if (rulengd < 0 || !load_wait_object(ctx, "rulengd"))
+		goto cleanup_procs;
+
+	for (double rate = o.rate; n < max_steps && !load_stop; rate *= o.growth) {
+		load_run_step(ctx, &o, rate, &steps[n]);
+
+		if (!load_alive(rulengd)) {
+			reason = "rulengd exited";
+			++n;
+			break;
+		}
+
+		reason = load_step_check(&o, &steps[n++]);
+		if (reason)
+			break;
+
+		saturation = rate;
+	}
+
+	load_report(&o, steps, n, saturation, reason);
+	rc = EXIT_SUCCESS;
+
+cleanup_procs:
+	if (load_alive(rulengd))
+		kill(rulengd, SIGTERM);
+
+	for (int i = 0; i < o.objects; i++)
+		if (load_alive(objects[i]))
+			kill(objects[i], SIGTERM);
+
+	if (ctx)
+		ubus_free(ctx);
+
+	if (load_alive(ubusd))
+		kill(ubusd, SIGTERM);
+
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+cleanup_files:
+	unlink(sock);
+	unlink(recipe);
+	unlink(package);
+	rmdir(dir);
+cleanup_mem:
+	if (shared != MAP_FAILED && shared != NULL)
+		munmap(shared, sizeof(*shared));
+	free(objects);
+	free(steps);
+	return rc;
+}
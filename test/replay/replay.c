@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+#include <libubox/uloop.h>
+#include <libubus.h>
+#include <uci.h>
+
+#include "ruleng_bus.h"
+#include "ruleng_capture.h"
+#include "ruleng_clock.h"
+#include "ruleng_json.h"
+#include "ruleng_log.h"
+#include "ruleng_rules.h"
+#include "ruleng_timer.h"
+
+/* events sent in a row when replaying as fast as possible */
+#define REPLAY_BATCH 64
+/* time left for the last actions to complete */
+#define REPLAY_DRAIN_MS 1000
+
+struct replay_opts {
+	const char *sock;
+	const char *rules;
+	const char *confdir;
+	/* send through ubusd instead of calling the event handlers */
+	bool bus;
+	bool asap;
+	double speed;
+	int log_level;
+};
+
+struct replay {
+	const struct replay_opts *o;
+	struct ruleng_capture_reader reader;
+	struct ruleng_capture_event ev;
+	/* the next event was read and waits to be sent */
+	bool pending;
+	struct ubus_context *ubus_ctx;
+	struct ruleng_bus_ctx *ctx;
+	struct uloop_timeout timer;
+	uint64_t start_ns;
+	uint64_t first_us;
+	uint64_t events;
+	uint64_t max_lag_ns;
+	enum ruleng_capture_rc rc;
+};
+
+static uint64_t replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void replay_done(struct uloop_timeout *t)
+{
+	(void) t;
+
+	uloop_end();
+}
+
+static void replay_send(struct replay *r)
+{
+	struct ruleng_capture_event *ev = &r->ev;
+
+	if (r->o->bus) {
+		ubus_send_event(r->ubus_ctx, ev->type, ev->msg);
+		return;
+	}
+
+	// windows follow the capture, however fast it is replayed
+	ruleng_clock_set_time(ev->ts_us);
+	ruleng_timer_run();
+
+	// the handlers rulengd registers, as if ubusd delivered the event
+	if (ev->engines & RULENG_BUS_DISPATCH_RULES)
+		ruleng_event_cb(r->ubus_ctx, &r->ctx->handler, ev->type, ev->msg);
+
+	if (ev->engines & RULENG_BUS_DISPATCH_JSON)
+		ruleng_event_json_cb(r->ubus_ctx, &r->ctx->json_handler, ev->type, ev->msg);
+}
+
+/* send the events which are due, then wait for the next one */
+static void replay_timer_cb(struct uloop_timeout *t)
+{
+	struct replay *r = container_of(t, struct replay, timer);
+	int sent = 0;
+
+	for (;;) {
+		uint64_t now = replay_now(), due = now;
+
+		if (!r->pending) {
+			r->rc = ruleng_capture_reader_next(&r->reader, &r->ev);
+			if (r->rc != RULENG_CAPTURE_OK)
+				break;
+
+			if (r->events == 0) {
+				r->start_ns = now;
+				r->first_us = r->ev.ts_us;
+			}
+
+			r->pending = true;
+		}
+
+		if (!r->o->asap)
+			due = r->start_ns + (uint64_t) ((r->ev.ts_us - r->first_us) * 1000 / r->o->speed);
+
+		if (due > now) {
+			uloop_timeout_set(t, (int) ((due - now + 999999) / 1000000));
+			return;
+		}
+
+		if (now - due > r->max_lag_ns)
+			r->max_lag_ns = now - due;
+
+		replay_send(r);
+		r->pending = false;
+		++r->events;
+
+		// let replies to the actions in
+		if (++sent == REPLAY_BATCH) {
+			uloop_timeout_set(t, 0);
+			return;
+		}
+	}
+
+	t->cb = replay_done;
+	uloop_timeout_set(t, REPLAY_DRAIN_MS);
+}
+
+static void replay_report(struct replay *r)
+{
+	struct blob_buf b = {0};
+	double seconds = 0;
+	char *json = NULL;
+
+	if (r->events)
+		seconds = (replay_now() - r->start_ns) / 1e9 - REPLAY_DRAIN_MS / 1e3;
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_string(&b, "mode", r->o->bus ? "ubus" : "local");
+	blobmsg_add_double(&b, "speed", r->o->asap ? 0 : r->o->speed);
+	blobmsg_add_u64(&b, "events", r->events);
+	blobmsg_add_double(&b, "seconds", seconds > 0 ? seconds : 0);
+	blobmsg_add_double(&b, "max_lag_ms", r->max_lag_ns / 1e6);
+
+	json = blobmsg_format_json(b.head, true);
+	if (json)
+		printf("%s\n", json);
+
+	free(json);
+	blob_buf_free(&b);
+}
+
+static void replay_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] <capture log>\n\n"
+		"Feeds the events of a capture log, as written by rulengd -e, to the\n"
+		"rules loaded here or, with -u, to ubusd. Rules loaded here see the\n"
+		"time of the capture, the replay speed does not change what fires.\n\n"
+		"Options:\n"
+		"  -s <socket> path to ubus socket [default]\n"
+		"  -r <rules> uci rules config filename, loaded here unless -u is given\n"
+		"  -C <dir> uci config directory [" UCI_CONFDIR "]\n"
+		"  -u send the events through ubusd to the rulengd running there\n"
+		"  -x <factor> replay that many times faster than captured [1]\n"
+		"  -a replay as fast as possible\n"
+		"  -L <level> log level, 0-7 [%d]\n"
+		"  -h help\n\n"
+		, prog, LOG_ERR);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_opts o = {
+		.speed = 1,
+		.log_level = LOG_ERR,
+	};
+	struct replay r = { .o = &o, .timer = { .cb = replay_timer_cb } };
+	struct ruleng_rules_ctx *com_ctx = NULL;
+	int rc = EXIT_FAILURE;
+	int c = -1;
+
+	while ((c = getopt(argc, argv, "s:r:C:ux:aL:h")) != -1) {
+		switch (c) {
+			case 's':
+				o.sock = optarg;
+				break;
+			case 'r':
+				o.rules = optarg;
+				break;
+			case 'C':
+				o.confdir = optarg;
+				break;
+			case 'u':
+				o.bus = true;
+				break;
+			case 'x':
+				o.speed = atof(optarg);
+				break;
+			case 'a':
+				o.asap = true;
+				break;
+			case 'L':
+				o.log_level = atoi(optarg);
+				break;
+			case 'h':
+				replay_usage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				replay_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind + 1 != argc || o.speed <= 0 || (!o.bus && o.rules == NULL)) {
+		replay_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (ruleng_capture_reader_open(&r.reader, argv[optind]) != RULENG_CAPTURE_OK) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	if (ruleng_log_init(NULL, o.log_level) != RULENG_LOG_OK)
+		goto cleanup_reader;
+
+	if (o.bus) {
+		r.ubus_ctx = ubus_connect(o.sock);
+		if (r.ubus_ctx == NULL) {
+			fprintf(stderr, "failed to connect to ubus\n");
+			goto cleanup_log;
+		}
+	} else {
+		if (ruleng_rules_ctx_init(&com_ctx) != RULENG_RULES_OK)
+			goto cleanup_log;
+
+		if (o.confdir)
+			uci_set_confdir(com_ctx->uci_ctx, o.confdir);
+
+		// ubusd only gets the actions, a rulengd running there is left alone
+		if (ruleng_bus_init_detached(&r.ctx, com_ctx, (char *) o.rules, o.sock) != RULENG_BUS_OK) {
+			fprintf(stderr, "failed to load the rules\n");
+			goto cleanup_rules;
+		}
+
+		r.ubus_ctx = r.ctx->ubus_ctx;
+		ruleng_clock_virtual(0);
+	}
+
+	uloop_init();
+	ubus_add_uloop(r.ubus_ctx);
+	uloop_timeout_set(&r.timer, 0);
+	uloop_run();
+	uloop_done();
+
+	// stopped early by a signal otherwise
+	if (r.rc == RULENG_CAPTURE_END || r.rc == RULENG_CAPTURE_OK) {
+		replay_report(&r);
+		rc = EXIT_SUCCESS;
+	} else {
+		fprintf(stderr, "%s: invalid capture log after %llu events\n",
+				argv[optind], (unsigned long long) r.events);
+	}
+
+	if (r.ctx)
+		ruleng_bus_free(r.ctx);
+	else
+		ubus_free(r.ubus_ctx);
+cleanup_rules:
+	if (com_ctx)
+		ruleng_rules_ctx_free(com_ctx);
+cleanup_log:
+	ruleng_log_free();
+cleanup_reader:
+	ruleng_capture_reader_close(&r.reader);
+	return rc;
+}
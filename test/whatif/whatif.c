@@ -0,0 +1,641 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+#include <uci.h>
+
+#include "ruleng_blob.h"
+#include "ruleng_bus.h"
+#include "ruleng_capture.h"
+#include "ruleng_clock.h"
+#include "ruleng_log.h"
+#include "ruleng_rules.h"
+#include "ruleng_json.h"
+#include "ruleng_timer.h"
+#include "ruleng_trie.h"
+#include "utils.h"
+
+enum {
+	WHATIF_CURRENT,
+	WHATIF_CANDIDATE,
+	__WHATIF_MAX,
+};
+
+static const char *const whatif_names[__WHATIF_MAX] = {
+	[WHATIF_CURRENT] = "current",
+	[WHATIF_CANDIDATE] = "candidate",
+};
+
+struct whatif_opts {
+	/* UCI packages of both rule sets, as paths */
+	const char *packages[__WHATIF_MAX];
+	const char *log;
+	/* event member correlated events share, NULL for a single shard */
+	const char *key;
+	int jobs;
+	bool all;
+	int log_level;
+};
+
+struct whatif_set {
+	struct ruleng_rules_ctx *com_ctx;
+	struct ruleng_bus_ctx *ctx;
+};
+
+/* an action of a rule and how often each set fired it */
+struct whatif_action {
+	struct avl_node avl;
+	uint64_t fired[__WHATIF_MAX];
+	char key[];
+};
+
+static struct avl_tree actions;
+
+/* whether events of a name came with the key member, without or both */
+enum {
+	WHATIF_KEYED = 1 << 0,
+	WHATIF_KEYLESS = 1 << 1,
+};
+
+struct whatif_type {
+	struct avl_node avl;
+	int flags;
+	char name[];
+};
+
+static struct whatif_action *whatif_action_get(const char *key)
+{
+	struct whatif_action *a = avl_find_element(&actions, key, a, avl);
+	size_t len = strlen(key) + 1;
+
+	if (a)
+		return a;
+
+	a = calloc(1, sizeof(*a) + len);
+	if (a == NULL)
+		return NULL;
+
+	memcpy(a->key, key, len);
+	a->avl.key = a->key;
+	avl_insert(&actions, &a->avl);
+
+	return a;
+}
+
+static void whatif_hook(
+  void *priv,
+  struct ubus_context *ubus_ctx,
+  const char *rule,
+  const struct ruleng_rule *action,
+  struct blob_attr *msg
+) {
+	(void) msg;
+
+	struct whatif_set *sets = priv;
+	struct whatif_action *a = NULL;
+	char key[512] = {0};
+	char name[256] = {0};
+	int set = 0;
+
+	// actions run by timers come along with the ubus context of their set
+	while (set < __WHATIF_MAX && sets[set].ctx->ubus_ctx != ubus_ctx)
+		++set;
+
+	if (set == __WHATIF_MAX)
+		return;
+
+	// UCI rules have no name, the event they wait for stands in
+	if (rule == NULL)
+		snprintf(name, sizeof(name), "uci:%s", action->event.name);
+
+	if (action->action.name)
+		snprintf(key, sizeof(key), "%s %s->%s", rule ? rule : name,
+				 action->action.object, action->action.name);
+	else
+		snprintf(key, sizeof(key), "%s cli:%s", rule ? rule : name,
+				 action->action.object);
+
+	a = whatif_action_get(key);
+	if (a)
+		++a->fired[set];
+}
+
+static int whatif_set_load(struct whatif_set *s, const char *path)
+{
+	char dir[PATH_MAX] = {0};
+	char *package = NULL;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+
+	package = strrchr(dir, '/');
+	if (package == NULL) {
+		fprintf(stderr, "%s: not a path to a uci package\n", path);
+		return -1;
+	}
+
+	*package++ = '\0';
+
+	if (ruleng_rules_ctx_init(&s->com_ctx) != RULENG_RULES_OK)
+		return -1;
+
+	uci_set_confdir(s->com_ctx->uci_ctx, dir[0] ? dir : "/");
+
+	if (ruleng_bus_init(&s->ctx, s->com_ctx, package, NULL, NULL) != RULENG_BUS_OK) {
+		fprintf(stderr, "%s: failed to load the rules\n", path);
+		ruleng_rules_ctx_free(s->com_ctx);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void whatif_set_free(struct whatif_set *s)
+{
+	ruleng_bus_free(s->ctx);
+	ruleng_rules_ctx_free(s->com_ctx);
+}
+
+/*
+ * Shard of an event, by the value of the key member. Events without it
+ * go to the first shard, all of them, see whatif_check().
+ */
+static int whatif_shard(const struct whatif_opts *o, const char *ref, struct ruleng_capture_event *ev)
+{
+	struct blob_attr *val = NULL;
+	uint32_t hash = RULENG_HASH_INIT;
+
+	if (o->jobs == 1)
+		return 0;
+
+	val = ruleng_blob_extract_value(ref, ev->msg);
+
+	if (val == NULL)
+		return 0;
+
+	hash = ruleng_hash(hash, blobmsg_data(val), blobmsg_data_len(val));
+
+	return (int) (hash % o->jobs);
+}
+
+/* whether events named 'type' match the event of a condition, a name or a pattern */
+static bool whatif_event_match(const char *event, const char *type)
+{
+	size_t len = strlen(event);
+
+	if (len > 0 && event[len - 1] == RULENG_TRIE_WILDCARD)
+		return strncmp(event, type, len - 1) == 0;
+
+	return strcmp(event, type) == 0;
+}
+
+/* whether the recipe rules of 's' each see events of one kind only */
+static int whatif_check_set(
+  const struct whatif_opts *o,
+  const struct whatif_set *s,
+  const char *path,
+  struct avl_tree *types
+) {
+	struct ruleng_json_rule *r = NULL;
+	struct whatif_type *t = NULL;
+	int ret = 0;
+
+	list_for_each_entry(r, &s->ctx->json_rules, list) {
+		int flags = 0;
+
+		for (int i = 0; i < r->n_conds; i++) {
+			if (r->conds[i].event == NULL)
+				continue;
+
+			avl_for_each_element(types, t, avl)
+				if (whatif_event_match(r->conds[i].event, t->name))
+					flags |= t->flags;
+		}
+
+		if (flags == (WHATIF_KEYED | WHATIF_KEYLESS)) {
+			fprintf(stderr, "%s: rule '%s' sees events with and without '%s', "
+					"evaluate it with -j 1\n", path, r->name, o->key);
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Events without the key member go to one shard, which is exact as long
+ * as no rule correlates them with events which have it: such a rule
+ * would see a part of the keyed events only, in each shard.
+ */
+static int whatif_check(const struct whatif_opts *o)
+{
+	struct whatif_set sets[__WHATIF_MAX] = {0};
+	struct ruleng_capture_reader r;
+	struct ruleng_capture_event ev = {0};
+	enum ruleng_capture_rc rc = RULENG_CAPTURE_OK;
+	struct avl_tree types;
+	struct whatif_type *t = NULL, *tmp = NULL;
+	char ref[256] = {0};
+	int loaded = 0, ret = -1;
+
+	avl_init(&types, avl_strcmp, false, NULL);
+	snprintf(ref, sizeof(ref), "&event->%s", o->key);
+
+	if (ruleng_capture_reader_open(&r, o->log) != RULENG_CAPTURE_OK) {
+		perror(o->log);
+		return -1;
+	}
+
+	while ((rc = ruleng_capture_reader_next(&r, &ev)) == RULENG_CAPTURE_OK) {
+		t = avl_find_element(&types, ev.type, t, avl);
+
+		if (t == NULL) {
+			size_t len = strlen(ev.type) + 1;
+
+			t = calloc(1, sizeof(*t) + len);
+			if (t == NULL)
+				goto cleanup_types;
+
+			memcpy(t->name, ev.type, len);
+			t->avl.key = t->name;
+			avl_insert(&types, &t->avl);
+		}
+
+		t->flags |= ruleng_blob_extract_value(ref, ev.msg) ? WHATIF_KEYED : WHATIF_KEYLESS;
+	}
+
+	if (rc != RULENG_CAPTURE_END) {
+		fprintf(stderr, "%s: invalid capture log\n", o->log);
+		goto cleanup_types;
+	}
+
+	// the rule sets are loaded again by the workers, the log thread stops before forking
+	if (ruleng_log_init(NULL, o->log_level) != RULENG_LOG_OK)
+		goto cleanup_types;
+
+	for (; loaded < __WHATIF_MAX; loaded++)
+		if (whatif_set_load(&sets[loaded], o->packages[loaded]))
+			goto cleanup_sets;
+
+	ret = 0;
+	for (int i = 0; i < __WHATIF_MAX; i++)
+		if (whatif_check_set(o, &sets[i], o->packages[i], &types))
+			ret = -1;
+
+cleanup_sets:
+	while (loaded-- > 0)
+		whatif_set_free(&sets[loaded]);
+
+	ruleng_log_free();
+cleanup_types:
+	avl_remove_all_elements(&types, t, avl, tmp)
+		free(t);
+
+	ruleng_capture_reader_close(&r);
+	return ret;
+}
+
+/* write the results of a shard as a blobmsg table */
+static int whatif_send(int fd, uint64_t events)
+{
+	struct blob_buf b = {0};
+	struct whatif_action *a = NULL;
+	const char *p = NULL;
+	size_t len = 0;
+	ssize_t n = 0;
+	void *t = NULL;
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_u64(&b, "events", events);
+
+	t = blobmsg_open_table(&b, "actions");
+	avl_for_each_element(&actions, a, avl) {
+		void *l = blobmsg_open_array(&b, a->key);
+
+		for (int i = 0; i < __WHATIF_MAX; i++)
+			blobmsg_add_u64(&b, NULL, a->fired[i]);
+
+		blobmsg_close_array(&b, l);
+	}
+	blobmsg_close_table(&b, t);
+
+	for (p = (const char *) b.head, len = blob_raw_len(b.head); len > 0; p += n, len -= n) {
+		n = write(fd, p, len);
+		if (n <= 0)
+			break;
+	}
+
+	blob_buf_free(&b);
+
+	return len == 0 ? 0 : -1;
+}
+
+/* evaluate both sets on the events of shard 'shard', in a child */
+static int whatif_worker(const struct whatif_opts *o, int shard, int fd)
+{
+	struct whatif_set sets[__WHATIF_MAX] = {0};
+	struct ruleng_capture_reader r;
+	struct ruleng_capture_event ev = {0};
+	enum ruleng_capture_rc rc = RULENG_CAPTURE_OK;
+	char ref[256] = {0};
+	uint64_t events = 0;
+	int set = 0, loaded = 0, ret = EXIT_FAILURE;
+
+	avl_init(&actions, avl_strcmp, false, NULL);
+	snprintf(ref, sizeof(ref), "&event->%s", o->key ? o->key : "");
+
+	if (ruleng_log_init(NULL, o->log_level) != RULENG_LOG_OK)
+		return EXIT_FAILURE;
+
+	for (; loaded < __WHATIF_MAX; loaded++)
+		if (whatif_set_load(&sets[loaded], o->packages[loaded]))
+			goto cleanup_sets;
+
+	if (ruleng_capture_reader_open(&r, o->log) != RULENG_CAPTURE_OK) {
+		perror(o->log);
+		goto cleanup_sets;
+	}
+
+	ruleng_bus_set_action_hook(whatif_hook, sets);
+	ruleng_clock_virtual(0);
+
+	while ((rc = ruleng_capture_reader_next(&r, &ev)) == RULENG_CAPTURE_OK) {
+		if (whatif_shard(o, ref, &ev) != shard)
+			continue;
+
+		// both sets see the events of a shard in the order and at the time captured
+		ruleng_clock_set_time(ev.ts_us);
+		ruleng_timer_run();
+		for (set = 0; set < __WHATIF_MAX; set++)
+			ruleng_bus_dispatch(sets[set].ctx, sets[set].ctx->ubus_ctx,
+								ev.type, ev.msg, ev.engines);
+
+		++events;
+	}
+
+	// what the rules still wait for, ABSENCE windows and delayed actions, fires too
+	while (ruleng_timer_count() > 0) {
+		ruleng_clock_set_time(ruleng_timer_next_ms() * 1000);
+		ruleng_timer_run();
+	}
+
+	if (rc != RULENG_CAPTURE_END)
+		fprintf(stderr, "%s: invalid capture log\n", o->log);
+	else if (whatif_send(fd, events) == 0)
+		ret = EXIT_SUCCESS;
+
+	ruleng_capture_reader_close(&r);
+cleanup_sets:
+	while (loaded-- > 0)
+		whatif_set_free(&sets[loaded]);
+
+	ruleng_log_free();
+	return ret;
+}
+
+/* add the results a worker wrote to 'fd' */
+static int whatif_merge(int fd, uint64_t *events)
+{
+	struct blob_attr *cur = NULL, *head = NULL;
+	char *buf = NULL;
+	size_t len = 0, size = 0;
+	ssize_t n = 0;
+	int rem = 0, ret = -1;
+
+	do {
+		if (len == size) {
+			char *p = realloc(buf, size ? 2 * size : 4096);
+
+			if (p == NULL)
+				goto exit;
+
+			buf = p;
+			size = size ? 2 * size : 4096;
+		}
+
+		n = read(fd, buf + len, size - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0);
+
+	head = (struct blob_attr *) buf;
+	if (len < sizeof(*head) || blob_raw_len(head) != len)
+		goto exit;
+
+	blob_for_each_attr(cur, head, rem) {
+		struct blob_attr *a = NULL;
+		int arem = 0;
+
+		if (strcmp(blobmsg_name(cur), "events") == 0) {
+			*events += blobmsg_get_u64(cur);
+			continue;
+		}
+
+		blobmsg_for_each_attr(a, cur, arem) {
+			struct whatif_action *wa = whatif_action_get(blobmsg_name(a));
+			struct blob_attr *c = NULL;
+			int crem = 0, i = 0;
+
+			if (wa == NULL)
+				goto exit;
+
+			blobmsg_for_each_attr(c, a, crem) {
+				if (i < __WHATIF_MAX)
+					wa->fired[i++] += blobmsg_get_u64(c);
+			}
+		}
+	}
+
+	ret = 0;
+
+exit:
+	free(buf);
+	return ret;
+}
+
+static void whatif_report(const struct whatif_opts *o, uint64_t events)
+{
+	struct blob_buf b = {0};
+	struct whatif_action *a = NULL;
+	uint64_t fired[__WHATIF_MAX] = {0};
+	uint32_t changed = 0;
+	char *json = NULL;
+	void *arr = NULL;
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_u64(&b, "events", events);
+	blobmsg_add_u32(&b, "shards", o->jobs);
+	if (o->key)
+		blobmsg_add_string(&b, "key", o->key);
+
+	arr = blobmsg_open_array(&b, "actions");
+	avl_for_each_element(&actions, a, avl) {
+		bool differs = a->fired[WHATIF_CURRENT] != a->fired[WHATIF_CANDIDATE];
+		void *t = NULL;
+
+		for (int i = 0; i < __WHATIF_MAX; i++)
+			fired[i] += a->fired[i];
+
+		changed += differs;
+		if (!differs && !o->all)
+			continue;
+
+		t = blobmsg_open_table(&b, NULL);
+		blobmsg_add_string(&b, "action", a->key);
+		for (int i = 0; i < __WHATIF_MAX; i++)
+			blobmsg_add_u64(&b, whatif_names[i], a->fired[i]);
+		blobmsg_close_table(&b, t);
+	}
+	blobmsg_close_array(&b, arr);
+
+	for (int i = 0; i < __WHATIF_MAX; i++)
+		blobmsg_add_u64(&b, whatif_names[i], fired[i]);
+	blobmsg_add_u32(&b, "changed", changed);
+
+	json = blobmsg_format_json(b.head, true);
+	if (json)
+		printf("%s\n", json);
+
+	free(json);
+	blob_buf_free(&b);
+}
+
+static void whatif_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] <current> <candidate> <capture log>\n\n"
+		"Evaluates two rule sets, given as paths to their UCI packages, against the\n"
+		"events of a capture log without running any action, and tells which\n"
+		"actions of which rules would fire a different number of times.\n\n"
+		"Options:\n"
+		"  -k <member> event member correlated events share, shards the log by it\n"
+		"  -j <jobs> shards evaluated in parallel with -k [online cpus]\n"
+		"  -a list every action, not only those which differ\n"
+		"  -L <level> log level, 0-7 [%d]\n"
+		"  -h help\n\n"
+		"Events without the member are evaluated in one shard, a rule which also sees\n"
+		"events with it needs -j 1. Results are printed as JSON.\n"
+		, prog, LOG_ERR);
+}
+
+int main(int argc, char **argv)
+{
+	struct whatif_opts o = {
+		.jobs = 0,
+		.log_level = LOG_ERR,
+	};
+	struct whatif_action *a = NULL, *tmp = NULL;
+	uint64_t events = 0;
+	int rc = EXIT_SUCCESS, started = 0;
+	int *fds = NULL;
+	pid_t *pids = NULL;
+	int c = -1;
+
+	while ((c = getopt(argc, argv, "k:j:aL:h")) != -1) {
+		switch (c) {
+			case 'k':
+				o.key = optarg;
+				break;
+			case 'j':
+				o.jobs = atoi(optarg);
+				break;
+			case 'a':
+				o.all = true;
+				break;
+			case 'L':
+				o.log_level = atoi(optarg);
+				break;
+			case 'h':
+				whatif_usage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				whatif_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind + 3 != argc || o.jobs < 0) {
+		whatif_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	o.packages[WHATIF_CURRENT] = argv[optind];
+	o.packages[WHATIF_CANDIDATE] = argv[optind + 1];
+	o.log = argv[optind + 2];
+
+	// without a key any event may correlate with any other, keep them in one
+	if (o.key == NULL)
+		o.jobs = 1;
+	else if (o.jobs == 0)
+		o.jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (o.jobs < 1)
+		o.jobs = 1;
+
+	if (o.jobs > 1 && whatif_check(&o))
+		return EXIT_FAILURE;
+
+	fds = calloc(o.jobs, sizeof(*fds));
+	pids = calloc(o.jobs, sizeof(*pids));
+	if (fds == NULL || pids == NULL) {
+		rc = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	avl_init(&actions, avl_strcmp, false, NULL);
+
+	// the dispatch path keeps per process state, shards run in processes
+	for (; started < o.jobs; started++) {
+		int p[2];
+
+		if (pipe(p)) {
+			perror("pipe");
+			rc = EXIT_FAILURE;
+			break;
+		}
+
+		pids[started] = fork();
+		if (pids[started] == 0) {
+			close(p[0]);
+			_exit(whatif_worker(&o, started, p[1]));
+		}
+
+		close(p[1]);
+		fds[started] = p[0];
+
+		if (pids[started] < 0) {
+			perror("fork");
+			close(p[0]);
+			rc = EXIT_FAILURE;
+			break;
+		}
+	}
+
+	for (int i = 0; i < started; i++) {
+		int status = 0;
+
+		if (whatif_merge(fds[i], &events))
+			rc = EXIT_FAILURE;
+
+		close(fds[i]);
+
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != EXIT_SUCCESS)
+			rc = EXIT_FAILURE;
+	}
+
+	if (rc == EXIT_SUCCESS)
+		whatif_report(&o, events);
+
+	avl_remove_all_elements(&actions, a, avl, tmp)
+		free(a);
+cleanup:
+	free(fds);
+	free(pids);
+	return rc;
+}